@@ -0,0 +1,504 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "costmap.hpp"
+#include "esdf.hpp"
+#include "geometry.hpp"
+#include "simd.hpp"
+
+namespace wra
+{
+
+struct LikelihoodFieldOptions
+{
+    double sigma_hit = 0.2;  // std dev of beam endpoint noise, m
+    double z_hit = 0.95;     // weight of the Gaussian hit term
+    double z_rand = 0.05;    // weight of the uniform term over max_range
+    double max_range = 12.0; // beams at or beyond this carry no information
+};
+
+// Log-likelihood of a beam endpoint per map cell, log(z_hit exp(-d^2 /
+// 2 sigma^2) + z_rand / max_range) with d the distance to the nearest
+// obstacle. A one-cell border holds the off-map value, so lookups clamp
+// their cell coordinates instead of branching. Cell (i, j) of the map is
+// centred at origin + resolution * (i, j).
+class LikelihoodField
+{
+public:
+    // occupied holds width * height bytes, row-major.
+    void build( const std::vector<uint8_t>& occupied, int width, int height, double resolution, double origin_x, double origin_y,
+                const LikelihoodFieldOptions& options = LikelihoodFieldOptions(), ThreadPool* pool = nullptr )
+    {
+        options_ = options;
+        width_ = width;
+        height_ = height;
+        resolution_ = resolution;
+        origin_x_ = origin_x;
+        origin_y_ = origin_y;
+        stride_ = width + 2;
+        rows_ = height + 2;
+
+        DistanceField field( width, height, 1, resolution );
+        builder_.compute( occupied, field, pool );
+
+        const double far = std::log( options.z_rand / options.max_range );
+        values_.assign( static_cast<size_t>( stride_ ) * rows_, static_cast<float>( far ) );
+        const double k = -0.5 / ( options.sigma_hit * options.sigma_hit );
+        for ( int y = 0; y < height; ++y )
+            for ( int x = 0; x < width; ++x )
+            {
+                double d = std::max( 0.0f, field.data()[field.index( x, y )] );
+                values_[static_cast<size_t>( y + 1 ) * stride_ + x + 1] =
+                    static_cast<float>( std::log( options.z_hit * std::exp( k * d * d ) + options.z_rand / options.max_range ) );
+            }
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int stride() const { return stride_; }
+    int rows() const { return rows_; }
+    double resolution() const { return resolution_; }
+    double origin_x() const { return origin_x_; }
+    double origin_y() const { return origin_y_; }
+    const LikelihoodFieldOptions& options() const { return options_; }
+    const float* data() const { return values_.data(); }
+
+    float at( double x, double y ) const
+    {
+        double gx = std::min( std::max( ( x - origin_x_ ) / resolution_ + 1.5, 0.0 ), stride_ - 1.0 );
+        double gy = std::min( std::max( ( y - origin_y_ ) / resolution_ + 1.5, 0.0 ), rows_ - 1.0 );
+        return values_[static_cast<size_t>( gy ) * stride_ + static_cast<size_t>( gx )];
+    }
+
+private:
+    LikelihoodFieldOptions options_;
+    int width_ = 0;
+    int height_ = 0;
+    int stride_ = 0;
+    int rows_ = 0;
+    double resolution_ = 1.0;
+    double origin_x_ = 0.0;
+    double origin_y_ = 0.0;
+    std::vector<float> values_;
+    EsdfBuilder builder_;
+};
+
+namespace detail
+{
+
+// Inputs to the beam kernels. Particle positions are pre-scaled into grid
+// units with the +1.5 border/rounding offset folded in, and headings are
+// given as resolution-scaled cos/sin, so an endpoint costs four FMAs.
+struct BeamBatch
+{
+    const float* field;
+    int stride;
+    int rows;
+    const float* bx; // beam endpoints in the sensor frame, m
+    const float* by;
+    size_t beams;
+    const float* gx; // particle position, grid units
+    const float* gy;
+    const float* c; // cos(theta) / resolution
+    const float* s;
+    float* out; // summed log-likelihood per particle
+};
+
+inline void beam_likelihood_scalar( const BeamBatch& b, size_t lo, size_t hi )
+{
+    const float xmax = static_cast<float>( b.stride - 1 ), ymax = static_cast<float>( b.rows - 1 );
+    for ( size_t i = lo; i < hi; ++i )
+    {
+        float sum = 0.0f;
+        for ( size_t k = 0; k < b.beams; ++k )
+        {
+            float x = b.gx[i] + b.c[i] * b.bx[k] - b.s[i] * b.by[k];
+            float y = b.gy[i] + b.s[i] * b.bx[k] + b.c[i] * b.by[k];
+            x = std::min( std::max( x, 0.0f ), xmax );
+            y = std::min( std::max( y, 0.0f ), ymax );
+            sum += b.field[static_cast<int>( y ) * b.stride + static_cast<int>( x )];
+        }
+        b.out[i] = sum;
+    }
+}
+
+#if defined( WRA_X86_SIMD )
+
+// Eight particles per register against one beam at a time; the field is
+// read with a gather. SSE2 has no gather, so that level uses the scalar
+// kernel. lo and hi must be multiples of 8 within padded arrays.
+__attribute__( ( target( "avx2,fma" ) ) ) inline void beam_likelihood_avx2( const BeamBatch& b, size_t lo, size_t hi )
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 xmax = _mm256_set1_ps( static_cast<float>( b.stride - 1 ) );
+    const __m256 ymax = _mm256_set1_ps( static_cast<float>( b.rows - 1 ) );
+    const __m256i stride = _mm256_set1_epi32( b.stride );
+    for ( size_t i = lo; i < hi; i += 8 )
+    {
+        const __m256 gx = _mm256_load_ps( b.gx + i ), gy = _mm256_load_ps( b.gy + i );
+        const __m256 c = _mm256_load_ps( b.c + i ), s = _mm256_load_ps( b.s + i );
+        __m256 sum = _mm256_setzero_ps();
+        for ( size_t k = 0; k < b.beams; ++k )
+        {
+            const __m256 bx = _mm256_set1_ps( b.bx[k] ), by = _mm256_set1_ps( b.by[k] );
+            __m256 x = _mm256_fnmadd_ps( s, by, _mm256_fmadd_ps( c, bx, gx ) );
+            __m256 y = _mm256_fmadd_ps( c, by, _mm256_fmadd_ps( s, bx, gy ) );
+            x = _mm256_min_ps( _mm256_max_ps( x, zero ), xmax );
+            y = _mm256_min_ps( _mm256_max_ps( y, zero ), ymax );
+            __m256i idx = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_cvttps_epi32( y ), stride ), _mm256_cvttps_epi32( x ) );
+            sum = _mm256_add_ps( sum, _mm256_i32gather_ps( b.field, idx, 4 ) );
+        }
+        _mm256_store_ps( b.out + i, sum );
+    }
+}
+
+#endif
+
+} // namespace detail
+
+struct AmclOptions
+{
+    size_t min_particles = 500;
+    size_t max_particles = 5000;
+    double kld_error = 0.01;              // bound on KL divergence to the true posterior
+    double kld_z = 2.33;                  // upper standard normal quantile, 1 - delta = 0.99
+    double bin_xy = 0.5;                  // KLD histogram bin size, m
+    double bin_theta = 10.0 * kPi / 180; // KLD histogram bin size, rad
+    // Odometry noise in the sense of Thrun's sample_motion_model_odometry:
+    // rotation from rotation, rotation from translation, translation from
+    // translation, translation from rotation.
+    double alpha1 = 0.2;
+    double alpha2 = 0.2;
+    double alpha3 = 0.2;
+    double alpha4 = 0.2;
+    size_t beams = 60;                // beams evaluated per scan, evenly subsampled
+    // Beams are not independent, so the product of their likelihoods is
+    // overconfident. Over a uniform spread it can pick a wrong mode on the
+    // first scan and leave KLD with a min_particles set around it. After
+    // reset_uniform the scan log-likelihood is scaled by global_power,
+    // growing by power_growth per update back to 1.
+    double global_power = 0.1;
+    double power_growth = 2.0;
+    double resample_threshold = 0.5;  // resample when n_eff / n drops below this
+    uint32_t seed = 1;
+};
+
+struct AmclUpdate
+{
+    size_t particles = 0; // particle count after the update
+    size_t beams = 0;     // beams evaluated per particle
+    double n_eff = 0.0;   // effective sample size before resampling
+    bool resampled = false;
+};
+
+// Monte Carlo localisation on a likelihood field. Particles are stored as
+// structure-of-arrays floats so the beam kernel scores eight particles per
+// AVX2 register. The sample count adapts through KLD sampling (Fox 2003):
+// resampling draws until the particles cover enough histogram bins for the
+// configured error bound. Draws walk the weight CDF along a golden-ratio
+// sequence, a low-variance systematic resampler whose every prefix spans
+// the whole CDF, so stopping early does not favour low indices. The sensor
+// sits at the base origin. Buffers are sized for max_particles up front.
+class MonteCarloLocalizer
+{
+public:
+    MonteCarloLocalizer( const LikelihoodField& field, const AmclOptions& options = AmclOptions(), SimdLevel level = detect_simd() )
+        : field_( field ), options_( options ), level_( level )
+    {
+        capacity_ = ( std::max( options.max_particles, options.min_particles ) + 7 ) & ~size_t( 7 );
+        for ( AlignedBuffer<float>* b : { &x_, &y_, &theta_, &next_x_, &next_y_, &next_theta_, &gx_, &gy_, &c_, &s_, &loglik_ } )
+            b->resize( capacity_ );
+        weight_.assign( capacity_, 0.0 );
+        cdf_.assign( capacity_, 0.0 );
+        copies_.assign( capacity_, 0 );
+        bx_.resize( ( options.beams + 7 ) & ~size_t( 7 ) );
+        by_.resize( bx_.size() );
+        size_t slots = 1;
+        while ( slots < 2 * capacity_ )
+            slots <<= 1;
+        bin_keys_.assign( slots, 0 );
+        bin_stamps_.assign( slots, 0 );
+        rng_.seed( options.seed );
+    }
+
+    SimdLevel level() const { return level_; }
+    size_t size() const { return n_; }
+    const float* x() const { return x_.data(); }
+    const float* y() const { return y_.data(); }
+    const float* theta() const { return theta_.data(); }
+    const double* weight() const { return weight_.data(); }
+
+    // max_particles samples around a pose.
+    void reset_gaussian( const Pose2D& mean, double sigma_xy, double sigma_theta )
+    {
+        std::normal_distribution<double> normal( 0.0, 1.0 );
+        n_ = options_.max_particles;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            x_[i] = static_cast<float>( mean.x + sigma_xy * normal( rng_ ) );
+            y_[i] = static_cast<float>( mean.y + sigma_xy * normal( rng_ ) );
+            theta_[i] = static_cast<float>( wrap( mean.theta + sigma_theta * normal( rng_ ) ) );
+        }
+        power_ = 1.0;
+        std::fill( weight_.begin(), weight_.begin() + n_, 1.0 / n_ );
+    }
+
+    // max_particles samples spread uniformly over the map, for global
+    // localisation. Scans are tempered by global_power until it has grown
+    // back to 1.
+    void reset_uniform()
+    {
+        std::uniform_real_distribution<double> u( 0.0, 1.0 );
+        const double w = field_.width() * field_.resolution(), h = field_.height() * field_.resolution();
+        n_ = options_.max_particles;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            x_[i] = static_cast<float>( field_.origin_x() + w * u( rng_ ) );
+            y_[i] = static_cast<float>( field_.origin_y() + h * u( rng_ ) );
+            theta_[i] = static_cast<float>( kPi * ( 2.0 * u( rng_ ) - 1.0 ) );
+        }
+        power_ = options_.global_power;
+        std::fill( weight_.begin(), weight_.begin() + n_, 1.0 / n_ );
+    }
+
+    // Moves every particle by the odometry increment from `from` to `to`,
+    // decomposed into rotate / translate / rotate with sampled noise.
+    void motion_update( const Pose2D& from, const Pose2D& to )
+    {
+        const double dx = to.x - from.x, dy = to.y - from.y;
+        const double trans = std::hypot( dx, dy );
+        const double rot1 = trans < 0.01 ? 0.0 : wrap( std::atan2( dy, dx ) - from.theta );
+        const double rot2 = wrap( to.theta - from.theta - rot1 );
+        // Turning in place or backing up should not inflate rotation noise
+        // by a half turn.
+        const double r1 = std::min( std::fabs( rot1 ), std::fabs( wrap( rot1 - kPi ) ) );
+        const double r2 = std::min( std::fabs( rot2 ), std::fabs( wrap( rot2 - kPi ) ) );
+        const double sd_rot1 = std::sqrt( options_.alpha1 * r1 * r1 + options_.alpha2 * trans * trans );
+        const double sd_trans = std::sqrt( options_.alpha3 * trans * trans + options_.alpha4 * ( r1 * r1 + r2 * r2 ) );
+        const double sd_rot2 = std::sqrt( options_.alpha1 * r2 * r2 + options_.alpha2 * trans * trans );
+
+        // Float draws and trig keep this loop on par with the beam kernel;
+        // headings are wrapped once, at the end.
+        std::normal_distribution<float> normal( 0.0f, 1.0f );
+        const float fr1 = static_cast<float>( rot1 ), ft = static_cast<float>( trans ), fr2 = static_cast<float>( rot2 );
+        const float s1 = static_cast<float>( sd_rot1 ), st = static_cast<float>( sd_trans ), s2 = static_cast<float>( sd_rot2 );
+        const float pi = static_cast<float>( kPi );
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            float heading = theta_[i] + fr1 - s1 * normal( rng_ );
+            float t = ft - st * normal( rng_ );
+            x_[i] += t * std::cos( heading );
+            y_[i] += t * std::sin( heading );
+            float th = heading + fr2 - s2 * normal( rng_ );
+            th -= th > pi ? 2.0f * pi : 0.0f;
+            th += th < -pi ? 2.0f * pi : 0.0f;
+            theta_[i] = th;
+        }
+    }
+
+    // Weights the particles by a scan and resamples when the effective
+    // sample size has dropped. Ranges that are not finite, not positive or
+    // at least max_range are skipped.
+    AmclUpdate sensor_update( const float* ranges, size_t count, double angle_min, double angle_increment )
+    {
+        AmclUpdate update;
+        size_t m = 0;
+        const double step = std::max( 1.0, static_cast<double>( count ) / options_.beams );
+        const double max_range = field_.options().max_range;
+        for ( double f = 0.0; f < count && m < options_.beams; f += step )
+        {
+            size_t i = static_cast<size_t>( f );
+            double r = ranges[i];
+            if ( !( r > 0.0 ) || !( r < max_range ) )
+                continue;
+            double a = angle_min + angle_increment * i;
+            bx_[m] = static_cast<float>( r * std::cos( a ) );
+            by_[m] = static_cast<float>( r * std::sin( a ) );
+            ++m;
+        }
+        update.beams = m;
+        if ( m == 0 || n_ == 0 )
+        {
+            update.particles = n_;
+            return update;
+        }
+
+        const double inv = 1.0 / field_.resolution();
+        const double ox = 1.5 - field_.origin_x() * inv, oy = 1.5 - field_.origin_y() * inv;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            gx_[i] = static_cast<float>( x_[i] * inv + ox );
+            gy_[i] = static_cast<float>( y_[i] * inv + oy );
+            c_[i] = static_cast<float>( std::cos( theta_[i] ) * inv );
+            s_[i] = static_cast<float>( std::sin( theta_[i] ) * inv );
+        }
+        detail::BeamBatch batch = { field_.data(), field_.stride(), field_.rows(), bx_.data(), by_.data(), m,
+                                    gx_.data(),    gy_.data(),      c_.data(),     s_.data(),  loglik_.data() };
+        switch ( level_ )
+        {
+#if defined( WRA_X86_SIMD )
+        case SimdLevel::Avx2:
+            detail::beam_likelihood_avx2( batch, 0, ( n_ + 7 ) & ~size_t( 7 ) );
+            break;
+#endif
+        default:
+            detail::beam_likelihood_scalar( batch, 0, n_ );
+        }
+
+        // Multiply into the previous weights relative to the best particle so
+        // the exponentials stay in range, tempered while power_ < 1.
+        float best = loglik_[0];
+        for ( size_t i = 1; i < n_; ++i )
+            best = std::max( best, loglik_[i] );
+        double total = 0.0;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            weight_[i] *= std::exp( power_ * static_cast<double>( loglik_[i] - best ) );
+            total += weight_[i];
+        }
+        double sq = 0.0;
+        if ( total > 0.0 && std::isfinite( total ) )
+            for ( size_t i = 0; i < n_; ++i )
+            {
+                weight_[i] /= total;
+                sq += weight_[i] * weight_[i];
+            }
+        else
+        {
+            std::fill( weight_.begin(), weight_.begin() + n_, 1.0 / n_ );
+            sq = 1.0 / n_;
+        }
+        update.n_eff = 1.0 / sq;
+        power_ = std::min( 1.0, power_ * options_.power_growth );
+        if ( update.n_eff < options_.resample_threshold * n_ )
+        {
+            resample();
+            update.resampled = true;
+        }
+        update.particles = n_;
+        return update;
+    }
+
+    // Weighted mean pose; the heading is a circular mean.
+    Pose2D estimate() const
+    {
+        double x = 0.0, y = 0.0, c = 0.0, s = 0.0;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            x += weight_[i] * x_[i];
+            y += weight_[i] * y_[i];
+            c += weight_[i] * std::cos( theta_[i] );
+            s += weight_[i] * std::sin( theta_[i] );
+        }
+        Pose2D p;
+        p.x = x;
+        p.y = y;
+        p.theta = std::atan2( s, c );
+        return p;
+    }
+
+    // KLD bound on the sample count for k occupied bins.
+    size_t kld_bound( size_t k ) const
+    {
+        if ( k <= 1 )
+            return options_.min_particles;
+        double a = 2.0 / ( 9.0 * ( k - 1 ) );
+        double b = 1.0 - a + std::sqrt( a ) * options_.kld_z;
+        return static_cast<size_t>( std::ceil( ( k - 1 ) / ( 2.0 * options_.kld_error ) * b * b * b ) );
+    }
+
+private:
+    static double wrap( double a ) { return std::remainder( a, 2.0 * kPi ); }
+
+    void resample()
+    {
+        double acc = 0.0;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            acc += weight_[i];
+            cdf_[i] = acc;
+        }
+        ++stamp_;
+        const double golden = 0.6180339887498949;
+        double u = std::uniform_real_distribution<double>( 0.0, 1.0 )( rng_ );
+        size_t bins = 0, target = options_.min_particles, drawn = 0;
+        while ( drawn < options_.max_particles && drawn < target )
+        {
+            size_t i = std::upper_bound( cdf_.begin(), cdf_.begin() + n_, u * acc ) - cdf_.begin();
+            i = std::min( i, n_ - 1 );
+            ++copies_[i];
+            ++drawn;
+            if ( insert_bin( x_[i], y_[i], theta_[i] ) )
+                target = std::max( target, kld_bound( ++bins ) );
+            u += golden;
+            u -= u >= 1.0 ? 1.0 : 0.0;
+        }
+
+        // Emit copies in source order so neighbouring particles stay close
+        // in memory, as a classic systematic pass would leave them.
+        size_t m = 0;
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            for ( uint32_t k = 0; k < copies_[i]; ++k, ++m )
+            {
+                next_x_[m] = x_[i];
+                next_y_[m] = y_[i];
+                next_theta_[m] = theta_[i];
+            }
+            copies_[i] = 0;
+        }
+        std::memcpy( x_.data(), next_x_.data(), m * sizeof( float ) );
+        std::memcpy( y_.data(), next_y_.data(), m * sizeof( float ) );
+        std::memcpy( theta_.data(), next_theta_.data(), m * sizeof( float ) );
+        n_ = m;
+        std::fill( weight_.begin(), weight_.begin() + n_, 1.0 / n_ );
+    }
+
+    // Marks the histogram bin of a pose; true if it was empty.
+    bool insert_bin( float x, float y, float theta )
+    {
+        auto q = []( double v, double size ) {
+            return static_cast<uint64_t>( static_cast<int64_t>( std::floor( v / size ) ) + ( 1 << 20 ) ) & 0x1FFFFF;
+        };
+        uint64_t key = ( q( x, options_.bin_xy ) << 42 ) | ( q( y, options_.bin_xy ) << 21 ) | q( theta, options_.bin_theta );
+        const size_t mask = bin_keys_.size() - 1;
+        for ( size_t slot = ( key * 0x9E3779B97F4A7C15ull ) >> 20 & mask;; slot = ( slot + 1 ) & mask )
+        {
+            if ( bin_stamps_[slot] != stamp_ )
+            {
+                bin_stamps_[slot] = stamp_;
+                bin_keys_[slot] = key;
+                return true;
+            }
+            if ( bin_keys_[slot] == key )
+                return false;
+        }
+    }
+
+    const LikelihoodField& field_;
+    AmclOptions options_;
+    SimdLevel level_;
+    size_t capacity_ = 0;
+    size_t n_ = 0;
+    double power_ = 1.0;
+    AlignedBuffer<float> x_, y_, theta_;
+    AlignedBuffer<float> next_x_, next_y_, next_theta_;
+    AlignedBuffer<float> gx_, gy_, c_, s_, loglik_;
+    AlignedBuffer<float> bx_, by_;
+    std::vector<double> weight_;
+    std::vector<double> cdf_;
+    std::vector<uint32_t> copies_;
+    std::vector<uint64_t> bin_keys_;
+    std::vector<uint32_t> bin_stamps_;
+    uint32_t stamp_ = 0;
+    std::mt19937 rng_;
+};
+
+} // namespace wra
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wra
+{
+namespace bench
+{
+
+struct Options
+{
+    int warmup = 3;
+    int reps = 20;
+    bool list = false;
+    bool quick = false;
+    std::string filter;
+    std::string json_path;
+    std::map<std::string, std::string> params;
+};
+
+// Passed to setup and run callbacks. Counters keep the last value written,
+// so a run callback can report e.g. path cost or convergence rate.
+class Context
+{
+public:
+    explicit Context( const Options& options ) : options_( options ) {}
+
+    bool quick() const { return options_.quick; }
+    int iteration() const { return iteration_; }
+
+    std::string param( const std::string& key, const std::string& fallback = "" ) const
+    {
+        auto it = options_.params.find( key );
+        return it == options_.params.end() ? fallback : it->second;
+    }
+
+    double param( const std::string& key, double fallback ) const
+    {
+        auto it = options_.params.find( key );
+        return it == options_.params.end() ? fallback : std::atof( it->second.c_str() );
+    }
+
+    void counter( const std::string& name, double value ) { counters_[name] = value; }
+    void items( double n ) { items_ = n; }
+
+private:
+    friend class Runner;
+
+    const Options& options_;
+    int iteration_ = 0;
+    double items_ = 0.0;
+    std::map<std::string, double> counters_;
+};
+
+struct Case
+{
+    std::string name;
+    std::function<void( Context& )> setup;
+    std::function<void( Context& )> run;
+};
+
+struct Result
+{
+    std::string name;
+    int reps = 0;
+    double mean_ns = 0.0;
+    double min_ns = 0.0;
+    double p50_ns = 0.0;
+    double p99_ns = 0.0;
+    double max_ns = 0.0;
+    double items_per_sec = 0.0;
+    std::map<std::string, double> counters;
+};
+
+inline std::vector<Case>& registry()
+{
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline void add( std::string name, std::function<void( Context& )> run,
+                 std::function<void( Context& )> setup = nullptr )
+{
+    registry().push_back( Case{ std::move( name ), std::move( setup ), std::move( run ) } );
+}
+
+template <typename T>
+inline void do_not_optimize( const T& value )
+{
+#if defined( __GNUC__ )
+    asm volatile( "" : : "r,m"( value ) : "memory" );
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// Nearest-rank percentile of an already sorted sample.
+inline double percentile( const std::vector<double>& sorted, double p )
+{
+    if ( sorted.empty() )
+        return 0.0;
+    size_t rank = static_cast<size_t>( p / 100.0 * sorted.size() + 0.999999 );
+    rank = std::min( std::max<size_t>( rank, 1 ), sorted.size() );
+    return sorted[rank - 1];
+}
+
+class Runner
+{
+public:
+    explicit Runner( const Options& options ) : options_( options ) {}
+
+    Result run( const Case& c ) const
+    {
+        using clock = std::chrono::steady_clock;
+
+        Context ctx( options_ );
+        if ( c.setup )
+            c.setup( ctx );
+
+        for ( int i = 0; i < options_.warmup; ++i )
+        {
+            ctx.iteration_ = i;
+            c.run( ctx );
+        }
+
+        std::vector<double> samples;
+        samples.reserve( options_.reps );
+        for ( int i = 0; i < options_.reps; ++i )
+        {
+            ctx.iteration_ = options_.warmup + i;
+            auto t0 = clock::now();
+            c.run( ctx );
+            auto t1 = clock::now();
+            samples.push_back( std::chrono::duration<double, std::nano>( t1 - t0 ).count() );
+        }
+
+        Result r;
+        r.name = c.name;
+        r.reps = options_.reps;
+        r.counters = ctx.counters_;
+        if ( samples.empty() )
+            return r;
+
+        double sum = 0.0;
+        for ( double s : samples )
+            sum += s;
+        std::sort( samples.begin(), samples.end() );
+        r.mean_ns = sum / samples.size();
+        r.min_ns = samples.front();
+        r.p50_ns = percentile( samples, 50.0 );
+        r.p99_ns = percentile( samples, 99.0 );
+        r.max_ns = samples.back();
+        if ( ctx.items_ > 0.0 && r.mean_ns > 0.0 )
+            r.items_per_sec = ctx.items_ * 1e9 / r.mean_ns;
+        return r;
+    }
+
+private:
+    const Options& options_;
+};
+
+inline bool matches( const std::string& name, const std::string& filter )
+{
+    return filter.empty() || name.find( filter ) != std::string::npos;
+}
+
+inline Options parse_args( int argc, char** argv )
+{
+    Options o;
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string arg = argv[i];
+        std::string key = arg;
+        std::string value;
+        size_t eq = arg.find( '=' );
+        if ( eq != std::string::npos )
+        {
+            key = arg.substr( 0, eq );
+            value = arg.substr( eq + 1 );
+        }
+
+        if ( key == "--warmup" )
+            o.warmup = std::max( 0, std::atoi( value.c_str() ) );
+        else if ( key == "--reps" )
+            o.reps = std::max( 1, std::atoi( value.c_str() ) );
+        else if ( key == "--filter" )
+            o.filter = value;
+        else if ( key == "--json" )
+            o.json_path = value.empty() ? "-" : value;
+        else if ( key == "--list" )
+            o.list = true;
+        else if ( key == "--quick" )
+            o.quick = true;
+        else if ( key.compare( 0, 2, "--" ) == 0 )
+            o.params[key.substr( 2 )] = value;
+    }
+    return o;
+}
+
+inline void write_json_string( std::FILE* f, const std::string& s )
+{
+    std::fputc( '"', f );
+    for ( char ch : s )
+    {
+        if ( static_cast<unsigned char>( ch ) < 0x20 )
+            std::fprintf( f, "\\u%04x", static_cast<unsigned>( ch ) );
+        else
+        {
+            if ( ch == '"' || ch == '\\' )
+                std::fputc( '\\', f );
+            std::fputc( ch, f );
+        }
+    }
+    std::fputc( '"', f );
+}
+
+// JSON has no NaN or infinity; a 0/0 ratio or unbounded counter is null.
+inline void write_json_number( std::FILE* f, const char* format, double v )
+{
+    if ( std::isfinite( v ) )
+        std::fprintf( f, format, v );
+    else
+        std::fputs( "null", f );
+}
+
+inline void write_json( std::FILE* f, const Options& o, const std::vector<Result>& results )
+{
+    std::fprintf( f, "{\n  \"warmup\": %d,\n  \"reps\": %d,\n  \"results\": [", o.warmup, o.reps );
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const Result& r = results[i];
+        std::fprintf( f, "%s\n    {\"name\": ", i ? "," : "" );
+        write_json_string( f, r.name );
+        std::fprintf( f, ", \"reps\": %d", r.reps );
+        const std::pair<const char*, double> timings[] = { { "mean_ns", r.mean_ns }, { "min_ns", r.min_ns },
+                                                           { "p50_ns", r.p50_ns },   { "p99_ns", r.p99_ns },
+                                                           { "max_ns", r.max_ns },   { "items_per_sec", r.items_per_sec } };
+        for ( const auto& t : timings )
+        {
+            std::fprintf( f, ", \"%s\": ", t.first );
+            write_json_number( f, "%.1f", t.second );
+        }
+        std::fprintf( f, ", \"counters\": {" );
+        bool first = true;
+        for ( const auto& kv : r.counters )
+        {
+            std::fprintf( f, "%s", first ? "" : ", " );
+            write_json_string( f, kv.first );
+            std::fprintf( f, ": " );
+            write_json_number( f, "%.6g", kv.second );
+            first = false;
+        }
+        std::fprintf( f, "}}" );
+    }
+    std::fprintf( f, "\n  ]\n}\n" );
+}
+
+inline void print_result( const Result& r )
+{
+    std::printf( "%-40s p50 %12.0f ns  p99 %12.0f ns  max %12.0f ns", r.name.c_str(), r.p50_ns,
+                 r.p99_ns, r.max_ns );
+    if ( r.items_per_sec > 0.0 )
+        std::printf( "  %.3g items/s", r.items_per_sec );
+    for ( const auto& kv : r.counters )
+        std::printf( "  %s=%.4g", kv.first.c_str(), kv.second );
+    std::printf( "\n" );
+}
+
+inline int run_all( const Options& o )
+{
+    if ( o.list )
+    {
+        for ( const Case& c : registry() )
+            if ( matches( c.name, o.filter ) )
+                std::printf( "%s\n", c.name.c_str() );
+        return 0;
+    }
+
+    // Keep the table off stdout when JSON goes there.
+    bool json_stdout = o.json_path == "-";
+    Runner runner( o );
+    std::vector<Result> results;
+    for ( const Case& c : registry() )
+    {
+        if ( !matches( c.name, o.filter ) )
+            continue;
+        results.push_back( runner.run( c ) );
+        if ( !json_stdout )
+        {
+            print_result( results.back() );
+            std::fflush( stdout );
+        }
+    }
+
+    if ( o.json_path.empty() )
+        return 0;
+    std::FILE* f = json_stdout ? stdout : std::fopen( o.json_path.c_str(), "w" );
+    if ( !f )
+    {
+        std::fprintf( stderr, "cannot open %s\n", o.json_path.c_str() );
+        return 1;
+    }
+    write_json( f, o, results );
+    if ( f != stdout )
+        std::fclose( f );
+    return 0;
+}
+
+} // namespace bench
+} // namespace wra
@@ -0,0 +1,557 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "geometry.hpp"
+#include "point_cloud.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+// Sensor pose in a fixed frame at a point in time, e.g. from integrated IMU
+// or wheel odometry.
+struct MotionSample
+{
+    double time = 0.0;
+    Isometry3 pose;
+};
+
+// Pose at `time` from samples sorted by time: constant angular and linear
+// velocity between neighbours, clamped at the ends.
+inline Isometry3 interpolate_motion( const std::vector<MotionSample>& samples, double time )
+{
+    auto later = std::lower_bound( samples.begin(), samples.end(), time,
+                                   []( const MotionSample& s, double t ) { return s.time < t; } );
+    if ( later == samples.begin() )
+        return samples.front().pose;
+    if ( later == samples.end() )
+        return samples.back().pose;
+    const MotionSample& a = *( later - 1 );
+    const MotionSample& b = *later;
+    double f = b.time > a.time ? ( time - a.time ) / ( b.time - a.time ) : 0.0;
+    Vec3 w = rotation_log( a.pose.R.transposed() * b.pose.R );
+    double angle = norm( w );
+    Mat3 R = angle > 1e-12 ? a.pose.R * axis_angle( w / angle, f * angle ) : a.pose.R;
+    return { R, a.pose.t + ( b.pose.t - a.pose.t ) * f };
+}
+
+enum class OutlierFilter
+{
+    None,
+    Radius,     // too few points within neighbor_radius
+    Statistical // mean distance to the mean_k nearest far above the frame's
+};
+
+inline const char* to_string( OutlierFilter filter )
+{
+    switch ( filter )
+    {
+    case OutlierFilter::None:
+        return "none";
+    case OutlierFilter::Radius:
+        return "radius";
+    case OutlierFilter::Statistical:
+        return "statistical";
+    }
+    return "?";
+}
+
+struct CloudPipelineOptions
+{
+    Vec3 crop_min = Vec3( -40.0, -40.0, -3.0 ); // m, kept box in the deskewed sensor frame
+    Vec3 crop_max = Vec3( 40.0, 40.0, 5.0 );    // m
+    double min_range = 1.0;                     // m; nearer returns are the robot itself
+    double voxel = 0.15;                        // m; 0 keeps every cropped point
+    bool centroid = true;                       // voxel centroid, or the first point in it
+    double deskew_step = 0.002;                 // s between precomputed motion corrections
+    OutlierFilter outliers = OutlierFilter::Radius;
+    double neighbor_radius = 0.6; // m searched by either filter
+    int min_neighbors = 4;        // radius: points needed in other voxels within the radius
+    int mean_k = 6;               // statistical: neighbours averaged, at most 32
+    double std_ratio = 2.0;       // statistical: cut at mean + std_ratio * stddev
+};
+
+struct CloudPipelineStats
+{
+    size_t input = 0;
+    size_t cropped = 0;  // removed by the box or min_range
+    size_t voxels = 0;   // left after downsampling
+    size_t outliers = 0; // removed by the outlier filter
+    size_t output = 0;
+};
+
+// Front end for raw lidar frames. Points are deskewed, cropped and binned
+// into a voxel hash one L1-sized block at a time, so the raw frame is read
+// once and no intermediate cloud is written. The outlier filter then runs
+// on the far smaller voxel set through a neighbour grid built with the same
+// open-addressing hash, without sorting. Deskew interpolates a table of
+// motion corrections precomputed at deskew_step, rather than interpolating
+// rotations per point. Buffers persist across frames.
+class CloudPipeline
+{
+public:
+    explicit CloudPipeline( const CloudPipelineOptions& options = CloudPipelineOptions() ) : options_( options ) {}
+
+    const CloudPipelineOptions& options() const { return options_; }
+    void set_options( const CloudPipelineOptions& options ) { options_ = options; }
+
+    // Motion across the sweep; deskewed points are expressed in the sensor
+    // frame at reference_time. Fewer than two samples disable deskew.
+    void set_motion( const std::vector<MotionSample>& samples, double reference_time )
+    {
+        knots_.clear();
+        if ( samples.size() < 2 )
+            return;
+        const double step = std::max( options_.deskew_step, 1e-5 );
+        const double span = samples.back().time - samples.front().time;
+        const size_t count = std::min<size_t>( static_cast<size_t>( std::ceil( span / step ) ) + 1, 1 << 16 );
+        knot0_ = samples.front().time - reference_time;
+        inv_step_ = count > 1 ? ( count - 1 ) / span : 0.0;
+        const Isometry3 to_reference = interpolate_motion( samples, reference_time ).inverse();
+        knots_.resize( std::max<size_t>( count, 2 ) * 12 );
+        for ( size_t k = 0; k < knots_.size() / 12; ++k )
+        {
+            double t = count > 1 ? samples.front().time + span * k / ( count - 1 ) : samples.front().time;
+            Isometry3 c = to_reference * interpolate_motion( samples, t );
+            float* o = &knots_[k * 12];
+            for ( int r = 0; r < 3; ++r )
+            {
+                for ( int j = 0; j < 3; ++j )
+                    o[r * 4 + j] = static_cast<float>( c.R( r, j ) );
+                o[r * 4 + 3] = static_cast<float>( c.t[r] );
+            }
+        }
+    }
+
+    void clear_motion() { knots_.clear(); }
+    bool deskews() const { return !knots_.empty(); }
+
+    // time[i] is the capture time of point i in seconds relative to the
+    // reference time; null skips deskew for this frame.
+    void process( const PointCloud& in, const float* time, PointCloud& out, CloudPipelineStats* stats = nullptr,
+                  ThreadPool* pool = nullptr )
+    {
+        const size_t n = in.size();
+        const bool deskew = time && deskews();
+        const bool binned = options_.voxel > 0.0;
+        entries_ = 0;
+        reserve_entries( binned ? std::min<size_t>( n, 1 << 16 ) : n );
+        if ( binned )
+            table_.prepare();
+        const float inv_voxel = binned ? static_cast<float>( 1.0 / options_.voxel ) : 0.0f;
+        const float min2 = static_cast<float>( options_.min_range * options_.min_range );
+        const float lo[3] = { float( options_.crop_min.x ), float( options_.crop_min.y ), float( options_.crop_min.z ) };
+        const float hi[3] = { float( options_.crop_max.x ), float( options_.crop_max.y ), float( options_.crop_max.z ) };
+        const size_t knot_count = knots_.size() / 12;
+
+        float bx[kBlock], by[kBlock], bz[kBlock];
+        uint32_t keep[kBlock];
+        size_t kept = 0;
+        for ( size_t begin = 0; begin < n; begin += kBlock )
+        {
+            const size_t m = std::min( kBlock, n - begin );
+            const float* x = in.x.data() + begin;
+            const float* y = in.y.data() + begin;
+            const float* z = in.z.data() + begin;
+            if ( deskew )
+            {
+                // Spinning sensors fire a whole column at one time, so the
+                // correction is only re-interpolated when the time changes.
+                const float* t = time + begin;
+                float c[12], last = std::numeric_limits<float>::quiet_NaN();
+                for ( size_t i = 0; i < m; ++i )
+                {
+                    if ( t[i] != last )
+                    {
+                        last = t[i];
+                        float u = static_cast<float>( ( t[i] - knot0_ ) * inv_step_ );
+                        u = std::min( std::max( u, 0.0f ), static_cast<float>( knot_count - 1 ) );
+                        size_t k = std::min( static_cast<size_t>( u ), knot_count - 2 );
+                        float f = u - static_cast<float>( k );
+                        const float* a = &knots_[k * 12];
+                        const float* b = a + 12;
+                        for ( int j = 0; j < 12; ++j )
+                            c[j] = a[j] + f * ( b[j] - a[j] );
+                    }
+                    bx[i] = c[0] * x[i] + c[1] * y[i] + c[2] * z[i] + c[3];
+                    by[i] = c[4] * x[i] + c[5] * y[i] + c[6] * z[i] + c[7];
+                    bz[i] = c[8] * x[i] + c[9] * y[i] + c[10] * z[i] + c[11];
+                }
+            }
+            else
+            {
+                std::copy( x, x + m, bx );
+                std::copy( y, y + m, by );
+                std::copy( z, z + m, bz );
+            }
+
+            // Branch-free compaction of the points inside the crop.
+            size_t survivors = 0;
+            for ( size_t i = 0; i < m; ++i )
+            {
+                bool inside = bx[i] >= lo[0] && bx[i] <= hi[0] && by[i] >= lo[1] && by[i] <= hi[1] && bz[i] >= lo[2] &&
+                              bz[i] <= hi[2] && bx[i] * bx[i] + by[i] * by[i] + bz[i] * bz[i] >= min2;
+                keep[survivors] = static_cast<uint32_t>( i );
+                survivors += inside;
+            }
+            kept += survivors;
+
+            const float* intensity = in.intensity.data() + begin;
+            for ( size_t s = 0; s < survivors; ++s )
+            {
+                const uint32_t i = keep[s];
+                if ( !binned )
+                {
+                    append_entry( bx[i], by[i], bz[i], intensity[i] );
+                    continue;
+                }
+                const uint32_t slot = table_.find_or_insert( voxel_key( bx[i], by[i], bz[i], inv_voxel ), entries_ );
+                if ( slot == entries_ )
+                    append_entry( bx[i], by[i], bz[i], intensity[i] );
+                else if ( options_.centroid )
+                {
+                    ex_[slot] += bx[i];
+                    ey_[slot] += by[i];
+                    ez_[slot] += bz[i];
+                    ei_[slot] += intensity[i];
+                    ++count_[slot];
+                }
+                else
+                    ++count_[slot];
+            }
+        }
+        if ( binned && options_.centroid )
+            for ( size_t e = 0; e < entries_; ++e )
+            {
+                float inv = 1.0f / static_cast<float>( count_[e] );
+                ex_[e] *= inv;
+                ey_[e] *= inv;
+                ez_[e] *= inv;
+                ei_[e] *= inv;
+            }
+
+        const size_t removed = filter_outliers( pool );
+        out.resize( entries_ - removed );
+        size_t o = 0;
+        for ( size_t e = 0; e < entries_; ++e )
+        {
+            if ( !alive_[e] )
+                continue;
+            out.x[o] = ex_[e];
+            out.y[o] = ey_[e];
+            out.z[o] = ez_[e];
+            out.intensity[o] = ei_[e];
+            ++o;
+        }
+        if ( stats )
+        {
+            stats->input = n;
+            stats->cropped = n - kept;
+            stats->voxels = entries_;
+            stats->outliers = removed;
+            stats->output = out.size();
+        }
+    }
+
+private:
+    static constexpr size_t kBlock = 256;
+    // Neighbour cells nearest first: own, faces, edges, corners. Early
+    // exits and the k-nearest bound then prune the most.
+    static constexpr int kCellOrder[27][3] = {
+        { 0, 0, 0 },   { -1, 0, 0 },  { 1, 0, 0 },   { 0, -1, 0 },  { 0, 1, 0 },   { 0, 0, -1 },  { 0, 0, 1 },
+        { -1, -1, 0 }, { -1, 1, 0 },  { 1, -1, 0 },  { 1, 1, 0 },   { -1, 0, -1 }, { -1, 0, 1 },  { 1, 0, -1 },
+        { 1, 0, 1 },   { 0, -1, -1 }, { 0, -1, 1 },  { 0, 1, -1 },  { 0, 1, 1 },   { -1, -1, -1 }, { -1, -1, 1 },
+        { -1, 1, -1 }, { -1, 1, 1 },  { 1, -1, -1 }, { 1, -1, 1 },  { 1, 1, -1 },  { 1, 1, 1 } };
+
+    // Open-addressing map from packed keys to dense ids, cleared by bumping
+    // a stamp as in VoxelDownsampler. It doubles when half full, so its
+    // size follows the number of distinct keys rather than the input.
+    class KeyTable
+    {
+    public:
+        void prepare()
+        {
+            if ( keys_.empty() )
+                resize( 1 << 12 );
+            if ( ++stamp_ == 0 )
+            {
+                std::fill( stamps_.begin(), stamps_.end(), 0 );
+                stamp_ = 1;
+            }
+            size_ = 0;
+        }
+
+        // The id stored for key; a new key gets next_id.
+        uint32_t find_or_insert( uint64_t key, size_t next_id )
+        {
+            if ( 2 * ( size_ + 1 ) > keys_.size() )
+                grow();
+            const size_t mask = keys_.size() - 1;
+            for ( size_t s = voxel_hash( key ) & mask;; s = ( s + 1 ) & mask )
+            {
+                if ( stamps_[s] != stamp_ )
+                {
+                    stamps_[s] = stamp_;
+                    keys_[s] = key;
+                    ids_[s] = static_cast<uint32_t>( next_id );
+                    ++size_;
+                    return ids_[s];
+                }
+                if ( keys_[s] == key )
+                    return ids_[s];
+            }
+        }
+
+        // Id of key, or -1.
+        int64_t find( uint64_t key ) const
+        {
+            const size_t mask = keys_.size() - 1;
+            for ( size_t s = voxel_hash( key ) & mask;; s = ( s + 1 ) & mask )
+            {
+                if ( stamps_[s] != stamp_ )
+                    return -1;
+                if ( keys_[s] == key )
+                    return ids_[s];
+            }
+        }
+
+    private:
+        void resize( size_t slots )
+        {
+            keys_.assign( slots, 0 );
+            ids_.assign( slots, 0 );
+            stamps_.assign( slots, 0 );
+            stamp_ = 0;
+        }
+
+        void grow()
+        {
+            std::vector<uint64_t> keys;
+            std::vector<uint32_t> ids;
+            for ( size_t s = 0; s < keys_.size(); ++s )
+                if ( stamps_[s] == stamp_ )
+                {
+                    keys.push_back( keys_[s] );
+                    ids.push_back( ids_[s] );
+                }
+            resize( 2 * keys_.size() );
+            stamp_ = 1;
+            const size_t mask = keys_.size() - 1;
+            for ( size_t i = 0; i < keys.size(); ++i )
+                for ( size_t s = voxel_hash( keys[i] ) & mask;; s = ( s + 1 ) & mask )
+                    if ( stamps_[s] != stamp_ )
+                    {
+                        stamps_[s] = stamp_;
+                        keys_[s] = keys[i];
+                        ids_[s] = ids[i];
+                        break;
+                    }
+        }
+
+        std::vector<uint64_t> keys_;
+        std::vector<uint32_t> ids_;
+        std::vector<uint32_t> stamps_;
+        uint32_t stamp_ = 0;
+        size_t size_ = 0;
+    };
+
+    void reserve_entries( size_t n )
+    {
+        if ( ex_.size() >= n )
+            return;
+        ex_.resize( n );
+        ey_.resize( n );
+        ez_.resize( n );
+        ei_.resize( n );
+        count_.resize( n );
+    }
+
+    void append_entry( float x, float y, float z, float intensity )
+    {
+        if ( entries_ == ex_.size() )
+            reserve_entries( 2 * entries_ + 1024 );
+        ex_[entries_] = x;
+        ey_[entries_] = y;
+        ez_[entries_] = z;
+        ei_[entries_] = intensity;
+        count_[entries_] = 1;
+        ++entries_;
+    }
+
+    // Marks alive_ and returns how many entries were dropped. Entries are
+    // bucketed into cells of neighbor_radius, laid out CSR by a counting
+    // pass, so each entry checks only the 27 cells around it.
+    size_t filter_outliers( ThreadPool* pool )
+    {
+        alive_.assign( entries_, 1 );
+        if ( options_.outliers == OutlierFilter::None || !entries_ )
+            return 0;
+
+        const double r = std::max( options_.neighbor_radius, 1e-3 );
+        const float inv = static_cast<float>( 1.0 / r );
+        cells_.prepare();
+        cell_of_.resize( entries_ );
+        cell_start_.clear();
+        size_t cells = 0;
+        for ( size_t e = 0; e < entries_; ++e )
+        {
+            const uint32_t id = cells_.find_or_insert( voxel_key( ex_[e], ey_[e], ez_[e], inv ), cells );
+            if ( id == cells )
+            {
+                ++cells;
+                cell_start_.push_back( 0 );
+            }
+            cell_of_[e] = id;
+            ++cell_start_[id];
+        }
+        cell_start_.push_back( 0 );
+        for ( size_t c = 0, sum = 0; c <= cells; ++c )
+        {
+            size_t k = cell_start_[c];
+            cell_start_[c] = static_cast<uint32_t>( sum );
+            sum += k;
+        }
+        // Coordinates are copied in cell order so a cell scan is contiguous.
+        members_.resize( entries_ );
+        mx_.resize( entries_ );
+        my_.resize( entries_ );
+        mz_.resize( entries_ );
+        mcount_.resize( entries_ );
+        fill_.assign( cell_start_.begin(), cell_start_.end() - 1 );
+        for ( size_t e = 0; e < entries_; ++e )
+        {
+            uint32_t j = fill_[cell_of_[e]]++;
+            members_[j] = static_cast<uint32_t>( e );
+            mx_[j] = ex_[e];
+            my_[j] = ey_[e];
+            mz_[j] = ez_[e];
+            mcount_[j] = count_[e];
+        }
+
+        const bool statistical = options_.outliers == OutlierFilter::Statistical;
+        const int k = std::min( std::max( options_.mean_k, 1 ), 32 );
+        const float r2 = static_cast<float>( r * r );
+        score_.resize( entries_ );
+        const uint32_t needed = static_cast<uint32_t>( std::max( options_.min_neighbors, 0 ) );
+        auto body = [&]( size_t lo, size_t hi ) {
+            float nearest[32];
+            for ( size_t e = lo; e < hi; ++e )
+            {
+                const float x = ex_[e], y = ey_[e], z = ez_[e];
+                const int cx = static_cast<int>( std::floor( x * inv ) ), cy = static_cast<int>( std::floor( y * inv ) ),
+                          cz = static_cast<int>( std::floor( z * inv ) );
+                // Gaps from the point to the lower and upper faces of its cell.
+                const float gap[3][2] = { { x * inv - cx, 1.0f - ( x * inv - cx ) },
+                                          { y * inv - cy, 1.0f - ( y * inv - cy ) },
+                                          { z * inv - cz, 1.0f - ( z * inv - cz ) } };
+                int found = 0;
+                uint32_t support = 0;
+                for ( int n = 0; n < 27 && ( statistical || support < needed ); ++n )
+                {
+                    const int* o = kCellOrder[n];
+                    float box2 = 0.0f;
+                    for ( int a = 0; a < 3; ++a )
+                        if ( o[a] )
+                        {
+                            float g = gap[a][o[a] > 0] * float( r );
+                            box2 += g * g;
+                        }
+                    if ( box2 > r2 || ( found == k && box2 >= nearest[k - 1] ) )
+                        continue;
+                    int64_t c = cells_.find( voxel_key( cx + o[0], cy + o[1], cz + o[2] ) );
+                    if ( c < 0 )
+                        continue;
+                    for ( uint32_t j = cell_start_[c]; j < cell_start_[c + 1]; ++j )
+                    {
+                        float dx = mx_[j] - x, dy = my_[j] - y, dz = mz_[j] - z;
+                        float d2 = dx * dx + dy * dy + dz * dz;
+                        if ( d2 > r2 || members_[j] == e )
+                            continue;
+                        if ( !statistical )
+                        {
+                            support += mcount_[j];
+                            continue;
+                        }
+                        // Insertion into the sorted k nearest so far.
+                        int p;
+                        if ( found < k )
+                            p = found++;
+                        else if ( d2 < nearest[k - 1] )
+                            p = k - 1;
+                        else
+                            continue;
+                        while ( p > 0 && nearest[p - 1] > d2 )
+                        {
+                            nearest[p] = nearest[p - 1];
+                            --p;
+                        }
+                        nearest[p] = d2;
+                    }
+                }
+                if ( !statistical )
+                {
+                    alive_[e] = support >= needed;
+                    continue;
+                }
+                float sum = 0.0f;
+                for ( int i = 0; i < found; ++i )
+                    sum += std::sqrt( nearest[i] );
+                score_[e] = found ? sum / found : std::numeric_limits<float>::infinity();
+            }
+        };
+        if ( pool )
+            pool->parallel_for( 0, entries_, 1024, body );
+        else
+            body( 0, entries_ );
+
+        if ( statistical )
+        {
+            double sum = 0.0, sq = 0.0;
+            size_t finite = 0;
+            for ( size_t e = 0; e < entries_; ++e )
+                if ( std::isfinite( score_[e] ) )
+                {
+                    sum += score_[e];
+                    sq += double( score_[e] ) * score_[e];
+                    ++finite;
+                }
+            const double mean = finite ? sum / finite : 0.0;
+            const double var = finite ? std::max( 0.0, sq / finite - mean * mean ) : 0.0;
+            const float cut = static_cast<float>( mean + options_.std_ratio * std::sqrt( var ) );
+            for ( size_t e = 0; e < entries_; ++e )
+                alive_[e] = score_[e] <= cut;
+        }
+        size_t removed = 0;
+        for ( size_t e = 0; e < entries_; ++e )
+            removed += !alive_[e];
+        return removed;
+    }
+
+    CloudPipelineOptions options_;
+    // Motion corrections: a row-major 3x4 [R | t] per knot.
+    std::vector<float> knots_;
+    double knot0_ = 0.0;
+    double inv_step_ = 0.0;
+    // Voxels, or cropped points when not binning.
+    KeyTable table_;
+    size_t entries_ = 0;
+    std::vector<float> ex_, ey_, ez_, ei_;
+    std::vector<uint32_t> count_;
+    // Outlier filter.
+    KeyTable cells_;
+    std::vector<uint32_t> cell_of_;
+    std::vector<uint32_t> cell_start_;
+    std::vector<uint32_t> fill_;
+    std::vector<uint32_t> members_;
+    std::vector<float> mx_, my_, mz_;
+    std::vector<uint32_t> mcount_;
+    std::vector<float> score_;
+    std::vector<uint8_t> alive_;
+};
+
+} // namespace wra
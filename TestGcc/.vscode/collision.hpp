@@ -0,0 +1,952 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "geometry.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+enum class ShapeType : uint8_t
+{
+    Sphere,
+    Box,
+    Capsule,
+    Triangle,
+    Hull
+};
+
+// Convex primitive in its local frame. Capsules run along local z; hulls
+// hold their vertices, triangles keep theirs inline so mesh soups stay
+// compact.
+struct ConvexShape
+{
+    ShapeType type = ShapeType::Sphere;
+    double radius = 0.0;
+    double half_length = 0.0;
+    Vec3 half_extents;
+    Vec3 tri[3];
+    std::vector<Vec3> vertices;
+
+    static ConvexShape sphere( double r )
+    {
+        ConvexShape s;
+        s.type = ShapeType::Sphere;
+        s.radius = r;
+        return s;
+    }
+
+    static ConvexShape box( double hx, double hy, double hz )
+    {
+        ConvexShape s;
+        s.type = ShapeType::Box;
+        s.half_extents = { hx, hy, hz };
+        return s;
+    }
+
+    static ConvexShape capsule( double r, double half_length )
+    {
+        ConvexShape s;
+        s.type = ShapeType::Capsule;
+        s.radius = r;
+        s.half_length = half_length;
+        return s;
+    }
+
+    static ConvexShape triangle( const Vec3& a, const Vec3& b, const Vec3& c )
+    {
+        ConvexShape s;
+        s.type = ShapeType::Triangle;
+        s.tri[0] = a;
+        s.tri[1] = b;
+        s.tri[2] = c;
+        return s;
+    }
+
+    static ConvexShape hull( std::vector<Vec3> points )
+    {
+        ConvexShape s;
+        s.type = ShapeType::Hull;
+        s.vertices = std::move( points );
+        return s;
+    }
+
+    // Farthest point along d, in the local frame.
+    Vec3 support( const Vec3& d ) const
+    {
+        switch ( type )
+        {
+        case ShapeType::Sphere:
+            return normalized( d ) * radius;
+        case ShapeType::Box:
+            return { d.x >= 0 ? half_extents.x : -half_extents.x, d.y >= 0 ? half_extents.y : -half_extents.y,
+                     d.z >= 0 ? half_extents.z : -half_extents.z };
+        case ShapeType::Capsule:
+            return Vec3( 0, 0, d.z >= 0 ? half_length : -half_length ) + normalized( d ) * radius;
+        case ShapeType::Triangle:
+            return farthest( tri, 3, d );
+        case ShapeType::Hull:
+            return farthest( vertices.data(), vertices.size(), d );
+        }
+        return {};
+    }
+
+    // Local bounding box as centre and half extents.
+    void local_bounds( Vec3& center, Vec3& half ) const
+    {
+        switch ( type )
+        {
+        case ShapeType::Sphere:
+            center = {};
+            half = { radius, radius, radius };
+            return;
+        case ShapeType::Box:
+            center = {};
+            half = half_extents;
+            return;
+        case ShapeType::Capsule:
+            center = {};
+            half = { radius, radius, half_length + radius };
+            return;
+        case ShapeType::Triangle:
+            point_bounds( tri, 3, center, half );
+            return;
+        case ShapeType::Hull:
+            point_bounds( vertices.data(), vertices.size(), center, half );
+            return;
+        }
+    }
+
+private:
+    static Vec3 farthest( const Vec3* p, size_t n, const Vec3& d )
+    {
+        size_t best = 0;
+        double best_dot = -std::numeric_limits<double>::infinity();
+        for ( size_t i = 0; i < n; ++i )
+        {
+            double s = dot( p[i], d );
+            if ( s > best_dot )
+            {
+                best_dot = s;
+                best = i;
+            }
+        }
+        return n ? p[best] : Vec3();
+    }
+
+    static void point_bounds( const Vec3* p, size_t n, Vec3& center, Vec3& half )
+    {
+        Vec3 lo( 1e300, 1e300, 1e300 );
+        Vec3 hi( -1e300, -1e300, -1e300 );
+        for ( size_t i = 0; i < n; ++i )
+            for ( int a = 0; a < 3; ++a )
+            {
+                lo[a] = std::min( lo[a], p[i][a] );
+                hi[a] = std::max( hi[a], p[i][a] );
+            }
+        center = ( lo + hi ) * 0.5;
+        half = ( hi - lo ) * 0.5;
+    }
+};
+
+struct Aabb
+{
+    float lo[3];
+    float hi[3];
+
+    bool overlaps( const Aabb& o ) const
+    {
+        return lo[0] <= o.hi[0] && o.lo[0] <= hi[0] && lo[1] <= o.hi[1] && o.lo[1] <= hi[1] && lo[2] <= o.hi[2] &&
+               o.lo[2] <= hi[2];
+    }
+};
+
+// Oriented box: centre, axes as the columns of R, half extents.
+struct Obb
+{
+    Vec3 center;
+    Mat3 R;
+    Vec3 half;
+
+    static Obb of( const ConvexShape& shape, const Isometry3& pose )
+    {
+        Vec3 c;
+        Obb b;
+        shape.local_bounds( c, b.half );
+        b.center = pose * c;
+        b.R = pose.R;
+        return b;
+    }
+
+    // Enclosing world box, rounded outwards to float.
+    Aabb bounds() const
+    {
+        Aabb a;
+        for ( int i = 0; i < 3; ++i )
+        {
+            double r = std::fabs( R( i, 0 ) ) * half.x + std::fabs( R( i, 1 ) ) * half.y + std::fabs( R( i, 2 ) ) * half.z;
+            a.lo[i] = std::nextafter( static_cast<float>( center[i] - r ), -std::numeric_limits<float>::infinity() );
+            a.hi[i] = std::nextafter( static_cast<float>( center[i] + r ), std::numeric_limits<float>::infinity() );
+        }
+        return a;
+    }
+
+    // Separating-axis test against an axis-aligned box (Gottschalk et al.):
+    // the three box axes and three OBB axes, plus the nine edge-edge axes
+    // when `edges` is set. Without them the test is still conservative.
+    bool overlaps( const Aabb& box, bool edges ) const
+    {
+        const double eps = 1e-9;
+        double ea[3], t[3], eb[3] = { half.x, half.y, half.z };
+        double absR[3][3];
+        for ( int i = 0; i < 3; ++i )
+        {
+            ea[i] = 0.5 * ( double( box.hi[i] ) - box.lo[i] );
+            t[i] = center[i] - 0.5 * ( double( box.hi[i] ) + box.lo[i] );
+            for ( int j = 0; j < 3; ++j )
+                absR[i][j] = std::fabs( R( i, j ) ) + eps;
+        }
+        for ( int i = 0; i < 3; ++i )
+            if ( std::fabs( t[i] ) > ea[i] + eb[0] * absR[i][0] + eb[1] * absR[i][1] + eb[2] * absR[i][2] )
+                return false;
+        for ( int j = 0; j < 3; ++j )
+        {
+            double ra = ea[0] * absR[0][j] + ea[1] * absR[1][j] + ea[2] * absR[2][j];
+            if ( std::fabs( t[0] * R( 0, j ) + t[1] * R( 1, j ) + t[2] * R( 2, j ) ) > ra + eb[j] )
+                return false;
+        }
+        if ( !edges )
+            return true;
+        for ( int i = 0; i < 3; ++i )
+        {
+            int i1 = ( i + 1 ) % 3, i2 = ( i + 2 ) % 3;
+            for ( int j = 0; j < 3; ++j )
+            {
+                int j1 = ( j + 1 ) % 3, j2 = ( j + 2 ) % 3;
+                double ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+                double rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+                if ( std::fabs( t[i2] * R( i1, j ) - t[i1] * R( i2, j ) ) > ra + rb )
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Contact
+{
+    // Moving shape A by -depth * normal separates the pair.
+    double depth = 0.0;
+    Vec3 normal;
+};
+
+// GJK boolean test and EPA penetration on pairs of posed convex shapes.
+// EPA scratch is kept between calls, so give each thread its own instance.
+class NarrowPhase
+{
+public:
+    bool intersect( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb )
+    {
+        return gjk( a, pa, b, pb );
+    }
+
+    // False if the shapes are apart; otherwise fills the contact.
+    bool penetration( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb,
+                      Contact& contact )
+    {
+        if ( !gjk( a, pa, b, pb ) )
+            return false;
+        epa( a, pa, b, pb, contact );
+        return true;
+    }
+
+private:
+    static Vec3 support( const ConvexShape& s, const Isometry3& p, const Vec3& d )
+    {
+        return p * s.support( p.R.transpose_times( d ) );
+    }
+
+    // Support of the Minkowski difference A - B.
+    static Vec3 support( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb,
+                         const Vec3& d )
+    {
+        return support( a, pa, d ) - support( b, pb, -d );
+    }
+
+    // Boolean GJK in the style of Muratori: keep the sub-simplex nearest the
+    // origin and search towards it. Newest point last in pts_. Treats
+    // non-convergence as contact, the safe answer for planning.
+    bool gjk( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb )
+    {
+        Vec3 d = pa.t - pb.t;
+        if ( squared_norm( d ) < 1e-18 )
+            d = { 1, 0, 0 };
+        pts_[0] = support( a, pa, b, pb, d );
+        n_ = 1;
+        d = -pts_[0];
+        for ( int iter = 0; iter < 64; ++iter )
+        {
+            if ( squared_norm( d ) < 1e-24 )
+                return true;
+            Vec3 p = support( a, pa, b, pb, d );
+            if ( dot( p, d ) < 0 )
+                return false;
+            pts_[n_++] = p;
+            if ( update_simplex( d ) )
+                return true;
+        }
+        return true;
+    }
+
+    void set( const Vec3& p0 )
+    {
+        pts_[0] = p0;
+        n_ = 1;
+    }
+    void set( const Vec3& p0, const Vec3& p1 )
+    {
+        pts_[0] = p0;
+        pts_[1] = p1;
+        n_ = 2;
+    }
+    void set( const Vec3& p0, const Vec3& p1, const Vec3& p2 )
+    {
+        pts_[0] = p0;
+        pts_[1] = p1;
+        pts_[2] = p2;
+        n_ = 3;
+    }
+
+    // Segment [b, a] with a newest.
+    // Points come by value: they usually alias pts_, which set() rewrites.
+    bool line( Vec3 a, Vec3 b, Vec3& d )
+    {
+        Vec3 ab = b - a, ao = -a;
+        if ( dot( ab, ao ) > 0 )
+        {
+            set( b, a );
+            d = cross( cross( ab, ao ), ab );
+            // Origin on the segment.
+            return squared_norm( d ) < 1e-24 * squared_norm( ab ) * squared_norm( ab );
+        }
+        set( a );
+        d = ao;
+        return false;
+    }
+
+    bool triangle( Vec3 a, Vec3 b, Vec3 c, Vec3& d )
+    {
+        Vec3 ab = b - a, ac = c - a, ao = -a;
+        Vec3 abc = cross( ab, ac );
+        if ( dot( cross( abc, ac ), ao ) > 0 )
+        {
+            if ( dot( ac, ao ) > 0 )
+            {
+                set( c, a );
+                d = cross( cross( ac, ao ), ac );
+                return false;
+            }
+            return line( a, b, d );
+        }
+        if ( dot( cross( ab, abc ), ao ) > 0 )
+            return line( a, b, d );
+        double side = dot( abc, ao );
+        if ( side > 0 )
+        {
+            set( c, b, a );
+            d = abc;
+        }
+        else if ( side < 0 )
+        {
+            set( b, c, a );
+            d = -abc;
+        }
+        else
+            return true; // origin in the triangle
+        return false;
+    }
+
+    bool update_simplex( Vec3& d )
+    {
+        switch ( n_ )
+        {
+        case 2:
+            return line( pts_[1], pts_[0], d );
+        case 3:
+            return triangle( pts_[2], pts_[1], pts_[0], d );
+        default:
+            break;
+        }
+        // Tetrahedron: check the three faces through the newest point a,
+        // each with its normal oriented away from the opposite vertex.
+        const Vec3 a = pts_[3], b = pts_[2], c = pts_[1], e = pts_[0];
+        const Vec3 ao = -a;
+        const Vec3 faces[3][3] = { { a, b, c }, { a, c, e }, { a, e, b } };
+        const Vec3 opposite[3] = { e, b, c };
+        for ( int f = 0; f < 3; ++f )
+        {
+            Vec3 n = cross( faces[f][1] - a, faces[f][2] - a );
+            if ( dot( n, opposite[f] - a ) > 0 )
+                n = -n;
+            if ( dot( n, ao ) > 0 )
+                return triangle( a, faces[f][1], faces[f][2], d );
+        }
+        return true;
+    }
+
+    struct Face
+    {
+        uint32_t v[3];
+        Vec3 normal;
+        double dist;
+    };
+
+    void add_face( uint32_t i, uint32_t j, uint32_t k )
+    {
+        Face f{ { i, j, k }, {}, 0.0 };
+        Vec3 n = cross( verts_[j] - verts_[i], verts_[k] - verts_[i] );
+        double len = norm( n );
+        if ( len < 1e-300 )
+        {
+            // Degenerate sliver: never the closest face.
+            f.normal = { 1, 0, 0 };
+            f.dist = std::numeric_limits<double>::infinity();
+        }
+        else
+        {
+            // Orient away from a strictly interior point; the origin may sit
+            // on the boundary of the initial tetrahedron, so it cannot.
+            f.normal = n / len;
+            if ( dot( f.normal, verts_[i] - interior_ ) < 0 )
+            {
+                std::swap( f.v[1], f.v[2] );
+                f.normal = -f.normal;
+            }
+            f.dist = std::max( 0.0, dot( f.normal, verts_[i] ) );
+        }
+        faces_.push_back( f );
+    }
+
+    void add_edge( uint32_t i, uint32_t j )
+    {
+        for ( size_t k = 0; k < edges_.size(); ++k )
+            if ( edges_[k].first == j && edges_[k].second == i )
+            {
+                edges_[k] = edges_.back();
+                edges_.pop_back();
+                return;
+            }
+        edges_.emplace_back( i, j );
+    }
+
+    // GJK may stop on a point, segment or triangle that holds the origin.
+    // Grow it to a tetrahedron with supports off its span so EPA has a
+    // volume to expand; false if the difference has no such extent.
+    bool complete_simplex( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb )
+    {
+        const Vec3 axes[3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        if ( n_ == 1 )
+        {
+            for ( int i = 0; i < 6 && n_ == 1; ++i )
+            {
+                Vec3 p = support( a, pa, b, pb, i < 3 ? axes[i] : -axes[i - 3] );
+                if ( squared_norm( p - pts_[0] ) > 1e-18 )
+                    pts_[n_++] = p;
+            }
+            if ( n_ == 1 )
+                return false;
+        }
+        if ( n_ == 2 )
+        {
+            Vec3 dir = pts_[1] - pts_[0];
+            int k = 0;
+            for ( int i = 1; i < 3; ++i )
+                if ( std::fabs( dir[i] ) < std::fabs( dir[k] ) )
+                    k = i;
+            Vec3 u = normalized( cross( dir, axes[k] ) );
+            Mat3 rot = axis_angle( normalized( dir ), 2.0943951023931957 );
+            for ( int i = 0; i < 3 && n_ == 2; ++i, u = rot * u )
+            {
+                Vec3 p = support( a, pa, b, pb, u );
+                if ( squared_norm( cross( p - pts_[0], dir ) ) > 1e-18 * squared_norm( dir ) )
+                    pts_[n_++] = p;
+            }
+            if ( n_ == 2 )
+                return false;
+        }
+        if ( n_ == 3 )
+        {
+            Vec3 n = cross( pts_[1] - pts_[0], pts_[2] - pts_[0] );
+            double scale = norm( n );
+            for ( int i = 0; i < 2 && n_ == 3; ++i, n = -n )
+            {
+                Vec3 p = support( a, pa, b, pb, n );
+                if ( std::fabs( dot( p - pts_[0], n ) ) > 1e-9 * scale )
+                    pts_[n_++] = p;
+            }
+            if ( n_ == 3 )
+                return false;
+        }
+        return true;
+    }
+
+    // Expanding polytope from the GJK tetrahedron (van den Bergen).
+    void epa( const ConvexShape& a, const Isometry3& pa, const ConvexShape& b, const Isometry3& pb, Contact& contact )
+    {
+        faces_.clear();
+        if ( !complete_simplex( a, pa, b, pb ) )
+        {
+            // Minkowski difference is flat: touching, no depth to report.
+            contact.depth = 0.0;
+            contact.normal = { 1, 0, 0 };
+            return;
+        }
+        verts_.assign( pts_, pts_ + 4 );
+        interior_ = ( pts_[0] + pts_[1] + pts_[2] + pts_[3] ) * 0.25;
+        add_face( 0, 1, 2 );
+        add_face( 0, 3, 1 );
+        add_face( 0, 2, 3 );
+        add_face( 1, 3, 2 );
+
+        for ( int iter = 0; iter < 128 && !faces_.empty(); ++iter )
+        {
+            size_t best = 0;
+            for ( size_t f = 1; f < faces_.size(); ++f )
+                if ( faces_[f].dist < faces_[best].dist )
+                    best = f;
+            Face closest = faces_[best];
+            Vec3 p = support( a, pa, b, pb, closest.normal );
+            double reach = dot( p, closest.normal );
+            if ( reach - closest.dist < 1e-7 || !std::isfinite( closest.dist ) )
+            {
+                contact.depth = std::isfinite( closest.dist ) ? closest.dist : 0.0;
+                contact.normal = closest.normal;
+                return;
+            }
+            uint32_t pi = static_cast<uint32_t>( verts_.size() );
+            verts_.push_back( p );
+            edges_.clear();
+            for ( size_t f = 0; f < faces_.size(); )
+            {
+                const Face& fc = faces_[f];
+                if ( dot( fc.normal, p - verts_[fc.v[0]] ) > 0 )
+                {
+                    add_edge( fc.v[0], fc.v[1] );
+                    add_edge( fc.v[1], fc.v[2] );
+                    add_edge( fc.v[2], fc.v[0] );
+                    faces_[f] = faces_.back();
+                    faces_.pop_back();
+                }
+                else
+                    ++f;
+            }
+            for ( const auto& e : edges_ )
+                add_face( e.first, e.second, pi );
+        }
+        size_t best = 0;
+        for ( size_t f = 1; f < faces_.size(); ++f )
+            if ( faces_[f].dist < faces_[best].dist )
+                best = f;
+        contact.depth = faces_.empty() ? 0.0 : faces_[best].dist;
+        contact.normal = faces_.empty() ? Vec3( 1, 0, 0 ) : faces_[best].normal;
+    }
+
+    Vec3 pts_[4];
+    int n_ = 0;
+    Vec3 interior_;
+    std::vector<Vec3> verts_;
+    std::vector<Face> faces_;
+    std::vector<std::pair<uint32_t, uint32_t>> edges_;
+};
+
+struct CollisionStats
+{
+    size_t nodes_visited = 0;
+    size_t narrow_tests = 0;
+
+    CollisionStats& operator+=( const CollisionStats& o )
+    {
+        nodes_visited += o.nodes_visited;
+        narrow_tests += o.narrow_tests;
+        return *this;
+    }
+};
+
+// Static environment: posed convex objects under a bounding volume
+// hierarchy. Nodes are flattened depth-first into one array; a node's left
+// child follows it and `offset` is the right child, or for leaves the first
+// primitive in the reordered index list.
+class CollisionWorld
+{
+public:
+    struct Node
+    {
+        Aabb box;
+        uint32_t offset;
+        uint16_t count; // 0 for interior nodes
+        uint8_t axis;
+        uint8_t pad;
+    };
+
+    uint32_t add( const ConvexShape& shape, const Isometry3& pose = Isometry3() )
+    {
+        objects_.push_back( { shape, pose, Obb::of( shape, pose ).bounds() } );
+        built_ = false;
+        return static_cast<uint32_t>( objects_.size() - 1 );
+    }
+
+    // Adds a triangle soup; indices are triples into vertices.
+    void add_mesh( const std::vector<Vec3>& vertices, const std::vector<uint32_t>& indices )
+    {
+        for ( size_t i = 0; i + 2 < indices.size(); i += 3 )
+            add( ConvexShape::triangle( vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]] ) );
+    }
+
+    size_t size() const { return objects_.size(); }
+    const std::vector<Node>& nodes() const { return nodes_; }
+
+    // Binned SAH build; leaves hold up to kLeafSize objects.
+    void build()
+    {
+        order_.resize( objects_.size() );
+        for ( uint32_t i = 0; i < order_.size(); ++i )
+            order_[i] = i;
+        nodes_.clear();
+        depth_ = 0;
+        if ( !objects_.empty() )
+            build( 0, static_cast<uint32_t>( objects_.size() ), 0 );
+        built_ = true;
+    }
+
+    // Whether shape at pose touches any object. Stops at the first hit.
+    // Objects added since the last build() are not seen, so build first.
+    bool collides( const ConvexShape& shape, const Isometry3& pose, NarrowPhase& narrow,
+                   CollisionStats* stats = nullptr ) const
+    {
+        assert( built_ && "CollisionWorld::build() must follow add()" );
+        if ( nodes_.empty() )
+            return false;
+        Obb obb = Obb::of( shape, pose );
+        Aabb box = obb.bounds();
+        // Depth-first traversal holds at most one pending sibling per level.
+        // SAH does not bound the depth, so trees deeper than the inline
+        // buffer spill to the heap.
+        uint32_t inline_stack[64];
+        std::vector<uint32_t> heap_stack;
+        uint32_t* stack = inline_stack;
+        if ( depth_ + 1 > 64 )
+        {
+            heap_stack.resize( depth_ + 1 );
+            stack = heap_stack.data();
+        }
+        uint32_t top = 0;
+        stack[top++] = 0;
+        CollisionStats local;
+        bool hit = false;
+        while ( top > 0 && !hit )
+        {
+            const Node& node = nodes_[stack[--top]];
+            ++local.nodes_visited;
+            if ( !node.box.overlaps( box ) || !obb.overlaps( node.box, false ) )
+                continue;
+            if ( node.count == 0 )
+            {
+                uint32_t self = static_cast<uint32_t>( &node - nodes_.data() );
+                stack[top++] = node.offset;
+                stack[top++] = self + 1;
+                continue;
+            }
+            for ( uint32_t i = node.offset; i < node.offset + node.count && !hit; ++i )
+            {
+                const Object& o = objects_[order_[i]];
+                if ( !o.box.overlaps( box ) || !obb.overlaps( o.box, true ) )
+                    continue;
+                ++local.narrow_tests;
+                hit = narrow.intersect( shape, pose, o.shape, o.pose );
+            }
+        }
+        if ( stats )
+            *stats += local;
+        return hit;
+    }
+
+    // Same answer as collides() by testing every object; for validation.
+    bool collides_brute( const ConvexShape& shape, const Isometry3& pose, NarrowPhase& narrow ) const
+    {
+        for ( const Object& o : objects_ )
+            if ( narrow.intersect( shape, pose, o.shape, o.pose ) )
+                return true;
+        return false;
+    }
+
+private:
+    static constexpr uint32_t kLeafSize = 4;
+    static constexpr int kBins = 12;
+
+    struct Object
+    {
+        ConvexShape shape;
+        Isometry3 pose;
+        Aabb box;
+    };
+
+    static void grow( Aabb& a, const Aabb& b )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            a.lo[i] = std::min( a.lo[i], b.lo[i] );
+            a.hi[i] = std::max( a.hi[i], b.hi[i] );
+        }
+    }
+
+    static Aabb empty_box()
+    {
+        Aabb a;
+        for ( int i = 0; i < 3; ++i )
+        {
+            a.lo[i] = std::numeric_limits<float>::max();
+            a.hi[i] = -std::numeric_limits<float>::max();
+        }
+        return a;
+    }
+
+    static float area( const Aabb& a )
+    {
+        float dx = a.hi[0] - a.lo[0], dy = a.hi[1] - a.lo[1], dz = a.hi[2] - a.lo[2];
+        return dx < 0 ? 0.0f : 2 * ( dx * dy + dy * dz + dz * dx );
+    }
+
+    float centroid( uint32_t obj, int axis ) const
+    {
+        return 0.5f * ( objects_[obj].box.lo[axis] + objects_[obj].box.hi[axis] );
+    }
+
+    uint32_t build( uint32_t begin, uint32_t end, uint32_t depth )
+    {
+        depth_ = std::max( depth_, depth );
+        uint32_t index = static_cast<uint32_t>( nodes_.size() );
+        nodes_.emplace_back();
+        Aabb box = empty_box(), cbox = empty_box();
+        for ( uint32_t i = begin; i < end; ++i )
+        {
+            grow( box, objects_[order_[i]].box );
+            for ( int a = 0; a < 3; ++a )
+            {
+                float c = centroid( order_[i], a );
+                cbox.lo[a] = std::min( cbox.lo[a], c );
+                cbox.hi[a] = std::max( cbox.hi[a], c );
+            }
+        }
+        nodes_[index].box = box;
+        uint32_t count = end - begin;
+
+        int axis = 0;
+        for ( int a = 1; a < 3; ++a )
+            if ( cbox.hi[a] - cbox.lo[a] > cbox.hi[axis] - cbox.lo[axis] )
+                axis = a;
+        float extent = cbox.hi[axis] - cbox.lo[axis];
+        if ( count <= kLeafSize || extent <= 0.0f )
+        {
+            make_leaf( index, begin, count, depth );
+            return index;
+        }
+
+        // Bin centroids along the widest axis and take the cheapest SAH
+        // split; stay a leaf if no split beats testing everything here.
+        Aabb bin_box[kBins];
+        uint32_t bin_count[kBins] = {};
+        for ( auto& b : bin_box )
+            b = empty_box();
+        auto bin_of = [&]( uint32_t obj ) {
+            int b = static_cast<int>( kBins * ( centroid( obj, axis ) - cbox.lo[axis] ) / extent );
+            return std::min( b, kBins - 1 );
+        };
+        for ( uint32_t i = begin; i < end; ++i )
+        {
+            int b = bin_of( order_[i] );
+            ++bin_count[b];
+            grow( bin_box[b], objects_[order_[i]].box );
+        }
+        float right_area[kBins];
+        uint32_t right_count[kBins];
+        Aabb acc = empty_box();
+        uint32_t n = 0;
+        for ( int b = kBins - 1; b > 0; --b )
+        {
+            grow( acc, bin_box[b] );
+            n += bin_count[b];
+            right_area[b] = area( acc );
+            right_count[b] = n;
+        }
+        acc = empty_box();
+        n = 0;
+        int split = -1;
+        float best = static_cast<float>( count ) * area( box );
+        for ( int b = 1; b < kBins; ++b )
+        {
+            grow( acc, bin_box[b - 1] );
+            n += bin_count[b - 1];
+            float cost = 0.125f * area( box ) + n * area( acc ) + right_count[b] * right_area[b];
+            if ( n > 0 && right_count[b] > 0 && cost < best )
+            {
+                best = cost;
+                split = b;
+            }
+        }
+        if ( split < 0 && count <= 4 * kLeafSize )
+        {
+            make_leaf( index, begin, count, depth );
+            return index;
+        }
+
+        uint32_t mid;
+        if ( split < 0 )
+        {
+            mid = begin + count / 2;
+            std::nth_element( order_.begin() + begin, order_.begin() + mid, order_.begin() + end,
+                              [&]( uint32_t x, uint32_t y ) { return centroid( x, axis ) < centroid( y, axis ); } );
+        }
+        else
+            mid = static_cast<uint32_t>(
+                std::partition( order_.begin() + begin, order_.begin() + end,
+                                [&]( uint32_t o ) { return bin_of( o ) < split; } ) -
+                order_.begin() );
+
+        build( begin, mid, depth + 1 );
+        uint32_t right = build( mid, end, depth + 1 );
+        nodes_[index].offset = right;
+        nodes_[index].count = 0;
+        nodes_[index].axis = static_cast<uint8_t>( axis );
+        return index;
+    }
+
+    void make_leaf( uint32_t index, uint32_t begin, uint32_t count, uint32_t depth )
+    {
+        // Oversized leaves only arise from coincident centroids; split them
+        // by index so count fits the node field.
+        if ( count > 0xffff )
+        {
+            uint32_t mid = begin + count / 2;
+            build( begin, mid, depth + 1 );
+            nodes_[index].offset = build( mid, begin + count, depth + 1 );
+            nodes_[index].count = 0;
+            return;
+        }
+        nodes_[index].offset = begin;
+        nodes_[index].count = static_cast<uint16_t>( count );
+    }
+
+    std::vector<Object> objects_;
+    std::vector<uint32_t> order_;
+    std::vector<Node> nodes_;
+    uint32_t depth_ = 0; // deepest node below the root
+    bool built_ = false;
+};
+
+// Collision geometry of a robot: convex shapes fixed to links, and the
+// shape pairs that are checked against each other for self-collision.
+struct RobotCollisionModel
+{
+    struct LinkShape
+    {
+        uint32_t link;
+        ConvexShape shape;
+        Isometry3 offset;
+    };
+
+    std::vector<LinkShape> shapes;
+    std::vector<std::pair<uint32_t, uint32_t>> self_pairs;
+    uint32_t links = 0;
+
+    uint32_t add( uint32_t link, const ConvexShape& shape, const Isometry3& offset = Isometry3() )
+    {
+        shapes.push_back( { link, shape, offset } );
+        links = std::max( links, link + 1 );
+        return static_cast<uint32_t>( shapes.size() - 1 );
+    }
+};
+
+// Tests whole robot configurations, given as world poses of every link,
+// against a world and against themselves.
+class CollisionChecker
+{
+public:
+    CollisionChecker( const CollisionWorld& world, const RobotCollisionModel& model )
+        : world_( world ), model_( model ), poses_( 1 ), narrow_( 1 )
+    {
+    }
+
+    const CollisionStats& stats() const { return stats_; }
+    void reset_stats() { stats_ = CollisionStats(); }
+
+    // link_poses holds model.links poses.
+    bool in_collision( const Isometry3* link_poses )
+    {
+        return check( link_poses, 0, stats_ );
+    }
+
+    // configs consecutive blocks of model.links poses; out[i] is 1 where
+    // configuration i collides.
+    void check_batch( const Isometry3* link_poses, size_t configs, uint8_t* out, ThreadPool* pool = nullptr )
+    {
+        size_t workers = pool ? pool->size() : 1;
+        if ( narrow_.size() < workers )
+        {
+            narrow_.resize( workers );
+            poses_.resize( workers );
+        }
+        std::vector<CollisionStats>& stats = worker_stats_;
+        stats.assign( workers, CollisionStats() );
+        auto run = [&]( size_t w ) {
+            size_t lo = configs * w / workers, hi = configs * ( w + 1 ) / workers;
+            for ( size_t c = lo; c < hi; ++c )
+                out[c] = check( link_poses + c * model_.links, w, stats[w] );
+        };
+        if ( pool && workers > 1 )
+            pool->run_chunks( workers, run );
+        else
+            run( 0 );
+        for ( const auto& s : stats )
+            stats_ += s;
+    }
+
+private:
+    bool check( const Isometry3* link_poses, size_t worker, CollisionStats& stats )
+    {
+        std::vector<Isometry3>& poses = poses_[worker];
+        NarrowPhase& narrow = narrow_[worker];
+        poses.resize( model_.shapes.size() );
+        for ( size_t s = 0; s < model_.shapes.size(); ++s )
+        {
+            const auto& ls = model_.shapes[s];
+            poses[s] = link_poses[ls.link] * ls.offset;
+        }
+        for ( const auto& p : model_.self_pairs )
+        {
+            ++stats.narrow_tests;
+            if ( narrow.intersect( model_.shapes[p.first].shape, poses[p.first], model_.shapes[p.second].shape,
+                                   poses[p.second] ) )
+                return true;
+        }
+        for ( size_t s = 0; s < model_.shapes.size(); ++s )
+            if ( world_.collides( model_.shapes[s].shape, poses[s], narrow, &stats ) )
+                return true;
+        return false;
+    }
+
+    const CollisionWorld& world_;
+    const RobotCollisionModel& model_;
+    std::vector<std::vector<Isometry3>> poses_;
+    std::vector<NarrowPhase> narrow_;
+    std::vector<CollisionStats> worker_stats_;
+    CollisionStats stats_;
+};
+
+} // namespace wra
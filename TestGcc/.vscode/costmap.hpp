@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace wra
+{
+
+// Zero-initialised array whose first element sits on a cache-line boundary.
+template <typename T>
+class AlignedBuffer
+{
+public:
+    static constexpr size_t kAlign = 64;
+
+    AlignedBuffer() = default;
+    explicit AlignedBuffer( size_t n ) { resize( n ); }
+
+    AlignedBuffer( const AlignedBuffer& o ) { *this = o; }
+
+    AlignedBuffer& operator=( const AlignedBuffer& o )
+    {
+        if ( this != &o )
+        {
+            resize( o.size_ );
+            std::memcpy( data_, o.data_, size_ * sizeof( T ) );
+        }
+        return *this;
+    }
+
+    void resize( size_t n )
+    {
+        raw_.assign( n * sizeof( T ) + kAlign, 0 );
+        uintptr_t p = reinterpret_cast<uintptr_t>( raw_.data() );
+        data_ = reinterpret_cast<T*>( ( p + kAlign - 1 ) & ~uintptr_t( kAlign - 1 ) );
+        size_ = n;
+    }
+
+    size_t size() const { return size_; }
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+    T& operator[]( size_t i ) { return data_[i]; }
+    const T& operator[]( size_t i ) const { return data_[i]; }
+
+private:
+    std::vector<unsigned char> raw_;
+    T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// 2D cost grid in ROS costmap units: 0 free, 253 inscribed, 254 lethal.
+// Rows start on cache-line boundaries and are padded to a multiple of 64
+// cells; padding stays free so vector kernels may run over whole rows.
+class Costmap
+{
+public:
+    static constexpr uint8_t kFree = 0;
+    static constexpr uint8_t kInscribed = 253;
+    static constexpr uint8_t kLethal = 254;
+
+    Costmap() = default;
+
+    Costmap( int width, int height, double resolution )
+        : width_( width ), height_( height ), resolution_( resolution )
+    {
+        stride_ = ( static_cast<size_t>( width ) + 63 ) & ~size_t( 63 );
+        cells_.resize( stride_ * height );
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t stride() const { return stride_; }
+    double resolution() const { return resolution_; }
+
+    uint8_t& at( int x, int y ) { return cells_[y * stride_ + x]; }
+    uint8_t at( int x, int y ) const { return cells_[y * stride_ + x]; }
+    uint8_t* row( int y ) { return cells_.data() + y * stride_; }
+    const uint8_t* row( int y ) const { return cells_.data() + y * stride_; }
+
+    void clear() { std::memset( cells_.data(), 0, cells_.size() ); }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    size_t stride_ = 0;
+    double resolution_ = 1.0;
+    AlignedBuffer<uint8_t> cells_;
+};
+
+struct InflationParams
+{
+    double inscribed_radius = 0.3;
+    double inflation_radius = 1.0;
+    double cost_scaling = 3.0;
+};
+
+namespace detail
+{
+
+// Vertical pass: distance in cells to the nearest lethal cell in the same
+// column, saturated at far. Runs down then up over whole padded rows.
+inline void column_pass_scalar( const Costmap& in, uint8_t* col, int far )
+{
+    const size_t w = in.stride();
+    const int h = in.height();
+    for ( int y = 0; y < h; ++y )
+    {
+        const uint8_t* src = in.row( y );
+        uint8_t* dst = col + y * w;
+        const uint8_t* prev = y ? dst - w : nullptr;
+        for ( size_t x = 0; x < w; ++x )
+            dst[x] = src[x] >= Costmap::kLethal ? 0 : static_cast<uint8_t>( std::min( prev ? prev[x] + 1 : far, far ) );
+    }
+    for ( int y = h - 2; y >= 0; --y )
+    {
+        uint8_t* dst = col + y * w;
+        const uint8_t* next = dst + w;
+        for ( size_t x = 0; x < w; ++x )
+            dst[x] = static_cast<uint8_t>( std::min<int>( dst[x], next[x] + 1 ) );
+    }
+}
+
+// Horizontal pass over one row of squared column distances padded by r on
+// both sides: d2[x] = min over |dx| <= r of sq[x + dx] + dx^2.
+inline void row_pass_scalar( const uint16_t* sq, uint16_t* d2, size_t w, int r )
+{
+    for ( size_t x = 0; x < w; ++x )
+    {
+        const uint16_t* c = sq + r + x;
+        uint32_t best = c[0];
+        for ( int dx = 1; dx <= r; ++dx )
+            best = std::min<uint32_t>( best, std::min( c[-dx], c[dx] ) + static_cast<uint32_t>( dx * dx ) );
+        d2[x] = static_cast<uint16_t>( std::min<uint32_t>( best, 0xffff ) );
+    }
+}
+
+#if defined( WRA_X86_SIMD )
+
+inline void column_pass_sse2( const Costmap& in, uint8_t* col, int far )
+{
+    const size_t w = in.stride();
+    const int h = in.height();
+    const __m128i one = _mm_set1_epi8( 1 );
+    const __m128i vfar = _mm_set1_epi8( static_cast<char>( far ) );
+    const __m128i lethal = _mm_set1_epi8( static_cast<char>( Costmap::kLethal ) );
+    for ( int y = 0; y < h; ++y )
+    {
+        const uint8_t* src = in.row( y );
+        uint8_t* dst = col + y * w;
+        for ( size_t x = 0; x < w; x += 16 )
+        {
+            __m128i v = y ? _mm_min_epu8( _mm_adds_epu8( _mm_load_si128( reinterpret_cast<const __m128i*>( dst - w + x ) ), one ), vfar )
+                          : vfar;
+            __m128i s = _mm_load_si128( reinterpret_cast<const __m128i*>( src + x ) );
+            __m128i obstacle = _mm_cmpeq_epi8( _mm_max_epu8( s, lethal ), s );
+            _mm_store_si128( reinterpret_cast<__m128i*>( dst + x ), _mm_andnot_si128( obstacle, v ) );
+        }
+    }
+    for ( int y = h - 2; y >= 0; --y )
+    {
+        uint8_t* dst = col + y * w;
+        for ( size_t x = 0; x < w; x += 16 )
+        {
+            __m128i below = _mm_adds_epu8( _mm_load_si128( reinterpret_cast<const __m128i*>( dst + w + x ) ), one );
+            __m128i v = _mm_load_si128( reinterpret_cast<const __m128i*>( dst + x ) );
+            _mm_store_si128( reinterpret_cast<__m128i*>( dst + x ), _mm_min_epu8( v, below ) );
+        }
+    }
+}
+
+// SSE2 has no unsigned 16-bit min; a - sat(a - b) is equivalent.
+inline __m128i min_epu16_sse2( __m128i a, __m128i b )
+{
+    return _mm_sub_epi16( a, _mm_subs_epu16( a, b ) );
+}
+
+inline void row_pass_sse2( const uint16_t* sq, uint16_t* d2, size_t w, int r )
+{
+    for ( size_t x = 0; x < w; x += 8 )
+    {
+        const uint16_t* c = sq + r + x;
+        __m128i best = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c ) );
+        for ( int dx = 1; dx <= r; ++dx )
+        {
+            __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c - dx ) );
+            __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( c + dx ) );
+            __m128i m = _mm_adds_epu16( min_epu16_sse2( a, b ), _mm_set1_epi16( static_cast<short>( dx * dx ) ) );
+            best = min_epu16_sse2( best, m );
+        }
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( d2 + x ), best );
+    }
+}
+
+__attribute__( ( target( "avx2" ) ) ) inline void column_pass_avx2( const Costmap& in, uint8_t* col, int far )
+{
+    const size_t w = in.stride();
+    const int h = in.height();
+    const __m256i one = _mm256_set1_epi8( 1 );
+    const __m256i vfar = _mm256_set1_epi8( static_cast<char>( far ) );
+    const __m256i lethal = _mm256_set1_epi8( static_cast<char>( Costmap::kLethal ) );
+    for ( int y = 0; y < h; ++y )
+    {
+        const uint8_t* src = in.row( y );
+        uint8_t* dst = col + y * w;
+        for ( size_t x = 0; x < w; x += 32 )
+        {
+            __m256i v = y ? _mm256_min_epu8( _mm256_adds_epu8( _mm256_load_si256( reinterpret_cast<const __m256i*>( dst - w + x ) ), one ), vfar )
+                          : vfar;
+            __m256i s = _mm256_load_si256( reinterpret_cast<const __m256i*>( src + x ) );
+            __m256i obstacle = _mm256_cmpeq_epi8( _mm256_max_epu8( s, lethal ), s );
+            _mm256_store_si256( reinterpret_cast<__m256i*>( dst + x ), _mm256_andnot_si256( obstacle, v ) );
+        }
+    }
+    for ( int y = h - 2; y >= 0; --y )
+    {
+        uint8_t* dst = col + y * w;
+        for ( size_t x = 0; x < w; x += 32 )
+        {
+            __m256i below = _mm256_adds_epu8( _mm256_load_si256( reinterpret_cast<const __m256i*>( dst + w + x ) ), one );
+            __m256i v = _mm256_load_si256( reinterpret_cast<const __m256i*>( dst + x ) );
+            _mm256_store_si256( reinterpret_cast<__m256i*>( dst + x ), _mm256_min_epu8( v, below ) );
+        }
+    }
+}
+
+__attribute__( ( target( "avx2" ) ) ) inline void row_pass_avx2( const uint16_t* sq, uint16_t* d2, size_t w, int r )
+{
+    for ( size_t x = 0; x < w; x += 16 )
+    {
+        const uint16_t* c = sq + r + x;
+        __m256i best = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( c ) );
+        for ( int dx = 1; dx <= r; ++dx )
+        {
+            __m256i a = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( c - dx ) );
+            __m256i b = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( c + dx ) );
+            __m256i m = _mm256_adds_epu16( _mm256_min_epu16( a, b ), _mm256_set1_epi16( static_cast<short>( dx * dx ) ) );
+            best = _mm256_min_epu16( best, m );
+        }
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( d2 + x ), best );
+    }
+}
+
+#endif
+
+} // namespace detail
+
+// Inflates lethal cells into a distance-based cost falloff. Exact Euclidean
+// distances within the inflation radius come from a vertical pass (nearest
+// obstacle per column) and a windowed horizontal min over squared
+// distances; a lookup table turns squared distance into cost. The kernel
+// set is picked once at construction from the running CPU.
+class InflationLayer
+{
+public:
+    // Squared distances must fit the 16-bit lanes of the horizontal pass.
+    static constexpr int kMaxRadiusCells = 180;
+
+    InflationLayer( const InflationParams& params, double resolution, SimdLevel level = detect_simd() )
+        : params_( params ), level_( level )
+    {
+        radius_ = std::min( kMaxRadiusCells, static_cast<int>( std::ceil( params.inflation_radius / resolution ) ) );
+        int limit = radius_ * radius_;
+        lut_.assign( limit + 2, Costmap::kFree );
+        for ( int d2 = 0; d2 <= limit; ++d2 )
+            lut_[d2] = cost_at( std::sqrt( static_cast<double>( d2 ) ) * resolution );
+    }
+
+    SimdLevel level() const { return level_; }
+    int radius_cells() const { return radius_; }
+
+    // Cost of a cell at the given distance from the nearest obstacle.
+    uint8_t cost_at( double distance ) const
+    {
+        if ( distance <= 0.0 )
+            return Costmap::kLethal;
+        if ( distance <= params_.inscribed_radius )
+            return Costmap::kInscribed;
+        if ( distance > params_.inflation_radius )
+            return Costmap::kFree;
+        double c = ( Costmap::kInscribed - 1 ) * std::exp( -params_.cost_scaling * ( distance - params_.inscribed_radius ) );
+        return static_cast<uint8_t>( c + 0.5 );
+    }
+
+    // Writes the inflated costs of `in` into `out`, which must have the same
+    // dimensions. Cells >= kLethal in `in` are obstacles.
+    void inflate( const Costmap& in, Costmap& out )
+    {
+        const size_t w = in.stride();
+        const int r = radius_;
+        const int far = r + 1;
+        if ( col_.size() != w * in.height() )
+            col_.resize( w * in.height() );
+        // One vector of slack past the right pad for the unaligned loads.
+        sq_.resize( w + 2 * r + 16 );
+        d2_.resize( w );
+        std::fill( sq_.begin(), sq_.end(), static_cast<uint16_t>( far * far ) );
+
+        switch ( level_ )
+        {
+#if defined( WRA_X86_SIMD )
+        case SimdLevel::Avx2:
+            detail::column_pass_avx2( in, col_.data(), far );
+            break;
+        case SimdLevel::Sse2:
+            detail::column_pass_sse2( in, col_.data(), far );
+            break;
+#endif
+        default:
+            detail::column_pass_scalar( in, col_.data(), far );
+        }
+
+        const uint16_t limit = static_cast<uint16_t>( lut_.size() - 1 );
+        for ( int y = 0; y < in.height(); ++y )
+        {
+            const uint8_t* col = col_.data() + y * w;
+            for ( size_t x = 0; x < w; ++x )
+                sq_[r + x] = static_cast<uint16_t>( col[x] * col[x] );
+
+            switch ( level_ )
+            {
+#if defined( WRA_X86_SIMD )
+            case SimdLevel::Avx2:
+                detail::row_pass_avx2( sq_.data(), d2_.data(), w, r );
+                break;
+            case SimdLevel::Sse2:
+                detail::row_pass_sse2( sq_.data(), d2_.data(), w, r );
+                break;
+#endif
+            default:
+                detail::row_pass_scalar( sq_.data(), d2_.data(), w, r );
+            }
+
+            uint8_t* dst = out.row( y );
+            for ( int x = 0; x < in.width(); ++x )
+                dst[x] = lut_[std::min( d2_[x], limit )];
+        }
+    }
+
+private:
+    InflationParams params_;
+    SimdLevel level_;
+    int radius_ = 0;
+    std::vector<uint8_t> lut_;
+    AlignedBuffer<uint8_t> col_;
+    std::vector<uint16_t> sq_;
+    std::vector<uint16_t> d2_;
+};
+
+} // namespace wra
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace wra
+{
+
+// Lower Cholesky factor L L^T = A of a small symmetric positive definite
+// matrix, reading only the lower triangle of A; the upper triangle of L is
+// left untouched. Returns false at the first non-positive pivot rather
+// than clamping it, so callers decide how to regularise (damp and retry,
+// or give up). A and L may be the same array for an in-place factor.
+template <size_t N>
+inline bool cholesky_factor( const double ( &A )[N][N], double ( &L )[N][N] )
+{
+    for ( size_t i = 0; i < N; ++i )
+        for ( size_t j = 0; j <= i; ++j )
+        {
+            double v = A[i][j];
+            for ( size_t k = 0; k < j; ++k )
+                v -= L[i][k] * L[j][k];
+            if ( i != j )
+                L[i][j] = v / L[j][j];
+            else if ( v > 0.0 )
+                L[i][i] = std::sqrt( v );
+            else
+                return false;
+        }
+    return true;
+}
+
+// Solves L L^T x = b in place (b passed in x) with the factor above.
+template <size_t N>
+inline void cholesky_solve( const double ( &L )[N][N], double* x )
+{
+    for ( size_t i = 0; i < N; ++i )
+    {
+        for ( size_t k = 0; k < i; ++k )
+            x[i] -= L[i][k] * x[k];
+        x[i] /= L[i][i];
+    }
+    for ( size_t i = N; i-- > 0; )
+    {
+        for ( size_t k = i + 1; k < N; ++k )
+            x[i] -= L[k][i] * x[k];
+        x[i] /= L[i][i];
+    }
+}
+
+} // namespace wra
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "grid_planner.hpp"
+
+namespace wra
+{
+
+struct CellUpdate
+{
+    Cell cell;
+    uint8_t cost = PlanningGrid::kBlocked;
+};
+
+// D* Lite (Koenig & Likhachev) over a PlanningGrid. The search is rooted at
+// the goal and its g/rhs tables persist between queries, so after a batch
+// of cell-cost changes only the inconsistent region around them is
+// repaired. Move costs and corner rules match GridAStar.
+class DStarLite
+{
+public:
+    explicit DStarLite( PlanningGrid& grid )
+        : grid_( grid ),
+          neighbors_( make_neighbors( grid ) ),
+          g_( grid.size(), kInfiniteCost ),
+          rhs_( grid.size(), kInfiniteCost ),
+          heap_pos_( grid.size(), kNotQueued )
+    {
+    }
+
+    const SearchStats& stats() const { return stats_; }
+
+    // Starts a fresh search; the previous search state is discarded.
+    void reset( const Cell& start, const Cell& goal )
+    {
+        for ( uint32_t v : heap_ )
+            heap_pos_[v] = kNotQueued;
+        heap_.clear();
+        keys_.clear();
+        std::fill( g_.begin(), g_.end(), kInfiniteCost );
+        std::fill( rhs_.begin(), rhs_.end(), kInfiniteCost );
+        start_cell_ = start;
+        goal_cell_ = goal;
+        last_cell_ = start;
+        start_ = static_cast<uint32_t>( grid_.index( start ) );
+        goal_ = static_cast<uint32_t>( grid_.index( goal ) );
+        km_ = 0;
+        rhs_[goal_] = 0;
+        push( goal_, key( goal_ ) );
+    }
+
+    // The robot moved; keeps the search state and shifts the key modifier.
+    void move_start( const Cell& start )
+    {
+        km_ += octile_distance( last_cell_, start );
+        last_cell_ = start;
+        start_cell_ = start;
+        start_ = static_cast<uint32_t>( grid_.index( start ) );
+    }
+
+    // Writes the new costs into the grid and queues every vertex whose
+    // outgoing edges may have changed: the cell itself and its neighbours,
+    // which covers diagonal moves that sweep past the cell's corner.
+    void apply( const std::vector<CellUpdate>& updates )
+    {
+        for ( const CellUpdate& u : updates )
+        {
+            if ( !grid_.inside( u.cell ) || grid_.cost( u.cell ) == u.cost )
+                continue;
+            grid_.set_cost( u.cell, u.cost );
+            uint32_t v = static_cast<uint32_t>( grid_.index( u.cell ) );
+            update_vertex( v );
+            for ( const GridNeighbor& n : neighbors_ )
+                if ( grid_.inside( neighbor_cell( u.cell, n ) ) )
+                    update_vertex( static_cast<uint32_t>( v + n.offset ) );
+        }
+    }
+
+    // Repairs the search and extracts the current path from start to goal.
+    bool plan( GridPath& path )
+    {
+        path.cells.clear();
+        path.cost = 0;
+        path.found = false;
+        stats_ = SearchStats();
+        compute_shortest_path();
+        if ( rhs_[start_] == kInfiniteCost || !grid_.free( start_cell_ ) )
+            return false;
+
+        const uint8_t* cells = grid_.data();
+        uint32_t u = start_;
+        Cell cu = start_cell_;
+        path.cells.push_back( cu );
+        // Greedy descent over g; bounded in case the tables are inconsistent.
+        for ( size_t steps = 0; u != goal_ && steps < grid_.size(); ++steps )
+        {
+            uint32_t best = kInfiniteCost;
+            const GridNeighbor* next = nullptr;
+            for ( const GridNeighbor& n : neighbors_ )
+            {
+                if ( !can_move( cells, u, n ) )
+                    continue;
+                uint32_t v = static_cast<uint32_t>( u + n.offset );
+                if ( g_[v] == kInfiniteCost )
+                    continue;
+                uint32_t c = relax( g_[v], n, cells[v] );
+                if ( c < best )
+                {
+                    best = c;
+                    next = &n;
+                }
+            }
+            if ( !next )
+                return false;
+            path.cost = relax( path.cost, *next, cells[u + next->offset] );
+            u = static_cast<uint32_t>( u + next->offset );
+            cu = neighbor_cell( cu, *next );
+            path.cells.push_back( cu );
+        }
+        path.found = u == goal_;
+        return path.found;
+    }
+
+private:
+    static constexpr uint32_t kNotQueued = 0xffffffffu;
+
+    // Lexicographic priority (k1, k2).
+    struct Key
+    {
+        uint64_t k1;
+        uint64_t k2;
+
+        bool operator<( const Key& o ) const { return k1 < o.k1 || ( k1 == o.k1 && k2 < o.k2 ); }
+    };
+
+    // g plus one move onto a cell of the given cost, saturated to
+    // kInfiniteCost so long heavy routes cannot wrap 32 bits.
+    static uint32_t relax( uint32_t g, const GridNeighbor& n, uint8_t cell )
+    {
+        uint64_t c = uint64_t( g ) + uint64_t( n.cost ) * cell;
+        return c < kInfiniteCost ? static_cast<uint32_t>( c ) : kInfiniteCost;
+    }
+
+    static Cell neighbor_cell( const Cell& c, const GridNeighbor& n ) { return Cell{ c.x + n.dx, c.y + n.dy, c.z + n.dz }; }
+
+    Key key( uint32_t v ) const
+    {
+        uint64_t m = std::min( g_[v], rhs_[v] );
+        if ( m == kInfiniteCost )
+            return Key{ ~uint64_t( 0 ), m };
+        return Key{ m + octile_distance( start_cell_, grid_.cell( v ) ) + km_, m };
+    }
+
+    void update_vertex( uint32_t u )
+    {
+        const uint8_t* cells = grid_.data();
+        if ( u != goal_ )
+        {
+            uint32_t best = kInfiniteCost;
+            if ( cells[u] != PlanningGrid::kBlocked )
+                for ( const GridNeighbor& n : neighbors_ )
+                {
+                    if ( !can_move( cells, u, n ) )
+                        continue;
+                    uint32_t v = static_cast<uint32_t>( u + n.offset );
+                    if ( g_[v] != kInfiniteCost )
+                        best = std::min( best, relax( g_[v], n, cells[v] ) );
+                }
+            rhs_[u] = best;
+        }
+        if ( g_[u] != rhs_[u] )
+        {
+            if ( heap_pos_[u] == kNotQueued )
+                push( u, key( u ) );
+            else
+                update( u, key( u ) );
+        }
+        else if ( heap_pos_[u] != kNotQueued )
+            remove( u );
+    }
+
+    void compute_shortest_path()
+    {
+        const uint8_t* cells = grid_.data();
+        while ( !heap_.empty() && ( keys_[0] < key( start_ ) || rhs_[start_] > g_[start_] ) )
+        {
+            uint32_t u = heap_[0];
+            Key k_old = keys_[0];
+            Key k_new = key( u );
+            ++stats_.expanded;
+            if ( k_old < k_new )
+            {
+                update( u, k_new );
+                continue;
+            }
+
+            remove( u );
+            if ( g_[u] > rhs_[u] )
+                g_[u] = rhs_[u];
+            else
+            {
+                g_[u] = kInfiniteCost;
+                update_vertex( u );
+            }
+            // Predecessors of u are the neighbours that can move into it.
+            if ( cells[u] == PlanningGrid::kBlocked )
+                continue;
+            for ( const GridNeighbor& n : neighbors_ )
+                if ( can_move( cells, u, n ) )
+                    update_vertex( static_cast<uint32_t>( u + n.offset ) );
+        }
+    }
+
+    // Indexed binary min-heap; heap_pos_ maps a cell to its heap slot.
+    void push( uint32_t v, const Key& k )
+    {
+        heap_.push_back( v );
+        keys_.push_back( k );
+        heap_pos_[v] = static_cast<uint32_t>( heap_.size() - 1 );
+        sift_up( heap_.size() - 1 );
+        ++stats_.pushed;
+    }
+
+    void update( uint32_t v, const Key& k )
+    {
+        size_t i = heap_pos_[v];
+        bool up = k < keys_[i];
+        keys_[i] = k;
+        if ( up )
+            sift_up( i );
+        else
+            sift_down( i );
+    }
+
+    void remove( uint32_t v )
+    {
+        size_t i = heap_pos_[v];
+        heap_pos_[v] = kNotQueued;
+        size_t last = heap_.size() - 1;
+        if ( i != last )
+        {
+            heap_[i] = heap_[last];
+            keys_[i] = keys_[last];
+            heap_pos_[heap_[i]] = static_cast<uint32_t>( i );
+        }
+        heap_.pop_back();
+        keys_.pop_back();
+        if ( i < heap_.size() )
+        {
+            uint32_t moved = heap_[i];
+            sift_up( i );
+            sift_down( heap_pos_[moved] );
+        }
+    }
+
+    void swap_slots( size_t a, size_t b )
+    {
+        std::swap( heap_[a], heap_[b] );
+        std::swap( keys_[a], keys_[b] );
+        heap_pos_[heap_[a]] = static_cast<uint32_t>( a );
+        heap_pos_[heap_[b]] = static_cast<uint32_t>( b );
+    }
+
+    void sift_up( size_t i )
+    {
+        while ( i > 0 )
+        {
+            size_t p = ( i - 1 ) / 2;
+            if ( !( keys_[i] < keys_[p] ) )
+                break;
+            swap_slots( i, p );
+            i = p;
+        }
+    }
+
+    void sift_down( size_t i )
+    {
+        for ( ;; )
+        {
+            size_t l = 2 * i + 1;
+            size_t m = i;
+            if ( l < heap_.size() && keys_[l] < keys_[m] )
+                m = l;
+            if ( l + 1 < heap_.size() && keys_[l + 1] < keys_[m] )
+                m = l + 1;
+            if ( m == i )
+                break;
+            swap_slots( i, m );
+            i = m;
+        }
+    }
+
+    PlanningGrid& grid_;
+    std::vector<GridNeighbor> neighbors_;
+    std::vector<uint32_t> g_;
+    std::vector<uint32_t> rhs_;
+    std::vector<uint32_t> heap_pos_;
+    std::vector<uint32_t> heap_;
+    std::vector<Key> keys_;
+    Cell start_cell_;
+    Cell goal_cell_;
+    Cell last_cell_;
+    uint32_t start_ = 0;
+    uint32_t goal_ = 0;
+    uint64_t km_ = 0;
+    SearchStats stats_;
+};
+
+} // namespace wra
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <cstddef>
+
+#include "geometry.hpp"
+#include "kinematics.hpp"
+
+namespace wra
+{
+
+// Rigid-body dynamics of a serial DH chain in Featherstone's spatial
+// notation: RNEA for inverse dynamics, ABA for forward dynamics, CRBA for
+// the joint-space inertia matrix. Body i is link i in its DH frame; its
+// joint turns about the z axis of frame i - 1, which in frame i is the
+// fixed line through -(a, d sin(alpha), d cos(alpha)) along
+// (0, sin(alpha), cos(alpha)).
+//
+// Every intermediate lives in fixed-size members sized by Model::dof, so
+// no call allocates; one instance per control thread is the workspace.
+template <typename Model>
+class RigidBodyDynamics
+{
+public:
+    static constexpr size_t dof = Model::dof;
+
+    RigidBodyDynamics()
+    {
+        for ( size_t i = 0; i < dof; ++i )
+        {
+            const DhJoint& j = Model::joints[i];
+            const LinkInertia& l = Model::links[i];
+            Vec3 axis( 0.0, j.sin_alpha, j.cos_alpha );
+            Vec3 origin( -j.a, -j.d * j.sin_alpha, -j.d * j.cos_alpha );
+            Vec3 v = cross( origin, axis );
+            for ( int k = 0; k < 3; ++k )
+            {
+                S_[i][k] = axis[k];
+                S_[i][k + 3] = v[k];
+            }
+            mass_[i] = l.mass;
+            com_[i] = { l.com[0], l.com[1], l.com[2] };
+            Mat3& I = inertia_[i];
+            I( 0, 0 ) = l.ixx;
+            I( 1, 1 ) = l.iyy;
+            I( 2, 2 ) = l.izz;
+            I( 0, 1 ) = I( 1, 0 ) = l.ixy;
+            I( 0, 2 ) = I( 2, 0 ) = l.ixz;
+            I( 1, 2 ) = I( 2, 1 ) = l.iyz;
+            spatial_inertia( mass_[i], com_[i], I, body_[i] );
+        }
+    }
+
+    // Gravity in the base frame; the default pulls along -z.
+    void set_gravity( const Vec3& g ) { gravity_ = g; }
+
+    // tau = M(q) qdd + C(q, qd) qd + g(q).
+    void inverse_dynamics( const double* q, const double* qd, const double* qdd, double* tau )
+    {
+        joint_transforms( q );
+        for ( size_t i = 0; i < dof; ++i )
+        {
+            Vec6 vp, ap;
+            parent_motion( i, v_, vp );
+            parent_acceleration( i, ap );
+            for ( int k = 0; k < 6; ++k )
+            {
+                v_[i][k] = vp[k] + S_[i][k] * qd[i];
+                a_[i][k] = ap[k] + S_[i][k] * qdd[i];
+            }
+            Vec6 vj, c;
+            for ( int k = 0; k < 6; ++k )
+                vj[k] = S_[i][k] * qd[i];
+            cross_motion( v_[i], vj, c );
+            for ( int k = 0; k < 6; ++k )
+                a_[i][k] += c[k];
+            Vec6 Iv, Ia;
+            apply_inertia( i, v_[i], Iv );
+            apply_inertia( i, a_[i], Ia );
+            cross_force( v_[i], Iv, f_[i] );
+            for ( int k = 0; k < 6; ++k )
+                f_[i][k] += Ia[k];
+        }
+        for ( size_t i = dof; i-- > 0; )
+        {
+            tau[i] = dot6( S_[i], f_[i] );
+            if ( i > 0 )
+            {
+                Vec6 fp;
+                transpose_force( i, f_[i], fp );
+                for ( int k = 0; k < 6; ++k )
+                    f_[i - 1][k] += fp[k];
+            }
+        }
+    }
+
+    // Gravity torques g(q).
+    void gravity_torques( const double* q, double* tau )
+    {
+        double zero[dof] = {};
+        inverse_dynamics( q, zero, zero, tau );
+    }
+
+    // Articulated-body algorithm: qdd = M(q)^-1 (tau - C(q, qd) qd - g(q)).
+    void forward_dynamics( const double* q, const double* qd, const double* tau, double* qdd )
+    {
+        joint_transforms( q );
+        for ( size_t i = 0; i < dof; ++i )
+        {
+            Vec6 vp, vj;
+            parent_motion( i, v_, vp );
+            for ( int k = 0; k < 6; ++k )
+            {
+                vj[k] = S_[i][k] * qd[i];
+                v_[i][k] = vp[k] + vj[k];
+            }
+            cross_motion( v_[i], vj, c_[i] );
+            copy6x6( body_[i], IA_[i] );
+            Vec6 Iv;
+            apply_inertia( i, v_[i], Iv );
+            cross_force( v_[i], Iv, pA_[i] );
+        }
+        for ( size_t i = dof; i-- > 0; )
+        {
+            for ( int r = 0; r < 6; ++r )
+            {
+                U_[i][r] = 0.0;
+                for ( int k = 0; k < 6; ++k )
+                    U_[i][r] += IA_[i][r][k] * S_[i][k];
+            }
+            D_[i] = dot6( S_[i], U_[i] );
+            u_[i] = tau[i] - dot6( S_[i], pA_[i] );
+            if ( i == 0 )
+                continue;
+            Mat6 Ia;
+            Vec6 pa;
+            for ( int r = 0; r < 6; ++r )
+                for ( int k = 0; k < 6; ++k )
+                    Ia[r][k] = IA_[i][r][k] - U_[i][r] * U_[i][k] / D_[i];
+            for ( int r = 0; r < 6; ++r )
+            {
+                pa[r] = pA_[i][r] + U_[i][r] * u_[i] / D_[i];
+                for ( int k = 0; k < 6; ++k )
+                    pa[r] += Ia[r][k] * c_[i][k];
+            }
+            congruence_add( i, Ia, IA_[i - 1] );
+            Vec6 fp;
+            transpose_force( i, pa, fp );
+            for ( int k = 0; k < 6; ++k )
+                pA_[i - 1][k] += fp[k];
+        }
+        for ( size_t i = 0; i < dof; ++i )
+        {
+            Vec6 ap;
+            parent_acceleration( i, ap );
+            for ( int k = 0; k < 6; ++k )
+                a_[i][k] = ap[k] + c_[i][k];
+            qdd[i] = ( u_[i] - dot6( U_[i], a_[i] ) ) / D_[i];
+            for ( int k = 0; k < 6; ++k )
+                a_[i][k] += S_[i][k] * qdd[i];
+        }
+    }
+
+    // Composite-rigid-body algorithm; fills the symmetric M(q).
+    void mass_matrix( const double* q, double ( *M )[dof] )
+    {
+        joint_transforms( q );
+        for ( size_t i = 0; i < dof; ++i )
+            copy6x6( body_[i], IA_[i] );
+        for ( size_t i = dof; i-- > 0; )
+        {
+            if ( i > 0 )
+                congruence_add( i, IA_[i], IA_[i - 1] );
+            Vec6 F;
+            for ( int r = 0; r < 6; ++r )
+            {
+                F[r] = 0.0;
+                for ( int k = 0; k < 6; ++k )
+                    F[r] += IA_[i][r][k] * S_[i][k];
+            }
+            M[i][i] = dot6( S_[i], F );
+            for ( size_t j = i; j-- > 0; )
+            {
+                Vec6 Fp;
+                transpose_force( j + 1, F, Fp );
+                for ( int k = 0; k < 6; ++k )
+                    F[k] = Fp[k];
+                M[i][j] = M[j][i] = dot6( S_[j], F );
+            }
+        }
+    }
+
+    // Flange Jacobian in the base frame, rows linear then angular.
+    void jacobian( const double* q, double ( *J )[dof] )
+    {
+        ForwardKinematics<Model>::compute( q, poses_ );
+        ForwardKinematics<Model>::jacobian( poses_, J );
+    }
+
+private:
+    typedef double Vec6[6];
+    typedef double Mat6[6][6];
+
+    static double dot6( const Vec6& a, const Vec6& b )
+    {
+        double s = 0.0;
+        for ( int k = 0; k < 6; ++k )
+            s += a[k] * b[k];
+        return s;
+    }
+
+    static void copy6x6( const Mat6& from, Mat6& to )
+    {
+        for ( int r = 0; r < 6; ++r )
+            for ( int k = 0; k < 6; ++k )
+                to[r][k] = from[r][k];
+    }
+
+    // [Ic + m (|c|^2 1 - c c^T), m c x; -m c x, m 1].
+    static void spatial_inertia( double m, const Vec3& c, const Mat3& Ic, Mat6& out )
+    {
+        Mat3 cx = skew( c );
+        double cc = dot( c, c );
+        for ( int r = 0; r < 3; ++r )
+            for ( int k = 0; k < 3; ++k )
+            {
+                out[r][k] = Ic( r, k ) + m * ( ( r == k ? cc : 0.0 ) - c[r] * c[k] );
+                out[r][k + 3] = m * cx( r, k );
+                out[r + 3][k] = -m * cx( r, k );
+                out[r + 3][k + 3] = r == k ? m : 0.0;
+            }
+    }
+
+    // Body i's inertia times a motion vector, using the rigid-body form:
+    // f = m (v + w x c), n = Ic w + c x f.
+    void apply_inertia( size_t i, const Vec6& m, Vec6& f ) const
+    {
+        Vec3 w( m[0], m[1], m[2] ), v( m[3], m[4], m[5] );
+        Vec3 lin = ( v + cross( w, com_[i] ) ) * mass_[i];
+        Vec3 ang = inertia_[i] * w + cross( com_[i], lin );
+        for ( int k = 0; k < 3; ++k )
+        {
+            f[k] = ang[k];
+            f[k + 3] = lin[k];
+        }
+    }
+
+    // Motion cross product v x m.
+    static void cross_motion( const Vec6& v, const Vec6& m, Vec6& out )
+    {
+        Vec3 w( v[0], v[1], v[2] ), vo( v[3], v[4], v[5] );
+        Vec3 mw( m[0], m[1], m[2] ), mv( m[3], m[4], m[5] );
+        Vec3 a = cross( w, mw ), b = cross( w, mv ) + cross( vo, mw );
+        for ( int k = 0; k < 3; ++k )
+        {
+            out[k] = a[k];
+            out[k + 3] = b[k];
+        }
+    }
+
+    // Force cross product v x* f.
+    static void cross_force( const Vec6& v, const Vec6& f, Vec6& out )
+    {
+        Vec3 w( v[0], v[1], v[2] ), vo( v[3], v[4], v[5] );
+        Vec3 n( f[0], f[1], f[2] ), fl( f[3], f[4], f[5] );
+        Vec3 a = cross( w, n ) + cross( vo, fl ), b = cross( w, fl );
+        for ( int k = 0; k < 3; ++k )
+        {
+            out[k] = a[k];
+            out[k + 3] = b[k];
+        }
+    }
+
+    // Parent-to-body transforms X_i = [E 0; -E r x, E] with E = R^T and
+    // r the body origin in parent coordinates.
+    void joint_transforms( const double* q )
+    {
+        for ( size_t i = 0; i < dof; ++i )
+        {
+            Isometry3 t = dh_transform( Model::joints[i], q[i] );
+            E_[i] = t.R.transposed();
+            r_[i] = t.t;
+        }
+    }
+
+    // X_i m for a motion vector given in the parent frame.
+    void transform_motion( size_t i, const Vec6& m, Vec6& out ) const
+    {
+        Vec3 w( m[0], m[1], m[2] ), v( m[3], m[4], m[5] );
+        Vec3 a = E_[i] * w, b = E_[i] * ( v - cross( r_[i], w ) );
+        for ( int k = 0; k < 3; ++k )
+        {
+            out[k] = a[k];
+            out[k + 3] = b[k];
+        }
+    }
+
+    // X_i^T f: a body force carried back to the parent frame.
+    void transpose_force( size_t i, const Vec6& f, Vec6& out ) const
+    {
+        Vec3 fl = E_[i].transpose_times( Vec3( f[3], f[4], f[5] ) );
+        Vec3 n = E_[i].transpose_times( Vec3( f[0], f[1], f[2] ) ) + cross( r_[i], fl );
+        for ( int k = 0; k < 3; ++k )
+        {
+            out[k] = n[k];
+            out[k + 3] = fl[k];
+        }
+    }
+
+    // Parent velocity seen in body i (the base is at rest).
+    void parent_motion( size_t i, const Vec6* v, Vec6& out ) const
+    {
+        if ( i == 0 )
+        {
+            for ( int k = 0; k < 6; ++k )
+                out[k] = 0.0;
+            return;
+        }
+        transform_motion( i, v[i - 1], out );
+    }
+
+    // Parent acceleration seen in body i; the base accelerates at -g,
+    // which folds gravity into every link.
+    void parent_acceleration( size_t i, Vec6& out ) const
+    {
+        if ( i > 0 )
+        {
+            transform_motion( i, a_[i - 1], out );
+            return;
+        }
+        Vec6 base = { 0, 0, 0, -gravity_.x, -gravity_.y, -gravity_.z };
+        transform_motion( 0, base, out );
+    }
+
+    // parent += X_i^T I X_i, built column by column from the structured
+    // transforms rather than from 6x6 products.
+    void congruence_add( size_t i, const Mat6& I, Mat6& parent ) const
+    {
+        Mat6 IX;
+        for ( int c = 0; c < 6; ++c )
+        {
+            Vec6 e = { 0, 0, 0, 0, 0, 0 }, xe, col;
+            e[c] = 1.0;
+            transform_motion( i, e, xe );
+            for ( int r = 0; r < 6; ++r )
+            {
+                col[r] = 0.0;
+                for ( int k = 0; k < 6; ++k )
+                    col[r] += I[r][k] * xe[k];
+            }
+            for ( int r = 0; r < 6; ++r )
+                IX[r][c] = col[r];
+        }
+        for ( int c = 0; c < 6; ++c )
+        {
+            Vec6 col, out;
+            for ( int r = 0; r < 6; ++r )
+                col[r] = IX[r][c];
+            transpose_force( i, col, out );
+            for ( int r = 0; r < 6; ++r )
+                parent[r][c] += out[r];
+        }
+    }
+
+    Vec3 gravity_{ 0.0, 0.0, -9.81 };
+
+    // Model constants.
+    Vec6 S_[dof];
+    double mass_[dof];
+    Vec3 com_[dof];
+    Mat3 inertia_[dof];
+    Mat6 body_[dof];
+
+    // Workspace.
+    Mat3 E_[dof];
+    Vec3 r_[dof];
+    Vec6 v_[dof];
+    Vec6 a_[dof];
+    Vec6 f_[dof];
+    Vec6 c_[dof];
+    Vec6 pA_[dof];
+    Vec6 U_[dof];
+    double D_[dof];
+    double u_[dof];
+    Mat6 IA_[dof];
+    Isometry3 poses_[dof];
+};
+
+} // namespace wra
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "grid_planner.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+// Signed Euclidean distance in metres over a dense 2D or 3D voxel grid,
+// negative inside obstacles. Voxel (i, j, k) is centred at resolution *
+// (i, j, k).
+class DistanceField
+{
+public:
+    DistanceField() = default;
+
+    DistanceField( int nx, int ny, int nz, double resolution )
+        : nx_( nx ), ny_( ny ), nz_( nz ), resolution_( resolution ), values_( static_cast<size_t>( nx ) * ny * nz, 0.0f )
+    {
+    }
+
+    int nx() const { return nx_; }
+    int ny() const { return ny_; }
+    int nz() const { return nz_; }
+    bool is3d() const { return nz_ > 1; }
+    double resolution() const { return resolution_; }
+    size_t size() const { return values_.size(); }
+
+    size_t index( int x, int y, int z = 0 ) const
+    {
+        return ( static_cast<size_t>( z ) * ny_ + y ) * nx_ + x;
+    }
+
+    Cell cell( size_t i ) const
+    {
+        Cell c;
+        c.x = static_cast<int>( i % nx_ );
+        c.y = static_cast<int>( ( i / nx_ ) % ny_ );
+        c.z = static_cast<int>( i / ( static_cast<size_t>( nx_ ) * ny_ ) );
+        return c;
+    }
+
+    bool inside( const Cell& c ) const
+    {
+        return c.x >= 0 && c.y >= 0 && c.z >= 0 && c.x < nx_ && c.y < ny_ && c.z < nz_;
+    }
+
+    float at( const Cell& c ) const { return values_[index( c.x, c.y, c.z )]; }
+    float* data() { return values_.data(); }
+    const float* data() const { return values_.data(); }
+
+    // Trilinear (bilinear in 2D) interpolation at a metric point, clamped to
+    // the grid. grad, if given, receives d(distance)/d(x, y, z).
+    float interpolate( double x, double y, double z, double* grad = nullptr ) const
+    {
+        double p[3] = { x / resolution_, y / resolution_, z / resolution_ };
+        int n[3] = { nx_, ny_, nz_ };
+        int i0[3];
+        double t[3];
+        for ( int a = 0; a < 3; ++a )
+        {
+            double q = std::min( std::max( p[a], 0.0 ), static_cast<double>( n[a] - 1 ) );
+            i0[a] = std::min( static_cast<int>( q ), std::max( n[a] - 2, 0 ) );
+            t[a] = n[a] > 1 ? q - i0[a] : 0.0;
+        }
+        int i1[3];
+        for ( int a = 0; a < 3; ++a )
+            i1[a] = std::min( i0[a] + 1, n[a] - 1 );
+
+        double c[2][2][2];
+        for ( int dz = 0; dz < 2; ++dz )
+            for ( int dy = 0; dy < 2; ++dy )
+                for ( int dx = 0; dx < 2; ++dx )
+                    c[dz][dy][dx] = values_[index( dx ? i1[0] : i0[0], dy ? i1[1] : i0[1], dz ? i1[2] : i0[2] )];
+
+        double c00 = c[0][0][0] + ( c[0][0][1] - c[0][0][0] ) * t[0];
+        double c01 = c[0][1][0] + ( c[0][1][1] - c[0][1][0] ) * t[0];
+        double c10 = c[1][0][0] + ( c[1][0][1] - c[1][0][0] ) * t[0];
+        double c11 = c[1][1][0] + ( c[1][1][1] - c[1][1][0] ) * t[0];
+        double c0 = c00 + ( c01 - c00 ) * t[1];
+        double c1 = c10 + ( c11 - c10 ) * t[1];
+        if ( grad )
+        {
+            double gx0 = ( ( c[0][0][1] - c[0][0][0] ) * ( 1 - t[1] ) + ( c[0][1][1] - c[0][1][0] ) * t[1] );
+            double gx1 = ( ( c[1][0][1] - c[1][0][0] ) * ( 1 - t[1] ) + ( c[1][1][1] - c[1][1][0] ) * t[1] );
+            grad[0] = ( gx0 * ( 1 - t[2] ) + gx1 * t[2] ) / resolution_;
+            grad[1] = ( ( c01 - c00 ) * ( 1 - t[2] ) + ( c11 - c10 ) * t[2] ) / resolution_;
+            grad[2] = nz_ > 1 ? ( c1 - c0 ) / resolution_ : 0.0;
+        }
+        return static_cast<float>( c0 + ( c1 - c0 ) * t[2] );
+    }
+
+private:
+    int nx_ = 0;
+    int ny_ = 0;
+    int nz_ = 0;
+    double resolution_ = 1.0;
+    std::vector<float> values_;
+};
+
+namespace detail
+{
+
+// 1D squared distance transform of sampled function f (Felzenszwalb &
+// Huttenlocher): lower envelope of parabolas rooted at each sample.
+inline void edt_1d( const float* f, float* d, int n, int* v, double* z )
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    int k = 0;
+    v[0] = 0;
+    z[0] = -inf;
+    z[1] = inf;
+    // f is finite everywhere (sites 0, others a large constant) and
+    // z[0] = -inf, so the pop loop always stops at k = 0.
+    for ( int q = 1; q < n; ++q )
+    {
+        double s;
+        for ( ;; )
+        {
+            int p = v[k];
+            s = ( ( f[q] + double( q ) * q ) - ( f[p] + double( p ) * p ) ) / ( 2.0 * ( q - p ) );
+            if ( s > z[k] )
+                break;
+            --k;
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = inf;
+    }
+    k = 0;
+    for ( int q = 0; q < n; ++q )
+    {
+        while ( z[k + 1] < q )
+            ++k;
+        double dq = q - v[k];
+        d[q] = static_cast<float>( dq * dq + f[v[k]] );
+    }
+}
+
+} // namespace detail
+
+// Batch ESDF via the linear-time exact Euclidean distance transform, run
+// separably along x, y and z. Lines of each pass are spread over a
+// ThreadPool. Scratch buffers persist between calls.
+class EsdfBuilder
+{
+public:
+    // occupied holds one byte per voxel in DistanceField::index order.
+    void compute( const std::vector<uint8_t>& occupied, DistanceField& field, ThreadPool* pool = nullptr )
+    {
+        outside_.resize( field.size() );
+        inside_.resize( field.size() );
+        const float far = 1e20f;
+        for ( size_t i = 0; i < field.size(); ++i )
+        {
+            outside_[i] = occupied[i] ? 0.0f : far;
+            inside_[i] = occupied[i] ? far : 0.0f;
+        }
+        transform( field, outside_, pool );
+        transform( field, inside_, pool );
+
+        const float res = static_cast<float>( field.resolution() );
+        float* out = field.data();
+        for ( size_t i = 0; i < field.size(); ++i )
+            out[i] = occupied[i] ? -std::sqrt( inside_[i] ) * res : std::sqrt( outside_[i] ) * res;
+    }
+
+private:
+    static void transform( const DistanceField& field, std::vector<float>& d2, ThreadPool* pool )
+    {
+        const int n[3] = { field.nx(), field.ny(), field.nz() };
+        const size_t stride[3] = { 1, static_cast<size_t>( n[0] ), static_cast<size_t>( n[0] ) * n[1] };
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            if ( n[axis] < 2 )
+                continue;
+            // Lines along `axis`, identified by their start voxel.
+            int a = ( axis + 1 ) % 3;
+            int b = ( axis + 2 ) % 3;
+            size_t lines = static_cast<size_t>( n[a] ) * n[b];
+            auto body = [&]( size_t lo, size_t hi ) {
+                static thread_local std::vector<float> f, d;
+                static thread_local std::vector<int> v;
+                static thread_local std::vector<double> z;
+                f.resize( n[axis] );
+                d.resize( n[axis] );
+                v.resize( n[axis] );
+                z.resize( n[axis] + 1 );
+                for ( size_t line = lo; line < hi; ++line )
+                {
+                    size_t base = ( line % n[a] ) * stride[a] + ( line / n[a] ) * stride[b];
+                    float* p = d2.data() + base;
+                    for ( int q = 0; q < n[axis]; ++q )
+                        f[q] = p[q * stride[axis]];
+                    detail::edt_1d( f.data(), d.data(), n[axis], v.data(), z.data() );
+                    for ( int q = 0; q < n[axis]; ++q )
+                        p[q * stride[axis]] = d[q];
+                }
+            };
+            if ( pool )
+                pool->parallel_for( 0, lines, 64, body );
+            else
+                body( 0, lines );
+        }
+    }
+
+    std::vector<float> outside_;
+    std::vector<float> inside_;
+};
+
+// Unsigned distance to a changing set of site voxels, maintained with the
+// dynamic brushfire of Lau et al.: adding a site sends a lowering wave,
+// removing one sends a raise wave that clears the cells it owned before
+// neighbouring sites re-lower them. Each cell remembers its nearest site,
+// so distances are Euclidean rather than chamfer. Propagation stops at
+// max_cells, which bounds the work per change.
+class DynamicDistanceMap
+{
+public:
+    static constexpr uint32_t kFar = std::numeric_limits<uint32_t>::max();
+
+    DynamicDistanceMap( int nx, int ny, int nz, int max_cells )
+        : nx_( nx ), ny_( ny ), nz_( nz ), max_d2_( static_cast<uint32_t>( max_cells ) * max_cells )
+    {
+        size_t n = static_cast<size_t>( nx ) * ny * nz;
+        d2_.assign( n, kFar );
+        site_of_.assign( n, kNone );
+        is_site_.assign( n, 0 );
+        raise_.assign( n, 0 );
+        int zr = nz > 1 ? 1 : 0;
+        for ( int dz = -zr; dz <= zr; ++dz )
+            for ( int dy = -1; dy <= 1; ++dy )
+                for ( int dx = -1; dx <= 1; ++dx )
+                    if ( dx || dy || dz )
+                        offsets_.push_back( Cell{ dx, dy, dz } );
+    }
+
+    uint32_t d2( size_t i ) const { return d2_[i]; }
+    bool is_site( size_t i ) const { return is_site_[i] != 0; }
+
+    // Marks sites without propagating; only sites bordering non-sites are
+    // queued, so seeding a mostly-site map stays cheap.
+    void seed( const std::vector<uint8_t>& sites )
+    {
+        std::fill( d2_.begin(), d2_.end(), kFar );
+        std::fill( site_of_.begin(), site_of_.end(), kNone );
+        std::fill( raise_.begin(), raise_.end(), 0 );
+        open_.clear();
+        for ( size_t i = 0; i < sites.size(); ++i )
+        {
+            is_site_[i] = sites[i] ? 1 : 0;
+            if ( sites[i] )
+            {
+                d2_[i] = 0;
+                site_of_[i] = static_cast<uint32_t>( i );
+            }
+        }
+        for ( size_t i = 0; i < sites.size(); ++i )
+        {
+            if ( !sites[i] )
+                continue;
+            bool border = false;
+            for_each_neighbor( i, [&]( size_t n ) { border |= !sites[n]; } );
+            if ( border )
+                push( i, 0 );
+        }
+    }
+
+    void add_site( size_t i )
+    {
+        if ( is_site_[i] )
+            return;
+        is_site_[i] = 1;
+        raise_[i] = 0;
+        set( i, 0, static_cast<uint32_t>( i ) );
+        push( i, 0 );
+    }
+
+    void remove_site( size_t i )
+    {
+        if ( !is_site_[i] )
+            return;
+        is_site_[i] = 0;
+        set( i, kFar, kNone );
+        raise_[i] = 1;
+        push( i, 0 );
+    }
+
+    // Runs the queued waves. Cells whose distance changed are appended to
+    // changed (possibly more than once).
+    void update( std::vector<uint32_t>* changed )
+    {
+        changed_ = changed;
+        while ( !open_.empty() )
+        {
+            std::pop_heap( open_.begin(), open_.end(), std::greater<std::pair<uint32_t, uint32_t>>() );
+            size_t s = open_.back().second;
+            open_.pop_back();
+            if ( raise_[s] )
+                raise( s );
+            else if ( site_of_[s] != kNone && is_site_[site_of_[s]] )
+                lower( s );
+        }
+        changed_ = nullptr;
+    }
+
+private:
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+    Cell cell( size_t i ) const
+    {
+        return Cell{ static_cast<int>( i % nx_ ), static_cast<int>( ( i / nx_ ) % ny_ ),
+                     static_cast<int>( i / ( static_cast<size_t>( nx_ ) * ny_ ) ) };
+    }
+
+    template <typename F>
+    void for_each_neighbor( size_t i, F&& f ) const
+    {
+        Cell c = cell( i );
+        for ( const Cell& o : offsets_ )
+        {
+            int x = c.x + o.x;
+            int y = c.y + o.y;
+            int z = c.z + o.z;
+            if ( x < 0 || y < 0 || z < 0 || x >= nx_ || y >= ny_ || z >= nz_ )
+                continue;
+            f( ( static_cast<size_t>( z ) * ny_ + y ) * nx_ + x );
+        }
+    }
+
+    void set( size_t i, uint32_t d2, uint32_t site )
+    {
+        d2_[i] = d2;
+        site_of_[i] = site;
+        if ( changed_ )
+            changed_->push_back( static_cast<uint32_t>( i ) );
+    }
+
+    void push( size_t i, uint32_t key )
+    {
+        open_.emplace_back( key, static_cast<uint32_t>( i ) );
+        std::push_heap( open_.begin(), open_.end(), std::greater<std::pair<uint32_t, uint32_t>>() );
+    }
+
+    void raise( size_t s )
+    {
+        for_each_neighbor( s, [&]( size_t n ) {
+            if ( site_of_[n] == kNone || raise_[n] )
+                return;
+            uint32_t old = d2_[n];
+            if ( !is_site_[site_of_[n]] )
+            {
+                set( n, kFar, kNone );
+                raise_[n] = 1;
+            }
+            push( n, old );
+        } );
+        raise_[s] = 0;
+    }
+
+    void lower( size_t s )
+    {
+        const uint32_t site = site_of_[s];
+        const Cell o = cell( site );
+        for_each_neighbor( s, [&]( size_t n ) {
+            if ( raise_[n] )
+                return;
+            Cell c = cell( n );
+            uint32_t d2 = static_cast<uint32_t>( ( c.x - o.x ) * ( c.x - o.x ) + ( c.y - o.y ) * ( c.y - o.y ) +
+                                                 ( c.z - o.z ) * ( c.z - o.z ) );
+            if ( d2 > max_d2_ )
+                return;
+            bool better = d2 < d2_[n] ||
+                          ( d2 == d2_[n] && ( site_of_[n] == kNone || !is_site_[site_of_[n]] ) );
+            if ( !better || site_of_[n] == site )
+                return;
+            set( n, d2, site );
+            push( n, d2 );
+        } );
+    }
+
+    int nx_;
+    int ny_;
+    int nz_;
+    uint32_t max_d2_;
+    std::vector<Cell> offsets_;
+    std::vector<uint32_t> d2_;
+    std::vector<uint32_t> site_of_;
+    std::vector<uint8_t> is_site_;
+    std::vector<uint8_t> raise_;
+    std::vector<std::pair<uint32_t, uint32_t>> open_;
+    std::vector<uint32_t>* changed_ = nullptr;
+};
+
+// Signed field kept up to date under occupancy changes. Two dynamic maps
+// track distance to the nearest occupied voxel (for free voxels) and to the
+// nearest free voxel (for occupied ones); only voxels whose distance moved
+// are rewritten in the field. Distances saturate at max_distance.
+class IncrementalDistanceField
+{
+public:
+    IncrementalDistanceField( int nx, int ny, int nz, double resolution, double max_distance )
+        : field_( nx, ny, nz, resolution ),
+          max_cells_( std::max( 1, static_cast<int>( std::ceil( max_distance / resolution ) ) ) ),
+          outside_( nx, ny, nz, max_cells_ ),
+          inside_( nx, ny, nz, max_cells_ ),
+          occupied_( field_.size(), 0 )
+    {
+    }
+
+    const DistanceField& field() const { return field_; }
+
+    void reset( const std::vector<uint8_t>& occupied )
+    {
+        occupied_ = occupied;
+        std::vector<uint8_t> free_cells( occupied.size() );
+        for ( size_t i = 0; i < occupied.size(); ++i )
+            free_cells[i] = !occupied[i];
+        outside_.seed( occupied_ );
+        inside_.seed( free_cells );
+        outside_.update( nullptr );
+        inside_.update( nullptr );
+        for ( size_t i = 0; i < field_.size(); ++i )
+            refresh( i );
+    }
+
+    void set_occupied( const Cell& c, bool occupied )
+    {
+        size_t i = field_.index( c.x, c.y, c.z );
+        if ( occupied_[i] == occupied )
+            return;
+        occupied_[i] = occupied;
+        if ( occupied )
+        {
+            outside_.add_site( i );
+            inside_.remove_site( i );
+        }
+        else
+        {
+            outside_.remove_site( i );
+            inside_.add_site( i );
+        }
+        changed_.push_back( static_cast<uint32_t>( i ) );
+    }
+
+    // Propagates pending changes; returns the number of field writes.
+    size_t update()
+    {
+        outside_.update( &changed_ );
+        inside_.update( &changed_ );
+        for ( uint32_t i : changed_ )
+            refresh( i );
+        size_t n = changed_.size();
+        changed_.clear();
+        return n;
+    }
+
+private:
+    void refresh( size_t i )
+    {
+        const double res = field_.resolution();
+        uint32_t d2 = occupied_[i] ? inside_.d2( i ) : outside_.d2( i );
+        double d = d2 == DynamicDistanceMap::kFar ? max_cells_ : std::min<double>( std::sqrt( double( d2 ) ), max_cells_ );
+        field_.data()[i] = static_cast<float>( ( occupied_[i] ? -d : d ) * res );
+    }
+
+    DistanceField field_;
+    int max_cells_;
+    DynamicDistanceMap outside_;
+    DynamicDistanceMap inside_;
+    std::vector<uint8_t> occupied_;
+    std::vector<uint32_t> changed_;
+};
+
+} // namespace wra
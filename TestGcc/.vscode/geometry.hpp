@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+namespace wra
+{
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Planar pose: position and heading in radians.
+struct Pose2D
+{
+    double x = 0.0;
+    double y = 0.0;
+    double theta = 0.0;
+};
+
+struct Vec3
+{
+    double x = 0.0;
+    double y = 0.0;
+    double z = 0.0;
+
+    Vec3() = default;
+    Vec3( double x_, double y_, double z_ ) : x( x_ ), y( y_ ), z( z_ ) {}
+
+    double operator[]( int i ) const { return i == 0 ? x : i == 1 ? y : z; }
+    double& operator[]( int i ) { return i == 0 ? x : i == 1 ? y : z; }
+
+    Vec3 operator+( const Vec3& o ) const { return { x + o.x, y + o.y, z + o.z }; }
+    Vec3 operator-( const Vec3& o ) const { return { x - o.x, y - o.y, z - o.z }; }
+    Vec3 operator-() const { return { -x, -y, -z }; }
+    Vec3 operator*( double s ) const { return { x * s, y * s, z * s }; }
+    Vec3 operator/( double s ) const { return { x / s, y / s, z / s }; }
+    Vec3& operator+=( const Vec3& o )
+    {
+        x += o.x;
+        y += o.y;
+        z += o.z;
+        return *this;
+    }
+    Vec3& operator-=( const Vec3& o )
+    {
+        x -= o.x;
+        y -= o.y;
+        z -= o.z;
+        return *this;
+    }
+    Vec3& operator*=( double s )
+    {
+        x *= s;
+        y *= s;
+        z *= s;
+        return *this;
+    }
+};
+
+inline Vec3 operator*( double s, const Vec3& v )
+{
+    return v * s;
+}
+
+inline double dot( const Vec3& a, const Vec3& b )
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3 cross( const Vec3& a, const Vec3& b )
+{
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline double squared_norm( const Vec3& v )
+{
+    return dot( v, v );
+}
+
+inline double norm( const Vec3& v )
+{
+    return std::sqrt( dot( v, v ) );
+}
+
+inline Vec3 normalized( const Vec3& v )
+{
+    double n = norm( v );
+    return n > 0.0 ? v / n : Vec3( 1.0, 0.0, 0.0 );
+}
+
+// Row-major 3x3 matrix.
+struct Mat3
+{
+    double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+
+    static Mat3 identity() { return Mat3(); }
+
+    static Mat3 zero()
+    {
+        Mat3 r;
+        for ( auto& row : r.m )
+            for ( double& v : row )
+                v = 0.0;
+        return r;
+    }
+
+    double operator()( int r, int c ) const { return m[r][c]; }
+    double& operator()( int r, int c ) { return m[r][c]; }
+
+    Vec3 row( int r ) const { return { m[r][0], m[r][1], m[r][2] }; }
+    Vec3 col( int c ) const { return { m[0][c], m[1][c], m[2][c] }; }
+
+    Vec3 operator*( const Vec3& v ) const
+    {
+        return { m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z, m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                 m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z };
+    }
+
+    Mat3 operator*( const Mat3& o ) const
+    {
+        Mat3 r = zero();
+        for ( int i = 0; i < 3; ++i )
+            for ( int k = 0; k < 3; ++k )
+                for ( int j = 0; j < 3; ++j )
+                    r.m[i][j] += m[i][k] * o.m[k][j];
+        return r;
+    }
+
+    Mat3 operator+( const Mat3& o ) const
+    {
+        Mat3 r;
+        for ( int i = 0; i < 3; ++i )
+            for ( int j = 0; j < 3; ++j )
+                r.m[i][j] = m[i][j] + o.m[i][j];
+        return r;
+    }
+
+    Mat3 operator*( double s ) const
+    {
+        Mat3 r;
+        for ( int i = 0; i < 3; ++i )
+            for ( int j = 0; j < 3; ++j )
+                r.m[i][j] = m[i][j] * s;
+        return r;
+    }
+
+    Mat3 transposed() const
+    {
+        Mat3 r;
+        for ( int i = 0; i < 3; ++i )
+            for ( int j = 0; j < 3; ++j )
+                r.m[i][j] = m[j][i];
+        return r;
+    }
+
+    // M^T v without forming the transpose.
+    Vec3 transpose_times( const Vec3& v ) const
+    {
+        return { m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z, m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                 m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z };
+    }
+};
+
+// Cross-product matrix: skew(a) * b == cross(a, b).
+inline Mat3 skew( const Vec3& a )
+{
+    Mat3 r = Mat3::zero();
+    r.m[0][1] = -a.z;
+    r.m[0][2] = a.y;
+    r.m[1][0] = a.z;
+    r.m[1][2] = -a.x;
+    r.m[2][0] = -a.y;
+    r.m[2][1] = a.x;
+    return r;
+}
+
+// Rotation by angle (radians) about a unit axis (Rodrigues).
+inline Mat3 axis_angle( const Vec3& axis, double angle )
+{
+    double c = std::cos( angle );
+    double s = std::sin( angle );
+    double t = 1.0 - c;
+    const double x = axis.x, y = axis.y, z = axis.z;
+    Mat3 r;
+    r.m[0][0] = t * x * x + c;
+    r.m[0][1] = t * x * y - s * z;
+    r.m[0][2] = t * x * z + s * y;
+    r.m[1][0] = t * x * y + s * z;
+    r.m[1][1] = t * y * y + c;
+    r.m[1][2] = t * y * z - s * x;
+    r.m[2][0] = t * x * z - s * y;
+    r.m[2][1] = t * y * z + s * x;
+    r.m[2][2] = t * z * z + c;
+    return r;
+}
+
+// Inverse of axis_angle: the rotation vector (axis * angle, angle in
+// [0, pi]) of a rotation matrix.
+inline Vec3 rotation_log( const Mat3& R )
+{
+    Vec3 w( R( 2, 1 ) - R( 1, 2 ), R( 0, 2 ) - R( 2, 0 ), R( 1, 0 ) - R( 0, 1 ) );
+    double c = std::max( -1.0, std::min( 1.0, 0.5 * ( R( 0, 0 ) + R( 1, 1 ) + R( 2, 2 ) - 1.0 ) ) );
+    double angle = std::acos( c );
+    if ( angle < 1e-6 )
+        return w * 0.5;
+    if ( angle < 3.14159265358979323846 - 1e-6 )
+        return w * ( 0.5 * angle / std::sin( angle ) );
+    // Near a half turn sin(angle) vanishes; read the axis off the symmetric
+    // part c I + (1 - c) a a^T instead, pivoting on the largest component.
+    int k = R( 0, 0 ) >= R( 1, 1 ) && R( 0, 0 ) >= R( 2, 2 ) ? 0 : R( 1, 1 ) >= R( 2, 2 ) ? 1 : 2;
+    Vec3 axis;
+    axis[k] = std::sqrt( std::max( 0.0, ( R( k, k ) - c ) / ( 1.0 - c ) ) );
+    for ( int i = 0; i < 3; ++i )
+        if ( i != k )
+            axis[i] = ( R( i, k ) + R( k, i ) ) / ( 2.0 * ( 1.0 - c ) * axis[k] );
+    if ( dot( axis, w ) < 0 )
+        axis = -axis;
+    return normalized( axis ) * angle;
+}
+
+// Rz(yaw) * Ry(pitch) * Rx(roll).
+inline Mat3 rpy( double roll, double pitch, double yaw )
+{
+    return axis_angle( { 0, 0, 1 }, yaw ) * axis_angle( { 0, 1, 0 }, pitch ) * axis_angle( { 1, 0, 0 }, roll );
+}
+
+// Rigid transform x -> R x + t.
+struct Isometry3
+{
+    Mat3 R;
+    Vec3 t;
+
+    Isometry3() = default;
+    Isometry3( const Mat3& R_, const Vec3& t_ ) : R( R_ ), t( t_ ) {}
+
+    Vec3 operator*( const Vec3& p ) const { return R * p + t; }
+    Isometry3 operator*( const Isometry3& o ) const { return { R * o.R, R * o.t + t }; }
+
+    Isometry3 inverse() const
+    {
+        Mat3 Rt = R.transposed();
+        return { Rt, -( Rt * t ) };
+    }
+};
+
+} // namespace wra
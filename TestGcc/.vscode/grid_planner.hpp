@@ -0,0 +1,483 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace wra
+{
+
+struct Cell
+{
+    int x = 0;
+    int y = 0;
+    int z = 0;
+};
+
+inline bool operator==( const Cell& a, const Cell& b )
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+inline bool operator!=( const Cell& a, const Cell& b )
+{
+    return !( a == b );
+}
+
+// Occupancy grid for the planners. A cost of 0 blocks the cell, 1..255
+// multiplies the cost of moving into it. Storage carries a one-cell blocked
+// border (none along z for 2D grids) so neighbour offsets never leave the
+// array and the search loops need no bounds checks.
+class PlanningGrid
+{
+public:
+    static constexpr uint8_t kBlocked = 0;
+
+    PlanningGrid() = default;
+
+    PlanningGrid( int nx, int ny, int nz = 1 )
+        : nx_( nx ), ny_( ny ), nz_( nz ), pad_z_( nz > 1 ? 1 : 0 )
+    {
+        sy_ = nx + 2;
+        sz_ = sy_ * static_cast<ptrdiff_t>( ny + 2 );
+        cells_.assign( static_cast<size_t>( sz_ ) * ( nz + 2 * pad_z_ ), kBlocked );
+        for ( int z = 0; z < nz; ++z )
+            for ( int y = 0; y < ny; ++y )
+                std::memset( &cells_[index( 0, y, z )], 1, nx );
+    }
+
+    int nx() const { return nx_; }
+    int ny() const { return ny_; }
+    int nz() const { return nz_; }
+    bool is3d() const { return nz_ > 1; }
+    size_t size() const { return cells_.size(); }
+    ptrdiff_t stride_y() const { return sy_; }
+    ptrdiff_t stride_z() const { return sz_; }
+
+    bool inside( const Cell& c ) const
+    {
+        return c.x >= 0 && c.y >= 0 && c.z >= 0 && c.x < nx_ && c.y < ny_ && c.z < nz_;
+    }
+
+    size_t index( int x, int y, int z = 0 ) const
+    {
+        return static_cast<size_t>( ( z + pad_z_ ) * sz_ + ( y + 1 ) * sy_ + ( x + 1 ) );
+    }
+
+    size_t index( const Cell& c ) const { return index( c.x, c.y, c.z ); }
+
+    Cell cell( size_t index ) const
+    {
+        ptrdiff_t i = static_cast<ptrdiff_t>( index );
+        Cell c;
+        c.z = static_cast<int>( i / sz_ ) - pad_z_;
+        i %= sz_;
+        c.y = static_cast<int>( i / sy_ ) - 1;
+        c.x = static_cast<int>( i % sy_ ) - 1;
+        return c;
+    }
+
+    uint8_t at( size_t index ) const { return cells_[index]; }
+    uint8_t cost( const Cell& c ) const { return cells_[index( c )]; }
+    bool free( const Cell& c ) const { return inside( c ) && cost( c ) != kBlocked; }
+
+    void set_cost( const Cell& c, uint8_t cost )
+    {
+        uint8_t& v = cells_[index( c )];
+        heavy_cells_ += ( cost > 1 ) - ( v > 1 );
+        v = cost;
+    }
+
+    // True when every free cell costs 1, which Jump Point Search relies on.
+    bool uniform() const { return heavy_cells_ == 0; }
+
+    const uint8_t* data() const { return cells_.data(); }
+
+private:
+    int nx_ = 0;
+    int ny_ = 0;
+    int nz_ = 0;
+    int pad_z_ = 0;
+    ptrdiff_t sy_ = 0;
+    ptrdiff_t sz_ = 0;
+    size_t heavy_cells_ = 0;
+    std::vector<uint8_t> cells_;
+};
+
+// Integer move costs keep the open list on integer keys. Straight moves cost
+// 1000 per unit of cell cost; diagonals use rounded-down sqrt(2) and sqrt(3).
+constexpr uint32_t kStraightCost = 1000;
+constexpr uint32_t kDiagonal2Cost = 1414;
+constexpr uint32_t kDiagonal3Cost = 1732;
+
+// Exact distance on an empty grid under the move costs above, so it is a
+// consistent heuristic for any cell costs >= 1.
+inline uint32_t octile_distance( const Cell& a, const Cell& b )
+{
+    uint32_t d[3] = { static_cast<uint32_t>( std::abs( a.x - b.x ) ),
+                      static_cast<uint32_t>( std::abs( a.y - b.y ) ),
+                      static_cast<uint32_t>( std::abs( a.z - b.z ) ) };
+    if ( d[0] > d[1] )
+        std::swap( d[0], d[1] );
+    if ( d[1] > d[2] )
+        std::swap( d[1], d[2] );
+    if ( d[0] > d[1] )
+        std::swap( d[0], d[1] );
+    return kDiagonal3Cost * d[0] + kDiagonal2Cost * ( d[1] - d[0] ) + kStraightCost * ( d[2] - d[1] );
+}
+
+// One entry of the 8- or 26-connected neighbourhood. Diagonal moves may not
+// cut corners, so each carries the offsets of the cells it sweeps past.
+struct GridNeighbor
+{
+    ptrdiff_t offset = 0;
+    uint32_t cost = 0;
+    int8_t dx = 0;
+    int8_t dy = 0;
+    int8_t dz = 0;
+    uint8_t corner_count = 0;
+    ptrdiff_t corners[6] = {};
+};
+
+inline std::vector<GridNeighbor> make_neighbors( const PlanningGrid& grid )
+{
+    std::vector<GridNeighbor> out;
+    int zr = grid.is3d() ? 1 : 0;
+    for ( int dz = -zr; dz <= zr; ++dz )
+        for ( int dy = -1; dy <= 1; ++dy )
+            for ( int dx = -1; dx <= 1; ++dx )
+            {
+                int axes = ( dx != 0 ) + ( dy != 0 ) + ( dz != 0 );
+                if ( axes == 0 )
+                    continue;
+                GridNeighbor n;
+                n.dx = static_cast<int8_t>( dx );
+                n.dy = static_cast<int8_t>( dy );
+                n.dz = static_cast<int8_t>( dz );
+                n.offset = dx + dy * grid.stride_y() + dz * grid.stride_z();
+                n.cost = axes == 1 ? kStraightCost : axes == 2 ? kDiagonal2Cost : kDiagonal3Cost;
+                // Every proper, non-empty subset of the move's axes.
+                for ( int mask = 1; mask < 7; ++mask )
+                {
+                    if ( ( ( mask & 1 ) && !dx ) || ( ( mask & 2 ) && !dy ) || ( ( mask & 4 ) && !dz ) )
+                        continue;
+                    int sx = ( mask & 1 ) ? dx : 0;
+                    int sy = ( mask & 2 ) ? dy : 0;
+                    int sz = ( mask & 4 ) ? dz : 0;
+                    if ( ( sx != 0 ) + ( sy != 0 ) + ( sz != 0 ) == axes )
+                        continue;
+                    n.corners[n.corner_count++] = sx + sy * grid.stride_y() + sz * grid.stride_z();
+                }
+                out.push_back( n );
+            }
+    return out;
+}
+
+inline bool can_move( const uint8_t* cells, size_t from, const GridNeighbor& n )
+{
+    if ( cells[from + n.offset] == PlanningGrid::kBlocked )
+        return false;
+    for ( int k = 0; k < n.corner_count; ++k )
+        if ( cells[from + n.corners[k]] == PlanningGrid::kBlocked )
+            return false;
+    return true;
+}
+
+inline int highest_bit( uint32_t v )
+{
+#if defined( __GNUC__ )
+    return 31 - __builtin_clz( v );
+#else
+    int b = 0;
+    while ( v >>= 1 )
+        ++b;
+    return b;
+#endif
+}
+
+// Monotone radix heap over 32-bit keys. Valid for A* with a consistent
+// heuristic since popped f-values never decrease. Buckets keep their
+// capacity across clear() so steady-state queries do not allocate.
+class RadixHeap
+{
+public:
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    void clear()
+    {
+        for ( auto& b : buckets_ )
+            b.clear();
+        last_ = 0;
+        size_ = 0;
+    }
+
+    void push( uint32_t key, uint32_t value )
+    {
+        buckets_[bucket( key )].emplace_back( key, value );
+        ++size_;
+    }
+
+    // Pops an entry with the minimum key.
+    std::pair<uint32_t, uint32_t> pop()
+    {
+        if ( buckets_[0].empty() )
+        {
+            int i = 1;
+            while ( buckets_[i].empty() )
+                ++i;
+            auto& src = buckets_[i];
+            uint32_t m = src[0].first;
+            for ( const auto& e : src )
+                m = std::min( m, e.first );
+            last_ = m;
+            for ( const auto& e : src )
+                buckets_[bucket( e.first )].push_back( e );
+            src.clear();
+        }
+        auto e = buckets_[0].back();
+        buckets_[0].pop_back();
+        --size_;
+        return e;
+    }
+
+private:
+    int bucket( uint32_t key ) const { return key == last_ ? 0 : highest_bit( key ^ last_ ) + 1; }
+
+    std::vector<std::pair<uint32_t, uint32_t>> buckets_[33];
+    uint32_t last_ = 0;
+    size_t size_ = 0;
+};
+
+struct GridPath
+{
+    std::vector<Cell> cells;
+    uint32_t cost = 0;
+    bool found = false;
+};
+
+struct SearchStats
+{
+    size_t expanded = 0;
+    size_t pushed = 0;
+};
+
+// Inclusive cell range a search may not leave.
+struct GridBox
+{
+    Cell lo;
+    Cell hi;
+
+    bool contains( const Cell& c ) const
+    {
+        return c.x >= lo.x && c.y >= lo.y && c.z >= lo.z && c.x <= hi.x && c.y <= hi.y && c.z <= hi.z;
+    }
+};
+
+constexpr uint32_t kInfiniteCost = std::numeric_limits<uint32_t>::max();
+
+// Per-cell search state in flat arrays: g-cost, parent index and a closed
+// bit. A per-cell query stamp marks which entries belong to the current
+// query, so nothing is cleared between queries.
+class SearchTable
+{
+public:
+    explicit SearchTable( size_t cells )
+        : g_( cells ), parent_( cells ), stamp_( cells, 0 ), closed_( ( cells + 63 ) / 64, 0 )
+    {
+    }
+
+    void begin_query()
+    {
+        if ( ++query_ == 0 )
+        {
+            std::fill( stamp_.begin(), stamp_.end(), 0 );
+            query_ = 1;
+        }
+    }
+
+    // First visit in this query: reset the cell's search state.
+    void touch( uint32_t v )
+    {
+        if ( stamp_[v] == query_ )
+            return;
+        stamp_[v] = query_;
+        g_[v] = kInfiniteCost;
+        parent_[v] = v;
+        closed_[v >> 6] &= ~( uint64_t( 1 ) << ( v & 63 ) );
+    }
+
+    bool visited( uint32_t v ) const { return stamp_[v] == query_; }
+    bool is_closed( uint32_t v ) const { return ( closed_[v >> 6] >> ( v & 63 ) ) & 1; }
+    void set_closed( uint32_t v ) { closed_[v >> 6] |= uint64_t( 1 ) << ( v & 63 ); }
+
+    uint32_t& g( uint32_t v ) { return g_[v]; }
+    uint32_t g( uint32_t v ) const { return g_[v]; }
+    uint32_t& parent( uint32_t v ) { return parent_[v]; }
+    uint32_t parent( uint32_t v ) const { return parent_[v]; }
+
+    // Appends the cells from the search root to t.
+    void reconstruct( const PlanningGrid& grid, uint32_t t, GridPath& path ) const
+    {
+        size_t first = path.cells.size();
+        for ( uint32_t v = t;; v = parent_[v] )
+        {
+            path.cells.push_back( grid.cell( v ) );
+            if ( parent_[v] == v )
+                break;
+        }
+        std::reverse( path.cells.begin() + first, path.cells.end() );
+        path.cost = g_[t];
+        path.found = true;
+    }
+
+private:
+    std::vector<uint32_t> g_;
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> stamp_;
+    std::vector<uint64_t> closed_;
+    uint32_t query_ = 0;
+};
+
+// Cost of following a cell sequence of unit moves, or kInfiniteCost if a
+// move is illegal or the sum does not fit below it.
+inline uint32_t path_cost( const PlanningGrid& grid, const std::vector<Cell>& cells )
+{
+    uint64_t cost = 0;
+    for ( size_t i = 1; i < cells.size(); ++i )
+    {
+        const Cell& a = cells[i - 1];
+        const Cell& b = cells[i];
+        int axes = ( a.x != b.x ) + ( a.y != b.y ) + ( a.z != b.z );
+        if ( !grid.free( b ) || octile_distance( a, b ) > kDiagonal3Cost )
+            return kInfiniteCost;
+        uint32_t base = axes == 1 ? kStraightCost : axes == 2 ? kDiagonal2Cost : kDiagonal3Cost;
+        cost += uint64_t( base ) * grid.cost( b );
+        if ( cost >= kInfiniteCost )
+            return kInfiniteCost;
+    }
+    return static_cast<uint32_t>( cost );
+}
+
+// A* over a PlanningGrid using a SearchTable and a radix-heap open list.
+// The grid must outlive the planner and keep its dimensions.
+class GridAStar
+{
+public:
+    static constexpr uint32_t kInfinity = kInfiniteCost;
+
+    explicit GridAStar( const PlanningGrid& grid )
+        : grid_( grid ), neighbors_( make_neighbors( grid ) ), table_( grid.size() )
+    {
+    }
+
+    const SearchStats& stats() const { return stats_; }
+
+    // Optimal path from start to goal. With bounds set, the search stays
+    // inside the box.
+    bool plan( const Cell& start, const Cell& goal, GridPath& path, const GridBox* bounds = nullptr )
+    {
+        path.cells.clear();
+        path.cost = 0;
+        path.found = false;
+        if ( !grid_.free( goal ) || ( bounds && !bounds->contains( goal ) ) )
+            return false;
+        uint32_t t = static_cast<uint32_t>( grid_.index( goal ) );
+        if ( !search( start, &goal, bounds ) || !table_.is_closed( t ) )
+            return false;
+        table_.reconstruct( grid_, t, path );
+        return true;
+    }
+
+    // Dijkstra from start over every reachable cell in bounds. Follow with
+    // cost_to() and extract() for any number of targets.
+    void expand_all( const Cell& start, const GridBox& bounds ) { search( start, nullptr, &bounds ); }
+
+    uint32_t cost_to( const Cell& c ) const
+    {
+        uint32_t v = static_cast<uint32_t>( grid_.index( c ) );
+        return table_.visited( v ) && table_.is_closed( v ) ? table_.g( v ) : kInfinity;
+    }
+
+    bool extract( const Cell& c, GridPath& path ) const
+    {
+        path.cells.clear();
+        path.found = false;
+        if ( cost_to( c ) == kInfinity )
+            return false;
+        table_.reconstruct( grid_, static_cast<uint32_t>( grid_.index( c ) ), path );
+        return true;
+    }
+
+private:
+    bool search( const Cell& start, const Cell* goal, const GridBox* bounds )
+    {
+        stats_ = SearchStats();
+        if ( !grid_.free( start ) || ( bounds && !bounds->contains( start ) ) )
+            return false;
+
+        table_.begin_query();
+        open_.clear();
+        const uint8_t* cells = grid_.data();
+        const uint32_t s = static_cast<uint32_t>( grid_.index( start ) );
+        const uint32_t t = goal ? static_cast<uint32_t>( grid_.index( *goal ) ) : kInfinity;
+
+        table_.touch( s );
+        table_.g( s ) = 0;
+        open_.push( goal ? octile_distance( start, *goal ) : 0, s );
+        stats_.pushed = 1;
+
+        while ( !open_.empty() )
+        {
+            uint32_t u = open_.pop().second;
+            if ( table_.is_closed( u ) )
+                continue;
+            table_.set_closed( u );
+            ++stats_.expanded;
+            if ( u == t )
+                return true;
+
+            const Cell cu = grid_.cell( u );
+            const uint32_t gu = table_.g( u );
+            for ( const GridNeighbor& n : neighbors_ )
+            {
+                if ( !can_move( cells, u, n ) )
+                    continue;
+                Cell cv{ cu.x + n.dx, cu.y + n.dy, cu.z + n.dz };
+                if ( bounds && !bounds->contains( cv ) )
+                    continue;
+                uint32_t v = static_cast<uint32_t>( u + n.offset );
+                table_.touch( v );
+                if ( table_.is_closed( v ) )
+                    continue;
+                // Summed in 64 bits: a step costs up to 1732 * 254, so a
+                // long path over heavy cells would wrap 32 bits and break
+                // the radix heap's monotone keys. Paths whose key no longer
+                // fits below kInfinity are dropped as unreachable.
+                const uint64_t g64 = uint64_t( gu ) + uint64_t( n.cost ) * cells[v];
+                const uint64_t key = g64 + ( goal ? octile_distance( cv, *goal ) : 0 );
+                if ( key >= kInfinity || g64 >= table_.g( v ) )
+                    continue;
+                const uint32_t gv = static_cast<uint32_t>( g64 );
+                table_.g( v ) = gv;
+                table_.parent( v ) = u;
+                open_.push( static_cast<uint32_t>( key ), v );
+                ++stats_.pushed;
+            }
+        }
+        return goal == nullptr;
+    }
+
+    const PlanningGrid& grid_;
+    std::vector<GridNeighbor> neighbors_;
+    SearchTable table_;
+    RadixHeap open_;
+    SearchStats stats_;
+};
+
+} // namespace wra
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "grid_planner.hpp"
+#include "hierarchical_planner.hpp"
+#include "jump_point.hpp"
+
+namespace wra
+{
+
+enum class GridSearchMode
+{
+    AStar,
+    JumpPoint,
+    Hierarchical
+};
+
+inline const char* to_string( GridSearchMode mode )
+{
+    switch ( mode )
+    {
+    case GridSearchMode::AStar:
+        return "astar";
+    case GridSearchMode::JumpPoint:
+        return "jps";
+    case GridSearchMode::Hierarchical:
+        return "hpa";
+    }
+    return "?";
+}
+
+inline bool parse_search_mode( const std::string& name, GridSearchMode& mode )
+{
+    for ( GridSearchMode m : { GridSearchMode::AStar, GridSearchMode::JumpPoint, GridSearchMode::Hierarchical } )
+        if ( name == to_string( m ) )
+        {
+            mode = m;
+            return true;
+        }
+    return false;
+}
+
+// Single query entry point over one grid. Jump Point Search needs a 2D
+// uniform-cost grid and HPA* a 2D grid; queries outside those limits fall
+// back to plain A*. The hierarchy is built lazily on first use, so call
+// invalidate() after editing the grid.
+class GridPlanner
+{
+public:
+    explicit GridPlanner( const PlanningGrid& grid, int cluster_size = 32 )
+        : grid_( grid ), astar_( grid ), jps_( grid ), cluster_size_( cluster_size )
+    {
+    }
+
+    void invalidate()
+    {
+        if ( hpa_ )
+            hpa_->rebuild();
+    }
+
+    // Mode actually used for the last query.
+    GridSearchMode last_mode() const { return last_mode_; }
+    const SearchStats& stats() const { return *stats_; }
+
+    bool plan( const Cell& start, const Cell& goal, GridPath& path, GridSearchMode mode = GridSearchMode::AStar )
+    {
+        if ( mode == GridSearchMode::JumpPoint && !grid_.is3d() && grid_.uniform() )
+            return run( mode, jps_.plan( start, goal, path ), jps_.stats() );
+        if ( mode == GridSearchMode::Hierarchical && !grid_.is3d() )
+        {
+            if ( !hpa_ )
+                hpa_.reset( new HierarchicalPlanner( grid_, cluster_size_ ) );
+            return run( mode, hpa_->plan( start, goal, path ), hpa_->stats() );
+        }
+        return run( GridSearchMode::AStar, astar_.plan( start, goal, path ), astar_.stats() );
+    }
+
+private:
+    bool run( GridSearchMode mode, bool found, const SearchStats& stats )
+    {
+        last_mode_ = mode;
+        stats_ = &stats;
+        return found;
+    }
+
+    const PlanningGrid& grid_;
+    GridAStar astar_;
+    JumpPointSearch jps_;
+    std::unique_ptr<HierarchicalPlanner> hpa_;
+    int cluster_size_;
+    GridSearchMode last_mode_ = GridSearchMode::AStar;
+    const SearchStats* stats_ = &astar_.stats();
+};
+
+} // namespace wra
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "grid_planner.hpp"
+
+namespace wra
+{
+
+// HPA* over a 2D PlanningGrid. The map is cut into square clusters; free
+// runs along shared cluster borders become entrances whose cells are
+// abstract nodes. Intra-cluster paths between entrances are searched once
+// at build time and cached, so a query only searches the start and goal
+// clusters locally plus the small abstract graph. Paths are near-optimal.
+class HierarchicalPlanner
+{
+public:
+    HierarchicalPlanner( const PlanningGrid& grid, int cluster_size = 32 )
+        : grid_( grid ), local_( grid ), cluster_size_( std::max( cluster_size, 4 ) )
+    {
+        rebuild();
+    }
+
+    size_t node_count() const { return node_cell_.size(); }
+    size_t edge_count() const { return edges_.size(); }
+    const SearchStats& stats() const { return stats_; }
+
+    // Recomputes entrances and cached paths; call after editing the grid.
+    void rebuild()
+    {
+        node_cell_.clear();
+        node_cluster_.clear();
+        edges_.clear();
+        path_cells_.clear();
+        cell_to_node_.clear();
+        if ( grid_.is3d() )
+            return;
+
+        clusters_x_ = ( grid_.nx() + cluster_size_ - 1 ) / cluster_size_;
+        clusters_y_ = ( grid_.ny() + cluster_size_ - 1 ) / cluster_size_;
+        std::vector<std::pair<uint32_t, Edge>> raw;
+        find_entrances( raw );
+        connect_clusters( raw );
+
+        // Compress into CSR order by source node.
+        std::stable_sort( raw.begin(), raw.end(),
+                          []( const std::pair<uint32_t, Edge>& a, const std::pair<uint32_t, Edge>& b ) {
+                              return a.first < b.first;
+                          } );
+        edge_begin_.assign( node_cell_.size() + 1, 0 );
+        for ( const auto& e : raw )
+            ++edge_begin_[e.first + 1];
+        for ( size_t i = 1; i < edge_begin_.size(); ++i )
+            edge_begin_[i] += edge_begin_[i - 1];
+        edges_.reserve( raw.size() );
+        for ( const auto& e : raw )
+            edges_.push_back( e.second );
+
+        size_t n = node_cell_.size() + 2;
+        g_.assign( n, 0 );
+        parent_.assign( n, 0 );
+        parent_edge_.assign( n, 0 );
+        stamp_.assign( n, 0 );
+        closed_.assign( n, 0 );
+        goal_cost_.assign( n, kInfiniteCost );
+        goal_stamp_.assign( n, 0 );
+    }
+
+    bool plan( const Cell& start, const Cell& goal, GridPath& path )
+    {
+        path.cells.clear();
+        path.cost = 0;
+        path.found = false;
+        stats_ = SearchStats();
+        if ( grid_.is3d() || !grid_.free( start ) || !grid_.free( goal ) )
+            return false;
+
+        uint32_t cs = cluster_of( start );
+        uint32_t cg = cluster_of( goal );
+        if ( cs == cg )
+        {
+            GridBox box = cluster_box( cs );
+            if ( local_.plan( start, goal, path, &box ) )
+                return true;
+        }
+
+        if ( ++query_ == 0 )
+        {
+            std::fill( stamp_.begin(), stamp_.end(), 0 );
+            std::fill( goal_stamp_.begin(), goal_stamp_.end(), 0 );
+            query_ = 1;
+        }
+
+        // Link the start to its cluster's entrances.
+        start_links_.clear();
+        local_.expand_all( start, cluster_box( cs ) );
+        for_each_node( cs, [&]( uint32_t node ) {
+            uint32_t c = local_.cost_to( grid_.cell( node_cell_[node] ) );
+            if ( c != kInfiniteCost )
+                start_links_.emplace_back( node, c );
+        } );
+
+        // Grid moves are charged on entry, so a search rooted at the goal
+        // gives approximate node-to-goal costs; refinement recomputes them.
+        local_.expand_all( goal, cluster_box( cg ) );
+        for_each_node( cg, [&]( uint32_t node ) {
+            uint32_t c = local_.cost_to( grid_.cell( node_cell_[node] ) );
+            if ( c == kInfiniteCost )
+                return;
+            goal_stamp_[node] = query_;
+            goal_cost_[node] = c;
+        } );
+
+        if ( !abstract_search( goal ) )
+            return false;
+        return refine( start, goal, path );
+    }
+
+private:
+    struct Edge
+    {
+        uint32_t to;
+        uint32_t cost;
+        // Cached cells after the source up to and including the target.
+        uint32_t path_begin;
+        uint32_t path_end;
+    };
+
+    uint32_t cluster_of( const Cell& c ) const
+    {
+        return static_cast<uint32_t>( ( c.y / cluster_size_ ) * clusters_x_ + c.x / cluster_size_ );
+    }
+
+    GridBox cluster_box( uint32_t cluster ) const
+    {
+        int cx = static_cast<int>( cluster ) % clusters_x_;
+        int cy = static_cast<int>( cluster ) / clusters_x_;
+        GridBox b;
+        b.lo = Cell{ cx * cluster_size_, cy * cluster_size_, 0 };
+        b.hi = Cell{ std::min( grid_.nx(), ( cx + 1 ) * cluster_size_ ) - 1,
+                     std::min( grid_.ny(), ( cy + 1 ) * cluster_size_ ) - 1, 0 };
+        return b;
+    }
+
+    template <typename F>
+    void for_each_node( uint32_t cluster, F&& f ) const
+    {
+        for ( uint32_t k = cluster_node_begin_[cluster]; k < cluster_node_begin_[cluster + 1]; ++k )
+            f( cluster_nodes_[k] );
+    }
+
+    uint32_t node_at( const Cell& c )
+    {
+        uint32_t idx = static_cast<uint32_t>( grid_.index( c ) );
+        auto it = cell_to_node_.find( idx );
+        if ( it != cell_to_node_.end() )
+            return it->second;
+        uint32_t id = static_cast<uint32_t>( node_cell_.size() );
+        node_cell_.push_back( idx );
+        node_cluster_.push_back( cluster_of( c ) );
+        cell_to_node_.emplace( idx, id );
+        return id;
+    }
+
+    void add_transition( const Cell& a, const Cell& b, std::vector<std::pair<uint32_t, Edge>>& raw )
+    {
+        uint32_t na = node_at( a );
+        uint32_t nb = node_at( b );
+        uint32_t pa = static_cast<uint32_t>( path_cells_.size() );
+        path_cells_.push_back( node_cell_[nb] );
+        path_cells_.push_back( node_cell_[na] );
+        raw.push_back( { na, Edge{ nb, kStraightCost * grid_.cost( b ), pa, pa + 1 } } );
+        raw.push_back( { nb, Edge{ na, kStraightCost * grid_.cost( a ), pa + 1, pa + 2 } } );
+    }
+
+    // Scans each shared border for maximal runs free on both sides. Short
+    // runs get one transition in the middle, long ones one at each end.
+    void find_entrances( std::vector<std::pair<uint32_t, Edge>>& raw )
+    {
+        const int c = cluster_size_;
+        auto scan = [&]( int length, const std::function<Cell( int, bool )>& side ) {
+            int run = -1;
+            for ( int k = 0; k <= length; ++k )
+            {
+                bool open = k < length && grid_.free( side( k, false ) ) && grid_.free( side( k, true ) );
+                if ( open && run < 0 )
+                    run = k;
+                if ( open || run < 0 )
+                    continue;
+                int last = k - 1;
+                if ( last - run + 1 < 6 )
+                {
+                    int mid = ( run + last ) / 2;
+                    add_transition( side( mid, false ), side( mid, true ), raw );
+                }
+                else
+                {
+                    add_transition( side( run, false ), side( run, true ), raw );
+                    add_transition( side( last, false ), side( last, true ), raw );
+                }
+                run = -1;
+            }
+        };
+
+        for ( int cy = 0; cy < clusters_y_; ++cy )
+            for ( int cx = 0; cx < clusters_x_; ++cx )
+            {
+                int x0 = cx * c;
+                int y0 = cy * c;
+                int w = std::min( grid_.nx(), x0 + c ) - x0;
+                int h = std::min( grid_.ny(), y0 + c ) - y0;
+                if ( cx + 1 < clusters_x_ )
+                    scan( h, [&]( int k, bool far ) { return Cell{ x0 + c - 1 + far, y0 + k, 0 }; } );
+                if ( cy + 1 < clusters_y_ )
+                    scan( w, [&]( int k, bool far ) { return Cell{ x0 + k, y0 + c - 1 + far, 0 }; } );
+            }
+    }
+
+    // Caches the optimal in-cluster path between every ordered pair of
+    // entrance nodes of each cluster.
+    void connect_clusters( std::vector<std::pair<uint32_t, Edge>>& raw )
+    {
+        size_t clusters = static_cast<size_t>( clusters_x_ ) * clusters_y_;
+        cluster_node_begin_.assign( clusters + 1, 0 );
+        for ( uint32_t cl : node_cluster_ )
+            ++cluster_node_begin_[cl + 1];
+        for ( size_t i = 1; i <= clusters; ++i )
+            cluster_node_begin_[i] += cluster_node_begin_[i - 1];
+        cluster_nodes_.assign( node_cell_.size(), 0 );
+        std::vector<uint32_t> fill( cluster_node_begin_.begin(), cluster_node_begin_.end() - 1 );
+        for ( uint32_t n = 0; n < node_cell_.size(); ++n )
+            cluster_nodes_[fill[node_cluster_[n]]++] = n;
+
+        GridPath local_path;
+        for ( uint32_t cl = 0; cl < clusters; ++cl )
+        {
+            GridBox box = cluster_box( cl );
+            for_each_node( cl, [&]( uint32_t u ) {
+                local_.expand_all( grid_.cell( node_cell_[u] ), box );
+                for_each_node( cl, [&]( uint32_t v ) {
+                    if ( u == v || !local_.extract( grid_.cell( node_cell_[v] ), local_path ) )
+                        return;
+                    uint32_t begin = static_cast<uint32_t>( path_cells_.size() );
+                    for ( size_t k = 1; k < local_path.cells.size(); ++k )
+                        path_cells_.push_back( static_cast<uint32_t>( grid_.index( local_path.cells[k] ) ) );
+                    raw.push_back( { u, Edge{ v, local_path.cost, begin, static_cast<uint32_t>( path_cells_.size() ) } } );
+                } );
+            } );
+        }
+    }
+
+    void relax( uint32_t v, uint32_t g, uint32_t from, uint32_t edge, uint32_t h )
+    {
+        if ( stamp_[v] != query_ )
+        {
+            stamp_[v] = query_;
+            g_[v] = kInfiniteCost;
+            closed_[v] = 0;
+        }
+        if ( closed_[v] || g >= g_[v] )
+            return;
+        g_[v] = g;
+        parent_[v] = from;
+        parent_edge_[v] = edge;
+        heap_.emplace_back( g + h, v );
+        std::push_heap( heap_.begin(), heap_.end(), std::greater<std::pair<uint32_t, uint32_t>>() );
+        ++stats_.pushed;
+    }
+
+    // A* over entrance nodes. Node ids n and n + 1 stand for start and goal.
+    bool abstract_search( const Cell& goal )
+    {
+        const uint32_t n = static_cast<uint32_t>( node_cell_.size() );
+        const uint32_t s = n;
+        const uint32_t t = n + 1;
+        heap_.clear();
+        stamp_[s] = query_;
+        g_[s] = 0;
+        closed_[s] = 0;
+        heap_.emplace_back( 0, s );
+
+        while ( !heap_.empty() )
+        {
+            std::pop_heap( heap_.begin(), heap_.end(), std::greater<std::pair<uint32_t, uint32_t>>() );
+            uint32_t u = heap_.back().second;
+            heap_.pop_back();
+            if ( closed_[u] )
+                continue;
+            closed_[u] = 1;
+            ++stats_.expanded;
+            if ( u == t )
+                return true;
+
+            if ( u == s )
+            {
+                for ( const auto& link : start_links_ )
+                    relax( link.first, link.second, s, 0,
+                           octile_distance( grid_.cell( node_cell_[link.first] ), goal ) );
+                continue;
+            }
+            if ( goal_stamp_[u] == query_ )
+                relax( t, g_[u] + goal_cost_[u], u, 0, 0 );
+            for ( uint32_t e = edge_begin_[u]; e < edge_begin_[u + 1]; ++e )
+            {
+                const Edge& edge = edges_[e];
+                relax( edge.to, g_[u] + edge.cost, u, e, octile_distance( grid_.cell( node_cell_[edge.to] ), goal ) );
+            }
+        }
+        return false;
+    }
+
+    bool refine( const Cell& start, const Cell& goal, GridPath& path )
+    {
+        const uint32_t n = static_cast<uint32_t>( node_cell_.size() );
+        chain_.clear();
+        for ( uint32_t v = parent_[n + 1]; v != n; v = parent_[v] )
+            chain_.push_back( v );
+        std::reverse( chain_.begin(), chain_.end() );
+
+        GridPath piece;
+        const Cell first = grid_.cell( node_cell_[chain_.front()] );
+        GridBox box = cluster_box( cluster_of( start ) );
+        if ( !local_.plan( start, first, piece, &box ) )
+            return false;
+        path.cells = piece.cells;
+
+        for ( size_t k = 1; k < chain_.size(); ++k )
+        {
+            const Edge& e = edges_[parent_edge_[chain_[k]]];
+            for ( uint32_t p = e.path_begin; p < e.path_end; ++p )
+                path.cells.push_back( grid_.cell( path_cells_[p] ) );
+        }
+
+        box = cluster_box( cluster_of( goal ) );
+        if ( !local_.plan( grid_.cell( node_cell_[chain_.back()] ), goal, piece, &box ) )
+            return false;
+        path.cells.insert( path.cells.end(), piece.cells.begin() + 1, piece.cells.end() );
+        path.cost = path_cost( grid_, path.cells );
+        path.found = true;
+        return true;
+    }
+
+    const PlanningGrid& grid_;
+    GridAStar local_;
+    int cluster_size_;
+    int clusters_x_ = 0;
+    int clusters_y_ = 0;
+
+    std::vector<uint32_t> node_cell_;
+    std::vector<uint32_t> node_cluster_;
+    std::vector<uint32_t> cluster_node_begin_;
+    std::vector<uint32_t> cluster_nodes_;
+    std::vector<uint32_t> edge_begin_;
+    std::vector<Edge> edges_;
+    std::vector<uint32_t> path_cells_;
+    std::unordered_map<uint32_t, uint32_t> cell_to_node_;
+
+    // Query scratch, sized at rebuild().
+    std::vector<uint32_t> g_;
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> parent_edge_;
+    std::vector<uint32_t> stamp_;
+    std::vector<uint8_t> closed_;
+    std::vector<uint32_t> goal_cost_;
+    std::vector<uint32_t> goal_stamp_;
+    std::vector<std::pair<uint32_t, uint32_t>> start_links_;
+    std::vector<std::pair<uint32_t, uint32_t>> heap_;
+    std::vector<uint32_t> chain_;
+    uint32_t query_ = 0;
+    SearchStats stats_;
+};
+
+} // namespace wra
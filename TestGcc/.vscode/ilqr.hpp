@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "dense_cholesky.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+// Derivatives of one stage at (x_k, u_k): dynamics Jacobians and the
+// stage cost's gradient and Hessian blocks.
+template <size_t NX, size_t NU>
+struct StageDerivatives
+{
+    double fx[NX][NX];
+    double fu[NX][NU];
+    double lx[NX];
+    double lu[NU];
+    double lxx[NX][NX];
+    double luu[NU][NU];
+    double lux[NU][NX];
+};
+
+struct IlqrOptions
+{
+    int max_iterations = 100;
+    // Stops once an accepted step lowers the cost by less than this
+    // fraction.
+    double tolerance = 1e-6;
+    // Step sizes 10^(-3 j / (candidates - 1)), tried largest first. With a
+    // pool, a wave of pool-size candidates is rolled out at once.
+    int line_search_candidates = 8;
+    // Accept a step when actual / expected reduction exceeds this.
+    double acceptance = 1e-4;
+    // Levenberg-Marquardt term on V_xx (Tassa et al., 2012), scaled by
+    // factor on failure and divided by it on success.
+    double regularization = 1e-6;
+    double regularization_min = 1e-9;
+    double regularization_max = 1e10;
+    double regularization_factor = 10.0;
+};
+
+struct IlqrResult
+{
+    bool converged = false;
+    int iterations = 0;
+    double initial_cost = 0.0;
+    double cost = 0.0;
+    // Rollouts evaluated by the line search over the whole solve.
+    size_t rollouts = 0;
+    double regularization = 0.0;
+};
+
+// Iterative LQR (Li and Todorov, 2004) with the regularised backward pass
+// of Tassa et al. Problem supplies
+//
+//   static constexpr size_t nx, nu;
+//   void dynamics( const double* x, const double* u, double* next ) const;
+//   double cost( size_t k, const double* x, const double* u ) const;
+//   double terminal_cost( const double* x ) const;
+//   void derivatives( size_t k, const double* x, const double* u,
+//                     StageDerivatives<nx, nu>& d ) const;
+//   void terminal_derivatives( const double* x, double* lx,
+//                              double ( *lxx )[nx] ) const;
+//
+// and must be safe to call concurrently. Matrices are fixed-size arrays
+// sized by nx and nu, so the backward pass runs entirely on the stack.
+// Per iteration the derivatives of every stage are evaluated as one batch
+// (spread over the pool when there is one), and line-search candidates are
+// rolled out in parallel waves. Trajectories, gains and candidate buffers
+// are allocated at construction.
+template <typename Problem>
+class Ilqr
+{
+public:
+    static constexpr size_t nx = Problem::nx;
+    static constexpr size_t nu = Problem::nu;
+    typedef StageDerivatives<nx, nu> Derivatives;
+
+    Ilqr( const Problem& problem, size_t horizon, ThreadPool* pool = nullptr, const IlqrOptions& options = IlqrOptions() )
+        : problem_( problem ), horizon_( horizon ), pool_( pool ), options_( options ), x_( ( horizon + 1 ) * nx ),
+          u_( horizon * nu ), d_( horizon ), K_( horizon ), kff_( horizon * nu ),
+          candidates_( std::max( 1, options.line_search_candidates ) )
+    {
+        for ( Candidate& c : candidates_ )
+        {
+            c.x.resize( ( horizon + 1 ) * nx );
+            c.u.resize( horizon * nu );
+        }
+    }
+
+    size_t horizon() const { return horizon_; }
+    const IlqrOptions& options() const { return options_; }
+
+    // Optimises the controls from u_init (horizon * nu, zeros when null)
+    // with the start state fixed at x0.
+    bool solve( const double* x0, const double* u_init, IlqrResult& result )
+    {
+        result = IlqrResult();
+        const size_t N = horizon_;
+        std::copy( x0, x0 + nx, x_.begin() );
+        if ( u_init )
+            std::copy( u_init, u_init + N * nu, u_.begin() );
+        else
+            std::fill( u_.begin(), u_.end(), 0.0 );
+        double cost = rollout( x_.data(), u_.data() );
+        if ( !std::isfinite( cost ) )
+            return false;
+        result.initial_cost = cost;
+
+        double mu = options_.regularization;
+        const int C = static_cast<int>( candidates_.size() );
+        bool stale = true;
+        for ( int it = 0; it < options_.max_iterations; ++it )
+        {
+            result.iterations = it + 1;
+            // A rejected step leaves the trajectory, so its derivatives, as
+            // they were.
+            if ( stale )
+                evaluate_derivatives();
+            stale = false;
+
+            double dv1 = 0.0, dv2 = 0.0;
+            while ( !backward( mu, dv1, dv2 ) )
+            {
+                mu = std::max( mu * options_.regularization_factor, options_.regularization_min );
+                if ( mu > options_.regularization_max )
+                {
+                    result.cost = cost;
+                    result.regularization = mu;
+                    return false;
+                }
+            }
+
+            // Line search in waves of the pool's width; the largest
+            // acceptable step of the first wave holding one wins.
+            int accepted = -1;
+            int wave = pool_ ? std::max( 1, static_cast<int>( pool_->size() ) ) : 1;
+            for ( int first = 0; first < C && accepted < 0; first += wave )
+            {
+                int count = std::min( wave, C - first );
+                auto run = [this, first, C]( size_t j ) { forward( candidates_[first + j], step_size( first + int( j ), C ) ); };
+                if ( pool_ && count > 1 )
+                    pool_->run_chunks( static_cast<size_t>( count ), run );
+                else
+                    for ( int j = 0; j < count; ++j )
+                        run( static_cast<size_t>( j ) );
+                result.rollouts += static_cast<size_t>( count );
+                for ( int j = first; j < first + count && accepted < 0; ++j )
+                {
+                    double alpha = step_size( j, C );
+                    double expected = -alpha * ( dv1 + alpha * dv2 );
+                    double actual = cost - candidates_[j].cost;
+                    if ( std::isfinite( candidates_[j].cost ) && expected > 0.0 && actual / expected > options_.acceptance )
+                        accepted = j;
+                }
+            }
+
+            if ( accepted < 0 )
+            {
+                // No descent at any step: either converged (expected
+                // reduction negligible) or the model is poor, so damp.
+                if ( -( dv1 + dv2 ) < options_.tolerance * std::fabs( cost ) )
+                {
+                    result.converged = true;
+                    break;
+                }
+                mu = std::max( mu * options_.regularization_factor, options_.regularization_min );
+                if ( mu > options_.regularization_max )
+                    break;
+                continue;
+            }
+
+            double previous = cost;
+            Candidate& best = candidates_[accepted];
+            x_.swap( best.x );
+            u_.swap( best.u );
+            cost = best.cost;
+            stale = true;
+            mu /= options_.regularization_factor;
+            if ( mu < options_.regularization_min )
+                mu = 0.0;
+            if ( previous - cost < options_.tolerance * std::fabs( previous ) )
+            {
+                result.converged = true;
+                break;
+            }
+        }
+        result.cost = cost;
+        result.regularization = mu;
+        return true;
+    }
+
+    const std::vector<double>& states() const { return x_; }
+    const std::vector<double>& controls() const { return u_; }
+
+private:
+    struct Candidate
+    {
+        std::vector<double> x;
+        std::vector<double> u;
+        double cost = 0.0;
+    };
+
+    static double step_size( int j, int count )
+    {
+        return count > 1 ? std::pow( 10.0, -3.0 * j / ( count - 1 ) ) : 1.0;
+    }
+
+    // Rolls x (x[0] set) forward under u and returns the total cost.
+    double rollout( double* x, const double* u ) const
+    {
+        double total = 0.0;
+        for ( size_t k = 0; k < horizon_; ++k )
+        {
+            total += problem_.cost( k, &x[k * nx], &u[k * nu] );
+            problem_.dynamics( &x[k * nx], &u[k * nu], &x[( k + 1 ) * nx] );
+        }
+        return total + problem_.terminal_cost( &x[horizon_ * nx] );
+    }
+
+    void evaluate_derivatives()
+    {
+        auto body = [this]( size_t lo, size_t hi ) {
+            for ( size_t k = lo; k < hi; ++k )
+                problem_.derivatives( k, &x_[k * nx], &u_[k * nu], d_[k] );
+        };
+        if ( pool_ )
+            pool_->parallel_for( 0, horizon_, 8, body );
+        else
+            body( 0, horizon_ );
+        problem_.terminal_derivatives( &x_[horizon_ * nx], Vx_terminal_, Vxx_terminal_ );
+    }
+
+    // Fills K_ and kff_; false if Q_uu is not positive definite at some
+    // stage. dv1 and dv2 receive the expected cost change coefficients,
+    // dJ(alpha) = alpha dv1 + alpha^2 dv2.
+    bool backward( double mu, double& dv1, double& dv2 )
+    {
+        double Vx[nx], Vxx[nx][nx];
+        std::copy( Vx_terminal_, Vx_terminal_ + nx, Vx );
+        std::copy( &Vxx_terminal_[0][0], &Vxx_terminal_[0][0] + nx * nx, &Vxx[0][0] );
+        dv1 = dv2 = 0.0;
+
+        for ( size_t k = horizon_; k-- > 0; )
+        {
+            const Derivatives& d = d_[k];
+            double Qx[nx], Qu[nu], Qxx[nx][nx], Quu[nu][nu], Qux[nu][nx];
+            // VF = Vxx fx, VFu = (Vxx + mu I) fu, VFx = (Vxx + mu I) fx.
+            double VF[nx][nx], VFu[nx][nu];
+            for ( size_t i = 0; i < nx; ++i )
+            {
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double v = 0.0;
+                    for ( size_t m = 0; m < nx; ++m )
+                        v += Vxx[i][m] * d.fx[m][j];
+                    VF[i][j] = v;
+                }
+                for ( size_t j = 0; j < nu; ++j )
+                {
+                    double v = mu * d.fu[i][j];
+                    for ( size_t m = 0; m < nx; ++m )
+                        v += Vxx[i][m] * d.fu[m][j];
+                    VFu[i][j] = v;
+                }
+            }
+            for ( size_t i = 0; i < nx; ++i )
+            {
+                double v = d.lx[i];
+                for ( size_t m = 0; m < nx; ++m )
+                    v += d.fx[m][i] * Vx[m];
+                Qx[i] = v;
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double w = d.lxx[i][j];
+                    for ( size_t m = 0; m < nx; ++m )
+                        w += d.fx[m][i] * VF[m][j];
+                    Qxx[i][j] = w;
+                }
+            }
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                double v = d.lu[i];
+                for ( size_t m = 0; m < nx; ++m )
+                    v += d.fu[m][i] * Vx[m];
+                Qu[i] = v;
+                for ( size_t j = 0; j < nu; ++j )
+                {
+                    double w = d.luu[i][j];
+                    for ( size_t m = 0; m < nx; ++m )
+                        w += d.fu[m][i] * VFu[m][j];
+                    Quu[i][j] = w;
+                }
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double w = d.lux[i][j];
+                    for ( size_t m = 0; m < nx; ++m )
+                        w += VFu[m][i] * d.fx[m][j];
+                    Qux[i][j] = w;
+                }
+            }
+
+            double L[nu][nu];
+            if ( !cholesky_factor( Quu, L ) )
+                return false;
+            double* kff = &kff_[k * nu];
+            double( &K )[nu][nx] = K_[k].m;
+            for ( size_t i = 0; i < nu; ++i )
+                kff[i] = -Qu[i];
+            cholesky_solve( L, kff );
+            for ( size_t j = 0; j < nx; ++j )
+            {
+                double col[nu];
+                for ( size_t i = 0; i < nu; ++i )
+                    col[i] = -Qux[i][j];
+                cholesky_solve( L, col );
+                for ( size_t i = 0; i < nu; ++i )
+                    K[i][j] = col[i];
+            }
+
+            // The expected reduction and the value update use the
+            // unregularised Q_uu and Q_ux:
+            // Vx = Qx + K' Quu k + K' Qu + Qux' k
+            // Vxx = Qxx + K' Quu K + K' Qux + Qux' K.
+            for ( size_t i = 0; i < nu; ++i )
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double v = 0.0;
+                    for ( size_t m = 0; m < nx; ++m )
+                        v += d.fu[m][i] * d.fx[m][j];
+                    Qux[i][j] -= mu * v;
+                }
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                for ( size_t j = 0; j < nu; ++j )
+                {
+                    double v = 0.0;
+                    for ( size_t m = 0; m < nx; ++m )
+                        v += d.fu[m][i] * d.fu[m][j];
+                    Quu[i][j] -= mu * v;
+                }
+            }
+            double Quu_k[nu], Quu_K[nu][nx];
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                double v = 0.0;
+                for ( size_t m = 0; m < nu; ++m )
+                    v += Quu[i][m] * kff[m];
+                Quu_k[i] = v;
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double w = 0.0;
+                    for ( size_t m = 0; m < nu; ++m )
+                        w += Quu[i][m] * K[m][j];
+                    Quu_K[i][j] = w;
+                }
+            }
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                dv1 += kff[i] * Qu[i];
+                dv2 += 0.5 * kff[i] * Quu_k[i];
+            }
+            for ( size_t i = 0; i < nx; ++i )
+            {
+                double v = Qx[i];
+                for ( size_t m = 0; m < nu; ++m )
+                    v += K[m][i] * ( Quu_k[m] + Qu[m] ) + Qux[m][i] * kff[m];
+                Vx[i] = v;
+            }
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    double v = Qxx[i][j];
+                    for ( size_t m = 0; m < nu; ++m )
+                        v += K[m][i] * ( Quu_K[m][j] + Qux[m][j] ) + Qux[m][i] * K[m][j];
+                    Vxx[i][j] = v;
+                }
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < i; ++j )
+                    Vxx[i][j] = Vxx[j][i] = 0.5 * ( Vxx[i][j] + Vxx[j][i] );
+        }
+        return true;
+    }
+
+    // u = u_k + alpha k + K (x - x_k) along a fresh rollout.
+    void forward( Candidate& c, double alpha ) const
+    {
+        std::copy( x_.begin(), x_.begin() + nx, c.x.begin() );
+        double total = 0.0;
+        for ( size_t k = 0; k < horizon_; ++k )
+        {
+            const double* xr = &x_[k * nx];
+            const double* x = &c.x[k * nx];
+            double* u = &c.u[k * nu];
+            const double( &K )[nu][nx] = K_[k].m;
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                double v = u_[k * nu + i] + alpha * kff_[k * nu + i];
+                for ( size_t j = 0; j < nx; ++j )
+                    v += K[i][j] * ( x[j] - xr[j] );
+                u[i] = v;
+            }
+            total += problem_.cost( k, x, u );
+            problem_.dynamics( x, u, &c.x[( k + 1 ) * nx] );
+        }
+        c.cost = total + problem_.terminal_cost( &c.x[horizon_ * nx] );
+    }
+
+    struct Gain
+    {
+        double m[nu][nx];
+    };
+
+    const Problem& problem_;
+    size_t horizon_;
+    ThreadPool* pool_;
+    IlqrOptions options_;
+    std::vector<double> x_;
+    std::vector<double> u_;
+    std::vector<Derivatives> d_;
+    std::vector<Gain> K_;
+    std::vector<double> kff_;
+    double Vx_terminal_[nx];
+    double Vxx_terminal_[nx][nx];
+    std::vector<Candidate> candidates_;
+};
+
+} // namespace wra
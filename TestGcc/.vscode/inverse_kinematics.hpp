@@ -0,0 +1,480 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "dense_cholesky.hpp"
+#include "geometry.hpp"
+#include "kinematics.hpp"
+
+namespace wra
+{
+
+// Puma-style layout the closed form covers: twists of +-90, 0, +-90, +-90,
+// +-90 and 0 degrees, with the last three axes meeting in the wrist centre
+// (a4 = a5 = a6 = d5 = 0).
+template <typename Model>
+constexpr bool has_spherical_wrist()
+{
+    if constexpr ( Model::dof != 6 )
+        return false;
+    else
+    {
+        const DhJoint* j = Model::joints;
+        return j[0].cos_alpha == 0.0 && j[1].sin_alpha == 0.0 && j[1].cos_alpha == 1.0 && j[2].cos_alpha == 0.0 &&
+               j[3].cos_alpha == 0.0 && j[4].cos_alpha == 0.0 && j[5].sin_alpha == 0.0 && j[5].cos_alpha == 1.0 &&
+               j[1].a != 0.0 && j[3].a == 0.0 && j[4].a == 0.0 && j[5].a == 0.0 && j[4].d == 0.0;
+    }
+}
+
+// Angle a shifted by whole turns to lie within pi of ref.
+inline double nearest_turn( double a, double ref )
+{
+    const double two_pi = 6.28318530717958647692;
+    return ref + ( a - ref ) - two_pi * std::round( ( a - ref ) / two_pi );
+}
+
+// Closed-form IK for has_spherical_wrist models. The wrist centre fixes
+// joints 1-3 (two shoulder and two elbow branches); the remaining rotation
+// is split over the wrist (two flips), for up to eight solutions.
+template <typename Model>
+class AnalyticIk
+{
+public:
+    static constexpr bool supported = has_spherical_wrist<Model>();
+    static constexpr size_t kMaxSolutions = 8;
+
+    // Writes up to kMaxSolutions joint vectors, each checked against FK.
+    // At the wrist singularity q4 is taken from `seed` (or 0).
+    static size_t solve_all( const Isometry3& target, double ( *out )[6], const double* seed = nullptr )
+    {
+        if constexpr ( !supported )
+            return 0;
+        else
+        {
+            const DhJoint* J = Model::joints;
+            const double pi = 3.14159265358979323846;
+            Vec3 w = target.t - target.R.col( 2 ) * J[5].d;
+            double e = -J[0].sin_alpha * ( J[1].d + J[2].d );
+            double rxy = std::hypot( w.x, w.y );
+            if ( rxy < std::fabs( e ) || rxy < 1e-12 )
+                return 0;
+            double psi = std::atan2( w.y, w.x ), phi = std::asin( e / rxy );
+            const double a2 = J[1].a, a3 = J[2].a, k = J[2].sin_alpha * J[3].d;
+            const double rho = std::hypot( a3, k ), phi3 = std::atan2( k, a3 );
+
+            size_t count = 0;
+            for ( double t1 : { psi - phi, psi - pi + phi } )
+            {
+                double c1 = std::cos( t1 ), s1 = std::sin( t1 );
+                double vx = c1 * w.x + s1 * w.y - J[0].a, vz = w.z - J[0].d;
+                double px = vx, py = J[0].sin_alpha * vz;
+                double D = ( px * px + py * py - a2 * a2 - a3 * a3 - k * k ) / ( 2 * a2 );
+                if ( std::fabs( D ) > rho * ( 1 + 1e-12 ) )
+                    continue;
+                double spread = std::acos( std::max( -1.0, std::min( 1.0, D / rho ) ) );
+                for ( double t3 : { phi3 + spread, phi3 - spread } )
+                {
+                    double c3 = std::cos( t3 ), s3 = std::sin( t3 );
+                    double t2 = std::atan2( py, px ) - std::atan2( a3 * s3 - k * c3, a2 + a3 * c3 + k * s3 );
+                    double theta[6] = { t1, t2, t3, 0, 0, 0 };
+                    count += wrist( target, theta, seed, out + count );
+                }
+            }
+            return count;
+        }
+    }
+
+    // Solution closest to seed, each joint within pi of its seed value.
+    static bool solve( const Isometry3& target, const double* seed, double* q )
+    {
+        double all[kMaxSolutions][6];
+        size_t n = solve_all( target, all, seed );
+        double best = std::numeric_limits<double>::infinity();
+        for ( size_t s = 0; s < n; ++s )
+        {
+            double d = 0.0;
+            for ( int j = 0; j < 6; ++j )
+            {
+                all[s][j] = nearest_turn( all[s][j], seed[j] );
+                d += ( all[s][j] - seed[j] ) * ( all[s][j] - seed[j] );
+            }
+            if ( d < best )
+            {
+                best = d;
+                std::copy( all[s], all[s] + 6, q );
+            }
+        }
+        return n > 0;
+    }
+
+private:
+    // Wrist joints for fixed theta[0..2]; appends the verified solutions.
+    static size_t wrist( const Isometry3& target, double* theta, const double* seed, double ( *out )[6] )
+    {
+        const DhJoint* J = Model::joints;
+        Mat3 R03 = dh_transform( J[0], theta[0] - J[0].offset ).R * dh_transform( J[1], theta[1] - J[1].offset ).R *
+                   dh_transform( J[2], theta[2] - J[2].offset ).R;
+        Mat3 R36 = R03.transposed() * target.R;
+        // Third column of R36 is sigma5 * (c4 s5, s4 s5, -sigma4 c5).
+        const double s4a = J[3].sin_alpha, s5a = J[4].sin_alpha;
+        Vec3 z = R36.col( 2 );
+        double c5 = -s4a * s5a * z.z, s5 = std::hypot( z.x, z.y );
+        size_t count = 0;
+        for ( double flip : { 1.0, -1.0 } )
+        {
+            if ( s5 < 1e-9 )
+            {
+                if ( flip < 0 )
+                    break;
+                theta[3] = seed ? seed[3] + J[3].offset : 0.0;
+            }
+            else
+                theta[3] = std::atan2( flip * s5a * z.y, flip * s5a * z.x );
+            theta[4] = std::atan2( flip * s5, c5 );
+            Mat3 M = ( dh_transform( J[3], theta[3] - J[3].offset ).R * dh_transform( J[4], theta[4] - J[4].offset ).R )
+                         .transposed() *
+                     R36;
+            theta[5] = std::atan2( M( 1, 0 ), M( 0, 0 ) );
+
+            double* q = out[count];
+            for ( int j = 0; j < 6; ++j )
+                q[j] = nearest_turn( theta[j] - J[j].offset, 0.0 );
+            Isometry3 check = ForwardKinematics<Model>::end_effector( q );
+            if ( norm( check.t - target.t ) < 1e-6 && norm( rotation_log( check.R.transposed() * target.R ) ) < 1e-6 )
+                ++count;
+        }
+        return count;
+    }
+};
+
+struct IkOptions
+{
+    int max_iterations = 100;
+    // Converged once both errors are within these (metres, radians).
+    double position_tolerance = 1e-6;
+    double rotation_tolerance = 1e-6;
+    // Initial damping; adapted per step as in Levenberg-Marquardt.
+    double lambda = 1e-3;
+    // Random restarts after the attempt from the seed fails.
+    int restarts = 4;
+    uint32_t seed = 1;
+    // Solutions remembered by quantised target pose; 0 disables.
+    size_t cache_capacity = 4096;
+    double cache_position_step = 1e-4;
+    double cache_rotation_step = 1e-4;
+    // Closed form when the model has one; numeric otherwise.
+    bool analytic = true;
+};
+
+struct IkResult
+{
+    bool converged = false;
+    // Found in the cache by quantised pose; exact repeats skip solving.
+    bool cache_hit = false;
+    bool analytic = false;
+    int iterations = 0;
+    int restarts = 0;
+    double position_error = 0.0;
+    double rotation_error = 0.0;
+};
+
+// IK front end: LRU cache of quantised poses, then the closed form where
+// the model has one, else damped least squares from a warm start. Without
+// an explicit seed the previous solution is the warm start, which is what
+// a pick-and-place loop or a trajectory follower wants.
+template <typename Model>
+class IkSolver
+{
+public:
+    static constexpr size_t dof = Model::dof;
+
+    explicit IkSolver( const IkOptions& options = IkOptions() ) : options_( options ), rng_( options.seed )
+    {
+        std::fill( last_, last_ + dof, 0.0 );
+    }
+
+    const IkOptions& options() const { return options_; }
+    void set_options( const IkOptions& options )
+    {
+        options_ = options;
+        clear_cache();
+    }
+
+    size_t cache_size() const { return index_.size(); }
+
+    void clear_cache()
+    {
+        index_.clear();
+        entries_.clear();
+        head_ = tail_ = kNone;
+    }
+
+    // Dof joints into q; seed may be null. False if no solution was found,
+    // in which case q holds the best attempt.
+    bool solve( const Isometry3& target, const double* seed, double* q, IkResult& result )
+    {
+        result = IkResult();
+        double start[dof];
+        std::copy( seed ? seed : last_, ( seed ? seed : last_ ) + dof, start );
+
+        CacheKey key = quantise( target );
+        uint32_t hit = options_.cache_capacity ? find( key ) : kNone;
+        if ( hit != kNone )
+        {
+            result.cache_hit = true;
+            const CacheEntry& entry = entries_[hit];
+            if ( same_pose( entry.target, target ) )
+            {
+                for ( size_t j = 0; j < dof; ++j )
+                    q[j] = nearest_turn( entry.q[j], start[j] );
+                result.converged = true;
+                finish( target, q, result );
+                return true;
+            }
+            // A neighbour in the same bin: start from its solution.
+            std::copy( entry.q, entry.q + dof, start );
+        }
+
+        if constexpr ( AnalyticIk<Model>::supported )
+            if ( options_.analytic )
+            {
+                result.analytic = true;
+                std::copy( start, start + dof, q );
+                result.converged = AnalyticIk<Model>::solve( target, start, q );
+            }
+        if ( !result.analytic )
+        {
+            std::copy( start, start + dof, q );
+            result.converged = refine( target, q, result );
+            std::uniform_real_distribution<double> u( -3.14159265358979323846, 3.14159265358979323846 );
+            while ( !result.converged && result.restarts < options_.restarts )
+            {
+                ++result.restarts;
+                for ( size_t j = 0; j < dof; ++j )
+                    q[j] = u( rng_ );
+                result.converged = refine( target, q, result );
+            }
+            for ( size_t j = 0; j < dof; ++j )
+                q[j] = nearest_turn( q[j], start[j] );
+        }
+
+        finish( target, q, result );
+        if ( result.converged && options_.cache_capacity )
+            insert( key, target, q, hit );
+        return result.converged;
+    }
+
+private:
+    static constexpr uint32_t kNone = ~0u;
+
+    struct CacheKey
+    {
+        int32_t v[6];
+        bool operator==( const CacheKey& o ) const { return std::equal( v, v + 6, o.v ); }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const CacheKey& k ) const
+        {
+            uint64_t h = 1469598103934665603ull;
+            for ( int32_t x : k.v )
+                h = ( h ^ static_cast<uint32_t>( x ) ) * 1099511628211ull;
+            return static_cast<size_t>( h ^ ( h >> 29 ) );
+        }
+    };
+
+    struct CacheEntry
+    {
+        CacheKey key;
+        Isometry3 target;
+        double q[dof];
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    CacheKey quantise( const Isometry3& target ) const
+    {
+        CacheKey k;
+        Vec3 w = rotation_log( target.R );
+        for ( int i = 0; i < 3; ++i )
+        {
+            k.v[i] = static_cast<int32_t>( std::llround( target.t[i] / options_.cache_position_step ) );
+            k.v[i + 3] = static_cast<int32_t>( std::llround( w[i] / options_.cache_rotation_step ) );
+        }
+        return k;
+    }
+
+    static bool same_pose( const Isometry3& a, const Isometry3& b )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( a.t[i] != b.t[i] )
+                return false;
+            for ( int j = 0; j < 3; ++j )
+                if ( a.R( i, j ) != b.R( i, j ) )
+                    return false;
+        }
+        return true;
+    }
+
+    // Lookup; a hit moves to the front of the recency list.
+    uint32_t find( const CacheKey& key )
+    {
+        auto it = index_.find( key );
+        if ( it == index_.end() )
+            return kNone;
+        unlink( it->second );
+        push_front( it->second );
+        return it->second;
+    }
+
+    void insert( const CacheKey& key, const Isometry3& target, const double* q, uint32_t slot )
+    {
+        if ( slot == kNone )
+        {
+            if ( entries_.size() < options_.cache_capacity )
+            {
+                slot = static_cast<uint32_t>( entries_.size() );
+                entries_.emplace_back();
+            }
+            else
+            {
+                // Evict the least recently used.
+                slot = tail_;
+                unlink( slot );
+                index_.erase( entries_[slot].key );
+            }
+            index_.emplace( key, slot );
+            push_front( slot );
+        }
+        CacheEntry& e = entries_[slot];
+        e.key = key;
+        e.target = target;
+        std::copy( q, q + dof, e.q );
+    }
+
+    void unlink( uint32_t i )
+    {
+        CacheEntry& e = entries_[i];
+        ( e.prev == kNone ? head_ : entries_[e.prev].next ) = e.next;
+        ( e.next == kNone ? tail_ : entries_[e.next].prev ) = e.prev;
+    }
+
+    void push_front( uint32_t i )
+    {
+        CacheEntry& e = entries_[i];
+        e.prev = kNone;
+        e.next = head_;
+        ( head_ == kNone ? tail_ : entries_[head_].prev ) = i;
+        head_ = i;
+    }
+
+    void finish( const Isometry3& target, const double* q, IkResult& result )
+    {
+        Isometry3 pose = ForwardKinematics<Model>::end_effector( q );
+        result.position_error = norm( target.t - pose.t );
+        result.rotation_error = norm( rotation_log( target.R * pose.R.transposed() ) );
+        if ( result.converged )
+            std::copy( q, q + dof, last_ );
+    }
+
+    // Pose error as [position; rotation vector], both in the base frame.
+    static void pose_error( const Isometry3& target, const Isometry3& pose, double* e )
+    {
+        Vec3 dp = target.t - pose.t, dw = rotation_log( target.R * pose.R.transposed() );
+        for ( int i = 0; i < 3; ++i )
+        {
+            e[i] = dp[i];
+            e[i + 3] = dw[i];
+        }
+    }
+
+    bool within_tolerance( const double* e ) const
+    {
+        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2] <= options_.position_tolerance * options_.position_tolerance &&
+               e[3] * e[3] + e[4] * e[4] + e[5] * e[5] <= options_.rotation_tolerance * options_.rotation_tolerance;
+    }
+
+    // Damped least squares, dq = J^T (J J^T + lambda I)^-1 e, with the
+    // damping raised on a rejected step and relaxed on an accepted one.
+    bool refine( const Isometry3& target, double* q, IkResult& result )
+    {
+        Isometry3 frames[dof], trial_frames[dof];
+        double e[6], trial_e[6], trial[dof];
+        ForwardKinematics<Model>::compute( q, frames );
+        pose_error( target, frames[dof - 1], e );
+        double cost = squared( e );
+        double lambda = options_.lambda;
+        for ( int it = 0; it < options_.max_iterations; ++it )
+        {
+            if ( within_tolerance( e ) )
+                return true;
+            ++result.iterations;
+            double Jm[6][dof];
+            ForwardKinematics<Model>::jacobian( frames, Jm );
+            double A[6][6], y[6];
+            for ( int r = 0; r < 6; ++r )
+                for ( int c = 0; c <= r; ++c )
+                {
+                    double s = 0.0;
+                    for ( size_t j = 0; j < dof; ++j )
+                        s += Jm[r][j] * Jm[c][j];
+                    A[r][c] = A[c][r] = s + ( r == c ? lambda : 0.0 );
+                }
+            std::copy( e, e + 6, y );
+            if ( !cholesky_factor( A, A ) )
+            {
+                lambda *= 10.0;
+                continue;
+            }
+            cholesky_solve( A, y );
+            for ( size_t j = 0; j < dof; ++j )
+            {
+                double s = 0.0;
+                for ( int r = 0; r < 6; ++r )
+                    s += Jm[r][j] * y[r];
+                trial[j] = q[j] + s;
+            }
+            ForwardKinematics<Model>::compute( trial, trial_frames );
+            pose_error( target, trial_frames[dof - 1], trial_e );
+            double trial_cost = squared( trial_e );
+            if ( trial_cost < cost )
+            {
+                std::copy( trial, trial + dof, q );
+                std::copy( trial_frames, trial_frames + dof, frames );
+                std::copy( trial_e, trial_e + 6, e );
+                cost = trial_cost;
+                lambda = std::max( lambda * 0.3, 1e-12 );
+            }
+            else if ( ( lambda *= 10.0 ) > 1e6 )
+                break;
+        }
+        return within_tolerance( e );
+    }
+
+    static double squared( const double* e )
+    {
+        double s = 0.0;
+        for ( int i = 0; i < 6; ++i )
+            s += e[i] * e[i];
+        return s;
+    }
+
+    IkOptions options_;
+    std::mt19937 rng_;
+    double last_[dof];
+    std::vector<CacheEntry> entries_;
+    std::unordered_map<CacheKey, uint32_t, KeyHash> index_;
+    uint32_t head_ = kNone;
+    uint32_t tail_ = kNone;
+};
+
+} // namespace wra
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "grid_planner.hpp"
+
+namespace wra
+{
+
+// Jump Point Search for uniform-cost 2D grids, using the same no-corner-
+// cutting move rules as GridAStar, so both return paths of equal cost.
+// Only jump points enter the open list; straight runs are scanned inline.
+class JumpPointSearch
+{
+public:
+    explicit JumpPointSearch( const PlanningGrid& grid ) : grid_( grid ), table_( grid.size() ) {}
+
+    const SearchStats& stats() const { return stats_; }
+
+    // Requires a 2D grid with grid.uniform(); returns false otherwise.
+    bool plan( const Cell& start, const Cell& goal, GridPath& path )
+    {
+        path.cells.clear();
+        path.cost = 0;
+        path.found = false;
+        stats_ = SearchStats();
+        if ( grid_.is3d() || !grid_.uniform() || !grid_.free( start ) || !grid_.free( goal ) )
+            return false;
+
+        cells_ = grid_.data();
+        sy_ = grid_.stride_y();
+        goal_ = static_cast<uint32_t>( grid_.index( goal ) );
+        table_.begin_query();
+        open_.clear();
+
+        uint32_t s = static_cast<uint32_t>( grid_.index( start ) );
+        table_.touch( s );
+        table_.g( s ) = 0;
+        open_.push( octile_distance( start, goal ), s );
+        stats_.pushed = 1;
+
+        while ( !open_.empty() )
+        {
+            uint32_t u = open_.pop().second;
+            if ( table_.is_closed( u ) )
+                continue;
+            table_.set_closed( u );
+            ++stats_.expanded;
+            if ( u == goal_ )
+            {
+                expand_path( u, path );
+                return true;
+            }
+
+            int count = successors( u );
+            const Cell cu = grid_.cell( u );
+            for ( int k = 0; k < count; ++k )
+            {
+                uint32_t v = succ_[k];
+                table_.touch( v );
+                if ( table_.is_closed( v ) )
+                    continue;
+                const Cell cv = grid_.cell( v );
+                uint32_t gv = table_.g( u ) + octile_distance( cu, cv );
+                if ( gv >= table_.g( v ) )
+                    continue;
+                table_.g( v ) = gv;
+                table_.parent( v ) = u;
+                open_.push( gv + octile_distance( cv, goal ), v );
+                ++stats_.pushed;
+            }
+        }
+        return false;
+    }
+
+private:
+    bool open( ptrdiff_t i ) const { return cells_[i] != PlanningGrid::kBlocked; }
+
+    // Scans along a straight direction; returns the first jump point or -1.
+    ptrdiff_t jump_straight( ptrdiff_t i, ptrdiff_t d ) const
+    {
+        // Offset of the rows/columns on either side of the scan line.
+        const ptrdiff_t side = ( d == 1 || d == -1 ) ? sy_ : 1;
+        for ( ;; )
+        {
+            i += d;
+            if ( !open( i ) )
+                return -1;
+            if ( i == static_cast<ptrdiff_t>( goal_ ) )
+                return i;
+            if ( ( open( i - side ) && !open( i - d - side ) ) || ( open( i + side ) && !open( i - d + side ) ) )
+                return i;
+        }
+    }
+
+    ptrdiff_t jump_diagonal( ptrdiff_t i, ptrdiff_t dx, ptrdiff_t dy ) const
+    {
+        for ( ;; )
+        {
+            if ( !open( i + dx ) || !open( i + dy ) || !open( i + dx + dy ) )
+                return -1;
+            i += dx + dy;
+            if ( i == static_cast<ptrdiff_t>( goal_ ) )
+                return i;
+            if ( jump_straight( i, dx ) >= 0 || jump_straight( i, dy ) >= 0 )
+                return i;
+        }
+    }
+
+    ptrdiff_t jump( ptrdiff_t i, int dx, int dy ) const
+    {
+        if ( dx != 0 && dy != 0 )
+            return jump_diagonal( i, dx, dy * sy_ );
+        return jump_straight( i, dx + dy * sy_ );
+    }
+
+    void add_direction( int dx, int dy ) { dirs_[dir_count_++] = { dx, dy }; }
+
+    // Pruned neighbour directions for u given its parent, then their jumps.
+    int successors( uint32_t u )
+    {
+        dir_count_ = 0;
+        const ptrdiff_t i = u;
+        uint32_t p = table_.parent( u );
+        if ( p == u )
+        {
+            for ( int dy = -1; dy <= 1; ++dy )
+                for ( int dx = -1; dx <= 1; ++dx )
+                    if ( dx || dy )
+                        add_direction( dx, dy );
+        }
+        else
+        {
+            const Cell cu = grid_.cell( u );
+            const Cell cp = grid_.cell( p );
+            int dx = ( cu.x > cp.x ) - ( cu.x < cp.x );
+            int dy = ( cu.y > cp.y ) - ( cu.y < cp.y );
+            if ( dx && dy )
+            {
+                add_direction( 0, dy );
+                add_direction( dx, 0 );
+                add_direction( dx, dy );
+            }
+            else if ( dx )
+            {
+                bool up = open( i + sy_ );
+                bool down = open( i - sy_ );
+                if ( open( i + dx ) )
+                {
+                    add_direction( dx, 0 );
+                    if ( up )
+                        add_direction( dx, 1 );
+                    if ( down )
+                        add_direction( dx, -1 );
+                }
+                if ( up )
+                    add_direction( 0, 1 );
+                if ( down )
+                    add_direction( 0, -1 );
+            }
+            else
+            {
+                bool right = open( i + 1 );
+                bool left = open( i - 1 );
+                if ( open( i + dy * sy_ ) )
+                {
+                    add_direction( 0, dy );
+                    if ( right )
+                        add_direction( 1, dy );
+                    if ( left )
+                        add_direction( -1, dy );
+                }
+                if ( right )
+                    add_direction( 1, 0 );
+                if ( left )
+                    add_direction( -1, 0 );
+            }
+        }
+
+        int count = 0;
+        for ( int k = 0; k < dir_count_; ++k )
+        {
+            ptrdiff_t j = jump( i, dirs_[k].x, dirs_[k].y );
+            if ( j >= 0 )
+                succ_[count++] = static_cast<uint32_t>( j );
+        }
+        return count;
+    }
+
+    // Jump points are joined by pure straight or diagonal runs; walk them
+    // to emit every cell.
+    void expand_path( uint32_t t, GridPath& path )
+    {
+        points_.clear();
+        for ( uint32_t v = t;; v = table_.parent( v ) )
+        {
+            points_.push_back( grid_.cell( v ) );
+            if ( table_.parent( v ) == v )
+                break;
+        }
+        path.cells.push_back( points_.back() );
+        for ( size_t k = points_.size() - 1; k > 0; --k )
+        {
+            Cell c = points_[k];
+            const Cell& to = points_[k - 1];
+            int dx = ( to.x > c.x ) - ( to.x < c.x );
+            int dy = ( to.y > c.y ) - ( to.y < c.y );
+            while ( c != to )
+            {
+                c.x += dx;
+                c.y += dy;
+                path.cells.push_back( c );
+            }
+        }
+        path.cost = table_.g( t );
+        path.found = true;
+    }
+
+    struct Direction
+    {
+        int x;
+        int y;
+    };
+
+    const PlanningGrid& grid_;
+    SearchTable table_;
+    RadixHeap open_;
+    SearchStats stats_;
+    std::vector<Cell> points_;
+    const uint8_t* cells_ = nullptr;
+    ptrdiff_t sy_ = 0;
+    uint32_t goal_ = 0;
+    Direction dirs_[8] = {};
+    int dir_count_ = 0;
+    uint32_t succ_[8] = {};
+};
+
+} // namespace wra
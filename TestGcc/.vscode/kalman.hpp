@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "dense_cholesky.hpp"
+
+namespace wra
+{
+
+// Row-major R x C matrix held by value, for the small fixed sizes of
+// filter states and measurements.
+template <size_t R, size_t C>
+struct FixedMatrix
+{
+    double m[R][C];
+
+    static FixedMatrix zero()
+    {
+        FixedMatrix r;
+        std::fill( &r.m[0][0], &r.m[0][0] + R * C, 0.0 );
+        return r;
+    }
+
+    static FixedMatrix identity()
+    {
+        FixedMatrix r = zero();
+        for ( size_t i = 0; i < std::min( R, C ); ++i )
+            r.m[i][i] = 1.0;
+        return r;
+    }
+
+    // Diagonal matrix from R values (square matrices only).
+    static FixedMatrix diagonal( const double* d )
+    {
+        FixedMatrix r = zero();
+        for ( size_t i = 0; i < R; ++i )
+            r.m[i][i] = d[i];
+        return r;
+    }
+
+    double operator()( size_t r, size_t c ) const { return m[r][c]; }
+    double& operator()( size_t r, size_t c ) { return m[r][c]; }
+};
+
+// A B.
+template <size_t R, size_t K, size_t C>
+inline FixedMatrix<R, C> multiply( const FixedMatrix<R, K>& A, const FixedMatrix<K, C>& B )
+{
+    FixedMatrix<R, C> out = FixedMatrix<R, C>::zero();
+    for ( size_t i = 0; i < R; ++i )
+        for ( size_t k = 0; k < K; ++k )
+        {
+            double a = A.m[i][k];
+            for ( size_t j = 0; j < C; ++j )
+                out.m[i][j] += a * B.m[k][j];
+        }
+    return out;
+}
+
+// A B'.
+template <size_t R, size_t K, size_t C>
+inline FixedMatrix<R, C> multiply_transpose( const FixedMatrix<R, K>& A, const FixedMatrix<C, K>& B )
+{
+    FixedMatrix<R, C> out;
+    for ( size_t i = 0; i < R; ++i )
+        for ( size_t j = 0; j < C; ++j )
+        {
+            double v = 0.0;
+            for ( size_t k = 0; k < K; ++k )
+                v += A.m[i][k] * B.m[j][k];
+            out.m[i][j] = v;
+        }
+    return out;
+}
+
+template <size_t N>
+inline void symmetrize( FixedMatrix<N, N>& A )
+{
+    for ( size_t i = 0; i < N; ++i )
+        for ( size_t j = 0; j < i; ++j )
+            A.m[i][j] = A.m[j][i] = 0.5 * ( A.m[i][j] + A.m[j][i] );
+}
+
+// Lower Cholesky factor with a zeroed upper triangle; false if A is not
+// positive definite.
+template <size_t N>
+inline bool cholesky( const FixedMatrix<N, N>& A, FixedMatrix<N, N>& L )
+{
+    if ( !cholesky_factor( A.m, L.m ) )
+        return false;
+    for ( size_t i = 0; i < N; ++i )
+        for ( size_t j = i + 1; j < N; ++j )
+            L.m[i][j] = 0.0;
+    return true;
+}
+
+// Kalman gain K = P_xz S^-1 from the Cholesky factor of S, solving
+// S K' = P_xz' row by row.
+template <size_t NX, size_t NZ>
+inline FixedMatrix<NX, NZ> kalman_gain( const FixedMatrix<NX, NZ>& Pxz, const FixedMatrix<NZ, NZ>& L )
+{
+    FixedMatrix<NX, NZ> K;
+    for ( size_t r = 0; r < NX; ++r )
+    {
+        double b[NZ];
+        std::copy( Pxz.m[r], Pxz.m[r] + NZ, b );
+        cholesky_solve( L.m, b );
+        for ( size_t i = 0; i < NZ; ++i )
+            K.m[r][i] = b[i];
+    }
+    return K;
+}
+
+inline double wrap_angle( double a )
+{
+    const double two_pi = 6.28318530717958647692;
+    return a - two_pi * std::round( a / two_pi );
+}
+
+// Default measurement residual a - b.
+template <size_t N>
+struct Difference
+{
+    void operator()( const double* a, const double* b, double* out ) const
+    {
+        for ( size_t i = 0; i < N; ++i )
+            out[i] = a[i] - b[i];
+    }
+};
+
+// Extended Kalman filter over a compile-time state size. Models are
+// callables, so the whole filter is inlined per model and nothing
+// allocates:
+//
+//   predict: f( const double* x, double* next, FixedMatrix<NX, NX>& F )
+//   update:  h( const double* x, double* z, FixedMatrix<NZ, NX>& H )
+//
+// Updates use the Joseph form (I - K H) P (I - K H)' + K R K', which
+// keeps P symmetric positive semidefinite in single steps where the
+// short form can lose it. State components marked angular are wrapped to
+// [-pi, pi] after each step.
+template <size_t NX>
+class ExtendedKalmanFilter
+{
+public:
+    static constexpr size_t nx = NX;
+    typedef FixedMatrix<NX, NX> Covariance;
+
+    void reset( const double* x, const Covariance& P )
+    {
+        std::copy( x, x + NX, x_ );
+        P_ = P;
+    }
+
+    void set_angular( size_t i ) { angular_ |= uint64_t( 1 ) << i; }
+
+    const double* state() const { return x_; }
+    const Covariance& covariance() const { return P_; }
+    // Normalised innovation squared of the last update, for gating and
+    // consistency checks.
+    double last_nis() const { return nis_; }
+
+    template <typename Transition>
+    void predict( Transition&& f, const Covariance& Q )
+    {
+        double next[NX];
+        Covariance F;
+        f( x_, next, F );
+        std::copy( next, next + NX, x_ );
+        wrap();
+        P_ = multiply_transpose( multiply( F, P_ ), F );
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NX; ++j )
+                P_.m[i][j] += Q.m[i][j];
+        symmetrize( P_ );
+    }
+
+    template <size_t NZ, typename Observation>
+    bool update( const double* z, Observation&& h, const FixedMatrix<NZ, NZ>& R )
+    {
+        return update<NZ>( z, h, R, Difference<NZ>() );
+    }
+
+    // residual( a, b, out ) forms a - b in measurement space (wrapping
+    // bearings, say). False, with the state untouched, if the innovation
+    // covariance is not positive definite.
+    template <size_t NZ, typename Observation, typename Residual>
+    bool update( const double* z, Observation&& h, const FixedMatrix<NZ, NZ>& R, Residual&& residual )
+    {
+        double zp[NZ], y[NZ];
+        FixedMatrix<NZ, NX> H;
+        h( x_, zp, H );
+        residual( z, zp, y );
+
+        FixedMatrix<NX, NZ> PHt = multiply_transpose( P_, H );
+        FixedMatrix<NZ, NZ> S = multiply( H, PHt ), L;
+        for ( size_t i = 0; i < NZ; ++i )
+            for ( size_t j = 0; j < NZ; ++j )
+                S.m[i][j] += R.m[i][j];
+        if ( !cholesky( S, L ) )
+            return false;
+        FixedMatrix<NX, NZ> K = kalman_gain( PHt, L );
+        nis_ = normalized_squared( L, y );
+
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NZ; ++j )
+                x_[i] += K.m[i][j] * y[j];
+        wrap();
+
+        Covariance IKH = Covariance::identity();
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NX; ++j )
+                for ( size_t k = 0; k < NZ; ++k )
+                    IKH.m[i][j] -= K.m[i][k] * H.m[k][j];
+        P_ = multiply_transpose( multiply( IKH, P_ ), IKH );
+        Covariance KRKt = multiply_transpose( multiply( K, R ), K );
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NX; ++j )
+                P_.m[i][j] += KRKt.m[i][j];
+        symmetrize( P_ );
+        return true;
+    }
+
+private:
+    void wrap()
+    {
+        for ( size_t i = 0; i < NX; ++i )
+            if ( angular_ >> i & 1 )
+                x_[i] = wrap_angle( x_[i] );
+    }
+
+    template <size_t NZ>
+    static double normalized_squared( const FixedMatrix<NZ, NZ>& L, const double* y )
+    {
+        double b[NZ], sum = 0.0;
+        for ( size_t i = 0; i < NZ; ++i )
+        {
+            double v = y[i];
+            for ( size_t k = 0; k < i; ++k )
+                v -= L.m[i][k] * b[k];
+            b[i] = v / L.m[i][i];
+            sum += b[i] * b[i];
+        }
+        return sum;
+    }
+
+    double x_[NX] = {};
+    Covariance P_ = Covariance::identity();
+    uint64_t angular_ = 0;
+    double nis_ = 0.0;
+};
+
+struct UkfOptions
+{
+    // Scaled sigma points of van der Merwe: spread alpha, prior
+    // knowledge beta (2 is optimal for Gaussians) and kappa.
+    double alpha = 0.5;
+    double beta = 2.0;
+    double kappa = 0.0;
+};
+
+// Unscented Kalman filter over a compile-time state size, with 2 NX + 1
+// scaled sigma points drawn from the Cholesky factor of P. Models need no
+// Jacobians:
+//
+//   predict: f( const double* x, double* next )
+//   update:  h( const double* x, double* z )
+//
+// Means are taken as X_0 plus the weighted residuals against X_0, so
+// angular state components (set_angular) and wrapping measurement
+// residuals average correctly across the +-pi seam. Sigma points are
+// redrawn for each update, so sequential updates of different sensors
+// compose. The update is P - K S K', symmetrised; the Joseph form does
+// not apply without a measurement Jacobian. All storage is fixed-size.
+template <size_t NX>
+class UnscentedKalmanFilter
+{
+public:
+    static constexpr size_t nx = NX;
+    static constexpr size_t points = 2 * NX + 1;
+    typedef FixedMatrix<NX, NX> Covariance;
+
+    explicit UnscentedKalmanFilter( const UkfOptions& options = UkfOptions() ) { set_options( options ); }
+
+    void set_options( const UkfOptions& options )
+    {
+        const double n = double( NX );
+        double lambda = options.alpha * options.alpha * ( n + options.kappa ) - n;
+        scale_ = std::sqrt( n + lambda );
+        wm_[0] = lambda / ( n + lambda );
+        wc_[0] = wm_[0] + 1.0 - options.alpha * options.alpha + options.beta;
+        for ( size_t i = 1; i < points; ++i )
+            wm_[i] = wc_[i] = 0.5 / ( n + lambda );
+    }
+
+    void reset( const double* x, const Covariance& P )
+    {
+        std::copy( x, x + NX, x_ );
+        P_ = P;
+    }
+
+    void set_angular( size_t i ) { angular_ |= uint64_t( 1 ) << i; }
+
+    const double* state() const { return x_; }
+    const Covariance& covariance() const { return P_; }
+    double last_nis() const { return nis_; }
+
+    // False, with the filter untouched, if P has lost definiteness.
+    template <typename Transition>
+    bool predict( Transition&& f, const Covariance& Q )
+    {
+        if ( !draw() )
+            return false;
+        double next[NX];
+        for ( size_t i = 0; i < points; ++i )
+        {
+            f( X_[i], next );
+            std::copy( next, next + NX, X_[i] );
+        }
+        state_mean( x_ );
+        P_ = Q;
+        double dx[NX];
+        for ( size_t i = 0; i < points; ++i )
+        {
+            state_residual( X_[i], x_, dx );
+            for ( size_t r = 0; r < NX; ++r )
+                for ( size_t c = 0; c < NX; ++c )
+                    P_.m[r][c] += wc_[i] * dx[r] * dx[c];
+        }
+        symmetrize( P_ );
+        return true;
+    }
+
+    template <size_t NZ, typename Observation>
+    bool update( const double* z, Observation&& h, const FixedMatrix<NZ, NZ>& R )
+    {
+        return update<NZ>( z, h, R, Difference<NZ>() );
+    }
+
+    template <size_t NZ, typename Observation, typename Residual>
+    bool update( const double* z, Observation&& h, const FixedMatrix<NZ, NZ>& R, Residual&& residual )
+    {
+        if ( !draw() )
+            return false;
+        double Z[points][NZ];
+        for ( size_t i = 0; i < points; ++i )
+            h( X_[i], Z[i] );
+
+        // zbar = Z_0 + sum w_i (Z_i - Z_0).
+        double zbar[NZ], dz[NZ], dx[NX];
+        std::copy( Z[0], Z[0] + NZ, zbar );
+        for ( size_t i = 1; i < points; ++i )
+        {
+            residual( Z[i], Z[0], dz );
+            for ( size_t k = 0; k < NZ; ++k )
+                zbar[k] += wm_[i] * dz[k];
+        }
+
+        FixedMatrix<NZ, NZ> S = R, L;
+        FixedMatrix<NX, NZ> Pxz = FixedMatrix<NX, NZ>::zero();
+        for ( size_t i = 0; i < points; ++i )
+        {
+            residual( Z[i], zbar, dz );
+            state_residual( X_[i], x_, dx );
+            for ( size_t r = 0; r < NZ; ++r )
+                for ( size_t c = 0; c < NZ; ++c )
+                    S.m[r][c] += wc_[i] * dz[r] * dz[c];
+            for ( size_t r = 0; r < NX; ++r )
+                for ( size_t c = 0; c < NZ; ++c )
+                    Pxz.m[r][c] += wc_[i] * dx[r] * dz[c];
+        }
+        if ( !cholesky( S, L ) )
+            return false;
+        FixedMatrix<NX, NZ> K = kalman_gain( Pxz, L );
+
+        double y[NZ];
+        residual( z, zbar, y );
+        nis_ = 0.0;
+        {
+            double b[NZ];
+            for ( size_t i = 0; i < NZ; ++i )
+            {
+                double v = y[i];
+                for ( size_t k = 0; k < i; ++k )
+                    v -= L.m[i][k] * b[k];
+                b[i] = v / L.m[i][i];
+                nis_ += b[i] * b[i];
+            }
+        }
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NZ; ++j )
+                x_[i] += K.m[i][j] * y[j];
+        wrap( x_ );
+
+        // P -= K S K' = Pxz K'.
+        Covariance PxzKt = multiply_transpose( Pxz, K );
+        for ( size_t i = 0; i < NX; ++i )
+            for ( size_t j = 0; j < NX; ++j )
+                P_.m[i][j] -= PxzKt.m[i][j];
+        symmetrize( P_ );
+        return true;
+    }
+
+private:
+    bool draw()
+    {
+        Covariance L;
+        if ( !cholesky( P_, L ) )
+            return false;
+        std::copy( x_, x_ + NX, X_[0] );
+        for ( size_t c = 0; c < NX; ++c )
+            for ( size_t r = 0; r < NX; ++r )
+            {
+                X_[1 + c][r] = x_[r] + scale_ * L.m[r][c];
+                X_[1 + NX + c][r] = x_[r] - scale_ * L.m[r][c];
+            }
+        return true;
+    }
+
+    void state_residual( const double* a, const double* b, double* out ) const
+    {
+        for ( size_t i = 0; i < NX; ++i )
+            out[i] = angular_ >> i & 1 ? wrap_angle( a[i] - b[i] ) : a[i] - b[i];
+    }
+
+    void state_mean( double* mean ) const
+    {
+        double d[NX];
+        std::copy( X_[0], X_[0] + NX, mean );
+        for ( size_t i = 1; i < points; ++i )
+        {
+            state_residual( X_[i], X_[0], d );
+            for ( size_t k = 0; k < NX; ++k )
+                mean[k] += wm_[i] * d[k];
+        }
+        wrap( mean );
+    }
+
+    void wrap( double* x ) const
+    {
+        for ( size_t i = 0; i < NX; ++i )
+            if ( angular_ >> i & 1 )
+                x[i] = wrap_angle( x[i] );
+    }
+
+    double x_[NX] = {};
+    Covariance P_ = Covariance::identity();
+    double X_[points][NX];
+    double wm_[points];
+    double wc_[points];
+    double scale_ = 1.0;
+    uint64_t angular_ = 0;
+    double nis_ = 0.0;
+};
+
+} // namespace wra
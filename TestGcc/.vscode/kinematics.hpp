@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+#include "geometry.hpp"
+
+namespace wra
+{
+
+// Standard DH joint: Rz(theta + offset) Tz(d) Tx(a) Rx(alpha), revolute.
+// The cosine and sine of alpha are stored so that models can be constexpr
+// and the unrolled chain can branch on them at compile time.
+struct DhJoint
+{
+    double a;
+    double d;
+    double cos_alpha;
+    double sin_alpha;
+    double offset;
+};
+
+namespace detail
+{
+
+// Taylor series after reduction to [-pi, pi]; exact enough for model
+// constants, and snapped so that right angles give exact 0 and +-1.
+constexpr double constexpr_sin( double x )
+{
+    const double pi = 3.14159265358979323846;
+    while ( x > pi )
+        x -= 2 * pi;
+    while ( x < -pi )
+        x += 2 * pi;
+    double term = x, sum = x;
+    for ( int k = 1; k < 30; ++k )
+    {
+        term *= -x * x / ( ( 2 * k ) * ( 2 * k + 1 ) );
+        sum += term;
+    }
+    if ( sum < 1e-14 && sum > -1e-14 )
+        return 0.0;
+    if ( sum > 1 - 1e-14 )
+        return 1.0;
+    if ( sum < -1 + 1e-14 )
+        return -1.0;
+    return sum;
+}
+
+constexpr double constexpr_cos( double x )
+{
+    return constexpr_sin( x + 1.57079632679489661923 );
+}
+
+} // namespace detail
+
+constexpr DhJoint dh( double a, double alpha, double d, double offset = 0.0 )
+{
+    return { a, d, detail::constexpr_cos( alpha ), detail::constexpr_sin( alpha ), offset };
+}
+
+// Rigid-body parameters of the link carried by a joint, in that joint's DH
+// frame: mass, centre of mass and the inertia tensor about the centre.
+struct LinkInertia
+{
+    double mass;
+    double com[3];
+    double ixx, iyy, izz;
+    double ixy, ixz, iyz;
+};
+
+// Robot models are types with a constexpr joint table, so ForwardKinematics
+// sees every constant at compile time. The link tables feed the dynamics;
+// they are representative values, not identified ones.
+struct Ur5
+{
+    static constexpr size_t dof = 6;
+    static constexpr DhJoint joints[dof] = {
+        dh( 0.0, 1.57079632679489661923, 0.089159 ), dh( -0.425, 0.0, 0.0 ),
+        dh( -0.39225, 0.0, 0.0 ), dh( 0.0, 1.57079632679489661923, 0.10915 ),
+        dh( 0.0, -1.57079632679489661923, 0.09465 ), dh( 0.0, 0.0, 0.0823 ) };
+    static constexpr LinkInertia links[dof] = {
+        { 3.7, { 0.0, -0.02561, 0.00193 }, 0.0103, 0.0103, 0.0067, 0, 0, 0 },
+        { 8.393, { 0.2125, 0.0, 0.11336 }, 0.0151, 0.2269, 0.2269, 0, 0, 0 },
+        { 2.33, { 0.15, 0.0, 0.0265 }, 0.0041, 0.0494, 0.0494, 0, 0, 0 },
+        { 1.219, { 0.0, -0.0018, 0.01634 }, 0.0022, 0.0022, 0.0022, 0, 0, 0 },
+        { 1.219, { 0.0, 0.0018, 0.01634 }, 0.0022, 0.0022, 0.0022, 0, 0, 0 },
+        { 0.1879, { 0.0, 0.0, -0.001159 }, 0.0001, 0.0001, 0.0001, 0, 0, 0 } };
+};
+
+// Spherical wrist: joint axes 4-6 meet in one point.
+struct Puma560
+{
+    static constexpr size_t dof = 6;
+    static constexpr DhJoint joints[dof] = {
+        dh( 0.0, 1.57079632679489661923, 0.0 ), dh( 0.4318, 0.0, 0.0 ),
+        dh( 0.0203, -1.57079632679489661923, 0.15005 ), dh( 0.0, 1.57079632679489661923, 0.4318 ),
+        dh( 0.0, -1.57079632679489661923, 0.0 ), dh( 0.0, 0.0, 0.0 ) };
+    // Armstrong, Khatib and Burdick (1986) as tabulated by Corke.
+    static constexpr LinkInertia links[dof] = {
+        { 0.0, { 0.0, 0.0, 0.0 }, 0.0, 0.35, 0.0, 0, 0, 0 },
+        { 17.4, { -0.3638, 0.006, 0.2275 }, 0.13, 0.524, 0.539, 0, 0, 0 },
+        { 4.8, { -0.0203, -0.0141, 0.070 }, 0.066, 0.086, 0.0125, 0, 0, 0 },
+        { 0.82, { 0.0, 0.019, 0.0 }, 1.8e-3, 1.3e-3, 1.8e-3, 0, 0, 0 },
+        { 0.34, { 0.0, 0.0, 0.0 }, 0.3e-3, 0.4e-3, 0.3e-3, 0, 0, 0 },
+        { 0.09, { 0.0, 0.0, 0.032 }, 0.15e-3, 0.15e-3, 0.04e-3, 0, 0, 0 } };
+};
+
+// Seven-axis arm laid out like the KUKA iiwa 14.
+struct Iiwa14
+{
+    static constexpr size_t dof = 7;
+    static constexpr DhJoint joints[dof] = {
+        dh( 0.0, -1.57079632679489661923, 0.36 ), dh( 0.0, 1.57079632679489661923, 0.0 ),
+        dh( 0.0, 1.57079632679489661923, 0.42 ), dh( 0.0, -1.57079632679489661923, 0.0 ),
+        dh( 0.0, -1.57079632679489661923, 0.4 ), dh( 0.0, 1.57079632679489661923, 0.0 ),
+        dh( 0.0, 0.0, 0.126 ) };
+    static constexpr LinkInertia links[dof] = {
+        { 4.0, { 0.0, 0.03, 0.12 }, 0.1, 0.09, 0.02, 0, 0, 0 },
+        { 4.0, { 0.0, 0.042, 0.0 }, 0.05, 0.018, 0.044, 0, 0, 0 },
+        { 3.0, { 0.0, 0.03, 0.13 }, 0.08, 0.075, 0.01, 0, 0, 0 },
+        { 2.7, { 0.0, 0.067, 0.034 }, 0.03, 0.01, 0.029, 0, 0, 0 },
+        { 1.7, { 0.0, 0.021, 0.076 }, 0.02, 0.018, 0.005, 0, 0, 0 },
+        { 1.8, { 0.0, 0.0006, 0.0004 }, 0.005, 0.0036, 0.0047, 0, 0, 0 },
+        { 0.3, { 0.0, 0.0, 0.02 }, 0.001, 0.001, 0.001, 0, 0, 0 } };
+};
+
+// Frame of one DH joint at angle q.
+inline Isometry3 dh_transform( const DhJoint& j, double q )
+{
+    double c = std::cos( q + j.offset ), s = std::sin( q + j.offset );
+    Isometry3 t;
+    t.R.m[0][0] = c;
+    t.R.m[0][1] = -s * j.cos_alpha;
+    t.R.m[0][2] = s * j.sin_alpha;
+    t.R.m[1][0] = s;
+    t.R.m[1][1] = c * j.cos_alpha;
+    t.R.m[1][2] = -c * j.sin_alpha;
+    t.R.m[2][0] = 0.0;
+    t.R.m[2][1] = j.sin_alpha;
+    t.R.m[2][2] = j.cos_alpha;
+    t.t = { j.a * c, j.a * s, j.d };
+    return t;
+}
+
+// Runtime chain: one matrix product per joint. The reference the unrolled
+// kernels are checked against, and the path for models built at runtime.
+inline void forward_kinematics( const DhJoint* joints, size_t dof, const double* q, Isometry3* link_poses )
+{
+    Isometry3 frame;
+    for ( size_t i = 0; i < dof; ++i )
+    {
+        frame = frame * dh_transform( joints[i], q[i] );
+        link_poses[i] = frame;
+    }
+}
+
+// Eight doubles handled as one value; GCC lowers the arithmetic to
+// whatever vector width the build targets (AVX-512, AVX2 pairs, SSE2).
+// The batch only pays off with AVX2 or wider, so build it -march=native
+// as the release task does; on plain SSE2 the scalar kernel is quicker.
+typedef double FkLanes __attribute__( ( vector_size( 8 * sizeof( double ) ) ) );
+typedef long long FkLaneMask __attribute__( ( vector_size( 8 * sizeof( long long ) ) ) );
+
+// Cephes-style sine and cosine on all lanes: Cody-Waite reduction by
+// pi/2, then the minimax polynomials on [-pi/4, pi/4]. Accurate to a few
+// ulp for joint-sized angles.
+inline void sincos_lanes( const FkLanes& x, FkLanes& s, FkLanes& c )
+{
+    const double two_over_pi = 0.63661977236758134308;
+    FkLanes y = x * two_over_pi;
+    FkLanes half = y >= 0.0 ? FkLanes{} + 0.5 : FkLanes{} - 0.5;
+    FkLaneMask n = __builtin_convertvector( y + half, FkLaneMask );
+    FkLanes nd = __builtin_convertvector( n, FkLanes );
+    FkLanes r = ( ( x - nd * 1.57079625129699707031 ) - nd * 7.54978941586159635336e-8 ) - nd * 5.39030285815811905290e-15;
+    FkLanes z = r * r;
+
+    FkLanes ps = ( ( ( ( 1.58962301576546568060e-10 * z - 2.50507477628578072866e-8 ) * z + 2.75573136213857245213e-6 ) * z -
+                     1.98412698295895385996e-4 ) * z + 8.33333333332211858878e-3 ) * z - 1.66666666666666307295e-1;
+    FkLanes pc = ( ( ( ( -1.13585365213876817300e-11 * z + 2.08757008419747316778e-9 ) * z - 2.75573141792967388112e-7 ) * z +
+                     2.48015872888517045348e-5 ) * z - 1.38888888888730564116e-3 ) * z + 4.16666666666665929218e-2;
+    FkLanes sr = r + r * z * ps;
+    FkLanes cr = 1.0 - 0.5 * z + z * z * pc;
+
+    FkLaneMask swap = ( n & 1 ) != 0;
+    s = swap ? cr : sr;
+    c = swap ? sr : cr;
+    s = ( n & 2 ) != 0 ? -s : s;
+    c = ( ( n + 1 ) & 2 ) != 0 ? -c : c;
+}
+
+// Forward kinematics with the joint chain unrolled per model. Each joint
+// step is specialised on its constants: alpha of 0 or +-90 degrees turns
+// the Rx product into a column swap, and zero a or d drops its term. The
+// scalar and batch paths share the same step over T = double or FkLanes.
+template <typename Model>
+class ForwardKinematics
+{
+public:
+    static constexpr size_t dof = Model::dof;
+    static constexpr size_t kLanes = 8;
+
+    // link_poses[i] is the frame after joint i; the last is the flange.
+    static void compute( const double* q, Isometry3* link_poses )
+    {
+        Frame<double> f;
+        chain( f, q, link_poses, std::make_index_sequence<dof>() );
+    }
+
+    static Isometry3 end_effector( const double* q )
+    {
+        Frame<double> f;
+        chain( f, q, nullptr, std::make_index_sequence<dof>() );
+        Isometry3 out;
+        store( f, 0, out );
+        return out;
+    }
+
+    // n configurations, dof consecutive joints each; link_poses receives
+    // dof poses per configuration in the same order, which is the layout
+    // CollisionChecker takes.
+    static void compute_batch( const double* q, size_t n, Isometry3* link_poses )
+    {
+        batch( q, n, link_poses, false );
+    }
+
+    // Flange pose only, one per configuration.
+    static void end_effector_batch( const double* q, size_t n, Isometry3* poses )
+    {
+        batch( q, n, poses, true );
+    }
+
+    // Geometric Jacobian of the flange in the base frame from the link
+    // poses of compute(): rows are linear then angular velocity, and
+    // joint i turns about the z axis of frame i - 1 (the base for i = 0).
+    static void jacobian( const Isometry3* link_poses, double ( *J )[dof] )
+    {
+        const Vec3 p = link_poses[dof - 1].t;
+        for ( size_t j = 0; j < dof; ++j )
+        {
+            Vec3 z = j ? link_poses[j - 1].R.col( 2 ) : Vec3( 0, 0, 1 );
+            Vec3 v = cross( z, p - ( j ? link_poses[j - 1].t : Vec3() ) );
+            for ( int i = 0; i < 3; ++i )
+            {
+                J[i][j] = v[i];
+                J[i + 3][j] = z[i];
+            }
+        }
+    }
+
+private:
+    template <typename T>
+    struct Frame
+    {
+        T r[3][3];
+        T p[3];
+    };
+
+    static void store( const Frame<double>& f, size_t, Isometry3& out )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            for ( int j = 0; j < 3; ++j )
+                out.R.m[i][j] = f.r[i][j];
+            out.t[i] = f.p[i];
+        }
+    }
+
+    static void store( const Frame<FkLanes>& f, size_t lane, Isometry3& out )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            for ( int j = 0; j < 3; ++j )
+                out.R.m[i][j] = f.r[i][j][lane];
+            out.t[i] = f.p[i][lane];
+        }
+    }
+
+    static void sincos( double x, double& s, double& c )
+    {
+        s = std::sin( x );
+        c = std::cos( x );
+    }
+
+    static void sincos( const FkLanes& x, FkLanes& s, FkLanes& c ) { sincos_lanes( x, s, c ); }
+
+    template <size_t I, typename T>
+    static void step( Frame<T>& f, const T& q )
+    {
+        constexpr DhJoint J = Model::joints[I];
+        T c, s;
+        if constexpr ( J.offset != 0.0 )
+            sincos( q + J.offset, s, c );
+        else
+            sincos( q, s, c );
+
+        if constexpr ( I == 0 )
+        {
+            // Base frame is the identity, so Rz(theta) is the frame itself.
+            f.r[0][0] = c;
+            f.r[0][1] = -s;
+            f.r[1][0] = s;
+            f.r[1][1] = c;
+            f.r[0][2] = f.r[1][2] = f.r[2][0] = f.r[2][1] = T{} + 0.0;
+            f.r[2][2] = T{} + 1.0;
+            f.p[0] = J.a * c;
+            f.p[1] = J.a * s;
+            f.p[2] = T{} + J.d;
+        }
+        else
+        {
+            for ( int k = 0; k < 3; ++k )
+            {
+                T x = f.r[k][0], y = f.r[k][1];
+                f.r[k][0] = c * x + s * y;
+                f.r[k][1] = c * y - s * x;
+            }
+            for ( int k = 0; k < 3; ++k )
+            {
+                if constexpr ( J.a != 0.0 )
+                    f.p[k] += J.a * f.r[k][0];
+                if constexpr ( J.d != 0.0 )
+                    f.p[k] += J.d * f.r[k][2];
+            }
+        }
+
+        if constexpr ( J.sin_alpha == 1.0 )
+            for ( int k = 0; k < 3; ++k )
+            {
+                T y = f.r[k][1];
+                f.r[k][1] = f.r[k][2];
+                f.r[k][2] = -y;
+            }
+        else if constexpr ( J.sin_alpha == -1.0 )
+            for ( int k = 0; k < 3; ++k )
+            {
+                T y = f.r[k][1];
+                f.r[k][1] = -f.r[k][2];
+                f.r[k][2] = y;
+            }
+        else if constexpr ( J.cos_alpha == -1.0 )
+            for ( int k = 0; k < 3; ++k )
+            {
+                f.r[k][1] = -f.r[k][1];
+                f.r[k][2] = -f.r[k][2];
+            }
+        else if constexpr ( J.sin_alpha != 0.0 )
+            for ( int k = 0; k < 3; ++k )
+            {
+                T y = f.r[k][1], z = f.r[k][2];
+                f.r[k][1] = J.cos_alpha * y + J.sin_alpha * z;
+                f.r[k][2] = J.cos_alpha * z - J.sin_alpha * y;
+            }
+    }
+
+    // Scalar chain; poses are written after every joint when requested.
+    template <size_t... I>
+    static void chain( Frame<double>& f, const double* q, Isometry3* poses, std::index_sequence<I...> )
+    {
+        ( ( step<I>( f, q[I] ), poses ? store( f, 0, poses[I] ) : void() ), ... );
+    }
+
+    // Lane chain; out holds kLanes blocks of `stride` poses, and joint I
+    // lands at offset I of each block (or 0 when only the flange is kept).
+    template <size_t... I>
+    static void chain( Frame<FkLanes>& f, const FkLanes* q, Isometry3* out, size_t stride, size_t lanes,
+                       bool flange_only, std::index_sequence<I...> )
+    {
+        auto emit = [&]( size_t joint ) {
+            if ( flange_only && joint + 1 != dof )
+                return;
+            size_t at = flange_only ? 0 : joint;
+            for ( size_t l = 0; l < lanes; ++l )
+                store( f, l, out[l * stride + at] );
+        };
+        ( ( step<I>( f, q[I] ), emit( I ) ), ... );
+    }
+
+    static void batch( const double* q, size_t n, Isometry3* out, bool flange_only )
+    {
+        const size_t stride = flange_only ? 1 : dof;
+        FkLanes lanes_q[dof];
+        for ( size_t base = 0; base < n; base += kLanes )
+        {
+            size_t lanes = std::min( kLanes, n - base );
+            // Transpose into lanes; a short tail repeats its last config.
+            for ( size_t j = 0; j < dof; ++j )
+                for ( size_t l = 0; l < kLanes; ++l )
+                    lanes_q[j][l] = q[( base + std::min( l, lanes - 1 ) ) * dof + j];
+            Frame<FkLanes> f;
+            chain( f, lanes_q, out + base * stride, stride, lanes, flange_only, std::make_index_sequence<dof>() );
+        }
+    }
+};
+
+} // namespace wra
@@ -1,7 +1,3935 @@
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
 #include <string>
 
-int main()
+#include "amcl.hpp"
+#include "bench.hpp"
+#include "cloud_pipeline.hpp"
+#include "collision.hpp"
+#include "costmap.hpp"
+#include "dstar_lite.hpp"
+#include "dynamics.hpp"
+#include "esdf.hpp"
+#include "grid_search.hpp"
+#include "ilqr.hpp"
+#include "inverse_kinematics.hpp"
+#include "kalman.hpp"
+#include "kinematics.hpp"
+#include "mpc.hpp"
+#include "occupancy_map.hpp"
+#include "parallel_rrt_star.hpp"
+#include "place_recognition.hpp"
+#include "pose_graph.hpp"
+#include "roadmap.hpp"
+#include "sampling_planner.hpp"
+#include "scan_matching.hpp"
+#include "spatial_index.hpp"
+#include "topp_ra.hpp"
+#include "trajectory_optimizer.hpp"
+
+using namespace wra;
+
+// Usage: mingw_test [--filter=substr] [--warmup=N] [--reps=N] [--json[=path|-]] [--list] [--quick]
+//        plus module-specific --key=value parameters.
+
+static void register_baseline()
+{
+    bench::add( "baseline/string", []( bench::Context& ctx ) {
+        std::string hello = "Hello C++!";
+        bench::do_not_optimize( hello );
+        ctx.items( 1 );
+    } );
+}
+
+// Warehouse-like map: rack rows with cross aisles plus scattered clutter.
+static PlanningGrid make_warehouse_grid( int nx, int ny, int nz, uint32_t seed )
+{
+    PlanningGrid grid( nx, ny, nz );
+    std::mt19937 rng( seed );
+    std::uniform_int_distribution<int> coin( 0, 99 );
+    for ( int z = 0; z < nz; ++z )
+        for ( int y = 0; y < ny; ++y )
+            for ( int x = 0; x < nx; ++x )
+            {
+                bool rack = ( y % 12 ) >= 8 && ( x % 64 ) >= 6;
+                if ( rack || coin( rng ) < 3 )
+                    grid.set_cost( Cell{ x, y, z }, PlanningGrid::kBlocked );
+            }
+    return grid;
+}
+
+static std::vector<std::pair<Cell, Cell>> make_queries( const PlanningGrid& grid, int count, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::uniform_int_distribution<int> rx( 0, grid.nx() - 1 );
+    std::uniform_int_distribution<int> ry( 0, grid.ny() - 1 );
+    std::uniform_int_distribution<int> rz( 0, grid.nz() - 1 );
+    std::vector<std::pair<Cell, Cell>> out;
+    while ( static_cast<int>( out.size() ) < count )
+    {
+        Cell a{ rx( rng ), ry( rng ), rz( rng ) };
+        Cell b{ rx( rng ), ry( rng ), rz( rng ) };
+        if ( grid.free( a ) && grid.free( b ) )
+            out.emplace_back( a, b );
+    }
+    return out;
+}
+
+// Textbook A* with a node-based priority queue and per-query tables, kept
+// as the reference the flat-array planner is measured against. Sums are
+// 64-bit and paths whose key reaches kInfinity are dropped, as GridAStar
+// does, so both agree on costs near the 32-bit limit.
+static uint32_t reference_astar( const PlanningGrid& grid, Cell start, Cell goal )
+{
+    auto neighbors = make_neighbors( grid );
+    std::vector<uint64_t> g( grid.size(), GridAStar::kInfinity );
+    std::vector<bool> closed( grid.size(), false );
+    using Entry = std::pair<uint64_t, size_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    size_t s = grid.index( start );
+    size_t t = grid.index( goal );
+    g[s] = 0;
+    open.emplace( octile_distance( start, goal ), s );
+    while ( !open.empty() )
+    {
+        size_t u = open.top().second;
+        open.pop();
+        if ( closed[u] )
+            continue;
+        closed[u] = true;
+        if ( u == t )
+            return static_cast<uint32_t>( g[t] );
+        for ( const GridNeighbor& n : neighbors )
+        {
+            if ( !can_move( grid.data(), u, n ) )
+                continue;
+            size_t v = u + n.offset;
+            uint64_t gv = g[u] + uint64_t( n.cost ) * grid.at( v );
+            uint64_t key = gv + octile_distance( grid.cell( v ), goal );
+            if ( closed[v] || key >= GridAStar::kInfinity || gv >= g[v] )
+                continue;
+            g[v] = gv;
+            open.emplace( key, v );
+        }
+    }
+    return GridAStar::kInfinity;
+}
+
+static void register_grid_planner()
+{
+    struct State
+    {
+        PlanningGrid grid;
+        std::vector<std::pair<Cell, Cell>> queries;
+        std::unique_ptr<GridPlanner> planner;
+        GridPath path;
+    };
+
+    for ( int dims = 2; dims <= 3; ++dims )
+    {
+        auto st = std::make_shared<State>();
+        auto setup = [st, dims]( bench::Context& ctx ) {
+            if ( st->planner )
+                return;
+            int n = dims == 2 ? ( ctx.quick() ? 512 : static_cast<int>( ctx.param( "grid", 2048.0 ) ) )
+                              : ( ctx.quick() ? 48 : 128 );
+            st->grid = make_warehouse_grid( n, n, dims == 2 ? 1 : n, 7 );
+            // Cross-facility routes: start in the left eighth, goal in the right.
+            for ( const auto& q : make_queries( st->grid, 256, 11 ) )
+                if ( q.first.x < n / 8 && q.second.x >= n - n / 8 )
+                    st->queries.push_back( q );
+            if ( st->queries.empty() )
+                st->queries = make_queries( st->grid, 16, 11 );
+            st->planner.reset( new GridPlanner( st->grid ) );
+            // Build the hierarchy outside the timed loop.
+            if ( dims == 2 )
+                st->planner->plan( st->queries[0].first, st->queries[0].second, st->path, GridSearchMode::Hierarchical );
+        };
+        std::string tag = dims == 2 ? "2d" : "3d";
+
+        for ( GridSearchMode mode : { GridSearchMode::AStar, GridSearchMode::JumpPoint, GridSearchMode::Hierarchical } )
+        {
+            if ( dims == 3 && mode != GridSearchMode::AStar )
+                continue;
+            bench::add( std::string( "grid/" ) + to_string( mode ) + "_" + tag, [st, mode]( bench::Context& ctx ) {
+                const auto& q = st->queries[ctx.iteration() % st->queries.size()];
+                st->planner->plan( q.first, q.second, st->path, mode );
+                ctx.counter( "expanded", static_cast<double>( st->planner->stats().expanded ) );
+                ctx.counter( "cost", st->path.cost );
+            }, setup );
+        }
+
+        bench::add( "grid/astar_reference_" + tag, [st]( bench::Context& ctx ) {
+            const auto& q = st->queries[ctx.iteration() % st->queries.size()];
+            ctx.counter( "cost", reference_astar( st->grid, q.first, q.second ) );
+        }, setup );
+    }
+}
+
+// A person stepping into the aisle: each batch clears the previous blob and
+// blocks a 3x3 blob on the original route. The stream is cyclic, so replaying
+// it any number of times leaves the grid consistent.
+static std::vector<std::vector<CellUpdate>> make_aisle_stream( const PlanningGrid& grid, const GridPath& route,
+                                                               int batches, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::uniform_int_distribution<size_t> pick( 1, route.cells.size() - 2 );
+    std::vector<std::vector<CellUpdate>> blobs( batches );
+    for ( auto& blob : blobs )
+    {
+        Cell c = route.cells[pick( rng )];
+        for ( int dy = -1; dy <= 1; ++dy )
+            for ( int dx = -1; dx <= 1; ++dx )
+            {
+                Cell b{ c.x + dx, c.y + dy, c.z };
+                if ( grid.inside( b ) && b != route.cells.front() && b != route.cells.back() )
+                    blob.push_back( CellUpdate{ b, PlanningGrid::kBlocked } );
+            }
+    }
+
+    std::vector<std::vector<CellUpdate>> stream( batches );
+    for ( int i = 0; i < batches; ++i )
+    {
+        for ( CellUpdate u : blobs[( i + batches - 1 ) % batches] )
+        {
+            u.cost = grid.cost( u.cell );
+            stream[i].push_back( u );
+        }
+        stream[i].insert( stream[i].end(), blobs[i].begin(), blobs[i].end() );
+    }
+    return stream;
+}
+
+static void register_dstar_lite()
+{
+    struct State
+    {
+        PlanningGrid grid;
+        Cell start;
+        Cell goal;
+        std::vector<std::vector<CellUpdate>> stream;
+        std::unique_ptr<DStarLite> dstar;
+        std::unique_ptr<GridAStar> astar;
+        GridPath path;
+    };
+
+    auto setup = []( State& st, bench::Context& ctx ) {
+        int n = ctx.quick() ? 256 : static_cast<int>( ctx.param( "dstar_grid", 1024.0 ) );
+        st.grid = make_warehouse_grid( n, n, 1, 5 );
+        GridAStar astar( st.grid );
+        // Prefer a cross-warehouse route; reseed the queries until one is
+        // solvable and long enough to drop blobs on, dropping the
+        // cross-warehouse filter if the first few seeds find none.
+        st.path = GridPath();
+        for ( uint32_t seed = 13; st.path.cells.size() < 3; ++seed )
+        {
+            bool cross = seed < 13 + 16;
+            for ( const auto& q : make_queries( st.grid, 256, seed ) )
+                if ( ( !cross || ( q.first.x < n / 8 && q.second.x >= n - n / 8 ) ) &&
+                     astar.plan( q.first, q.second, st.path ) && st.path.cells.size() >= 3 )
+                    break;
+        }
+        st.start = st.path.cells.front();
+        st.goal = st.path.cells.back();
+        st.stream = make_aisle_stream( st.grid, st.path, 64, 17 );
+    };
+
+    auto incremental = std::make_shared<State>();
+    bench::add( "dstar/replan_2d", [incremental]( bench::Context& ctx ) {
+        State& st = *incremental;
+        st.dstar->apply( st.stream[ctx.iteration() % st.stream.size()] );
+        st.dstar->plan( st.path );
+        ctx.counter( "expanded", static_cast<double>( st.dstar->stats().expanded ) );
+        ctx.counter( "cost", st.path.cost );
+    }, [incremental, setup]( bench::Context& ctx ) {
+        setup( *incremental, ctx );
+        incremental->dstar.reset( new DStarLite( incremental->grid ) );
+        incremental->dstar->reset( incremental->start, incremental->goal );
+        incremental->dstar->plan( incremental->path );
+    } );
+
+    auto scratch = std::make_shared<State>();
+    bench::add( "dstar/astar_from_scratch_2d", [scratch]( bench::Context& ctx ) {
+        State& st = *scratch;
+        for ( const CellUpdate& u : st.stream[ctx.iteration() % st.stream.size()] )
+            st.grid.set_cost( u.cell, u.cost );
+        st.astar->plan( st.start, st.goal, st.path );
+        ctx.counter( "expanded", static_cast<double>( st.astar->stats().expanded ) );
+        ctx.counter( "cost", st.path.cost );
+    }, [scratch, setup]( bench::Context& ctx ) {
+        setup( *scratch, ctx );
+        scratch->astar.reset( new GridAStar( scratch->grid ) );
+    } );
+}
+
+// Obstacle-only costmap: room walls, shelving and sensor speckle.
+static Costmap make_obstacle_costmap( int width, int height, double resolution, uint32_t seed )
+{
+    Costmap map( width, height, resolution );
+    std::mt19937 rng( seed );
+    std::uniform_int_distribution<int> coin( 0, 999 );
+    for ( int y = 0; y < height; ++y )
+        for ( int x = 0; x < width; ++x )
+        {
+            bool wall = x == 0 || y == 0 || x == width - 1 || y == height - 1;
+            bool shelf = ( y % 40 ) < 3 && ( x % 100 ) > 20;
+            if ( wall || shelf || coin( rng ) < 4 )
+                map.at( x, y ) = Costmap::kLethal;
+        }
+    return map;
+}
+
+// Stamps a disc of decaying cost around every obstacle cell.
+static void reference_inflate( const InflationLayer& layer, const Costmap& in, Costmap& out )
+{
+    const int r = layer.radius_cells();
+    out.clear();
+    for ( int y = 0; y < in.height(); ++y )
+        for ( int x = 0; x < in.width(); ++x )
+        {
+            if ( in.at( x, y ) < Costmap::kLethal )
+                continue;
+            for ( int dy = -r; dy <= r; ++dy )
+                for ( int dx = -r; dx <= r; ++dx )
+                {
+                    int cx = x + dx;
+                    int cy = y + dy;
+                    if ( cx < 0 || cy < 0 || cx >= in.width() || cy >= in.height() || dx * dx + dy * dy > r * r )
+                        continue;
+                    uint8_t c = layer.cost_at( std::sqrt( double( dx * dx + dy * dy ) ) * in.resolution() );
+                    out.at( cx, cy ) = std::max( out.at( cx, cy ), c );
+                }
+        }
+}
+
+static void register_costmap()
+{
+    struct State
+    {
+        Costmap obstacles;
+        Costmap inflated;
+        std::unique_ptr<InflationLayer> layer;
+    };
+
+    // 10 cm cells over a 40 m x 40 m window around the robot.
+    auto setup = []( State& st, bench::Context& ctx, SimdLevel level ) {
+        int n = ctx.quick() ? 200 : 400;
+        st.obstacles = make_obstacle_costmap( n, n, 0.1, 3 );
+        st.inflated = Costmap( n, n, 0.1 );
+        InflationParams params;
+        params.inflation_radius = ctx.param( "inflation_radius", 1.0 );
+        st.layer.reset( new InflationLayer( params, 0.1, level ) );
+    };
+
+    SimdLevel best = detect_simd();
+    for ( SimdLevel level : { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2 } )
+    {
+        if ( static_cast<int>( level ) > static_cast<int>( best ) )
+            continue;
+        auto st = std::make_shared<State>();
+        bench::add( std::string( "costmap/inflate_" ) + to_string( level ), [st]( bench::Context& ctx ) {
+            st->layer->inflate( st->obstacles, st->inflated );
+            ctx.items( static_cast<double>( st->obstacles.width() ) * st->obstacles.height() );
+            // Cells that differ from the brute-force reference.
+            if ( ctx.iteration() == 0 )
+            {
+                Costmap expected( st->obstacles.width(), st->obstacles.height(), 0.1 );
+                reference_inflate( *st->layer, st->obstacles, expected );
+                size_t mismatches = 0;
+                for ( int y = 0; y < expected.height(); ++y )
+                    for ( int x = 0; x < expected.width(); ++x )
+                        mismatches += st->inflated.at( x, y ) != expected.at( x, y );
+                ctx.counter( "mismatches", static_cast<double>( mismatches ) );
+            }
+        }, [st, setup, level]( bench::Context& ctx ) { setup( *st, ctx, level ); } );
+    }
+
+    auto ref = std::make_shared<State>();
+    bench::add( "costmap/inflate_reference", [ref]( bench::Context& ctx ) {
+        reference_inflate( *ref->layer, ref->obstacles, ref->inflated );
+        ctx.items( static_cast<double>( ref->obstacles.width() ) * ref->obstacles.height() );
+    }, [ref, setup]( bench::Context& ctx ) { setup( *ref, ctx, SimdLevel::Scalar ); } );
+}
+
+static std::vector<uint8_t> make_voxel_scene( int nx, int ny, int nz, uint32_t seed )
+{
+    std::vector<uint8_t> occupied( static_cast<size_t>( nx ) * ny * nz, 0 );
+    std::mt19937 rng( seed );
+    std::uniform_int_distribution<int> coin( 0, 999 );
+    for ( int z = 0; z < nz; ++z )
+        for ( int y = 0; y < ny; ++y )
+            for ( int x = 0; x < nx; ++x )
+            {
+                bool floor = nz > 1 && z == 0;
+                bool shelf = ( y % 40 ) < 3 && ( x % 100 ) > 20 && z < nz / 2;
+                if ( floor || shelf || coin( rng ) < 2 )
+                    occupied[( static_cast<size_t>( z ) * ny + y ) * nx + x] = 1;
+            }
+    return occupied;
+}
+
+// Worker count of the shared pool: --threads, else the hardware threads.
+static unsigned bench_threads( const bench::Context& ctx )
+{
+    return std::max( 1u, static_cast<unsigned>( ctx.param( "threads", double( std::thread::hardware_concurrency() ) ) ) );
+}
+
+static ThreadPool& bench_pool( bench::Context& ctx )
+{
+    static ThreadPool pool( bench_threads( ctx ) );
+    return pool;
+}
+
+// Files the benches generate go under --data_dir, by default a directory
+// of their own in the system temp directory, and are deleted when the run
+// ends, so nothing is left where the binary was started. Closers release
+// handles such as file mappings first; Windows cannot delete a mapped file.
+struct BenchScratch
+{
+    std::filesystem::path dir;
+    bool created = false;
+    std::vector<std::string> files;
+    std::vector<std::function<void()>> closers;
+};
+
+static BenchScratch& bench_scratch()
+{
+    static BenchScratch scratch;
+    return scratch;
+}
+
+// Directory for generated files, with a trailing separator.
+static std::string bench_data_dir( bench::Context& ctx )
+{
+    BenchScratch& s = bench_scratch();
+    if ( s.dir.empty() )
+    {
+        std::string given = ctx.param( "data_dir", "" );
+        std::error_code ec;
+        s.dir = given.empty() ? std::filesystem::temp_directory_path( ec ) /
+                                    ( "wra_bench_" + std::to_string( std::chrono::steady_clock::now().time_since_epoch().count() ) )
+                              : std::filesystem::path( given );
+        s.created = std::filesystem::create_directories( s.dir, ec );
+    }
+    return ( s.dir / "" ).string();
+}
+
+// Marks a generated file for deletion at exit and returns its path.
+static std::string track_bench_file( const std::string& path )
+{
+    bench_scratch().files.push_back( path );
+    return bench_scratch().files.back();
+}
+
+static void remove_bench_data()
+{
+    BenchScratch& s = bench_scratch();
+    for ( auto& close : s.closers )
+        close();
+    std::error_code ec;
+    for ( const std::string& f : s.files )
+        std::filesystem::remove( f, ec );
+    if ( s.created )
+        std::filesystem::remove( s.dir, ec );
+}
+
+static void register_esdf()
+{
+    constexpr float kEsdfTruncation = 2.0f; // m
+    struct State
+    {
+        std::vector<uint8_t> occupied;
+        DistanceField field;
+        EsdfBuilder builder;
+        std::unique_ptr<IncrementalDistanceField> incremental;
+        std::mt19937 rng{ 5 };
+    };
+
+    for ( int dims = 2; dims <= 3; ++dims )
+    {
+        std::string tag = dims == 2 ? "2d" : "3d";
+        auto st = std::make_shared<State>();
+        auto setup = [st, dims]( bench::Context& ctx ) {
+            int n = dims == 2 ? ( ctx.quick() ? 256 : 1024 ) : ( ctx.quick() ? 48 : 128 );
+            int nz = dims == 2 ? 1 : n;
+            st->occupied = make_voxel_scene( n, n, nz, 9 );
+            st->field = DistanceField( n, n, nz, 0.1 );
+        };
+
+        for ( bool parallel : { false, true } )
+            bench::add( "esdf/batch_" + tag + ( parallel ? "_pool" : "_serial" ), [st, parallel]( bench::Context& ctx ) {
+                st->builder.compute( st->occupied, st->field, parallel ? &bench_pool( ctx ) : nullptr );
+                ctx.items( static_cast<double>( st->field.size() ) );
+                if ( parallel )
+                    ctx.counter( "threads", bench_pool( ctx ).size() );
+            }, setup );
+
+        // A sensor frame toggles a handful of voxels; only their wave is redone.
+        // The first rep checks the repaired field against a batch transform
+        // of the same occupancy inside the truncation band.
+        bench::add( "esdf/incremental_" + tag, [st]( bench::Context& ctx ) {
+            const DistanceField& f = st->incremental->field();
+            for ( int k = 0; k < 64; ++k )
+            {
+                size_t i = st->rng() % f.size();
+                st->occupied[i] = !st->occupied[i];
+                st->incremental->set_occupied( f.cell( i ), st->occupied[i] != 0 );
+            }
+            ctx.counter( "voxels_updated", static_cast<double>( st->incremental->update() ) );
+            if ( ctx.iteration() == 0 )
+            {
+                st->builder.compute( st->occupied, st->field );
+                size_t mismatches = 0;
+                for ( size_t i = 0; i < f.size(); ++i )
+                {
+                    float ref = st->field.data()[i];
+                    if ( std::fabs( ref ) < kEsdfTruncation && std::fabs( f.data()[i] - ref ) > 1e-4f )
+                        ++mismatches;
+                }
+                ctx.counter( "mismatches", static_cast<double>( mismatches ) );
+            }
+        }, [st, setup]( bench::Context& ctx ) {
+            setup( ctx );
+            const DistanceField& f = st->field;
+            st->incremental.reset( new IncrementalDistanceField( f.nx(), f.ny(), f.nz(), f.resolution(), kEsdfTruncation ) );
+            st->incremental->reset( st->occupied );
+        } );
+    }
+}
+
+// Unit box split by a wall at x0 = 0.5 with one slot through it. The slot
+// is narrow in x1 (and x2 above two dimensions), so uniform sampling rarely
+// lands in it, and sits off the start-goal line so goal bias cannot steer
+// straight through.
+static SamplingProblem make_narrow_passage( int dim, float gap )
+{
+    SamplingProblem p;
+    p.dim = dim;
+    p.lower.assign( dim, 0.0f );
+    p.upper.assign( dim, 1.0f );
+    p.start.assign( dim, 0.5f );
+    p.goal.assign( dim, 0.5f );
+    p.start[0] = 0.1f;
+    p.goal[0] = 0.9f;
+    p.start[1] = 0.1f;
+    p.goal[1] = 0.9f;
+    p.goal_tolerance = 0.05f;
+    p.resolution = 0.01f;
+    int slot_dims = dim > 2 ? 2 : 1;
+    p.valid = [gap, slot_dims]( const float* q ) {
+        if ( q[0] < 0.45f || q[0] > 0.55f )
+            return true;
+        for ( int d = 1; d <= slot_dims; ++d )
+            if ( std::fabs( q[d] - 0.75f ) > gap / 2 )
+                return false;
+        return true;
+    };
+    return p;
+}
+
+static void register_sampling_planners()
+{
+    for ( int dim : { 2, 6 } )
+    {
+        SamplingProblem problem = make_narrow_passage( dim, dim == 2 ? 0.03f : 0.15f );
+        for ( SamplingAlgorithm algorithm : { SamplingAlgorithm::Rrt, SamplingAlgorithm::RrtConnect,
+                                              SamplingAlgorithm::RrtStar, SamplingAlgorithm::InformedRrtStar } )
+            for ( NearestIndexKind index : { NearestIndexKind::Brute, NearestIndexKind::KdTree, NearestIndexKind::Gnat } )
+            {
+                auto planner = std::make_shared<SamplingPlanner>( problem, SamplingOptions() );
+                auto result = std::make_shared<SamplingResult>();
+                bool optimizing = algorithm == SamplingAlgorithm::RrtStar || algorithm == SamplingAlgorithm::InformedRrtStar;
+                std::string name = std::string( "sampling/" ) + to_string( algorithm ) + "_" + to_string( index ) + "_" +
+                                   std::to_string( dim ) + "d";
+                bench::add( name, [planner, result]( bench::Context& ctx ) {
+                    SamplingOptions options = planner->options();
+                    options.seed = static_cast<uint32_t>( ctx.iteration() + 1 );
+                    planner->set_options( options );
+                    planner->solve( *result );
+                    ctx.counter( "solved", result->solved );
+                    ctx.counter( "cost", result->solved ? result->cost : 0.0 );
+                    ctx.counter( "nodes", static_cast<double>( result->nodes ) );
+                    ctx.counter( "state_checks", static_cast<double>( result->state_checks ) );
+                    ctx.items( static_cast<double>( result->iterations ) );
+                }, [planner, algorithm, index, optimizing, dim]( bench::Context& ctx ) {
+                    SamplingOptions options;
+                    options.algorithm = algorithm;
+                    options.index = index;
+                    options.step = dim == 2 ? 0.05f : 0.5f;
+                    // RRT* variants run a fixed sample budget; the others
+                    // stop at the first solution.
+                    options.max_iterations = optimizing ? ( ctx.quick() ? 3000 : 10000 ) : 200000;
+                    options.max_nodes = options.max_iterations;
+                    planner->set_options( options );
+                } );
+            }
+    }
+}
+
+// Cost reached within a fixed wall-clock budget for 1, 2, 4, ... workers up
+// to the pool size, so rows read as a cost-vs-threads curve at equal time.
+static void register_parallel_rrt_star( const bench::Options& bench_options )
+{
+    const unsigned pool_threads = bench_threads( bench::Context( bench_options ) );
+    for ( int dim : { 2, 6 } )
+    {
+        SamplingProblem problem = make_narrow_passage( dim, dim == 2 ? 0.03f : 0.15f );
+        for ( unsigned threads = 1; threads <= pool_threads; threads *= 2 )
+        {
+            auto planner = std::make_shared<ParallelRrtStar>( problem, ParallelRrtStarOptions() );
+            auto result = std::make_shared<ParallelRrtStarResult>();
+            std::string name = "parallel_rrt_star/" + std::to_string( dim ) + "d_t" + std::to_string( threads );
+            bench::add( name, [planner, result, threads]( bench::Context& ctx ) {
+                ParallelRrtStarOptions options = planner->options();
+                options.seed = static_cast<uint32_t>( ctx.iteration() + 1 );
+                planner->set_options( options );
+                ThreadPool& pool = bench_pool( ctx );
+                planner->solve( *result, &pool, threads );
+                ctx.counter( "threads", std::min( threads, pool.size() ) );
+                ctx.counter( "solved", result->solved );
+                ctx.counter( "cost", result->solved ? result->cost : 0.0 );
+                ctx.counter( "first_solution_ms", result->first_solution_ms );
+                ctx.counter( "nodes", static_cast<double>( result->nodes ) );
+                ctx.counter( "rewires", static_cast<double>( result->rewires ) );
+                ctx.items( static_cast<double>( result->iterations ) );
+            }, [planner, dim]( bench::Context& ctx ) {
+                ParallelRrtStarOptions options;
+                options.step = dim == 2 ? 0.05f : 0.5f;
+                options.time_limit_ms = ctx.param( "budget_ms", ctx.quick() ? 20.0 : 100.0 );
+                options.max_nodes = 200000;
+                planner->set_options( options );
+            } );
+        }
+    }
+}
+
+// Valid start/goal pairs on opposite sides of the passage wall.
+static std::vector<std::pair<std::vector<float>, std::vector<float>>> make_passage_queries( const SamplingProblem& p,
+                                                                                           int count, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::uniform_real_distribution<float> u( 0.0f, 1.0f );
+    auto sample = [&]( float lo, float hi ) {
+        std::vector<float> q( p.dim );
+        do
+        {
+            for ( float& x : q )
+                x = u( rng );
+            q[0] = lo + ( hi - lo ) * q[0];
+        } while ( !p.valid( q.data() ) );
+        return q;
+    };
+    std::vector<std::pair<std::vector<float>, std::vector<float>>> out;
+    for ( int i = 0; i < count; ++i )
+    {
+        auto a = sample( 0.0f, 0.4f );
+        out.emplace_back( a, sample( 0.6f, 1.0f ) );
+    }
+    return out;
+}
+
+// Offline build and save against startup from the mapped file. The
+// startup cases open a file and answer one query on it, which is what a
+// planner process pays at boot instead of a build.
+static void register_roadmap()
+{
+    struct State
+    {
+        SamplingProblem problem;
+        RoadmapOptions options;
+        RoadmapBuilder builder;
+        Roadmap eager;
+        Roadmap lazy;
+        std::string eager_path;
+        std::string lazy_path;
+        RoadmapFile file;
+        std::unique_ptr<PrmPlanner> planner;
+        std::vector<std::pair<std::vector<float>, std::vector<float>>> queries;
+        PrmResult result;
+    };
+
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( !st->queries.empty() )
+            return;
+        st->problem = make_narrow_passage( 6, 0.15f );
+        st->options.vertices = ctx.quick() ? 2000 : 5000;
+        // Written under --data_dir and deleted at exit unless --roadmap
+        // names a place to keep them.
+        std::string base = ctx.param( "roadmap", "" );
+        bool scratch = base.empty();
+        if ( scratch )
+            base = bench_data_dir( ctx ) + "roadmap_6d";
+        st->eager_path = base + "_eager.bin";
+        st->lazy_path = base + "_lazy.bin";
+        if ( scratch )
+        {
+            track_bench_file( st->eager_path );
+            track_bench_file( st->lazy_path );
+            bench_scratch().closers.push_back( [st] {
+                st->planner.reset();
+                st->file.close();
+            } );
+        }
+        st->options.lazy = false;
+        st->builder.build( st->problem, st->options, st->eager );
+        st->options.lazy = true;
+        st->builder.build( st->problem, st->options, st->lazy );
+        save_roadmap( st->eager_path, st->eager.view() );
+        save_roadmap( st->lazy_path, st->lazy.view() );
+        st->queries = make_passage_queries( st->problem, 64, 17 );
+    };
+    auto report = []( bench::Context& ctx, const PrmResult& r ) {
+        ctx.counter( "solved", r.solved );
+        ctx.counter( "cost", r.solved ? r.cost : 0.0 );
+        ctx.counter( "edges_checked", static_cast<double>( r.edges_checked ) );
+        ctx.counter( "edges_invalidated", static_cast<double>( r.edges_invalidated ) );
+    };
+
+    for ( bool lazy : { false, true } )
+        bench::add( std::string( "prm/build_" ) + ( lazy ? "lazy" : "eager" ) + "_6d", [st, lazy]( bench::Context& ctx ) {
+            Roadmap map;
+            RoadmapOptions options = st->options;
+            options.lazy = lazy;
+            st->builder.build( st->problem, options, map );
+            ctx.items( options.vertices );
+            ctx.counter( "edges", map.targets.size() / 2 );
+            ctx.counter( "state_checks", static_cast<double>( st->builder.state_checks() ) );
+        }, setup );
+
+    bench::add( "prm/save_6d", [st]( bench::Context& ctx ) {
+        ctx.counter( "ok", save_roadmap( st->eager_path, st->eager.view() ) );
+        ctx.items( st->eager.offsets.size() - 1 );
+    }, setup );
+
+    for ( bool lazy : { false, true } )
+        bench::add( std::string( "prm/startup_mmap_" ) + ( lazy ? "lazy" : "eager" ) + "_6d",
+                    [st, report, lazy]( bench::Context& ctx ) {
+            RoadmapFile file;
+            if ( !file.open( lazy ? st->lazy_path : st->eager_path ) )
+                return;
+            PrmPlanner planner( file.view(), st->problem );
+            const auto& q = st->queries[ctx.iteration() % st->queries.size()];
+            PrmResult r;
+            planner.query( q.first.data(), q.second.data(), r );
+            report( ctx, r );
+            ctx.counter( "vertices", file.view().vertices );
+        }, setup );
+
+    // What a process that does not trust the file adds to startup: a full
+    // read of the mapping.
+    bench::add( "prm/validate_mmap_6d", [st]( bench::Context& ctx ) {
+        RoadmapFile file;
+        ctx.counter( "ok", file.open( st->eager_path ) && file.validate() );
+        ctx.items( file.view().edges );
+    }, setup );
+
+    for ( bool lazy : { false, true } )
+        bench::add( std::string( "prm/query_" ) + ( lazy ? "lazy_mmap" : "eager" ) + "_6d",
+                    [st, report]( bench::Context& ctx ) {
+            const auto& q = st->queries[ctx.iteration() % st->queries.size()];
+            st->planner->query( q.first.data(), q.second.data(), st->result );
+            report( ctx, st->result );
+        }, [st, setup, lazy]( bench::Context& ctx ) {
+            setup( ctx );
+            if ( lazy )
+            {
+                // Edge states settled by earlier reps stay in the private mapping.
+                st->file.open( st->lazy_path );
+                st->planner.reset( new PrmPlanner( st->file.view(), st->problem ) );
+            }
+            else
+                st->planner.reset( new PrmPlanner( st->eager.view(), st->problem ) );
+        } );
+}
+
+// Shelved workcell: a floor mesh, a table and clutter boxes on it, all
+// within reach of a six-link arm standing at the origin.
+static CollisionWorld make_workcell( int clutter, uint32_t seed )
+{
+    CollisionWorld world;
+    const int n = 40;
+    std::vector<Vec3> vertices;
+    std::vector<uint32_t> indices;
+    for ( int y = 0; y <= n; ++y )
+        for ( int x = 0; x <= n; ++x )
+            vertices.emplace_back( -2.0 + 4.0 * x / n, -2.0 + 4.0 * y / n, -0.1 );
+    for ( int y = 0; y < n; ++y )
+        for ( int x = 0; x < n; ++x )
+        {
+            uint32_t a = y * ( n + 1 ) + x;
+            indices.insert( indices.end(), { a, a + 1, a + n + 1, a + 1, a + n + 2, a + n + 1 } );
+        }
+    world.add_mesh( vertices, indices );
+    world.add( ConvexShape::box( 0.4, 0.8, 0.02 ), Isometry3( Mat3(), { 0.9, 0.0, 0.4 } ) );
+
+    std::mt19937 rng( seed );
+    std::uniform_real_distribution<double> u( 0.0, 1.0 );
+    for ( int i = 0; i < clutter; ++i )
+    {
+        double h = 0.02 + 0.06 * u( rng );
+        Vec3 at( 0.55 + 0.7 * u( rng ), -0.75 + 1.5 * u( rng ), 0.42 + h );
+        world.add( ConvexShape::box( 0.02 + 0.05 * u( rng ), 0.02 + 0.05 * u( rng ), h ),
+                   Isometry3( rpy( 0.0, 0.0, 6.28 * u( rng ) ), at ) );
+    }
+    world.build();
+    return world;
+}
+
+// Capsule per link; joints alternate z and y axes, links extend along z.
+static RobotCollisionModel make_arm_model( int links, double length )
+{
+    RobotCollisionModel model;
+    for ( int i = 0; i < links; ++i )
+        model.add( i, ConvexShape::capsule( 0.05, 0.5 * length - 0.05 ), Isometry3( Mat3(), { 0, 0, 0.5 * length } ) );
+    for ( int i = 0; i < links; ++i )
+        for ( int j = i + 2; j < links; ++j )
+            model.self_pairs.emplace_back( i, j );
+    return model;
+}
+
+// Link poses for `configs` random joint vectors, one block per config.
+static std::vector<Isometry3> make_arm_poses( int links, double length, size_t configs, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::uniform_real_distribution<double> u( -2.5, 2.5 );
+    std::vector<Isometry3> poses( configs * links );
+    for ( size_t c = 0; c < configs; ++c )
+    {
+        Isometry3 frame;
+        for ( int i = 0; i < links; ++i )
+        {
+            Vec3 axis = i % 2 == 0 ? Vec3( 0, 0, 1 ) : Vec3( 0, 1, 0 );
+            frame = frame * Isometry3( axis_angle( axis, u( rng ) ), {} );
+            poses[c * links + i] = frame;
+            frame = frame * Isometry3( Mat3(), { 0, 0, length } );
+        }
+    }
+    return poses;
+}
+
+// Narrow phase on its own, then whole-arm checks through the hierarchy
+// against an all-pairs sweep of the same world. Items are checks, so
+// items/s reads as checks per second.
+static void register_collision()
+{
+    const int links = 6;
+    const double length = 0.3;
+
+    struct State
+    {
+        std::vector<std::pair<Isometry3, Isometry3>> pairs;
+        ConvexShape a = ConvexShape::box( 0.2, 0.1, 0.05 );
+        ConvexShape b = ConvexShape::capsule( 0.05, 0.2 );
+        NarrowPhase narrow;
+        CollisionWorld world;
+        RobotCollisionModel model;
+        std::unique_ptr<CollisionChecker> checker;
+        std::vector<Isometry3> poses;
+        std::vector<uint8_t> out;
+        size_t configs = 0;
+    };
+
+    auto st = std::make_shared<State>();
+    auto setup = [st, links, length]( bench::Context& ctx ) {
+        if ( st->checker )
+            return;
+        std::mt19937 rng( 3 );
+        std::uniform_real_distribution<double> u( -1.0, 1.0 );
+        for ( int i = 0; i < 4096; ++i )
+            st->pairs.emplace_back( Isometry3( rpy( 3 * u( rng ), 3 * u( rng ), 3 * u( rng ) ), {} ),
+                                    Isometry3( rpy( 3 * u( rng ), 3 * u( rng ), 3 * u( rng ) ),
+                                               { 0.4 * u( rng ), 0.4 * u( rng ), 0.4 * u( rng ) } ) );
+        st->world = make_workcell( ctx.quick() ? 100 : 400, 11 );
+        st->model = make_arm_model( links, length );
+        st->checker.reset( new CollisionChecker( st->world, st->model ) );
+        st->configs = ctx.quick() ? 256 : 2048;
+        st->poses = make_arm_poses( links, length, st->configs, 13 );
+        st->out.assign( st->configs, 0 );
+    };
+
+    bench::add( "collision/gjk_pairs", [st]( bench::Context& ctx ) {
+        size_t hits = 0;
+        for ( const auto& p : st->pairs )
+            hits += st->narrow.intersect( st->a, p.first, st->b, p.second );
+        ctx.items( static_cast<double>( st->pairs.size() ) );
+        ctx.counter( "hit_rate", static_cast<double>( hits ) / st->pairs.size() );
+    }, setup );
+
+    bench::add( "collision/epa_pairs", [st]( bench::Context& ctx ) {
+        double depth = 0.0;
+        Contact contact;
+        for ( const auto& p : st->pairs )
+            if ( st->narrow.penetration( st->a, p.first, st->b, p.second, contact ) )
+                depth = std::max( depth, contact.depth );
+        ctx.items( static_cast<double>( st->pairs.size() ) );
+        ctx.counter( "max_depth", depth );
+    }, setup );
+
+    bench::add( "collision/bvh_build", [st]( bench::Context& ctx ) {
+        st->world.build();
+        ctx.items( static_cast<double>( st->world.size() ) );
+        ctx.counter( "nodes", static_cast<double>( st->world.nodes().size() ) );
+    }, setup );
+
+    bench::add( "collision/robot_check", [st]( bench::Context& ctx ) {
+        st->checker->reset_stats();
+        size_t hits = 0;
+        for ( size_t c = 0; c < st->configs; ++c )
+            hits += st->checker->in_collision( st->poses.data() + c * st->model.links );
+        const CollisionStats& s = st->checker->stats();
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "colliding", static_cast<double>( hits ) / st->configs );
+        ctx.counter( "nodes_per_check", static_cast<double>( s.nodes_visited ) / st->configs );
+        ctx.counter( "narrow_per_check", static_cast<double>( s.narrow_tests ) / st->configs );
+    }, setup );
+
+    // Same answers without the hierarchy; mismatches against the BVH must be 0.
+    bench::add( "collision/robot_check_brute", [st]( bench::Context& ctx ) {
+        std::vector<Isometry3> poses( st->model.shapes.size() );
+        size_t hits = 0, mismatches = 0;
+        for ( size_t c = 0; c < st->configs; ++c )
+        {
+            const Isometry3* link_poses = st->poses.data() + c * st->model.links;
+            for ( size_t s = 0; s < poses.size(); ++s )
+                poses[s] = link_poses[st->model.shapes[s].link] * st->model.shapes[s].offset;
+            bool hit = false;
+            for ( const auto& p : st->model.self_pairs )
+                if ( !hit )
+                    hit = st->narrow.intersect( st->model.shapes[p.first].shape, poses[p.first],
+                                                st->model.shapes[p.second].shape, poses[p.second] );
+            for ( size_t s = 0; s < poses.size() && !hit; ++s )
+                hit = st->world.collides_brute( st->model.shapes[s].shape, poses[s], st->narrow );
+            hits += hit;
+            if ( ctx.iteration() == 0 )
+                mismatches += hit != st->checker->in_collision( link_poses );
+        }
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "colliding", static_cast<double>( hits ) / st->configs );
+        if ( ctx.iteration() == 0 )
+            ctx.counter( "mismatches", static_cast<double>( mismatches ) );
+    }, setup );
+
+    bench::add( "collision/robot_batch_pool", [st]( bench::Context& ctx ) {
+        ThreadPool& pool = bench_pool( ctx );
+        st->checker->check_batch( st->poses.data(), st->configs, st->out.data(), &pool );
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "threads", pool.size() );
+    }, setup );
+}
+
+// Generic per-joint matrix chain against the unrolled kernel and the
+// eight-lane batch, on the same random configurations. Items are FK calls.
+template <typename Model>
+static void register_kinematics_model( const std::string& tag )
+{
+    constexpr size_t dof = Model::dof;
+    struct State
+    {
+        std::vector<double> q;
+        std::vector<Isometry3> poses;
+        std::vector<Isometry3> reference;
+        size_t configs = 0;
+    };
+
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        st->configs = ctx.quick() ? 4096 : 65536;
+        std::mt19937 rng( 21 );
+        std::uniform_real_distribution<double> u( -3.0, 3.0 );
+        st->q.resize( st->configs * dof );
+        for ( double& x : st->q )
+            x = u( rng );
+        st->poses.resize( st->configs * dof );
+        st->reference.resize( st->configs * dof );
+        for ( size_t c = 0; c < st->configs; ++c )
+            forward_kinematics( Model::joints, dof, &st->q[c * dof], &st->reference[c * dof] );
+    };
+    // Largest element difference from the generic chain, over `stride`-spaced
+    // link poses (dof for flange-only output).
+    auto max_error = [st]( size_t stride ) {
+        double err = 0.0;
+        for ( size_t c = 0; c < st->configs; ++c )
+        {
+            const Isometry3& a = st->poses[c * stride + stride - 1];
+            const Isometry3& b = st->reference[c * dof + dof - 1];
+            for ( int i = 0; i < 3; ++i )
+            {
+                err = std::max( err, std::fabs( a.t[i] - b.t[i] ) );
+                for ( int j = 0; j < 3; ++j )
+                    err = std::max( err, std::fabs( a.R( i, j ) - b.R( i, j ) ) );
+            }
+        }
+        return err;
+    };
+
+    bench::add( "fk/generic_" + tag, [st]( bench::Context& ctx ) {
+        for ( size_t c = 0; c < st->configs; ++c )
+            forward_kinematics( Model::joints, dof, &st->q[c * dof], &st->poses[c * dof] );
+        ctx.items( static_cast<double>( st->configs ) );
+    }, setup );
+
+    bench::add( "fk/unrolled_" + tag, [st, max_error]( bench::Context& ctx ) {
+        for ( size_t c = 0; c < st->configs; ++c )
+            ForwardKinematics<Model>::compute( &st->q[c * dof], &st->poses[c * dof] );
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "max_err", max_error( dof ) );
+    }, setup );
+
+    bench::add( "fk/batch8_" + tag, [st, max_error]( bench::Context& ctx ) {
+        ForwardKinematics<Model>::compute_batch( st->q.data(), st->configs, st->poses.data() );
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "max_err", max_error( dof ) );
+    }, setup );
+
+    bench::add( "fk/batch8_flange_" + tag, [st, max_error]( bench::Context& ctx ) {
+        ForwardKinematics<Model>::end_effector_batch( st->q.data(), st->configs, st->poses.data() );
+        ctx.items( static_cast<double>( st->configs ) );
+        ctx.counter( "max_err", max_error( 1 ) );
+    }, setup );
+}
+
+static void register_kinematics()
+{
+    register_kinematics_model<Ur5>( "ur5" );
+    register_kinematics_model<Puma560>( "puma560" );
+    register_kinematics_model<Iiwa14>( "iiwa14" );
+}
+
+// Targets as flange poses of joint vectors, so every one is reachable.
+template <typename Model>
+static std::vector<Isometry3> make_reachable_targets( const std::vector<double>& q )
+{
+    std::vector<Isometry3> targets( q.size() / Model::dof );
+    for ( size_t i = 0; i < targets.size(); ++i )
+        targets[i] = ForwardKinematics<Model>::end_effector( &q[i * Model::dof] );
+    return targets;
+}
+
+// Solves over a target list. `seeded` gives every solve the zero vector
+// (a cold start); otherwise the solver warm-starts from its last answer.
+template <typename Model>
+static void run_ik( bench::Context& ctx, IkSolver<Model>& solver, const std::vector<Isometry3>& targets, bool seeded )
+{
+    const double zero[Model::dof] = {};
+    double q[Model::dof];
+    size_t converged = 0, hits = 0, iterations = 0, restarts = 0;
+    IkResult r;
+    for ( const Isometry3& t : targets )
+    {
+        converged += solver.solve( t, seeded ? zero : nullptr, q, r );
+        hits += r.cache_hit;
+        iterations += r.iterations;
+        restarts += r.restarts;
+    }
+    double n = static_cast<double>( targets.size() );
+    ctx.items( n );
+    ctx.counter( "converged", converged / n );
+    ctx.counter( "iterations", iterations / n );
+    ctx.counter( "restarts", restarts / n );
+    if ( solver.options().cache_capacity )
+        ctx.counter( "cache_hit", hits / n );
+}
+
+// Solves per second and convergence for: the closed form, DLS from a
+// cold seed, DLS warm-started along a trajectory, and a pick-and-place
+// cycle over a few bins with and without the pose cache.
+static void register_inverse_kinematics()
+{
+    struct State
+    {
+        std::vector<Isometry3> random_puma;
+        std::vector<Isometry3> random_ur5;
+        std::vector<Isometry3> random_iiwa;
+        std::vector<Isometry3> trajectory_iiwa;
+        std::vector<Isometry3> bins_iiwa;
+    };
+
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( !st->random_puma.empty() )
+            return;
+        size_t n = ctx.quick() ? 256 : 2048;
+        std::mt19937 rng( 31 );
+        std::uniform_real_distribution<double> u( -2.5, 2.5 );
+        auto random_q = [&]( size_t dof ) {
+            std::vector<double> q( n * dof );
+            for ( double& x : q )
+                x = u( rng );
+            return q;
+        };
+        st->random_puma = make_reachable_targets<Puma560>( random_q( 6 ) );
+        st->random_ur5 = make_reachable_targets<Ur5>( random_q( 6 ) );
+        st->random_iiwa = make_reachable_targets<Iiwa14>( random_q( 7 ) );
+
+        // Smooth joint-space sweep sampled at 1 kHz-like spacing.
+        std::vector<double> q( n * 7 );
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t j = 0; j < 7; ++j )
+                q[i * 7 + j] = 0.8 * std::sin( 0.002 * i * ( j + 1 ) + 0.3 * j );
+        st->trajectory_iiwa = make_reachable_targets<Iiwa14>( q );
+
+        // Sixteen pick bins and one place pose, visited in random order.
+        std::vector<double> bins = random_q( 7 );
+        bins.resize( 17 * 7 );
+        std::vector<Isometry3> poses = make_reachable_targets<Iiwa14>( bins );
+        std::uniform_int_distribution<size_t> pick( 0, 15 );
+        for ( size_t i = 0; i < n; ++i )
+            st->bins_iiwa.push_back( poses[i % 2 ? 16 : pick( rng )] );
+    };
+
+    auto uncached = [] {
+        IkOptions o;
+        o.cache_capacity = 0;
+        return o;
+    };
+
+    bench::add( "ik/analytic_puma560", [st, uncached]( bench::Context& ctx ) {
+        IkSolver<Puma560> solver( uncached() );
+        run_ik( ctx, solver, st->random_puma, false );
+    }, setup );
+
+    bench::add( "ik/dls_cold_puma560", [st, uncached]( bench::Context& ctx ) {
+        IkOptions o = uncached();
+        o.analytic = false;
+        IkSolver<Puma560> solver( o );
+        run_ik( ctx, solver, st->random_puma, true );
+    }, setup );
+
+    bench::add( "ik/dls_cold_ur5", [st, uncached]( bench::Context& ctx ) {
+        IkSolver<Ur5> solver( uncached() );
+        run_ik( ctx, solver, st->random_ur5, true );
+    }, setup );
+
+    bench::add( "ik/dls_cold_iiwa14", [st, uncached]( bench::Context& ctx ) {
+        IkSolver<Iiwa14> solver( uncached() );
+        run_ik( ctx, solver, st->random_iiwa, true );
+    }, setup );
+
+    bench::add( "ik/dls_warm_trajectory_iiwa14", [st, uncached]( bench::Context& ctx ) {
+        IkSolver<Iiwa14> solver( uncached() );
+        run_ik( ctx, solver, st->trajectory_iiwa, false );
+    }, setup );
+
+    for ( bool cached : { false, true } )
+        bench::add( std::string( "ik/pick_place_iiwa14" ) + ( cached ? "_cached" : "" ), [st, uncached, cached]( bench::Context& ctx ) {
+            IkSolver<Iiwa14> solver( cached ? IkOptions() : uncached() );
+            run_ik( ctx, solver, st->bins_iiwa, false );
+        }, setup );
+}
+
+// One rep is a second of a 1 kHz loop: 1000 calls over a joint-space
+// sweep, so p99 and max read as per-second jitter. Nothing in the call
+// path allocates; the workspace is the RigidBodyDynamics instance.
+template <typename Model>
+static void register_dynamics_model( const std::string& tag )
+{
+    constexpr size_t dof = Model::dof;
+    struct State
+    {
+        RigidBodyDynamics<Model> dynamics;
+        std::vector<double> q, qd, qdd;
+        double out[dof];
+        double M[dof][dof];
+        double J[6][dof];
+    };
+    const size_t steps = 1000;
+    auto st = std::make_shared<State>();
+    auto setup = [st, steps]( bench::Context& ) {
+        if ( !st->q.empty() )
+            return;
+        for ( size_t k = 0; k < steps; ++k )
+            for ( size_t j = 0; j < dof; ++j )
+            {
+                double t = 0.001 * k * ( j + 1 );
+                st->q.push_back( std::sin( t + j ) );
+                st->qd.push_back( std::cos( t + j ) * ( j + 1 ) );
+                st->qdd.push_back( -std::sin( t + j ) * ( j + 1 ) * ( j + 1 ) );
+            }
+    };
+
+    bench::add( "dyn/rnea_" + tag, [st, steps]( bench::Context& ctx ) {
+        for ( size_t k = 0; k < steps; ++k )
+            st->dynamics.inverse_dynamics( &st->q[k * dof], &st->qd[k * dof], &st->qdd[k * dof], st->out );
+        bench::do_not_optimize( st->out );
+        ctx.items( static_cast<double>( steps ) );
+    }, setup );
+
+    bench::add( "dyn/aba_" + tag, [st, steps]( bench::Context& ctx ) {
+        for ( size_t k = 0; k < steps; ++k )
+            st->dynamics.forward_dynamics( &st->q[k * dof], &st->qd[k * dof], &st->qdd[k * dof], st->out );
+        bench::do_not_optimize( st->out );
+        ctx.items( static_cast<double>( steps ) );
+    }, setup );
+
+    bench::add( "dyn/crba_" + tag, [st, steps]( bench::Context& ctx ) {
+        for ( size_t k = 0; k < steps; ++k )
+            st->dynamics.mass_matrix( &st->q[k * dof], st->M );
+        bench::do_not_optimize( st->M );
+        ctx.items( static_cast<double>( steps ) );
+    }, setup );
+
+    bench::add( "dyn/jacobian_" + tag, [st, steps]( bench::Context& ctx ) {
+        for ( size_t k = 0; k < steps; ++k )
+            st->dynamics.jacobian( &st->q[k * dof], st->J );
+        bench::do_not_optimize( st->J );
+        ctx.items( static_cast<double>( steps ) );
+    }, setup );
+
+    // Round trip ABA(RNEA(qdd)) == qdd on the sweep, as a sanity counter.
+    bench::add( "dyn/roundtrip_" + tag, [st, steps]( bench::Context& ctx ) {
+        double tau[dof], err = 0.0;
+        for ( size_t k = 0; k < steps; ++k )
+        {
+            st->dynamics.inverse_dynamics( &st->q[k * dof], &st->qd[k * dof], &st->qdd[k * dof], tau );
+            st->dynamics.forward_dynamics( &st->q[k * dof], &st->qd[k * dof], tau, st->out );
+            for ( size_t j = 0; j < dof; ++j )
+                err = std::max( err, std::fabs( st->out[j] - st->qdd[k * dof + j] ) );
+        }
+        ctx.items( static_cast<double>( steps ) );
+        ctx.counter( "max_err", err );
+    }, setup );
+}
+
+static void register_dynamics()
+{
+    register_dynamics_model<Ur5>( "ur5" );
+    register_dynamics_model<Iiwa14>( "iiwa14" );
+}
+
+// Baseline without TOPP-RA's coupling of the limits: at each stage half the
+// acceleration budget goes to sddot and half to the centripetal term
+// ddq * sdot^2, giving a local sdot cap and sddot cap. The profile rides
+// the caps with a trapezoid (forward and backward passes) between them,
+// starting and ending at rest.
+static double naive_trapezoid_duration( const ToppRa& topp, const double* vmax, const double* amax )
+{
+    const size_t dof = topp.dof();
+    const size_t n = topp.stages();
+    const auto& s = topp.path_s();
+    const auto& dq = topp.path_dq();
+    const auto& ddq = topp.path_ddq();
+    std::vector<double> v2( n ), sdd( n, 1e300 );
+    for ( size_t i = 0; i < n; ++i )
+    {
+        double sd = 1e300;
+        for ( size_t j = 0; j < dof; ++j )
+        {
+            double d = std::fabs( dq[i * dof + j] ), dd = std::fabs( ddq[i * dof + j] );
+            if ( d > 1e-12 )
+            {
+                sd = std::min( sd, vmax[j] / d );
+                sdd[i] = std::min( sdd[i], 0.5 * amax[j] / d );
+            }
+            if ( dd > 1e-12 )
+                sd = std::min( sd, std::sqrt( 0.5 * amax[j] / dd ) );
+        }
+        v2[i] = sd * sd;
+    }
+    v2.front() = v2.back() = 0.0;
+    for ( size_t i = 0; i + 1 < n; ++i )
+        v2[i + 1] = std::min( v2[i + 1], v2[i] + 2.0 * sdd[i] * ( s[i + 1] - s[i] ) );
+    for ( size_t i = n - 1; i > 0; --i )
+        v2[i - 1] = std::min( v2[i - 1], v2[i] + 2.0 * sdd[i] * ( s[i] - s[i - 1] ) );
+    double t = 0.0;
+    for ( size_t i = 0; i + 1 < n; ++i )
+        t += 2.0 * ( s[i + 1] - s[i] ) / ( std::sqrt( v2[i] ) + std::sqrt( v2[i + 1] ) );
+    return t;
+}
+
+// A 1000-waypoint smooth joint-space path for the iiwa, parameterised
+// under its datasheet velocity limits, a flat acceleration limit and
+// optionally a fraction of its torque limits; the default fraction is low
+// enough that torque, not acceleration, sets the pace on part of the path.
+// Counters report the resulting cycle time, against the decoupled
+// trapezoid for the velocity/acceleration case, and the worst limit ratio
+// seen on the output (should be <= 1).
+static void register_topp_ra()
+{
+    constexpr size_t dof = Iiwa14::dof;
+    struct State
+    {
+        std::vector<double> waypoints;
+        double vmax[dof] = { 1.48, 1.48, 1.75, 1.31, 2.27, 2.36, 2.36 };
+        double amax[dof] = { 8, 8, 8, 8, 8, 8, 8 };
+        double tmax[dof] = { 320, 320, 176, 176, 110, 40, 40 };
+        ToppRaResult result;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ) {
+        if ( !st->waypoints.empty() )
+            return;
+        const size_t n = 1000;
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t j = 0; j < dof; ++j )
+            {
+                double t = double( i ) / double( n - 1 );
+                st->waypoints.push_back( 0.8 * std::sin( 6.283185307179586 * t * double( j % 3 + 1 ) + double( j ) ) +
+                                         0.3 * std::sin( 7.0 * t + double( j ) ) );
+            }
+    };
+
+    for ( int torque = 0; torque < 2; ++torque )
+    {
+        auto topp = std::make_shared<ToppRa>( dof );
+        auto tlim = std::make_shared<std::vector<double>>( dof );
+        // Limits are set and the output is checked once, outside the timed
+        // reps; a rep is a single solve on the warm instance.
+        auto configure = [st, setup, topp, tlim, torque]( bench::Context& ctx ) {
+            setup( ctx );
+            double fraction = ctx.param( "torque_fraction", 0.18 );
+            for ( size_t j = 0; j < dof; ++j )
+                ( *tlim )[j] = st->tmax[j] * fraction;
+            topp->set_velocity_limits( st->vmax );
+            topp->set_acceleration_limits( st->amax );
+            if ( torque )
+                topp->set_torque_limits( tlim->data(), rnea_torque_model<Iiwa14>() );
+
+            ToppRaResult r;
+            if ( !topp->solve( st->waypoints.data(), st->waypoints.size() / dof, r ) )
+            {
+                ctx.counter( "failed_stage", static_cast<double>( r.failed_stage ) );
+                return;
+            }
+            double vr = 0.0, ar = 0.0, tr = 0.0;
+            RigidBodyDynamics<Iiwa14> dyn;
+            for ( size_t i = 0; i < r.time.size(); ++i )
+            {
+                double tau[dof];
+                if ( torque )
+                    dyn.inverse_dynamics( &topp->path_q()[i * dof], &r.velocity[i * dof], &r.acceleration[i * dof], tau );
+                for ( size_t j = 0; j < dof; ++j )
+                {
+                    vr = std::max( vr, std::fabs( r.velocity[i * dof + j] ) / st->vmax[j] );
+                    ar = std::max( ar, std::fabs( r.acceleration[i * dof + j] ) / st->amax[j] );
+                    if ( torque )
+                        tr = std::max( tr, std::fabs( tau[j] ) / ( *tlim )[j] );
+                }
+            }
+            ctx.counter( "duration_s", r.duration );
+            if ( !torque )
+            {
+                // The baseline knows nothing of torque, so it only compares
+                // against the velocity/acceleration case.
+                double naive = naive_trapezoid_duration( *topp, st->vmax, st->amax );
+                ctx.counter( "naive_trapezoid_s", naive );
+                ctx.counter( "cycle_time_saving", 1.0 - r.duration / naive );
+            }
+            ctx.counter( "max_vel_ratio", vr );
+            ctx.counter( "max_acc_ratio", ar );
+            if ( torque )
+                ctx.counter( "max_torque_ratio", tr );
+        };
+        bench::add( torque ? "topp_ra/torque_iiwa14" : "topp_ra/vel_acc_iiwa14", [st, topp]( bench::Context& ctx ) {
+            topp->solve( st->waypoints.data(), st->waypoints.size() / dof, st->result );
+            bench::do_not_optimize( st->result.duration );
+            ctx.items( static_cast<double>( topp->stages() ) );
+        }, configure );
+    }
+}
+
+// Dense Cholesky of the same metric, the baseline a dense optimiser would
+// pay per step: O(n^2) per solve against the banded O(n).
+struct DenseCholesky
 {
-    std::string hello = "Hello C++!";
-    puts( hello.c_str() );
-}
\ No newline at end of file
+    size_t n = 0;
+    std::vector<double> L;
+
+    bool factor( const BandedCholesky& band )
+    {
+        n = band.size();
+        L.assign( n * n, 0.0 );
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t j = i > band.bandwidth() ? i - band.bandwidth() : 0; j <= i; ++j )
+                L[i * n + j] = band.at( i, j );
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t j = 0; j <= i; ++j )
+            {
+                double s = L[i * n + j];
+                for ( size_t m = 0; m < j; ++m )
+                    s -= L[i * n + m] * L[j * n + m];
+                if ( j < i )
+                    L[i * n + j] = s / L[j * n + j];
+                else if ( s > 0.0 )
+                    L[i * n + i] = std::sqrt( s );
+                else
+                    return false;
+            }
+        return true;
+    }
+
+    void solve( double* b, size_t columns ) const
+    {
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t c = 0; c < columns; ++c )
+            {
+                double s = b[i * columns + c];
+                for ( size_t m = 0; m < i; ++m )
+                    s -= L[i * n + m] * b[m * columns + c];
+                b[i * columns + c] = s / L[i * n + i];
+            }
+        for ( size_t i = n; i-- > 0; )
+            for ( size_t c = 0; c < columns; ++c )
+            {
+                double s = b[i * columns + c];
+                for ( size_t m = i + 1; m < n; ++m )
+                    s -= L[m * n + i] * b[m * columns + c];
+                b[i * columns + c] = s / L[i * n + i];
+            }
+    }
+};
+
+// 10 m square at 5 cm: three shelves with a gap at alternate ends plus
+// scattered discs. The input is an RRT-Connect path for a 10 cm robot,
+// planned once in setup, which the optimiser smooths each rep.
+static void register_trajectory_optimizer()
+{
+    struct State
+    {
+        DistanceField field;
+        std::vector<double> path;
+        std::unique_ptr<TrajectoryOptimizer> optimizer;
+        TrajectoryOptimizerResult result;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( !st->optimizer )
+        {
+            const int n = 200;
+            const double res = 0.05;
+            std::vector<uint8_t> occupied( n * n, 0 );
+            std::mt19937 rng( 3 );
+            for ( int y = 0; y < n; ++y )
+                for ( int x = 0; x < n; ++x )
+                    if ( ( y % 40 ) < 3 && ( x % 100 ) > 20 )
+                        occupied[y * n + x] = 1;
+            for ( int k = 0; k < 25; ++k )
+            {
+                int cx = rng() % n, cy = rng() % n, r = 4 + rng() % 6;
+                for ( int y = std::max( 0, cy - r ); y < std::min( n, cy + r ); ++y )
+                    for ( int x = std::max( 0, cx - r ); x < std::min( n, cx + r ); ++x )
+                        if ( ( x - cx ) * ( x - cx ) + ( y - cy ) * ( y - cy ) < r * r )
+                            occupied[y * n + x] = 1;
+            }
+            st->field = DistanceField( n, n, 1, res );
+            EsdfBuilder().compute( occupied, st->field );
+
+            SamplingProblem problem;
+            problem.dim = 2;
+            problem.lower = { 0.0f, 0.0f };
+            problem.upper = { float( n * res ), float( n * res ) };
+            problem.start = { 0.5f, 1.0f };
+            problem.goal = { 9.5f, 9.0f };
+            problem.resolution = 0.02f;
+            const DistanceField* field = &st->field;
+            problem.valid = [field]( const float* q ) { return field->interpolate( q[0], q[1], 0.0 ) > 0.1; };
+            SamplingOptions options;
+            options.algorithm = SamplingAlgorithm::RrtConnect;
+            options.index = NearestIndexKind::KdTree;
+            options.step = 0.3f;
+            options.max_iterations = options.max_nodes = 200000;
+            SamplingPlanner planner( problem, options );
+            SamplingResult planned;
+            planner.solve( planned );
+            st->path.assign( planned.path.begin(), planned.path.end() );
+            st->optimizer.reset( new TrajectoryOptimizer( st->field ) );
+        }
+        TrajectoryOptimizerOptions options;
+        options.radius = 0.1;
+        options.waypoints = static_cast<size_t>( ctx.param( "waypoints", 100.0 ) );
+        st->optimizer->set_options( options );
+    };
+
+    bench::add( "traj_opt/chomp_rrt_2d", [st]( bench::Context& ctx ) {
+        const TrajectoryOptimizerOptions& o = st->optimizer->options();
+        st->optimizer->optimize( st->path.data(), st->path.size() / 2, st->result );
+        const TrajectoryOptimizerResult& r = st->result;
+        ctx.items( static_cast<double>( r.iterations ) );
+        ctx.counter( "collision_free", r.collision_free );
+        ctx.counter( "min_clearance", r.min_clearance );
+        ctx.counter( "input_smoothness", TrajectoryOptimizer::smoothness_cost( st->path.data(), st->path.size() / 2, 2,
+                                                                               o.velocity_weight, o.acceleration_weight ) );
+        ctx.counter( "output_smoothness", r.smoothness_cost );
+        ctx.counter( "input_waypoints", static_cast<double>( st->path.size() / 2 ) );
+        ctx.counter( "output_length", r.length );
+    }, setup );
+
+    // One covariant step's linear solve (two right-hand sides) on the
+    // smoothness metric, banded against dense, as the waypoint count grows.
+    for ( size_t n : { 100, 1000, 4000 } )
+    {
+        struct Solve
+        {
+            BandedCholesky banded;
+            DenseCholesky dense;
+            std::vector<double> source;
+            std::vector<double> rhs;
+        };
+        auto sv = std::make_shared<Solve>();
+        auto solve_setup = [sv, n]( bench::Context& ) {
+            if ( !sv->source.empty() )
+                return;
+            // Velocity plus acceleration metric, as built by the optimiser.
+            double dt = 1.0 / double( n + 1 );
+            sv->banded.resize( n, 2 );
+            for ( size_t i = 0; i < n; ++i )
+            {
+                sv->banded.at( i, i ) = 2.0 / dt + 0.01 * 6.0 / ( dt * dt * dt );
+                if ( i >= 1 )
+                    sv->banded.at( i, i - 1 ) = -1.0 / dt - 0.01 * 4.0 / ( dt * dt * dt );
+                if ( i >= 2 )
+                    sv->banded.at( i, i - 2 ) = 0.01 / ( dt * dt * dt );
+            }
+            if ( n <= 1000 )
+                sv->dense.factor( sv->banded );
+            sv->banded.factor();
+            for ( size_t i = 0; i < 2 * n; ++i )
+                sv->source.push_back( std::sin( 0.1 * double( i ) ) );
+            sv->rhs = sv->source;
+        };
+        std::string tag = "_n" + std::to_string( n );
+        bench::add( "traj_opt/metric_solve_banded" + tag, [sv]( bench::Context& ctx ) {
+            std::copy( sv->source.begin(), sv->source.end(), sv->rhs.begin() );
+            sv->banded.solve( sv->rhs.data(), 2 );
+            bench::do_not_optimize( sv->rhs[0] );
+            ctx.items( static_cast<double>( sv->banded.size() ) );
+        }, solve_setup );
+        // Dense factorisation is O(n^3); the largest size is banded only.
+        if ( n <= 1000 )
+            bench::add( "traj_opt/metric_solve_dense" + tag, [sv]( bench::Context& ctx ) {
+                std::copy( sv->source.begin(), sv->source.end(), sv->rhs.begin() );
+                sv->dense.solve( sv->rhs.data(), 2 );
+                bench::do_not_optimize( sv->rhs[0] );
+                ctx.items( static_cast<double>( sv->dense.n ) );
+            }, solve_setup );
+    }
+}
+
+// Figure-eight x = a sin(wt), y = a/2 sin(2wt) with its feedforward speed
+// and yaw rate.
+static void figure_eight_reference( double t, double* x, double* u )
+{
+    const double a = 3.0, w = 0.25;
+    double dx = a * w * std::cos( w * t ), dy = a * w * std::cos( 2 * w * t );
+    double ddx = -a * w * w * std::sin( w * t ), ddy = -2 * a * w * w * std::sin( 2 * w * t );
+    x[0] = a * std::sin( w * t );
+    x[1] = 0.5 * a * std::sin( 2 * w * t );
+    x[2] = std::atan2( dy, dx );
+    u[0] = std::hypot( dx, dy );
+    u[1] = ( dx * ddy - dy * ddx ) / ( dx * dx + dy * dy );
+}
+
+// Closed-loop tracking of the figure eight at 20 Hz with a 30-stage
+// horizon, the plant slipping 3% of commanded speed. One rep is `steps`
+// control periods; each solve is timed on its own and the worst case is
+// kept across all reps, so long runs (--reps) read as the worst-case
+// latency against the 5 ms budget. The cold variant drops the warm start
+// every period.
+static void register_mpc()
+{
+    struct State
+    {
+        std::unique_ptr<NonlinearMpc<Unicycle>> mpc;
+        std::vector<double> x_ref, u_ref, samples;
+        double x[3];
+        double t = 0.0;
+        double worst_us = 0.0;
+        size_t solves = 0;
+        size_t misses = 0;
+    };
+    for ( bool warm : { true, false } )
+    {
+        auto st = std::make_shared<State>();
+        auto setup = [st]( bench::Context& ctx ) {
+            size_t horizon = static_cast<size_t>( ctx.param( "horizon", 30.0 ) );
+            NonlinearMpc<Unicycle>::Options options;
+            options.dt = 0.05;
+            options.state_weight[0] = options.state_weight[1] = 10.0;
+            options.terminal_weight[0] = options.terminal_weight[1] = 50.0;
+            options.terminal_weight[2] = 5.0;
+            options.u_min[0] = -0.2;
+            options.u_max[0] = 1.0;
+            options.u_min[1] = -1.5;
+            options.u_max[1] = 1.5;
+            st->mpc.reset( new NonlinearMpc<Unicycle>( horizon, options ) );
+            st->x_ref.resize( ( horizon + 1 ) * 3 );
+            st->u_ref.resize( horizon * 2 );
+            double u[2];
+            figure_eight_reference( 0.0, st->x, u );
+            st->x[0] += 0.3;
+            st->x[2] += 0.3;
+        };
+        bench::add( std::string( "mpc/unicycle_figure_eight_" ) + ( warm ? "warm" : "cold" ), [st, warm]( bench::Context& ctx ) {
+            using clock = std::chrono::steady_clock;
+            NonlinearMpc<Unicycle>& mpc = *st->mpc;
+            const size_t horizon = mpc.horizon();
+            const double dt = mpc.options().dt;
+            const int steps = ctx.quick() ? 200 : 1000;
+            double err2 = 0.0;
+            int iterations = 0, max_iterations = 0;
+            st->samples.clear();
+            for ( int n = 0; n < steps; ++n )
+            {
+                double u_ff[2];
+                for ( size_t k = 0; k <= horizon; ++k )
+                {
+                    figure_eight_reference( st->t + k * dt, &st->x_ref[k * 3], u_ff );
+                    if ( k < horizon )
+                        std::copy( u_ff, u_ff + 2, &st->u_ref[k * 2] );
+                }
+                if ( !warm )
+                    mpc.reset();
+                double u[2];
+                auto t0 = clock::now();
+                MpcResult r = mpc.solve( st->x, st->x_ref.data(), st->u_ref.data(), u );
+                double us = std::chrono::duration<double, std::micro>( clock::now() - t0 ).count();
+                st->samples.push_back( us );
+                st->worst_us = std::max( st->worst_us, us );
+                st->misses += us > 5000.0;
+                ++st->solves;
+                iterations += r.qp_iterations;
+                max_iterations = std::max( max_iterations, r.qp_iterations );
+
+                double applied[2] = { 0.97 * u[0], u[1] }, next[3], e[3];
+                Unicycle::step( st->x, applied, dt, next );
+                std::copy( next, next + 3, st->x );
+                st->t += dt;
+                Unicycle::error( st->x, &st->x_ref[3], e );
+                err2 += e[0] * e[0] + e[1] * e[1];
+            }
+            std::sort( st->samples.begin(), st->samples.end() );
+            ctx.items( static_cast<double>( steps ) );
+            ctx.counter( "worst_solve_us", st->worst_us );
+            ctx.counter( "p99_solve_us", st->samples[st->samples.size() * 99 / 100] );
+            ctx.counter( "budget_5ms_misses", static_cast<double>( st->misses ) );
+            ctx.counter( "total_solves", static_cast<double>( st->solves ) );
+            ctx.counter( "mean_qp_iterations", double( iterations ) / steps );
+            ctx.counter( "max_qp_iterations", max_iterations );
+            ctx.counter( "rms_position_error", std::sqrt( err2 / steps ) );
+        }, setup );
+    }
+}
+
+// Whole-body reach for a UR5 on a differential-drive base: state (x, y,
+// heading, q1..q6), controls (speed, yaw rate, joint rates). The stage
+// cost pulls the flange along the straight line from its start to the
+// target and penalises control effort; the terminal cost is the flange
+// error. Flange terms are Gauss-Newton (J' W J), so every stage's
+// derivatives cost an FK and a Jacobian.
+struct MobileReach
+{
+    static constexpr size_t dof = Ur5::dof;
+    static constexpr size_t nx = 3 + dof;
+    static constexpr size_t nu = 2 + dof;
+
+    double dt = 0.05;
+    size_t horizon = 100;
+    double mount_height = 0.4;
+    double track_weight = 20.0;
+    double terminal_weight = 2000.0;
+    double base_effort = 0.5;
+    double joint_effort = 0.2;
+    Vec3 start, target;
+
+    // Flange position in the world; J, if given, receives d/dx (3 x nx).
+    Vec3 flange( const double* x, double ( *J )[nx] = nullptr ) const
+    {
+        Isometry3 links[dof];
+        ForwardKinematics<Ur5>::compute( &x[3], links );
+        const Vec3 p = links[dof - 1].t;
+        double c = std::cos( x[2] ), s = std::sin( x[2] );
+        Vec3 world( x[0] + c * p.x - s * p.y, x[1] + s * p.x + c * p.y, mount_height + p.z );
+        if ( J )
+        {
+            double Ja[6][dof];
+            ForwardKinematics<Ur5>::jacobian( links, Ja );
+            for ( size_t r = 0; r < 3; ++r )
+                std::fill( J[r], J[r] + nx, 0.0 );
+            J[0][0] = J[1][1] = 1.0;
+            J[0][2] = -s * p.x - c * p.y;
+            J[1][2] = c * p.x - s * p.y;
+            for ( size_t j = 0; j < dof; ++j )
+            {
+                J[0][3 + j] = c * Ja[0][j] - s * Ja[1][j];
+                J[1][3 + j] = s * Ja[0][j] + c * Ja[1][j];
+                J[2][3 + j] = Ja[2][j];
+            }
+        }
+        return world;
+    }
+
+    Vec3 reference( size_t k ) const { return start + ( target - start ) * ( double( k ) / double( horizon ) ); }
+
+    void dynamics( const double* x, const double* u, double* next, double ( *fx )[nx] = nullptr,
+                   double ( *fu )[nu] = nullptr ) const
+    {
+        double A[3][3], B[3][2];
+        Unicycle::step( x, u, dt, next, fx ? A : nullptr, fu ? B : nullptr );
+        for ( size_t j = 0; j < dof; ++j )
+            next[3 + j] = x[3 + j] + u[2 + j] * dt;
+        if ( fx )
+        {
+            for ( size_t r = 0; r < nx; ++r )
+                for ( size_t c = 0; c < nx; ++c )
+                    fx[r][c] = r < 3 && c < 3 ? A[r][c] : double( r == c );
+        }
+        if ( fu )
+        {
+            for ( size_t r = 0; r < nx; ++r )
+                for ( size_t c = 0; c < nu; ++c )
+                    fu[r][c] = r < 3 && c < 2 ? B[r][c] : ( r >= 3 && c == r - 1 ? dt : 0.0 );
+        }
+    }
+
+    double effort( size_t i ) const { return i < 2 ? base_effort : joint_effort; }
+
+    double cost( size_t k, const double* x, const double* u ) const
+    {
+        double total = 0.0;
+        for ( size_t i = 0; i < nu; ++i )
+            total += 0.5 * effort( i ) * u[i] * u[i];
+        return total + 0.5 * track_weight * squared_norm( flange( x ) - reference( k ) );
+    }
+
+    double terminal_cost( const double* x ) const { return 0.5 * terminal_weight * squared_norm( flange( x ) - target ); }
+
+    void derivatives( size_t k, const double* x, const double* u, StageDerivatives<nx, nu>& d ) const
+    {
+        double next[nx];
+        dynamics( x, u, next, d.fx, d.fu );
+        gauss_newton( flange_jacobian( x, reference( k ) ), track_weight, d.lx, d.lxx );
+        for ( size_t i = 0; i < nu; ++i )
+        {
+            d.lu[i] = effort( i ) * u[i];
+            std::fill( d.luu[i], d.luu[i] + nu, 0.0 );
+            std::fill( d.lux[i], d.lux[i] + nx, 0.0 );
+            d.luu[i][i] = effort( i );
+        }
+    }
+
+    void terminal_derivatives( const double* x, double* lx, double ( *lxx )[nx] ) const
+    {
+        gauss_newton( flange_jacobian( x, target ), terminal_weight, lx, lxx );
+    }
+
+    struct FlangeJacobian
+    {
+        Vec3 error;
+        double J[3][nx];
+    };
+
+    FlangeJacobian flange_jacobian( const double* x, const Vec3& goal ) const
+    {
+        FlangeJacobian f;
+        f.error = flange( x, f.J ) - goal;
+        return f;
+    }
+
+    static void gauss_newton( const FlangeJacobian& f, double w, double* lx, double ( *lxx )[nx] )
+    {
+        for ( size_t i = 0; i < nx; ++i )
+        {
+            lx[i] = w * ( f.J[0][i] * f.error.x + f.J[1][i] * f.error.y + f.J[2][i] * f.error.z );
+            for ( size_t j = 0; j < nx; ++j )
+                lxx[i][j] = w * ( f.J[0][i] * f.J[0][j] + f.J[1][i] * f.J[1][j] + f.J[2][i] * f.J[2][j] );
+        }
+    }
+};
+
+// Textbook iLQR as the baseline: the same algorithm, regularisation and
+// step sizes as Ilqr, but with heap-allocated dynamic matrices built per
+// stage, a serial derivative loop and a serial backtracking line search.
+// Returns the final cost.
+template <typename Problem>
+static double reference_ilqr( const Problem& problem, size_t N, const double* x0, const IlqrOptions& options, int& iterations )
+{
+    typedef std::vector<double> Vector;
+    struct Matrix
+    {
+        size_t rows, cols;
+        std::vector<double> a;
+        Matrix( size_t r, size_t c ) : rows( r ), cols( c ), a( r * c, 0.0 ) {}
+        double& operator()( size_t i, size_t j ) { return a[i * cols + j]; }
+        double operator()( size_t i, size_t j ) const { return a[i * cols + j]; }
+    };
+    auto mul = []( const Matrix& A, const Matrix& B ) {
+        Matrix C( A.rows, B.cols );
+        for ( size_t i = 0; i < A.rows; ++i )
+            for ( size_t k = 0; k < A.cols; ++k )
+                for ( size_t j = 0; j < B.cols; ++j )
+                    C( i, j ) += A( i, k ) * B( k, j );
+        return C;
+    };
+    auto transpose = []( const Matrix& A ) {
+        Matrix T( A.cols, A.rows );
+        for ( size_t i = 0; i < A.rows; ++i )
+            for ( size_t j = 0; j < A.cols; ++j )
+                T( j, i ) = A( i, j );
+        return T;
+    };
+    auto mulv = []( const Matrix& A, const Vector& v ) {
+        Vector r( A.rows, 0.0 );
+        for ( size_t i = 0; i < A.rows; ++i )
+            for ( size_t j = 0; j < A.cols; ++j )
+                r[i] += A( i, j ) * v[j];
+        return r;
+    };
+    // Solves H X = B by Cholesky; false if H is not positive definite.
+    auto chol_solve = []( Matrix H, Matrix B, Matrix& X ) {
+        size_t n = H.rows;
+        for ( size_t i = 0; i < n; ++i )
+            for ( size_t j = 0; j <= i; ++j )
+            {
+                double v = H( i, j );
+                for ( size_t m = 0; m < j; ++m )
+                    v -= H( i, m ) * H( j, m );
+                if ( i != j )
+                    H( i, j ) = v / H( j, j );
+                else if ( v > 0.0 )
+                    H( i, i ) = std::sqrt( v );
+                else
+                    return false;
+            }
+        for ( size_t c = 0; c < B.cols; ++c )
+        {
+            for ( size_t i = 0; i < n; ++i )
+            {
+                for ( size_t m = 0; m < i; ++m )
+                    B( i, c ) -= H( i, m ) * B( m, c );
+                B( i, c ) /= H( i, i );
+            }
+            for ( size_t i = n; i-- > 0; )
+            {
+                for ( size_t m = i + 1; m < n; ++m )
+                    B( i, c ) -= H( m, i ) * B( m, c );
+                B( i, c ) /= H( i, i );
+            }
+        }
+        X = B;
+        return true;
+    };
+
+    const size_t nx = Problem::nx, nu = Problem::nu;
+    std::vector<Vector> x( N + 1, Vector( nx ) ), u( N, Vector( nu, 0.0 ) );
+    auto rollout = [&]( std::vector<Vector>& xs, const std::vector<Vector>& us ) {
+        double total = 0.0;
+        for ( size_t k = 0; k < N; ++k )
+        {
+            total += problem.cost( k, xs[k].data(), us[k].data() );
+            problem.dynamics( xs[k].data(), us[k].data(), xs[k + 1].data() );
+        }
+        return total + problem.terminal_cost( xs[N].data() );
+    };
+    x[0].assign( x0, x0 + nx );
+    double cost = rollout( x, u );
+    double mu = options.regularization;
+    std::vector<Matrix> K( N, Matrix( nu, nx ) );
+    std::vector<Vector> kff( N );
+    iterations = 0;
+    for ( int it = 0; it < options.max_iterations; ++it )
+    {
+        iterations = it + 1;
+        std::vector<StageDerivatives<Problem::nx, Problem::nu>> d( N );
+        for ( size_t k = 0; k < N; ++k )
+            problem.derivatives( k, x[k].data(), u[k].data(), d[k] );
+        Vector Vx( nx );
+        Matrix Vxx( nx, nx );
+        {
+            double lxx[Problem::nx][Problem::nx];
+            problem.terminal_derivatives( x[N].data(), Vx.data(), lxx );
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < nx; ++j )
+                    Vxx( i, j ) = lxx[i][j];
+        }
+
+        bool ok = true;
+        double dv1 = 0.0, dv2 = 0.0;
+        for ( size_t k = N; k-- > 0 && ok; )
+        {
+            Matrix fx( nx, nx ), fu( nx, nu ), lxx( nx, nx ), luu( nu, nu ), lux( nu, nx );
+            Vector lx( d[k].lx, d[k].lx + nx ), lu( d[k].lu, d[k].lu + nu );
+            for ( size_t i = 0; i < nx; ++i )
+            {
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    fx( i, j ) = d[k].fx[i][j];
+                    lxx( i, j ) = d[k].lxx[i][j];
+                }
+                for ( size_t j = 0; j < nu; ++j )
+                    fu( i, j ) = d[k].fu[i][j];
+            }
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                for ( size_t j = 0; j < nu; ++j )
+                    luu( i, j ) = d[k].luu[i][j];
+                for ( size_t j = 0; j < nx; ++j )
+                    lux( i, j ) = d[k].lux[i][j];
+            }
+            Matrix fxT = transpose( fx ), fuT = transpose( fu );
+            Vector Qx = mulv( fxT, Vx ), Qu = mulv( fuT, Vx );
+            for ( size_t i = 0; i < nx; ++i )
+                Qx[i] += lx[i];
+            for ( size_t i = 0; i < nu; ++i )
+                Qu[i] += lu[i];
+            Matrix Qxx = mul( fxT, mul( Vxx, fx ) ), Quu = mul( fuT, mul( Vxx, fu ) ), Qux = mul( fuT, mul( Vxx, fx ) );
+            Matrix FuFu = mul( fuT, fu ), FuFx = mul( fuT, fx );
+            Matrix Quu_reg = Quu, Qux_reg = Qux;
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < nx; ++j )
+                    Qxx( i, j ) += lxx( i, j );
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                for ( size_t j = 0; j < nu; ++j )
+                {
+                    Quu( i, j ) += luu( i, j );
+                    Quu_reg( i, j ) = Quu( i, j ) + mu * FuFu( i, j );
+                }
+                for ( size_t j = 0; j < nx; ++j )
+                {
+                    Qux( i, j ) += lux( i, j );
+                    Qux_reg( i, j ) = Qux( i, j ) + mu * FuFx( i, j );
+                }
+            }
+            Matrix rhs( nu, nx + 1 ), sol( nu, nx + 1 );
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                for ( size_t j = 0; j < nx; ++j )
+                    rhs( i, j ) = -Qux_reg( i, j );
+                rhs( i, nx ) = -Qu[i];
+            }
+            if ( !chol_solve( Quu_reg, rhs, sol ) )
+            {
+                ok = false;
+                break;
+            }
+            kff[k].assign( nu, 0.0 );
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                for ( size_t j = 0; j < nx; ++j )
+                    K[k]( i, j ) = sol( i, j );
+                kff[k][i] = sol( i, nx );
+            }
+            Matrix KT = transpose( K[k] ), QuxT = transpose( Qux );
+            Vector Quu_k = mulv( Quu, kff[k] );
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                dv1 += kff[k][i] * Qu[i];
+                dv2 += 0.5 * kff[k][i] * Quu_k[i];
+            }
+            Vector a = mulv( KT, Quu_k ), b = mulv( KT, Qu ), c = mulv( QuxT, kff[k] );
+            for ( size_t i = 0; i < nx; ++i )
+                Vx[i] = Qx[i] + a[i] + b[i] + c[i];
+            Matrix A = mul( KT, mul( Quu, K[k] ) ), B = mul( KT, Qux ), C = mul( QuxT, K[k] );
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < nx; ++j )
+                    Vxx( i, j ) = Qxx( i, j ) + A( i, j ) + B( i, j ) + C( i, j );
+            for ( size_t i = 0; i < nx; ++i )
+                for ( size_t j = 0; j < i; ++j )
+                    Vxx( i, j ) = Vxx( j, i ) = 0.5 * ( Vxx( i, j ) + Vxx( j, i ) );
+        }
+        if ( !ok )
+        {
+            mu = std::max( mu * options.regularization_factor, options.regularization_min );
+            if ( mu > options.regularization_max )
+                break;
+            continue;
+        }
+
+        bool accepted = false;
+        const int C = options.line_search_candidates;
+        for ( int j = 0; j < C && !accepted; ++j )
+        {
+            double alpha = C > 1 ? std::pow( 10.0, -3.0 * j / ( C - 1 ) ) : 1.0;
+            std::vector<Vector> xn( N + 1, Vector( nx ) ), un( N, Vector( nu ) );
+            xn[0] = x[0];
+            double total = 0.0;
+            for ( size_t k = 0; k < N; ++k )
+            {
+                Vector dx( nx );
+                for ( size_t i = 0; i < nx; ++i )
+                    dx[i] = xn[k][i] - x[k][i];
+                Vector fb = mulv( K[k], dx );
+                for ( size_t i = 0; i < nu; ++i )
+                    un[k][i] = u[k][i] + alpha * kff[k][i] + fb[i];
+                total += problem.cost( k, xn[k].data(), un[k].data() );
+                problem.dynamics( xn[k].data(), un[k].data(), xn[k + 1].data() );
+            }
+            total += problem.terminal_cost( xn[N].data() );
+            double expected = -alpha * ( dv1 + alpha * dv2 );
+            if ( std::isfinite( total ) && expected > 0.0 && ( cost - total ) / expected > options.acceptance )
+            {
+                double previous = cost;
+                x = xn;
+                u = un;
+                cost = total;
+                accepted = true;
+                mu /= options.regularization_factor;
+                if ( mu < options.regularization_min )
+                    mu = 0.0;
+                if ( previous - cost < options.tolerance * std::fabs( previous ) )
+                    return cost;
+            }
+        }
+        if ( !accepted )
+        {
+            if ( -( dv1 + dv2 ) < options.tolerance * std::fabs( cost ) )
+                break;
+            mu = std::max( mu * options.regularization_factor, options.regularization_min );
+            if ( mu > options.regularization_max )
+                break;
+        }
+    }
+    return cost;
+}
+
+// MobileReach from the home pose to a target 3 m ahead and to the side,
+// 100 stages of 50 ms. The fixed-size solver runs serially and on the
+// pool (batched derivatives, parallel line-search waves); the reference
+// is the textbook version above. Counters compare final costs.
+static void register_ilqr()
+{
+    struct State
+    {
+        MobileReach problem;
+        double x0[MobileReach::nx] = {};
+        std::unique_ptr<Ilqr<MobileReach>> serial, pooled;
+        IlqrResult result;
+        double reference_cost = 0.0;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( st->serial )
+            return;
+        const double home[6] = { 0.0, -1.2, 1.6, -1.9, -1.57, 0.0 };
+        std::copy( home, home + 6, st->x0 + 3 );
+        st->problem.start = st->problem.flange( st->x0 );
+        st->problem.target = Vec3( 3.0, 1.5, 0.9 );
+        st->serial.reset( new Ilqr<MobileReach>( st->problem, st->problem.horizon ) );
+        st->pooled.reset( new Ilqr<MobileReach>( st->problem, st->problem.horizon, &bench_pool( ctx ) ) );
+        int iterations = 0;
+        st->reference_cost = reference_ilqr( st->problem, st->problem.horizon, st->x0, IlqrOptions(), iterations );
+    };
+    auto report = [st]( bench::Context& ctx ) {
+        const IlqrResult& r = st->result;
+        ctx.items( static_cast<double>( r.iterations ) );
+        ctx.counter( "converged", r.converged );
+        ctx.counter( "initial_cost", r.initial_cost );
+        ctx.counter( "final_cost", r.cost );
+        ctx.counter( "reference_cost", st->reference_cost );
+        ctx.counter( "rollouts", static_cast<double>( r.rollouts ) );
+    };
+
+    bench::add( "ilqr/mobile_reach_reference", [st]( bench::Context& ctx ) {
+        int iterations = 0;
+        double cost = reference_ilqr( st->problem, st->problem.horizon, st->x0, IlqrOptions(), iterations );
+        ctx.items( static_cast<double>( iterations ) );
+        ctx.counter( "final_cost", cost );
+    }, setup );
+    bench::add( "ilqr/mobile_reach_fixed_serial", [st, report]( bench::Context& ctx ) {
+        st->serial->solve( st->x0, nullptr, st->result );
+        report( ctx );
+    }, setup );
+    bench::add( "ilqr/mobile_reach_fixed_pool", [st, report]( bench::Context& ctx ) {
+        st->pooled->solve( st->x0, nullptr, st->result );
+        report( ctx );
+        ctx.counter( "threads", bench_pool( ctx ).size() );
+    }, setup );
+}
+
+// Wheel-odometry / gyro fusion for a planar base at 400 Hz. State (x, y,
+// heading, v, yaw rate, gyro bias); the wheels measure (v, yaw rate), the
+// gyro yaw rate plus bias, and a 10 Hz position fix anchors x and y. Each
+// functor has a Jacobian overload for the EKF and a plain one for the UKF.
+struct OdomImuTransition
+{
+    double dt = 1.0 / 400.0;
+
+    void operator()( const double* x, double* next ) const
+    {
+        double c = std::cos( x[2] ), s = std::sin( x[2] );
+        next[0] = x[0] + x[3] * c * dt;
+        next[1] = x[1] + x[3] * s * dt;
+        next[2] = x[2] + x[4] * dt;
+        next[3] = x[3];
+        next[4] = x[4];
+        next[5] = x[5];
+    }
+
+    void operator()( const double* x, double* next, FixedMatrix<6, 6>& F ) const
+    {
+        ( *this )( x, next );
+        double c = std::cos( x[2] ), s = std::sin( x[2] );
+        F = FixedMatrix<6, 6>::identity();
+        F.m[0][2] = -x[3] * s * dt;
+        F.m[0][3] = c * dt;
+        F.m[1][2] = x[3] * c * dt;
+        F.m[1][3] = s * dt;
+        F.m[2][4] = dt;
+    }
+};
+
+// Measures the sum of the listed state components, one per row.
+template <size_t NZ>
+struct LinearObservation
+{
+    size_t first[NZ];
+    size_t second[NZ];
+
+    void operator()( const double* x, double* z ) const
+    {
+        for ( size_t i = 0; i < NZ; ++i )
+            z[i] = x[first[i]] + ( second[i] < 6 ? x[second[i]] : 0.0 );
+    }
+
+    void operator()( const double* x, double* z, FixedMatrix<NZ, 6>& H ) const
+    {
+        ( *this )( x, z );
+        H = FixedMatrix<NZ, 6>::zero();
+        for ( size_t i = 0; i < NZ; ++i )
+        {
+            H.m[i][first[i]] = 1.0;
+            if ( second[i] < 6 )
+                H.m[i][second[i]] = 1.0;
+        }
+    }
+};
+
+// A fleet of robots, each with its own filter, run for one second of
+// 400 Hz sensor data per rep from precomputed streams. Predicts and
+// updates are separate sweeps over the fleet so each can be timed;
+// counters give ns per call and filter steps per second per core, and the
+// final position RMS error as a sanity check. _pool splits the fleet over
+// bench_pool.
+template <typename Filter>
+static void register_kalman_filter( const std::string& tag )
+{
+    struct Stream
+    {
+        // Per step: wheels (v, w), gyro, noisy position fix (x, y).
+        std::vector<double> wheels, gyro, fix;
+        double final_x = 0.0, final_y = 0.0;
+    };
+    struct State
+    {
+        OdomImuTransition transition;
+        FixedMatrix<6, 6> Q;
+        std::vector<Filter> filters;
+        std::vector<Stream> streams;
+        FixedMatrix<2, 2> R_wheels, R_fix;
+        FixedMatrix<1, 1> R_gyro;
+    };
+    const size_t steps = 400;
+    auto st = std::make_shared<State>();
+    auto setup = [st, steps]( bench::Context& ctx ) {
+        size_t robots = static_cast<size_t>( ctx.param( "robots", ctx.quick() ? 64.0 : 256.0 ) );
+        if ( st->streams.size() == robots )
+            return;
+        const double dt = st->transition.dt;
+        const double q[6] = { 1e-8, 1e-8, 1e-8, 4.0 * dt, 4.0 * dt, 1e-8 * dt };
+        const double rw[2] = { 0.02 * 0.02, 0.05 * 0.05 }, rf[2] = { 0.05 * 0.05, 0.05 * 0.05 }, rg[1] = { 0.005 * 0.005 };
+        st->Q = FixedMatrix<6, 6>::diagonal( q );
+        st->R_wheels = FixedMatrix<2, 2>::diagonal( rw );
+        st->R_fix = FixedMatrix<2, 2>::diagonal( rf );
+        st->R_gyro = FixedMatrix<1, 1>::diagonal( rg );
+        st->filters.assign( robots, Filter() );
+        st->streams.assign( robots, Stream() );
+        std::mt19937 rng( 11 );
+        std::normal_distribution<double> noise( 0.0, 1.0 );
+        for ( size_t r = 0; r < robots; ++r )
+        {
+            Stream& s = st->streams[r];
+            double x = 0.0, y = 0.0, th = 0.0, bias = 0.01 * noise( rng ), phase = 0.1 * double( r );
+            for ( size_t k = 0; k < steps; ++k )
+            {
+                double t = double( k ) * dt;
+                double v = 1.0 + 0.5 * std::sin( 2.0 * t + phase ), w = 0.8 * std::sin( 1.3 * t + phase );
+                x += v * std::cos( th ) * dt;
+                y += v * std::sin( th ) * dt;
+                th += w * dt;
+                s.wheels.push_back( v + 0.02 * noise( rng ) );
+                s.wheels.push_back( w + 0.05 * noise( rng ) );
+                s.gyro.push_back( w + bias + 0.005 * noise( rng ) );
+                s.fix.push_back( x + 0.05 * noise( rng ) );
+                s.fix.push_back( y + 0.05 * noise( rng ) );
+            }
+            s.final_x = x;
+            s.final_y = y;
+        }
+    };
+
+    auto run = [st, steps]( bench::Context& ctx, ThreadPool* pool ) {
+        using clock = std::chrono::steady_clock;
+        const size_t robots = st->filters.size();
+        const double x0[6] = { 0, 0, 0, 1, 0, 0 }, p0[6] = { 0.01, 0.01, 0.01, 1, 1, 1e-4 };
+        for ( Filter& f : st->filters )
+        {
+            f.reset( x0, FixedMatrix<6, 6>::diagonal( p0 ) );
+            f.set_angular( 2 );
+        }
+        const LinearObservation<2> wheels = { { 3, 4 }, { 6, 6 } }, fix = { { 0, 1 }, { 6, 6 } };
+        const LinearObservation<1> gyro = { { 4 }, { 5 } };
+        size_t k = 0;
+        auto predict = [&]( size_t lo, size_t hi ) {
+            for ( size_t r = lo; r < hi; ++r )
+                st->filters[r].predict( st->transition, st->Q );
+        };
+        auto update = [&]( size_t lo, size_t hi ) {
+            for ( size_t r = lo; r < hi; ++r )
+            {
+                Filter& f = st->filters[r];
+                const Stream& s = st->streams[r];
+                f.update( &s.wheels[k * 2], wheels, st->R_wheels );
+                f.update( &s.gyro[k], gyro, st->R_gyro );
+                if ( k % 40 == 39 )
+                    f.update( &s.fix[k * 2], fix, st->R_fix );
+            }
+        };
+
+        double predict_ns = 0.0, update_ns = 0.0;
+        for ( k = 0; k < steps; ++k )
+        {
+            auto t0 = clock::now();
+            if ( pool )
+                pool->parallel_for( 0, robots, 16, predict );
+            else
+                predict( 0, robots );
+            auto t1 = clock::now();
+            if ( pool )
+                pool->parallel_for( 0, robots, 16, update );
+            else
+                update( 0, robots );
+            auto t2 = clock::now();
+            predict_ns += std::chrono::duration<double, std::nano>( t1 - t0 ).count();
+            update_ns += std::chrono::duration<double, std::nano>( t2 - t1 ).count();
+        }
+
+        double err2 = 0.0;
+        for ( size_t r = 0; r < robots; ++r )
+        {
+            const double* x = st->filters[r].state();
+            err2 += ( x[0] - st->streams[r].final_x ) * ( x[0] - st->streams[r].final_x ) +
+                    ( x[1] - st->streams[r].final_y ) * ( x[1] - st->streams[r].final_y );
+        }
+        double calls = double( steps * robots ), threads = pool ? pool->size() : 1;
+        double per_core = calls / ( ( predict_ns + update_ns ) * 1e-9 ) / threads;
+        ctx.items( calls );
+        ctx.counter( "robots", static_cast<double>( robots ) );
+        ctx.counter( "predict_ns", predict_ns * threads / calls );
+        ctx.counter( "update_ns", update_ns * threads / calls );
+        ctx.counter( "steps_per_s_per_core", per_core );
+        ctx.counter( "robots_at_400hz_per_core", per_core / 400.0 );
+        ctx.counter( "final_position_rms", std::sqrt( err2 / double( robots ) ) );
+    };
+
+    bench::add( "kalman/" + tag + "_odom_imu_fleet", [run]( bench::Context& ctx ) { run( ctx, nullptr ); }, setup );
+    bench::add( "kalman/" + tag + "_odom_imu_fleet_pool", [run]( bench::Context& ctx ) { run( ctx, &bench_pool( ctx ) ); },
+                setup );
+}
+
+static void register_kalman()
+{
+    register_kalman_filter<ExtendedKalmanFilter<6>>( "ekf" );
+    register_kalman_filter<UnscentedKalmanFilter<6>>( "ukf" );
+}
+
+// 20 m square hall at 0.05 m: outer walls, a few partition walls and
+// scattered pillars, all kept 1 m clear of the circle of radius 6 m around
+// the centre that the robot drives.
+static std::vector<uint8_t> make_hall_map( int n, double resolution, uint32_t seed )
+{
+    std::vector<uint8_t> occ( static_cast<size_t>( n ) * n, 0 );
+    const double c = 0.5 * n * resolution;
+    auto clear_of_path = [&]( double x, double y ) { return std::fabs( std::hypot( x - c, y - c ) - 6.0 ) > 1.0; };
+    auto fill = [&]( double x0, double y0, double x1, double y1 ) {
+        for ( int y = std::max( 0, int( y0 / resolution ) ); y <= std::min( n - 1, int( y1 / resolution ) ); ++y )
+            for ( int x = std::max( 0, int( x0 / resolution ) ); x <= std::min( n - 1, int( x1 / resolution ) ); ++x )
+                if ( clear_of_path( x * resolution, y * resolution ) || x < 4 || y < 4 || x >= n - 4 || y >= n - 4 )
+                    occ[static_cast<size_t>( y ) * n + x] = 1;
+    };
+    const double size = n * resolution;
+    fill( 0, 0, size, 0.15 );
+    fill( 0, size - 0.15, size, size );
+    fill( 0, 0, 0.15, size );
+    fill( size - 0.15, 0, size, size );
+    fill( 0, 0.3 * size, 0.15 * size, 0.3 * size + 0.1 );
+    fill( 0.7 * size, 0.6 * size, size, 0.6 * size + 0.1 );
+    fill( 0.55 * size, 0, 0.55 * size + 0.1, 0.12 * size );
+    fill( c - 1.5, c - 0.1, c + 1.5, c + 0.1 );
+    std::mt19937 rng( seed );
+    std::uniform_real_distribution<double> u( 0.5, size - 0.5 ), side( 0.2, 0.6 );
+    for ( int i = 0; i < 40; ++i )
+    {
+        double x = u( rng ), y = u( rng ), w = side( rng ), h = side( rng );
+        if ( clear_of_path( x, y ) && clear_of_path( x + w, y + h ) && clear_of_path( x + w, y ) && clear_of_path( x, y + h ) )
+            fill( x, y, x + w, y + h );
+    }
+    return occ;
+}
+
+// Range along a ray by half-cell marching, max_range if nothing is hit.
+static float cast_ray( const std::vector<uint8_t>& occ, int n, double resolution, double x, double y, double angle, double max_range )
+{
+    const double step = 0.5 * resolution, dx = std::cos( angle ) * step, dy = std::sin( angle ) * step;
+    for ( double r = 0.0; r < max_range; r += step, x += dx, y += dy )
+    {
+        int cx = int( std::floor( x / resolution + 0.5 ) ), cy = int( std::floor( y / resolution + 0.5 ) );
+        if ( cx < 0 || cy < 0 || cx >= n || cy >= n || occ[static_cast<size_t>( cy ) * n + cx] )
+            return static_cast<float>( r );
+    }
+    return static_cast<float>( max_range );
+}
+
+// A robot drives 1 m/s around the hall at 10 Hz with drifting odometry and
+// a 360-beam scan per step. _tracking starts from a rough prior with
+// 500..5000 particles and _global from max_particles spread over the whole
+// map; both report the cost of one motion + sensor update, the adaptive
+// particle count and the pose error against ground truth. _scalar forces the
+// scalar beam kernel. core_fraction_at_10hz is the share of one core the
+// filter needs at the scan rate.
+static void register_amcl()
+{
+    struct State
+    {
+        int n = 400;
+        double resolution = 0.05;
+        std::vector<uint8_t> occ;
+        LikelihoodField field;
+        std::vector<Pose2D> truth, odom;
+        std::vector<float> scans;
+        size_t beams = 360;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        size_t steps = static_cast<size_t>( ctx.param( "steps", ctx.quick() ? 100.0 : 300.0 ) );
+        if ( st->truth.size() == steps )
+            return;
+        st->occ = make_hall_map( st->n, st->resolution, 5 );
+        st->field.build( st->occ, st->n, st->n, st->resolution, 0.0, 0.0 );
+        std::mt19937 rng( 17 );
+        std::normal_distribution<double> noise( 0.0, 1.0 );
+        const double c = 0.5 * st->n * st->resolution, radius = 6.0, ds = 0.1;
+        st->truth.clear();
+        st->odom.clear();
+        st->scans.clear();
+        Pose2D odom;
+        for ( size_t k = 0; k < steps; ++k )
+        {
+            double phi = k * ds / radius;
+            Pose2D p;
+            p.x = c + radius * std::cos( phi );
+            p.y = c + radius * std::sin( phi );
+            p.theta = std::remainder( phi + kPi / 2, 2 * kPi );
+            if ( k )
+            {
+                // Odometry integrates the true body-frame increment with 5%
+                // translation and 2% + 0.5 deg rotation noise.
+                const Pose2D& q = st->truth.back();
+                double dth = std::remainder( p.theta - q.theta, 2 * kPi );
+                double dist = std::hypot( p.x - q.x, p.y - q.y ) * ( 1.0 + 0.05 * noise( rng ) );
+                double turn = dth * ( 1.0 + 0.02 * noise( rng ) ) + 0.009 * noise( rng );
+                odom.x += dist * std::cos( odom.theta + 0.5 * turn );
+                odom.y += dist * std::sin( odom.theta + 0.5 * turn );
+                odom.theta = std::remainder( odom.theta + turn, 2 * kPi );
+            }
+            st->truth.push_back( p );
+            st->odom.push_back( odom );
+            for ( size_t b = 0; b < st->beams; ++b )
+            {
+                double a = -kPi + 2 * kPi * b / st->beams;
+                float r = cast_ray( st->occ, st->n, st->resolution, p.x, p.y, p.theta + a, 12.0 );
+                st->scans.push_back( r < 12.0f ? static_cast<float>( r + 0.02 * noise( rng ) ) : r );
+            }
+        }
+    };
+
+    // Each iteration runs the filter once per seed. A run is localised when
+    // its estimate stays within 0.5 m and 0.2 rad of the truth over the
+    // second half of the drive; the error counters cover localised runs.
+    auto run = [st]( bench::Context& ctx, bool global, SimdLevel level ) {
+        using clock = std::chrono::steady_clock;
+        const size_t seeds = static_cast<size_t>( ctx.param( "seeds", 8.0 ) );
+        const size_t steps = st->truth.size();
+        double update_ns = 0.0, particles = 0.0, err2 = 0.0, head2 = 0.0, beam_evals = 0.0, first = 0.0, last = 0.0;
+        size_t resamples = 0, tracked = 0, localised = 0;
+        for ( size_t seed = 1; seed <= seeds; ++seed )
+        {
+            AmclOptions options;
+            if ( global )
+                options.max_particles = static_cast<size_t>( ctx.param( "global_particles", ctx.quick() ? 20000.0 : 50000.0 ) );
+            options.seed = static_cast<uint32_t>( seed );
+            MonteCarloLocalizer amcl( st->field, options, level );
+            if ( global )
+                amcl.reset_uniform();
+            else
+            {
+                Pose2D prior = st->truth[0];
+                prior.x += 0.2;
+                prior.y -= 0.2;
+                prior.theta += 0.1;
+                amcl.reset_gaussian( prior, 0.3, 0.15 );
+            }
+
+            double run_err2 = 0.0, run_head2 = 0.0;
+            bool held = true;
+            for ( size_t k = 0; k < steps; ++k )
+            {
+                auto t0 = clock::now();
+                if ( k )
+                    amcl.motion_update( st->odom[k - 1], st->odom[k] );
+                size_t scored = amcl.size();
+                AmclUpdate u = amcl.sensor_update( &st->scans[k * st->beams], st->beams, -kPi, 2 * kPi / st->beams );
+                update_ns += std::chrono::duration<double, std::nano>( clock::now() - t0 ).count();
+                beam_evals += double( u.beams ) * scored;
+                particles += double( amcl.size() );
+                resamples += u.resampled;
+                if ( k == 0 )
+                    first += double( u.particles );
+                if ( 2 * k >= steps )
+                {
+                    Pose2D e = amcl.estimate();
+                    double d2 = ( e.x - st->truth[k].x ) * ( e.x - st->truth[k].x ) + ( e.y - st->truth[k].y ) * ( e.y - st->truth[k].y );
+                    double dth = std::remainder( e.theta - st->truth[k].theta, 2 * kPi );
+                    held = held && d2 < 0.25 && std::fabs( dth ) < 0.2;
+                    run_err2 += d2;
+                    run_head2 += dth * dth;
+                }
+            }
+            last += double( amcl.size() );
+            if ( held )
+            {
+                ++localised;
+                err2 += run_err2;
+                head2 += run_head2;
+                tracked += steps - ( steps + 1 ) / 2;
+            }
+        }
+        const double updates = double( steps * seeds );
+        ctx.items( updates );
+        ctx.counter( "simd", level == SimdLevel::Avx2 ? 1.0 : 0.0 );
+        ctx.counter( "update_us", update_ns * 1e-3 / updates );
+        ctx.counter( "core_fraction_at_10hz", update_ns * 1e-9 / updates * 10.0 );
+        ctx.counter( "beams_per_us", beam_evals / ( update_ns * 1e-3 ) );
+        ctx.counter( "particles_mean", particles / updates );
+        ctx.counter( "particles_first", first / seeds );
+        ctx.counter( "particles_last", last / seeds );
+        ctx.counter( "resample_rate", double( resamples ) / updates );
+        ctx.counter( "success_rate", double( localised ) / seeds );
+        ctx.counter( "position_rms", tracked ? std::sqrt( err2 / tracked ) : 0.0 );
+        ctx.counter( "heading_rms", tracked ? std::sqrt( head2 / tracked ) : 0.0 );
+    };
+
+    bench::add( "amcl/tracking", [run]( bench::Context& ctx ) { run( ctx, false, detect_simd() ); }, setup );
+    bench::add( "amcl/tracking_scalar", [run]( bench::Context& ctx ) { run( ctx, false, SimdLevel::Scalar ); }, setup );
+    bench::add( "amcl/global", [run]( bench::Context& ctx ) { run( ctx, true, detect_simd() ); }, setup );
+    bench::add( "amcl/global_scalar", [run]( bench::Context& ctx ) { run( ctx, true, SimdLevel::Scalar ); }, setup );
+}
+
+// Street scene for a simulated 64-beam spinning lidar: ground plane,
+// building blocks on both sides, parked cars and poles.
+struct LidarScene
+{
+    struct Box
+    {
+        Vec3 lo, hi;
+    };
+    struct Pole
+    {
+        double x, y, radius, height;
+    };
+    std::vector<Box> boxes;
+    std::vector<Pole> poles;
+
+    explicit LidarScene( uint32_t seed )
+    {
+        std::mt19937 rng( seed );
+        std::uniform_real_distribution<double> u( 0.0, 1.0 );
+        for ( int side : { -1, 1 } )
+        {
+            for ( double x = -60.0; x < 120.0; )
+            {
+                double len = 8.0 + 14.0 * u( rng ), setback = 9.0 + 6.0 * u( rng ), depth = 8.0 + 10.0 * u( rng );
+                double y0 = side * setback, y1 = side * ( setback + depth );
+                boxes.push_back( { Vec3( x, std::min( y0, y1 ), 0.0 ), Vec3( x + len, std::max( y0, y1 ), 6.0 + 20.0 * u( rng ) ) } );
+                x += len + 2.0 + 6.0 * u( rng );
+            }
+            for ( double x = -50.0; x < 110.0; x += 7.0 + 10.0 * u( rng ) )
+            {
+                double y = side * ( 4.0 + 0.5 * u( rng ) );
+                boxes.push_back( { Vec3( x, y - 0.9, 0.0 ), Vec3( x + 4.2, y + 0.9, 1.5 ) } );
+            }
+            for ( double x = -55.0; x < 115.0; x += 12.0 )
+                poles.push_back( { x + 3.0 * u( rng ), side * 6.5, 0.15, 7.0 } );
+        }
+    }
+
+    // Slab test; shortens best when the ray enters b before it.
+    static void hit( const Box& b, const Vec3& o, const Vec3& d, double& best )
+    {
+        double t0 = 0.0, t1 = best;
+        for ( int a = 0; a < 3 && t0 <= t1; ++a )
+        {
+            if ( std::fabs( d[a] ) < 1e-12 )
+            {
+                if ( o[a] < b.lo[a] || o[a] > b.hi[a] )
+                    t0 = t1 + 1.0;
+                continue;
+            }
+            double ta = ( b.lo[a] - o[a] ) / d[a], tb = ( b.hi[a] - o[a] ) / d[a];
+            t0 = std::max( t0, std::min( ta, tb ) );
+            t1 = std::min( t1, std::max( ta, tb ) );
+        }
+        if ( t0 <= t1 && t0 > 0.0 )
+            best = t0;
+    }
+
+    // Distance along a unit ray to the first hit, or max_range.
+    double cast( const Vec3& o, const Vec3& d, double max_range ) const
+    {
+        double best = max_range;
+        if ( d.z < 0.0 )
+            best = std::min( best, -o.z / d.z );
+        for ( const Box& b : boxes )
+            hit( b, o, d, best );
+        for ( const Pole& p : poles )
+        {
+            double ox = o.x - p.x, oy = o.y - p.y, a = d.x * d.x + d.y * d.y;
+            double b = ox * d.x + oy * d.y, c = ox * ox + oy * oy - p.radius * p.radius, disc = b * b - a * c;
+            if ( a < 1e-12 || disc < 0.0 )
+                continue;
+            double t = ( -b - std::sqrt( disc ) ) / a;
+            if ( t > 0.0 && t < best && o.z + t * d.z < p.height )
+                best = t;
+        }
+        return best;
+    }
+
+    // One sweep from `pose` (sensor frame: x forward, z up), in the sensor
+    // frame, with Gaussian range noise. Rays that hit nothing are dropped.
+    void scan( const Isometry3& pose, int rings, int columns, std::mt19937& rng, PointCloud& out ) const
+    {
+        std::normal_distribution<double> noise( 0.0, 0.02 );
+        out.clear();
+        for ( int r = 0; r < rings; ++r )
+        {
+            double elev = ( -24.8 + 26.8 * r / ( rings - 1 ) ) * kPi / 180.0;
+            for ( int c = 0; c < columns; ++c )
+            {
+                double az = 2.0 * kPi * c / columns;
+                Vec3 dir( std::cos( elev ) * std::cos( az ), std::cos( elev ) * std::sin( az ), std::sin( elev ) );
+                double t = cast( pose.t, pose.R * dir, 100.0 );
+                if ( t >= 100.0 )
+                    continue;
+                Vec3 p = dir * ( t + noise( rng ) );
+                out.push_back( static_cast<float>( p.x ), static_cast<float>( p.y ), static_cast<float>( p.z ),
+                               static_cast<float>( t ) );
+            }
+        }
+    }
+};
+
+// Lidar odometry in the KISS-ICP pattern on scans read from disk: each
+// frame is voxel-downsampled twice (0.25 or 0.5 m for the map, 1.5 m for
+// registration), aligned against a 1 m VoxelHashMap from a constant-velocity
+// guess, then merged into the map. By default a 64 x 4800 sensor driving
+// 0.5 m per frame down a synthetic street is simulated once and written as
+// KITTI .bin files (lidar_scan_NNNNNN.bin under --data_dir); pass --scans=
+// a KITTI velodyne/ prefix to replay real data instead, in which case there
+// is no ground truth and the drift counters read zero. Counters give the
+// per-frame cost by stage and how it compares with a 20 Hz sensor.
+// On synthetic data the constant-velocity model starts from a wheel
+// odometry prior, the true first motion off by odom_error (20%): from a
+// zero-motion guess point-to-point locks onto the sensor-fixed ring
+// pattern on the flat ground and never starts moving. Point-to-point also
+// needs a tighter kernel than the default so the residuals between
+// neighbouring ground rings are down-weighted. Replayed data has no prior.
+static void register_scan_matching()
+{
+    struct State
+    {
+        std::string prefix;
+        bool synthetic = true;
+        std::vector<PointCloud> frames;
+        std::vector<Isometry3> truth;
+        double bytes = 0.0;
+    };
+    auto st = std::make_shared<State>();
+    auto path = []( const std::string& prefix, size_t k ) {
+        char name[32];
+        std::snprintf( name, sizeof( name ), "%06zu.bin", k );
+        return prefix + name;
+    };
+    auto load = [st, path]() {
+        st->frames.clear();
+        st->bytes = 0.0;
+        PointCloud cloud;
+        for ( size_t k = 0; ( !st->synthetic || k < st->truth.size() ) && load_kitti_bin( path( st->prefix, k ), cloud ); ++k )
+        {
+            st->bytes += 16.0 * cloud.size();
+            st->frames.push_back( cloud );
+        }
+    };
+    auto setup = [st, path, load]( bench::Context& ctx ) {
+        if ( !st->frames.empty() )
+            return;
+        std::string given = ctx.param( "scans", "" );
+        st->synthetic = given.empty();
+        st->prefix = st->synthetic ? bench_data_dir( ctx ) + "lidar_scan_" : given;
+        if ( st->synthetic )
+        {
+            size_t count = static_cast<size_t>( ctx.param( "frames", ctx.quick() ? 10.0 : 40.0 ) );
+            LidarScene scene( 3 );
+            std::mt19937 rng( 7 );
+            PointCloud cloud;
+            for ( size_t k = 0; k < count; ++k )
+            {
+                double yaw = 0.004 * k;
+                Isometry3 pose( axis_angle( { 0, 0, 1 }, yaw ), Vec3( 0.5 * k, 0.02 * k * k * 0.5 * 0.5, 1.8 ) );
+                st->truth.push_back( pose );
+                scene.scan( pose, 64, 4800, rng, cloud );
+                save_kitti_bin( track_bench_file( path( st->prefix, k ) ), cloud );
+            }
+        }
+        load();
+    };
+
+    bench::add( "scan_match/load_scans", [st, load]( bench::Context& ctx ) {
+        load();
+        double points = st->bytes / 16.0;
+        ctx.items( points );
+        ctx.counter( "frames", static_cast<double>( st->frames.size() ) );
+        ctx.counter( "points_per_frame", st->frames.empty() ? 0.0 : points / st->frames.size() );
+    }, setup );
+
+    // ICP wants a dense map for its nearest neighbours and voxel normals;
+    // NDT fits one Gaussian per voxel and converges better from a sparser
+    // one, where ground cells do not swamp the structure.
+    struct Case
+    {
+        const char* name;
+        ScanMatchMethod method;
+        double map_spacing;
+        double robust_scale;
+    };
+    for ( Case c : { Case{ "p2p", ScanMatchMethod::PointToPoint, 0.25, 0.1 }, Case{ "p2plane", ScanMatchMethod::PointToPlane, 0.25, 0.2 },
+                     Case{ "ndt", ScanMatchMethod::Ndt, 0.5, 0.2 } } )
+        for ( bool parallel : { false, true } )
+            bench::add( std::string( "scan_match/odometry_" ) + c.name + ( parallel ? "_pool" : "" ), [st, c, parallel]( bench::Context& ctx ) {
+                using clock = std::chrono::steady_clock;
+                ThreadPool* pool = parallel ? &bench_pool( ctx ) : nullptr;
+                ScanMatchOptions options;
+                options.method = c.method;
+                options.robust_scale = c.robust_scale;
+                ScanMatcher matcher( options, pool );
+                VoxelHashMap map( 1.0, 20 );
+                VoxelDownsampler downsampler;
+                PointCloud frame, source;
+                Isometry3 pose, delta;
+                if ( st->synthetic && st->truth.size() > 1 )
+                {
+                    const double scale = 1.0 - ctx.param( "odom_error", 0.2 );
+                    const Isometry3 first = st->truth[0].inverse() * st->truth[1];
+                    delta = Isometry3( axis_angle( { 0, 0, 1 }, scale * rotation_log( first.R ).z ), first.t * scale );
+                }
+                double total_ns = 0.0, filter_ns = 0.0, align_ns = 0.0, iterations = 0.0, rmse = 0.0, source_points = 0.0, points = 0.0;
+                size_t failures = 0;
+                for ( size_t k = 0; k < st->frames.size(); ++k )
+                {
+                    auto t0 = clock::now();
+                    downsampler.apply( st->frames[k], c.map_spacing, frame );
+                    downsampler.apply( frame, 1.5, source );
+                    auto t1 = clock::now();
+                    if ( k )
+                    {
+                        ScanMatchResult result;
+                        Isometry3 guess = pose * delta;
+                        failures += !matcher.align( map, source, guess, result );
+                        delta = pose.inverse() * result.pose;
+                        pose = result.pose;
+                        iterations += double( result.iterations );
+                        rmse += result.rmse;
+                    }
+                    auto t2 = clock::now();
+                    map.insert( frame, pose );
+                    map.remove_far( pose.t, 100.0 );
+                    map.update_statistics( pool );
+                    total_ns += std::chrono::duration<double, std::nano>( clock::now() - t0 ).count();
+                    filter_ns += std::chrono::duration<double, std::nano>( t1 - t0 ).count();
+                    align_ns += std::chrono::duration<double, std::nano>( t2 - t1 ).count();
+                    source_points += double( source.size() );
+                    points += double( st->frames[k].size() );
+                }
+
+                // The simulated sensor starts at the origin of its own frame,
+                // so odometry is compared with truth relative to frame 0.
+                const size_t n = st->frames.size();
+                double trans_err = 0.0, rot_err = 0.0, length = 0.0;
+                if ( st->synthetic && n > 1 )
+                {
+                    Isometry3 expected = st->truth[0].inverse() * st->truth[n - 1];
+                    Isometry3 error = expected.inverse() * pose;
+                    trans_err = norm( error.t );
+                    rot_err = norm( rotation_log( error.R ) ) * 180.0 / kPi;
+                    for ( size_t k = 1; k < n; ++k )
+                        length += norm( st->truth[k].t - st->truth[k - 1].t );
+                }
+                ctx.items( points );
+                ctx.counter( "ms_per_frame", total_ns * 1e-6 / n );
+                ctx.counter( "downsample_ms", filter_ns * 1e-6 / n );
+                ctx.counter( "align_ms", align_ns * 1e-6 / n );
+                ctx.counter( "map_update_ms", ( total_ns - filter_ns - align_ns ) * 1e-6 / n );
+                ctx.counter( "realtime_factor_20hz", 50e6 * n / total_ns );
+                ctx.counter( "source_points", source_points / n );
+                ctx.counter( "map_voxels", static_cast<double>( map.voxels() ) );
+                ctx.counter( "iterations_mean", iterations / std::max<size_t>( n - 1, 1 ) );
+                ctx.counter( "rmse_mean", rmse / std::max<size_t>( n - 1, 1 ) );
+                ctx.counter( "failures", static_cast<double>( failures ) );
+                ctx.counter( "drift_pct", length > 0.0 ? 100.0 * trans_err / length : 0.0 );
+                ctx.counter( "drift_deg", rot_err );
+            }, setup );
+}
+
+// Manhattan-world style SE(2) dataset: a random walk on a unit grid that
+// turns at random and whenever it would leave a square, with a loop closure
+// to an earlier pose each time it revisits a cell.
+static void make_manhattan_graph( size_t poses, uint32_t seed, PoseGraph<Se2>& graph )
+{
+    std::mt19937 rng( seed );
+    std::normal_distribution<double> noise( 0.0, 1.0 );
+    std::uniform_real_distribution<double> uni( 0.0, 1.0 );
+    const double sigma_xy = 0.05, sigma_th = 0.005;
+    double info[3][3] = { { 1.0 / ( sigma_xy * sigma_xy ), 0, 0 }, { 0, 1.0 / ( sigma_xy * sigma_xy ), 0 }, { 0, 0, 1.0 / ( sigma_th * sigma_th ) } };
+    const int half = std::max( 5, static_cast<int>( std::sqrt( double( poses ) ) / 2 ) );
+    std::vector<Pose2D> truth;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> visits;
+    auto measure = [&]( const Pose2D& a, const Pose2D& b ) {
+        Pose2D z = Se2::between( a, b );
+        z.x += sigma_xy * noise( rng );
+        z.y += sigma_xy * noise( rng );
+        z.theta = Se2::wrap( z.theta + sigma_th * noise( rng ) );
+        return z;
+    };
+    graph.clear();
+    int x = 0, y = 0, dir = 0;
+    const int dx[4] = { 1, 0, -1, 0 }, dy[4] = { 0, 1, 0, -1 };
+    for ( uint32_t v = 0; v < poses; ++v )
+    {
+        Pose2D p;
+        p.x = x;
+        p.y = y;
+        p.theta = Se2::wrap( dir * kPi / 2 );
+        truth.push_back( p );
+        if ( v == 0 )
+            graph.add_vertex( p );
+        else
+        {
+            Pose2D z = measure( truth[v - 1], p );
+            graph.add_vertex( Se2::compose( graph.pose( v - 1 ), z ) );
+            graph.add_edge( v - 1, v, z, info );
+        }
+        uint64_t cell = voxel_key( x, y, 0 );
+        auto& seen = visits[cell];
+        for ( uint32_t u : seen )
+            if ( u + 10 < v && uni( rng ) < 0.5 )
+            {
+                graph.add_edge( u, v, measure( truth[u], p ), info );
+                break;
+            }
+        seen.push_back( v );
+
+        double r = uni( rng );
+        if ( r < 0.15 )
+            dir = ( dir + 1 ) % 4;
+        else if ( r < 0.3 )
+            dir = ( dir + 3 ) % 4;
+        while ( std::abs( x + dx[dir] ) > half || std::abs( y + dy[dir] ) > half )
+            dir = ( dir + 1 ) % 4;
+        x += dx[dir];
+        y += dy[dir];
+    }
+}
+
+// Sphere style SE(3) dataset: a spiral of rings with odometry along each
+// ring and a closure to the pose directly below on the previous ring.
+static void make_sphere_graph( size_t poses, uint32_t seed, PoseGraph<Se3>& graph )
+{
+    std::mt19937 rng( seed );
+    std::normal_distribution<double> noise( 0.0, 1.0 );
+    const double sigma_t = 0.05, sigma_r = 0.005;
+    double info[6][6] = {};
+    for ( int k = 0; k < 6; ++k )
+        info[k][k] = k < 3 ? 1.0 / ( sigma_t * sigma_t ) : 1.0 / ( sigma_r * sigma_r );
+    const size_t per_ring = std::max<size_t>( 10, static_cast<size_t>( std::sqrt( double( poses ) ) ) );
+    const size_t rings = ( poses + per_ring - 1 ) / per_ring;
+    const double radius = 0.5 * per_ring / kPi;
+    std::vector<Isometry3> truth;
+    auto measure = [&]( const Isometry3& a, const Isometry3& b ) {
+        double d[6];
+        for ( int k = 0; k < 6; ++k )
+            d[k] = ( k < 3 ? sigma_t : sigma_r ) * noise( rng );
+        return Se3::retract( Se3::between( a, b ), d );
+    };
+    graph.clear();
+    for ( uint32_t v = 0; v < poses; ++v )
+    {
+        double lon = 2.0 * kPi * ( v % per_ring ) / per_ring;
+        double lat = -0.5 * kPi + kPi * ( double( v ) / per_ring + 0.5 ) / ( rings + 1 );
+        Mat3 R = axis_angle( { 0, 0, 1 }, lon ) * axis_angle( { 0, 1, 0 }, -lat );
+        Vec3 t( radius * std::cos( lat ) * std::cos( lon ), radius * std::cos( lat ) * std::sin( lon ), radius * std::sin( lat ) );
+        truth.emplace_back( R, t );
+        if ( v == 0 )
+            graph.add_vertex( truth[0] );
+        else
+        {
+            Isometry3 z = measure( truth[v - 1], truth[v] );
+            graph.add_vertex( Se3::compose( graph.pose( v - 1 ), z ) );
+            graph.add_edge( v - 1, v, z, info );
+        }
+        if ( v >= per_ring )
+            graph.add_edge( v - per_ring, v, measure( truth[v - per_ring], truth[v] ), info );
+    }
+}
+
+template <typename Group>
+static void register_pose_graph_group( const std::string& tag, size_t quick_poses, size_t full_poses,
+                                       void ( *make )( size_t, uint32_t, PoseGraph<Group>& ) )
+{
+    struct State
+    {
+        std::string path;
+        PoseGraph<Group> graph;
+        double bytes = 0.0;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st, tag, quick_poses, full_poses, make]( bench::Context& ctx ) {
+        if ( !st->path.empty() )
+            return;
+        st->path = ctx.param( "g2o_" + tag, "" );
+        if ( st->path.empty() )
+        {
+            st->path = track_bench_file( bench_data_dir( ctx ) + "pose_graph_" + tag + ".g2o" );
+            PoseGraph<Group> generated;
+            make( static_cast<size_t>( ctx.param( "poses", double( ctx.quick() ? quick_poses : full_poses ) ) ), 11, generated );
+            save_g2o( st->path, generated );
+        }
+        load_g2o( st->path, st->graph );
+    };
+
+    bench::add( "pose_graph/load_" + tag, [st]( bench::Context& ctx ) {
+        PoseGraph<Group> graph;
+        bool ok = load_g2o( st->path, graph );
+        ctx.items( double( graph.vertices() + graph.edges().size() ) );
+        ctx.counter( "ok", ok );
+        ctx.counter( "poses", double( graph.vertices() ) );
+        ctx.counter( "edges", double( graph.edges().size() ) );
+    }, setup );
+
+    bench::add( "pose_graph/batch_" + tag, [st]( bench::Context& ctx ) {
+        PoseGraph<Group> graph = st->graph;
+        BatchPoseGraphOptimizer<Group> optimizer;
+        PoseGraphResult result;
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = optimizer.optimize( graph, PoseGraphOptions(), result );
+        double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - t0 ).count();
+        ctx.items( double( graph.vertices() ) );
+        ctx.counter( "ok", ok );
+        ctx.counter( "converged", result.converged );
+        ctx.counter( "iterations", double( result.iterations ) );
+        ctx.counter( "ms_per_iteration", ms / std::max<size_t>( result.iterations, 1 ) );
+        ctx.counter( "chi2_initial", result.initial_chi2 );
+        ctx.counter( "chi2_final", result.final_chi2 );
+        ctx.counter( "factor_blocks", double( result.factor_blocks ) );
+    }, setup );
+
+    // Fill and factorisation time of one Gauss-Newton step with and without
+    // the minimum degree ordering, on a prefix of the graph so the natural
+    // order stays affordable.
+    bench::add( "pose_graph/ordering_" + tag, [st]( bench::Context& ctx ) {
+        const size_t n = std::min<size_t>( st->graph.vertices(), static_cast<size_t>( ctx.param( "ordering_poses", 1000.0 ) ) );
+        PoseGraph<Group> prefix;
+        for ( size_t v = 0; v < n; ++v )
+            prefix.add_vertex( st->graph.pose( v ) );
+        for ( const auto& e : st->graph.edges() )
+            if ( e.i < n && e.j < n )
+                prefix.add_edge( e );
+        for ( bool reorder : { false, true } )
+        {
+            PoseGraph<Group> graph = prefix;
+            BatchPoseGraphOptimizer<Group> optimizer;
+            PoseGraphOptions options;
+            options.max_iterations = 1;
+            options.reorder = reorder;
+            PoseGraphResult result;
+            auto t0 = std::chrono::steady_clock::now();
+            optimizer.optimize( graph, options, result );
+            double ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - t0 ).count();
+            std::string key = reorder ? "min_degree_" : "natural_";
+            ctx.counter( key + "blocks", double( result.factor_blocks ) );
+            ctx.counter( key + "ms", ms );
+        }
+        ctx.items( double( n ) );
+        ctx.counter( "poses", double( n ) );
+    }, setup );
+
+    // Replays the graph one pose at a time, as a SLAM front end would: each
+    // new pose starts from the previous estimate composed with the file's
+    // relative initial guess, and is added with every edge to earlier poses.
+    // Full runs replay a prefix by default (--replay_poses) since every
+    // update on a large graph costs milliseconds.
+    bench::add( "pose_graph/incremental_" + tag, [st]( bench::Context& ctx ) {
+        using clock = std::chrono::steady_clock;
+        const PoseGraph<Group>& graph = st->graph;
+        const size_t n = std::min( graph.vertices(), static_cast<size_t>( ctx.param( "replay_poses", ctx.quick() ? 1e9 : 10000.0 ) ) );
+        std::vector<std::vector<uint32_t>> arriving( n );
+        for ( uint32_t k = 0; k < graph.edges().size(); ++k )
+        {
+            const auto& e = graph.edges()[k];
+            if ( std::max( e.i, e.j ) < n )
+                arriving[std::max( e.i, e.j )].push_back( k );
+        }
+        IncrementalPoseGraphOptions options;
+        IncrementalPoseGraphOptimizer<Group> isam( options );
+        std::vector<double> update_us;
+        update_us.reserve( n );
+        double refactored = 0.0, solved = 0.0, relinearized = 0.0;
+        bool ok = true;
+        for ( uint32_t v = 0; v < n; ++v )
+        {
+            auto t0 = clock::now();
+            isam.add_vertex( v ? Group::compose( isam.estimate( v - 1 ), Group::between( graph.pose( v - 1 ), graph.pose( v ) ) ) : graph.pose( 0 ) );
+            for ( uint32_t k : arriving[v] )
+            {
+                const auto& e = graph.edges()[k];
+                isam.add_edge( e.i, e.j, e.z, e.info );
+            }
+            IncrementalPoseGraphStats stats;
+            ok = isam.update( &stats ) && ok;
+            update_us.push_back( std::chrono::duration<double, std::micro>( clock::now() - t0 ).count() );
+            refactored += double( stats.refactored );
+            solved += double( stats.back_substituted );
+            relinearized += double( stats.relinearized );
+        }
+        double total = 0.0;
+        for ( double t : update_us )
+            total += t;
+        std::sort( update_us.begin(), update_us.end() );
+        ctx.items( double( n ) );
+        ctx.counter( "ok", ok );
+        ctx.counter( "update_us_mean", total / std::max<size_t>( n, 1 ) );
+        ctx.counter( "update_us_p99", n ? update_us[n * 99 / 100] : 0.0 );
+        ctx.counter( "update_us_max", n ? update_us.back() : 0.0 );
+        ctx.counter( "refactored_per_update", refactored / std::max<size_t>( n, 1 ) );
+        ctx.counter( "solved_per_update", solved / std::max<size_t>( n, 1 ) );
+        ctx.counter( "relinearized", relinearized );
+        ctx.counter( "factor_blocks", double( isam.factor_blocks() ) );
+        ctx.counter( "cached_blocks", double( isam.cached_blocks() ) );
+        ctx.counter( "chi2_final", isam.chi2() );
+    }, setup );
+}
+
+static void register_pose_graph()
+{
+    register_pose_graph_group<Se2>( "se2", 3500, 100000, make_manhattan_graph );
+    register_pose_graph_group<Se3>( "se3", 1000, 2500, make_sphere_graph );
+}
+
+// Warehouse floor for place recognition: rows of racks split into bays of
+// random length and height, cross aisles, and pallets left along the aisle
+// sides. Boxes are bucketed on a 2D grid that rays walk cell by cell, so a
+// scan only tests the racks it passes.
+struct FacilityScene
+{
+    using Box = LidarScene::Box;
+    static constexpr double kCell = 4.0;
+    static constexpr double kOrigin = -2.0;
+    static constexpr double kRowPitch = 11.0;
+    static constexpr double kRackDepth = 2.4;
+    static constexpr double kCeiling = 12.0;
+
+    double length;
+    int aisles;
+    std::vector<Box> boxes;
+    int nx = 0, ny = 0;
+    std::vector<std::vector<uint32_t>> grid;
+
+    FacilityScene( double length_, int aisles_, uint32_t seed ) : length( length_ ), aisles( aisles_ )
+    {
+        std::mt19937 rng( seed );
+        std::uniform_real_distribution<double> u( 0.0, 1.0 );
+        const double width = aisles * kRowPitch + kRackDepth;
+        for ( int k = 0; k <= aisles; ++k )
+        {
+            const double y = k * kRowPitch;
+            for ( double x = 8.0; x < length - 8.0; )
+            {
+                if ( u( rng ) < 0.06 )
+                {
+                    x += 4.0 + 3.0 * u( rng );
+                    continue;
+                }
+                double bay = std::min( 2.7 + 5.0 * u( rng ), length - 8.0 - x );
+                boxes.push_back( { Vec3( x, y, 0.0 ), Vec3( x + bay, y + kRackDepth, 2.5 + 8.5 * u( rng ) ) } );
+                x += bay + 0.15;
+            }
+        }
+        for ( int k = 0; k < aisles; ++k )
+        {
+            const double lo = k * kRowPitch + kRackDepth, hi = ( k + 1 ) * kRowPitch;
+            for ( double x = 10.0 + 20.0 * u( rng ); x < length - 10.0; x += 8.0 + 25.0 * u( rng ) )
+            {
+                double side = 0.8 + 0.6 * u( rng ), y = u( rng ) < 0.5 ? lo + 0.2 : hi - 0.2 - side;
+                boxes.push_back( { Vec3( x, y, 0.0 ), Vec3( x + side, y + side, 0.4 + 1.8 * u( rng ) ) } );
+            }
+        }
+        boxes.push_back( { Vec3( -1.0, -1.0, 0.0 ), Vec3( 0.0, width + 1.0, kCeiling ) } );
+        boxes.push_back( { Vec3( length, -1.0, 0.0 ), Vec3( length + 1.0, width + 1.0, kCeiling ) } );
+        boxes.push_back( { Vec3( 0.0, -1.0, 0.0 ), Vec3( length, 0.0, kCeiling ) } );
+        boxes.push_back( { Vec3( 0.0, width, 0.0 ), Vec3( length, width + 1.0, kCeiling ) } );
+
+        nx = static_cast<int>( std::ceil( ( length - 2.0 * kOrigin ) / kCell ) );
+        ny = static_cast<int>( std::ceil( ( width - 2.0 * kOrigin ) / kCell ) );
+        grid.resize( size_t( nx ) * ny );
+        for ( uint32_t b = 0; b < boxes.size(); ++b )
+        {
+            int x0 = cell( boxes[b].lo.x ), x1 = cell( boxes[b].hi.x ), y0 = cell( boxes[b].lo.y ), y1 = cell( boxes[b].hi.y );
+            for ( int cy = std::max( y0, 0 ); cy <= std::min( y1, ny - 1 ); ++cy )
+                for ( int cx = std::max( x0, 0 ); cx <= std::min( x1, nx - 1 ); ++cx )
+                    grid[size_t( cy ) * nx + cx].push_back( b );
+        }
+    }
+
+    static int cell( double v ) { return static_cast<int>( std::floor( ( v - kOrigin ) / kCell ) ); }
+
+    double aisle_y( int k ) const { return k * kRowPitch + 0.5 * ( kRowPitch + kRackDepth ); }
+
+    // Distance along a unit ray to the first hit, or max_range. Rays that
+    // leave through the open roof miss.
+    double cast( const Vec3& o, const Vec3& d, double max_range ) const
+    {
+        double best = max_range, reach = max_range;
+        if ( d.z < 0.0 )
+            best = std::min( best, -o.z / d.z );
+        else if ( d.z > 0.0 )
+            reach = std::min( reach, ( kCeiling - o.z ) / d.z );
+        int cx = cell( o.x ), cy = cell( o.y );
+        const int sx = d.x > 0.0 ? 1 : -1, sy = d.y > 0.0 ? 1 : -1;
+        const double inf = std::numeric_limits<double>::infinity();
+        double tx = std::fabs( d.x ) > 1e-12 ? ( kOrigin + ( cx + ( sx > 0 ) ) * kCell - o.x ) / d.x : inf;
+        double ty = std::fabs( d.y ) > 1e-12 ? ( kOrigin + ( cy + ( sy > 0 ) ) * kCell - o.y ) / d.y : inf;
+        const double dx = std::fabs( d.x ) > 1e-12 ? kCell / std::fabs( d.x ) : inf;
+        const double dy = std::fabs( d.y ) > 1e-12 ? kCell / std::fabs( d.y ) : inf;
+        while ( cx >= 0 && cy >= 0 && cx < nx && cy < ny )
+        {
+            for ( uint32_t b : grid[size_t( cy ) * nx + cx] )
+                LidarScene::hit( boxes[b], o, d, best );
+            double exit = std::min( tx, ty );
+            if ( exit >= best || exit >= reach )
+                break;
+            if ( tx < ty )
+            {
+                cx += sx;
+                tx += dx;
+            }
+            else
+            {
+                cy += sy;
+                ty += dy;
+            }
+        }
+        return best < reach ? best : max_range;
+    }
+
+    // Sweep of a 32-beam, 90 degree field of view dome lidar at 1.8 m, in
+    // the sensor frame. A narrow field of view sees rack faces only up to
+    // a few metres, which makes every aisle look alike.
+    void scan( const Pose2D& pose, int columns, std::mt19937& rng, PointCloud& out ) const
+    {
+        std::normal_distribution<double> noise( 0.0, 0.02 );
+        const Mat3 R = axis_angle( { 0, 0, 1 }, pose.theta );
+        const Vec3 o( pose.x, pose.y, 1.8 );
+        out.clear();
+        for ( int r = 0; r < 32; ++r )
+        {
+            double elev = ( -45.0 + 90.0 * r / 31.0 ) * kPi / 180.0;
+            for ( int c = 0; c < columns; ++c )
+            {
+                double az = 2.0 * kPi * c / columns;
+                Vec3 dir( std::cos( elev ) * std::cos( az ), std::cos( elev ) * std::sin( az ), std::sin( elev ) );
+                double t = cast( o, R * dir, 80.0 );
+                if ( t >= 80.0 )
+                    continue;
+                Vec3 p = dir * ( t + noise( rng ) );
+                out.push_back( static_cast<float>( p.x ), static_cast<float>( p.y ), static_cast<float>( p.z ) );
+            }
+        }
+    }
+};
+
+// Keyframes every `step` m down each aisle in a serpentine, then a second
+// pass over a random subset of aisles in either direction, offset across
+// the aisle, which are the loops to find.
+static std::vector<Pose2D> make_facility_route( const FacilityScene& scene, double step, double revisit, uint32_t seed )
+{
+    std::mt19937 rng( seed );
+    std::uniform_real_distribution<double> u( 0.0, 1.0 );
+    std::normal_distribution<double> jitter( 0.0, 1.0 );
+    std::vector<Pose2D> route;
+    auto drive = [&]( int aisle, bool forward, double offset, double start ) {
+        for ( double s = 4.0 + start; s < scene.length - 4.0; s += step )
+        {
+            double x = forward ? s : scene.length - s;
+            route.push_back( { x, scene.aisle_y( aisle ) + offset + 0.1 * jitter( rng ),
+                               ( forward ? 0.0 : kPi ) + 0.05 * jitter( rng ) } );
+        }
+    };
+    for ( int k = 0; k < scene.aisles; ++k )
+        drive( k, k % 2 == 0, 0.0, 0.0 );
+    std::vector<int> order( scene.aisles );
+    for ( int k = 0; k < scene.aisles; ++k )
+        order[k] = k;
+    std::shuffle( order.begin(), order.end(), rng );
+    for ( int k = 0; k < static_cast<int>( std::ceil( revisit * scene.aisles ) ); ++k )
+        drive( order[k], u( rng ) < 0.5, 2.0 * u( rng ) - 1.0, step * u( rng ) );
+    return route;
+}
+
+static void register_place_recognition()
+{
+    struct State
+    {
+        std::vector<Pose2D> route;
+        std::vector<ScanContext> descriptors;
+        std::vector<PointCloud> samples;
+        std::vector<uint8_t> loop;
+        std::vector<std::vector<uint32_t>> exact;
+    };
+    auto st = std::make_shared<State>();
+    // A match counts when it lies this close to the query.
+    const double match_radius = 4.0;
+    static constexpr int kMaxCandidates = 40;
+    auto setup = [st, match_radius]( bench::Context& ctx ) {
+        if ( !st->route.empty() )
+            return;
+        ScanContextOptions options;
+        options.candidates = kMaxCandidates;
+        FacilityScene scene( ctx.param( "facility_length", ctx.quick() ? 120.0 : 300.0 ),
+                             static_cast<int>( ctx.param( "facility_aisles", ctx.quick() ? 6.0 : 16.0 ) ), 11 );
+        st->route = make_facility_route( scene, 1.5, 0.35, 12 );
+        std::mt19937 rng( 13 );
+        PointCloud cloud;
+        for ( const Pose2D& pose : st->route )
+        {
+            scene.scan( pose, 512, rng, cloud );
+            st->descriptors.emplace_back();
+            make_scan_context( cloud, options, st->descriptors.back() );
+            if ( st->samples.size() < 20 )
+                st->samples.push_back( cloud );
+        }
+        // A keyframe closes a loop when the index holds one near it, and the
+        // exact ring-key neighbours are the reference for the ANN recall;
+        // a prefix of them is the exact answer for fewer candidates.
+        const size_t n = st->route.size();
+        st->loop.assign( n, 0 );
+        for ( size_t i = options.exclude_recent; i < n; ++i )
+            for ( size_t j = 0; j + options.exclude_recent < i && !st->loop[i]; ++j )
+                st->loop[i] = std::hypot( st->route[i].x - st->route[j].x, st->route[i].y - st->route[j].y ) < 0.5 * match_radius;
+        options.index = NearestIndexKind::Brute;
+        ScanContextDatabase db( options );
+        st->exact.resize( n );
+        for ( size_t i = 0; i < n; ++i )
+        {
+            db.candidates( st->descriptors[i], st->exact[i] );
+            db.add( st->descriptors[i] );
+        }
+    };
+
+    bench::add( "place_recognition/describe", [st]( bench::Context& ctx ) {
+        ScanContextOptions options;
+        ScanContext desc;
+        double points = 0.0;
+        for ( const PointCloud& cloud : st->samples )
+        {
+            make_scan_context( cloud, options, desc );
+            points += double( cloud.size() );
+        }
+        ctx.items( points );
+        ctx.counter( "scans", double( st->samples.size() ) );
+    }, setup );
+
+    // Replays the route: every keyframe queries the database, then joins it.
+    // More candidates buy recall with rerank time; the index decides what
+    // retrieving them costs. proposal_precision is the share of proposals
+    // that lie near the query, before any geometric check.
+    struct Case
+    {
+        NearestIndexKind kind;
+        int candidates;
+    };
+    for ( Case c : { Case{ NearestIndexKind::Brute, 10 }, Case{ NearestIndexKind::KdTree, 10 }, Case{ NearestIndexKind::Gnat, 10 },
+                     Case{ NearestIndexKind::Hnsw, 10 }, Case{ NearestIndexKind::Brute, kMaxCandidates },
+                     Case{ NearestIndexKind::Hnsw, kMaxCandidates } } )
+        bench::add( std::string( "place_recognition/query_" ) + to_string( c.kind ) + "_k" + std::to_string( c.candidates ),
+                    [st, c, match_radius]( bench::Context& ctx ) {
+            using clock = std::chrono::steady_clock;
+            ScanContextOptions options;
+            options.index = c.kind;
+            options.candidates = c.candidates;
+            options.threshold = ctx.param( "threshold", options.threshold );
+            ScanContextDatabase db( options );
+            std::vector<uint32_t> candidates;
+            double query_ns = 0.0, retrieve_ns = 0.0, insert_ns = 0.0, key_hits = 0.0, key_total = 0.0, yaw_err = 0.0;
+            size_t queries = 0, loops = 0, top1 = 0, topk = 0, loop_proposed = 0, proposed = 0, true_proposed = 0, located = 0;
+            auto is_nearby = [&]( size_t i, uint32_t id ) {
+                return std::hypot( st->route[i].x - st->route[id].x, st->route[i].y - st->route[id].y ) < match_radius;
+            };
+            for ( size_t i = 0; i < st->descriptors.size(); ++i )
+            {
+                const ScanContext& desc = st->descriptors[i];
+                if ( db.indexed() )
+                {
+                    PlaceMatch match;
+                    auto t0 = clock::now();
+                    db.query( desc, match );
+                    auto t1 = clock::now();
+                    db.candidates( desc, candidates );
+                    auto t2 = clock::now();
+                    query_ns += std::chrono::duration<double, std::nano>( t1 - t0 ).count();
+                    retrieve_ns += std::chrono::duration<double, std::nano>( t2 - t1 ).count();
+                    ++queries;
+                    const size_t exact = std::min( st->exact[i].size(), candidates.size() );
+                    for ( size_t j = 0; j < exact; ++j )
+                        key_hits += std::count( candidates.begin(), candidates.end(), st->exact[i][j] );
+                    key_total += double( exact );
+                    bool correct = match.candidates && is_nearby( i, match.id );
+                    if ( st->loop[i] )
+                    {
+                        ++loops;
+                        top1 += correct;
+                        topk += std::any_of( candidates.begin(), candidates.end(), [&]( uint32_t id ) { return is_nearby( i, id ); } );
+                        loop_proposed += match.proposed && correct;
+                    }
+                    if ( match.proposed )
+                    {
+                        ++proposed;
+                        true_proposed += correct;
+                    }
+                    if ( correct )
+                    {
+                        ++located;
+                        double e = std::remainder( st->route[i].theta - st->route[match.id].theta - match.yaw, 2.0 * kPi );
+                        yaw_err += std::fabs( e ) * 180.0 / kPi;
+                    }
+                }
+                auto t3 = clock::now();
+                db.add( desc );
+                insert_ns += std::chrono::duration<double, std::nano>( clock::now() - t3 ).count();
+            }
+            ctx.items( double( queries ) );
+            ctx.counter( "keyframes", double( db.size() ) );
+            ctx.counter( "loops", double( loops ) );
+            ctx.counter( "recall_at_1", loops ? double( top1 ) / loops : 0.0 );
+            ctx.counter( "recall_at_k", loops ? double( topk ) / loops : 0.0 );
+            ctx.counter( "proposal_recall", loops ? double( loop_proposed ) / loops : 0.0 );
+            ctx.counter( "proposal_precision", proposed ? double( true_proposed ) / proposed : 1.0 );
+            ctx.counter( "key_recall", key_total > 0.0 ? key_hits / key_total : 1.0 );
+            ctx.counter( "yaw_err_deg", located ? yaw_err / located : 0.0 );
+            ctx.counter( "query_us", queries ? 1e-3 * query_ns / queries : 0.0 );
+            ctx.counter( "retrieve_us", queries ? 1e-3 * retrieve_ns / queries : 0.0 );
+            ctx.counter( "insert_us", 1e-3 * insert_ns / std::max<size_t>( db.size(), 1 ) );
+        }, setup );
+
+    // Ring-key retrieval alone against a long-lived map of `keyframes`
+    // keys: the route's keys tiled with 5 cm of noise per ring, since
+    // rendering that many scans would swamp the run and only the index cost
+    // grows with the map. A few hundred keyframes favour the linear scan;
+    // this is the scale the ANN indexes are for.
+    struct Scale
+    {
+        SoaStore keys;
+        std::vector<std::vector<float>> queries;
+        std::vector<std::vector<uint32_t>> exact;
+    };
+    auto scale = std::make_shared<Scale>();
+    static constexpr size_t kScaleCandidates = 10;
+    auto scale_setup = [st, scale, setup]( bench::Context& ctx ) {
+        setup( ctx );
+        if ( scale->keys.size() )
+            return;
+        const int rings = ScanContextOptions().rings;
+        const size_t n = static_cast<size_t>( ctx.param( "keyframes", ctx.quick() ? 20000.0 : 100000.0 ) );
+        std::mt19937 rng( 14 );
+        std::normal_distribution<float> noise( 0.0f, 0.05f );
+        std::vector<float> key( rings );
+        scale->keys.reset( rings, n );
+        for ( size_t i = 0; i < n; ++i )
+        {
+            const std::vector<float>& src = st->descriptors[i % st->descriptors.size()].ring_key;
+            for ( int r = 0; r < rings; ++r )
+                key[r] = src[r] + noise( rng );
+            scale->keys.push( key.data() );
+        }
+        auto exact = make_nearest_index( NearestIndexKind::Brute, scale->keys );
+        for ( uint32_t i = 0; i < scale->keys.size(); ++i )
+            exact->add( i );
+        const size_t queries = std::min<size_t>( st->descriptors.size(), 256 );
+        for ( size_t q = 0; q < queries; ++q )
+        {
+            const std::vector<float>& src = st->descriptors[q * st->descriptors.size() / queries].ring_key;
+            scale->queries.emplace_back( rings );
+            for ( int r = 0; r < rings; ++r )
+                scale->queries.back()[r] = src[r] + noise( rng );
+            scale->exact.emplace_back();
+            exact->nearest_k( scale->queries.back().data(), kScaleCandidates, scale->exact.back() );
+        }
+    };
+
+    for ( NearestIndexKind kind : { NearestIndexKind::Brute, NearestIndexKind::KdTree, NearestIndexKind::Gnat, NearestIndexKind::Hnsw } )
+    {
+        struct Index
+        {
+            std::unique_ptr<NearestNeighbors> index;
+            double insert_us = 0.0;
+        };
+        auto index = std::make_shared<Index>();
+        bench::add( std::string( "place_recognition/map_retrieve_" ) + to_string( kind ), [scale, index]( bench::Context& ctx ) {
+            std::vector<uint32_t> found;
+            double hits = 0.0, retrieve_ns = 0.0;
+            for ( size_t q = 0; q < scale->queries.size(); ++q )
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                index->index->nearest_k( scale->queries[q].data(), kScaleCandidates, found );
+                retrieve_ns += std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - t0 ).count();
+                if ( ctx.iteration() == 0 )
+                    for ( uint32_t id : scale->exact[q] )
+                        hits += std::count( found.begin(), found.end(), id );
+            }
+            ctx.items( double( scale->queries.size() ) );
+            ctx.counter( "keyframes", double( scale->keys.size() ) );
+            ctx.counter( "insert_us", index->insert_us );
+            ctx.counter( "retrieve_us", 1e-3 * retrieve_ns / double( scale->queries.size() ) );
+            if ( ctx.iteration() == 0 )
+                ctx.counter( "key_recall", hits / double( scale->queries.size() * kScaleCandidates ) );
+        }, [scale, scale_setup, index, kind]( bench::Context& ctx ) {
+            scale_setup( ctx );
+            if ( index->index )
+                return;
+            index->index = make_nearest_index( kind, scale->keys );
+            auto t0 = std::chrono::steady_clock::now();
+            for ( uint32_t i = 0; i < scale->keys.size(); ++i )
+                index->index->add( i );
+            double ns = std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - t0 ).count();
+            index->insert_us = 1e-3 * ns / double( scale->keys.size() );
+        } );
+    }
+}
+
+// One sweep of a spinning 64-beam lidar while the platform drives at
+// `speed` and turns at `yaw_rate`: column c fires period * (1 - c / columns)
+// before the sweep ends, from the pose at that time, and its points are in
+// the sensor frame of that instant, as a driver delivers them. truth holds
+// the same returns in the frame at the end of the sweep. A fraction of
+// returns are spurious dust hits short of the surface, flagged by intensity
+// 1. motion gets odometry at 200 Hz around the sweep, relative to its end.
+struct SkewedFrame
+{
+    PointCloud cloud;
+    std::vector<float> time;
+    PointCloud truth;
+    std::vector<MotionSample> motion;
+};
+
+static void make_skewed_frame( const LidarScene& scene, const Isometry3& end_pose, double speed, double yaw_rate, double dust,
+                               uint32_t seed, SkewedFrame& frame )
+{
+    const int rings = 64, columns = 4800;
+    const double period = 0.1;
+    std::mt19937 rng( seed );
+    std::normal_distribution<double> noise( 0.0, 0.02 );
+    std::uniform_real_distribution<double> u( 0.0, 1.0 );
+    // Constant twist, relative to the pose at the end of the sweep (t = 0).
+    auto relative = [&]( double t ) {
+        double yaw = yaw_rate * t;
+        double s = std::fabs( yaw_rate ) > 1e-9 ? std::sin( yaw ) / yaw_rate : t;
+        double c = std::fabs( yaw_rate ) > 1e-9 ? ( 1.0 - std::cos( yaw ) ) / yaw_rate : 0.0;
+        return Isometry3( axis_angle( { 0, 0, 1 }, yaw ), Vec3( speed * s, speed * c, 0.0 ) );
+    };
+    frame.cloud.clear();
+    frame.truth.clear();
+    frame.time.clear();
+    frame.motion.clear();
+    for ( double t = -0.12; t <= 0.0101; t += 0.005 )
+        frame.motion.push_back( { t, relative( t ) } );
+    for ( int c = 0; c < columns; ++c )
+    {
+        const double t = -period * ( 1.0 - double( c ) / columns );
+        const Isometry3 local = relative( t );
+        const Isometry3 pose = end_pose * local;
+        const double az = 2.0 * kPi * c / columns;
+        for ( int r = 0; r < rings; ++r )
+        {
+            double elev = ( -24.8 + 26.8 * r / ( rings - 1 ) ) * kPi / 180.0;
+            Vec3 dir( std::cos( elev ) * std::cos( az ), std::cos( elev ) * std::sin( az ), std::sin( elev ) );
+            double range = scene.cast( pose.t, pose.R * dir, 100.0 );
+            if ( range >= 100.0 )
+                continue;
+            bool spurious = u( rng ) < dust;
+            if ( spurious )
+                range *= 0.2 + 0.7 * u( rng );
+            Vec3 p = dir * ( range + noise( rng ) );
+            Vec3 q = local * p;
+            float flag = spurious ? 1.0f : 0.0f;
+            frame.cloud.push_back( float( p.x ), float( p.y ), float( p.z ), flag );
+            frame.truth.push_back( float( q.x ), float( q.y ), float( q.z ), flag );
+            frame.time.push_back( float( t ) );
+        }
+    }
+}
+
+static void register_cloud_pipeline()
+{
+    struct State
+    {
+        std::vector<SkewedFrame> frames;
+        double points = 0.0;
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( !st->frames.empty() )
+            return;
+        LidarScene scene( 3 );
+        const size_t count = static_cast<size_t>( ctx.param( "cloud_frames", ctx.quick() ? 1.0 : 3.0 ) );
+        st->frames.resize( count );
+        for ( size_t k = 0; k < count; ++k )
+        {
+            Isometry3 pose( axis_angle( { 0, 0, 1 }, 0.1 * k ), Vec3( 20.0 * k, 0.0, 1.8 ) );
+            make_skewed_frame( scene, pose, ctx.param( "speed", 8.0 ), ctx.param( "yaw_rate", 0.6 ), 0.01, 40 + uint32_t( k ), st->frames[k] );
+            st->points += double( st->frames[k].cloud.size() );
+        }
+    };
+    auto report = [st]( bench::Context& ctx, const CloudPipelineStats& total, const PointCloud& last ) {
+        double noise = 0.0;
+        for ( float i : last.intensity )
+            noise += i > 0.5f;
+        const double frames = double( st->frames.size() );
+        ctx.items( st->points );
+        ctx.counter( "points_per_frame", st->points / frames );
+        ctx.counter( "cropped", total.cropped / frames );
+        ctx.counter( "voxels", total.voxels / frames );
+        ctx.counter( "outliers", total.outliers / frames );
+        ctx.counter( "output", total.output / frames );
+        ctx.counter( "dust_left_last", noise );
+    };
+
+    // Deskew alone, every point kept, checked against the returns in the
+    // end-of-sweep frame.
+    bench::add( "cloud/deskew_only", [st]( bench::Context& ctx ) {
+        CloudPipelineOptions options;
+        options.crop_min = Vec3( -1e9, -1e9, -1e9 );
+        options.crop_max = Vec3( 1e9, 1e9, 1e9 );
+        options.min_range = 0.0;
+        options.voxel = 0.0;
+        options.outliers = OutlierFilter::None;
+        CloudPipeline pipeline( options );
+        PointCloud out;
+        auto distance = []( const PointCloud& a, const PointCloud& b, size_t i ) {
+            double dx = a.x[i] - b.x[i], dy = a.y[i] - b.y[i], dz = a.z[i] - b.z[i];
+            return std::sqrt( dx * dx + dy * dy + dz * dz );
+        };
+        double err = 0.0, raw = 0.0, worst = 0.0;
+        for ( const SkewedFrame& f : st->frames )
+        {
+            pipeline.set_motion( f.motion, 0.0 );
+            pipeline.process( f.cloud, f.time.data(), out );
+            for ( size_t i = 0; i < out.size(); ++i )
+            {
+                double e = distance( out, f.truth, i );
+                err += e;
+                worst = std::max( worst, e );
+                raw += distance( f.cloud, f.truth, i );
+            }
+        }
+        ctx.items( st->points );
+        ctx.counter( "err_mm_mean", 1e3 * err / st->points );
+        ctx.counter( "err_mm_max", 1e3 * worst );
+        ctx.counter( "skew_mm_mean", 1e3 * raw / st->points );
+    }, setup );
+
+    for ( OutlierFilter filter : { OutlierFilter::None, OutlierFilter::Radius, OutlierFilter::Statistical } )
+        for ( bool parallel : { false, true } )
+        {
+            if ( parallel && filter == OutlierFilter::None )
+                continue;
+            bench::add( std::string( "cloud/fused_" ) + to_string( filter ) + ( parallel ? "_pool" : "" ),
+                        [st, filter, parallel, report]( bench::Context& ctx ) {
+                CloudPipelineOptions options;
+                options.outliers = filter;
+                options.min_neighbors = static_cast<int>( ctx.param( "min_neighbors", options.min_neighbors ) );
+                CloudPipeline pipeline( options );
+                ThreadPool* pool = parallel ? &bench_pool( ctx ) : nullptr;
+                PointCloud out;
+                CloudPipelineStats total;
+                for ( const SkewedFrame& f : st->frames )
+                {
+                    CloudPipelineStats s;
+                    pipeline.set_motion( f.motion, 0.0 );
+                    pipeline.process( f.cloud, f.time.data(), out, &s, pool );
+                    total.cropped += s.cropped;
+                    total.voxels += s.voxels;
+                    total.outliers += s.outliers;
+                    total.output += s.output;
+                }
+                report( ctx, total, out );
+                if ( parallel )
+                    ctx.counter( "threads", pool->size() );
+            }, setup );
+        }
+
+    // The same deskew, crop and first-point voxel grid as separate passes
+    // with a full intermediate cloud each, deskewing by interpolating the
+    // odometry per point: what chaining the stages would cost.
+    bench::add( "cloud/staged_first_point", [st, report]( bench::Context& ctx ) {
+        CloudPipelineOptions options;
+        VoxelDownsampler downsampler;
+        PointCloud deskewed, cropped, out;
+        CloudPipelineStats total;
+        const float min2 = float( options.min_range * options.min_range );
+        for ( const SkewedFrame& f : st->frames )
+        {
+            const Isometry3 to_end = interpolate_motion( f.motion, 0.0 ).inverse();
+            deskewed.resize( f.cloud.size() );
+            for ( size_t i = 0; i < f.cloud.size(); ++i )
+            {
+                Vec3 p = to_end * ( interpolate_motion( f.motion, f.time[i] ) * Vec3( f.cloud.x[i], f.cloud.y[i], f.cloud.z[i] ) );
+                deskewed.x[i] = float( p.x );
+                deskewed.y[i] = float( p.y );
+                deskewed.z[i] = float( p.z );
+                deskewed.intensity[i] = f.cloud.intensity[i];
+            }
+            cropped.clear();
+            for ( size_t i = 0; i < deskewed.size(); ++i )
+            {
+                float x = deskewed.x[i], y = deskewed.y[i], z = deskewed.z[i];
+                if ( x >= options.crop_min.x && x <= options.crop_max.x && y >= options.crop_min.y && y <= options.crop_max.y &&
+                     z >= options.crop_min.z && z <= options.crop_max.z && x * x + y * y + z * z >= min2 )
+                    cropped.push_back( x, y, z, deskewed.intensity[i] );
+            }
+            downsampler.apply( cropped, options.voxel, out );
+            total.cropped += f.cloud.size() - cropped.size();
+            total.voxels += out.size();
+            total.output += out.size();
+        }
+        report( ctx, total, out );
+    }, setup );
+
+    bench::add( "cloud/fused_first_point", [st, report]( bench::Context& ctx ) {
+        CloudPipelineOptions options;
+        options.centroid = false;
+        options.outliers = OutlierFilter::None;
+        CloudPipeline pipeline( options );
+        PointCloud out;
+        CloudPipelineStats total;
+        for ( const SkewedFrame& f : st->frames )
+        {
+            CloudPipelineStats s;
+            pipeline.set_motion( f.motion, 0.0 );
+            pipeline.process( f.cloud, f.time.data(), out, &s );
+            total.cropped += s.cropped;
+            total.voxels += s.voxels;
+            total.output += s.output;
+        }
+        report( ctx, total, out );
+    }, setup );
+}
+
+// Spatial indexes over a lidar map: three 64-beam sweeps merged in the
+// world frame, queried by a fourth sweep taken from between them, as ICP
+// correspondence search would. The brute-force index gives the reference
+// answers for the first brute_queries queries and its own per-query cost;
+// the mismatch counters compare each tree against it on those queries.
+static void register_spatial_index()
+{
+    struct State
+    {
+        PointCloud map, queries;
+        SoaStore store;
+        std::unique_ptr<BruteForceIndex> brute;
+        size_t checked = 0;
+        std::vector<std::vector<float>> knn_truth; // squared distances, nearest first
+        std::vector<size_t> radius_truth;          // points within the radius
+        std::vector<PointCloud> stream;            // scans for incremental insertion
+    };
+    auto st = std::make_shared<State>();
+    constexpr int kK = 8;
+    constexpr float kRadius = 0.3f;
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( st->brute )
+            return;
+        LidarScene scene( 3 );
+        std::mt19937 rng( 11 );
+        const int columns = static_cast<int>( ctx.param( "spatial_columns", ctx.quick() ? 1200.0 : 3600.0 ) );
+        PointCloud scan;
+        auto sweep = [&]( double x, double yaw, PointCloud& out ) {
+            Isometry3 pose( axis_angle( { 0, 0, 1 }, yaw ), Vec3( x, 0.3, 1.8 ) );
+            scene.scan( pose, 64, columns, rng, scan );
+            for ( size_t i = 0; i < scan.size(); ++i )
+            {
+                Vec3 p = pose * Vec3( scan.x[i], scan.y[i], scan.z[i] );
+                out.push_back( float( p.x ), float( p.y ), float( p.z ), scan.intensity[i] );
+            }
+        };
+        for ( int k = 0; k < 3; ++k )
+            sweep( 4.0 * k, 0.05 * k, st->map );
+        sweep( 5.0, 0.08, st->queries );
+        for ( int k = 0; k < 6; ++k )
+        {
+            st->stream.emplace_back();
+            sweep( 2.0 * k, 0.02 * k, st->stream.back() );
+        }
+
+        st->store.reset( 3, st->map.size() );
+        for ( size_t i = 0; i < st->map.size(); ++i )
+        {
+            float p[3] = { st->map.x[i], st->map.y[i], st->map.z[i] };
+            st->store.push( p );
+        }
+        st->brute = std::make_unique<BruteForceIndex>( st->store );
+        st->brute->add( static_cast<uint32_t>( st->map.size() - 1 ) );
+        st->checked = std::min( st->queries.size(), static_cast<size_t>( ctx.param( "brute_queries", ctx.quick() ? 200.0 : 1000.0 ) ) );
+        std::vector<uint32_t> ids;
+        for ( size_t q = 0; q < st->checked; ++q )
+        {
+            float p[3] = { st->queries.x[q], st->queries.y[q], st->queries.z[q] };
+            st->brute->nearest_k( p, kK, ids );
+            st->knn_truth.emplace_back();
+            for ( uint32_t id : ids )
+                st->knn_truth.back().push_back( st->store.distance2( id, p ) );
+            ids.clear();
+            st->brute->within( p, kRadius, ids );
+            st->radius_truth.push_back( ids.size() );
+        }
+    };
+    // Compares distances, not ids, so equidistant points may swap.
+    auto knn_mismatches = [st]( const KnnBatch& out ) {
+        double bad = 0.0;
+        for ( size_t q = 0; q < st->checked; ++q )
+            for ( int j = 0; j < kK; ++j )
+                if ( std::fabs( out.dist2[q * kK + j] - st->knn_truth[q][j] ) > 1e-5f * ( 1.0f + st->knn_truth[q][j] ) )
+                {
+                    bad += 1.0;
+                    break;
+                }
+        return bad;
+    };
+    auto radius_mismatches = [st]( const RadiusBatch& out ) {
+        double bad = 0.0;
+        for ( size_t q = 0; q < st->checked; ++q )
+            bad += out.offsets[q + 1] - out.offsets[q] != st->radius_truth[q];
+        return bad;
+    };
+
+    bench::add( "spatial/knn_brute", [st]( bench::Context& ctx ) {
+        std::vector<uint32_t> ids;
+        double sink = 0.0;
+        for ( size_t q = 0; q < st->checked; ++q )
+        {
+            float p[3] = { st->queries.x[q], st->queries.y[q], st->queries.z[q] };
+            st->brute->nearest_k( p, kK, ids );
+            sink += ids.front();
+        }
+        ctx.items( double( st->checked ) );
+        ctx.counter( "map_points", double( st->map.size() ) );
+        ctx.counter( "sink", sink );
+    }, setup );
+
+    bench::add( "spatial/radius_brute", [st]( bench::Context& ctx ) {
+        std::vector<uint32_t> ids;
+        double found = 0.0;
+        for ( size_t q = 0; q < st->checked; ++q )
+        {
+            float p[3] = { st->queries.x[q], st->queries.y[q], st->queries.z[q] };
+            ids.clear();
+            st->brute->within( p, kRadius, ids );
+            found += ids.size();
+        }
+        ctx.items( double( st->checked ) );
+        ctx.counter( "found_per_query", found / double( st->checked ) );
+    }, setup );
+
+    for ( bool parallel : { false, true } )
+    {
+        const std::string suffix = parallel ? "_pool" : "";
+        bench::add( "spatial/build_kdtree" + suffix, [st, parallel]( bench::Context& ctx ) {
+            ImplicitKdTree tree;
+            tree.build( st->map, parallel ? &bench_pool( ctx ) : nullptr );
+            ctx.items( double( st->map.size() ) );
+        }, setup );
+        bench::add( "spatial/build_octree" + suffix, [st, parallel]( bench::Context& ctx ) {
+            MortonOctree tree;
+            tree.build( st->map, 1.0, parallel ? &bench_pool( ctx ) : nullptr );
+            ctx.items( double( st->map.size() ) );
+            ctx.counter( "nodes", double( tree.nodes() ) );
+            ctx.counter( "slots", double( tree.slots() ) );
+        }, setup );
+    }
+
+    // One query at a time in scan order, the way a caller without the
+    // batch API would use the trees, against the Morton-grouped batch.
+    auto add_queries = [st, setup, knn_mismatches, radius_mismatches]( const std::string& tag, auto make ) {
+        using Tree = decltype( make() );
+        auto tree = std::make_shared<Tree>( make() );
+        auto build = [st, setup, tree]( bench::Context& ctx ) {
+            setup( ctx );
+            if ( tree->empty() )
+                tree->build( st->map );
+        };
+        bench::add( "spatial/knn_" + tag + "_single", [st, tree, knn_mismatches]( bench::Context& ctx ) {
+            KnnBatch out;
+            out.k = kK;
+            out.ids.assign( st->queries.size() * kK, kNoPoint );
+            out.dist2.assign( st->queries.size() * kK, std::numeric_limits<float>::infinity() );
+            std::vector<uint32_t> ids;
+            std::vector<float> d2;
+            for ( size_t q = 0; q < st->queries.size(); ++q )
+            {
+                tree->knn( st->queries.x[q], st->queries.y[q], st->queries.z[q], kK, ids, &d2 );
+                std::copy( d2.begin(), d2.end(), &out.dist2[q * kK] );
+            }
+            ctx.items( double( st->queries.size() ) );
+            ctx.counter( "mismatches", knn_mismatches( out ) );
+        }, build );
+        for ( bool parallel : { false, true } )
+            bench::add( "spatial/knn_" + tag + "_batch" + ( parallel ? "_pool" : "" ), [st, tree, parallel, knn_mismatches]( bench::Context& ctx ) {
+                KnnBatch out;
+                tree->knn( st->queries, kK, out, parallel ? &bench_pool( ctx ) : nullptr );
+                ctx.items( double( st->queries.size() ) );
+                ctx.counter( "mismatches", knn_mismatches( out ) );
+            }, build );
+        bench::add( "spatial/radius_" + tag + "_single", [st, tree, radius_mismatches]( bench::Context& ctx ) {
+            RadiusBatch out;
+            out.offsets.assign( 1, 0 );
+            std::vector<uint32_t> ids;
+            for ( size_t q = 0; q < st->queries.size(); ++q )
+            {
+                tree->radius( st->queries.x[q], st->queries.y[q], st->queries.z[q], kRadius, ids );
+                out.ids.insert( out.ids.end(), ids.begin(), ids.end() );
+                out.offsets.push_back( uint32_t( out.ids.size() ) );
+            }
+            ctx.items( double( st->queries.size() ) );
+            ctx.counter( "found_per_query", out.offsets.back() / double( st->queries.size() ) );
+            ctx.counter( "mismatches", radius_mismatches( out ) );
+        }, build );
+        for ( bool parallel : { false, true } )
+            bench::add( "spatial/radius_" + tag + "_batch" + ( parallel ? "_pool" : "" ), [st, tree, parallel, radius_mismatches]( bench::Context& ctx ) {
+                RadiusBatch out;
+                tree->radius( st->queries, kRadius, out, parallel ? &bench_pool( ctx ) : nullptr );
+                ctx.items( double( st->queries.size() ) );
+                ctx.counter( "found_per_query", out.offsets.back() / double( st->queries.size() ) );
+                ctx.counter( "mismatches", radius_mismatches( out ) );
+            }, build );
+    };
+    add_queries( "kdtree", [] { return ImplicitKdTree(); } );
+    add_queries( "octree", [] { return MortonOctree(); } );
+
+    // A growing map: each scan either inserted into the octree or the whole
+    // map rebuilt, then the first scan's points queried once against it.
+    for ( bool rebuild : { false, true } )
+        bench::add( rebuild ? "spatial/octree_rebuild" : "spatial/octree_insert", [st, rebuild]( bench::Context& ctx ) {
+            MortonOctree tree;
+            tree.reset( Vec3( 5.0, 0.0, 0.0 ), 128.0 );
+            PointCloud all;
+            double rejected = 0.0;
+            for ( const PointCloud& scan : st->stream )
+            {
+                for ( size_t i = 0; i < scan.size(); ++i )
+                {
+                    if ( !rebuild )
+                        rejected += !tree.insert( scan.x[i], scan.y[i], scan.z[i], uint32_t( all.size() ) );
+                    all.push_back( scan.x[i], scan.y[i], scan.z[i], scan.intensity[i] );
+                }
+                if ( rebuild )
+                    tree.build( all );
+            }
+            KnnBatch out;
+            tree.knn( st->queries, 1, out );
+            double wrong = 0.0;
+            for ( size_t q = 0; q < st->queries.size(); q += 997 )
+            {
+                uint32_t id = out.ids[q];
+                float dx = all.x[id] - st->queries.x[q], dy = all.y[id] - st->queries.y[q], dz = all.z[id] - st->queries.z[q];
+                float best = std::numeric_limits<float>::max();
+                for ( size_t i = 0; i < all.size(); ++i )
+                {
+                    float ex = all.x[i] - st->queries.x[q], ey = all.y[i] - st->queries.y[q], ez = all.z[i] - st->queries.z[q];
+                    best = std::min( best, ex * ex + ey * ey + ez * ez );
+                }
+                wrong += dx * dx + dy * dy + dz * dz > best;
+            }
+            ctx.items( double( all.size() ) );
+            ctx.counter( "points", double( tree.size() ) );
+            ctx.counter( "rejected", rejected );
+            ctx.counter( "nn_wrong", wrong );
+        }, setup );
+}
+
+// Occupancy mapping from a 64-beam lidar driving down the street scene.
+// Items are lidar points integrated. After the run the last scan is
+// checked against the map: its endpoints should read occupied and the
+// voxels halfway along its rays free. The pooled map is compared voxel by
+// voxel with a serial one built in setup. The nodedupe case updates a
+// voxel once per ray crossing it, as OctoMap's per-ray insertion does.
+static void register_occupancy_map()
+{
+    struct State
+    {
+        std::vector<PointCloud> frames;
+        std::vector<Isometry3> poses;
+        double points = 0.0;
+        std::unique_ptr<OccupancyMap> serial; // reference the pooled map must match
+    };
+    auto st = std::make_shared<State>();
+    auto setup = [st]( bench::Context& ctx ) {
+        if ( !st->frames.empty() )
+            return;
+        LidarScene scene( 3 );
+        std::mt19937 rng( 5 );
+        const size_t count = static_cast<size_t>( ctx.param( "occupancy_frames", ctx.quick() ? 4.0 : 12.0 ) );
+        const int columns = static_cast<int>( ctx.param( "occupancy_columns", ctx.quick() ? 1024.0 : 2048.0 ) );
+        st->frames.resize( count );
+        for ( size_t k = 0; k < count; ++k )
+        {
+            st->poses.emplace_back( axis_angle( { 0, 0, 1 }, 0.02 * k ), Vec3( 1.5 * k, 0.0, 1.8 ) );
+            scene.scan( st->poses.back(), 64, columns, rng, st->frames[k] );
+            st->points += double( st->frames[k].size() );
+        }
+        OccupancyMapOptions options;
+        options.resolution = ctx.param( "resolution", options.resolution );
+        st->serial = std::make_unique<OccupancyMap>( options );
+        for ( size_t k = 0; k < count; ++k )
+            st->serial->integrate( st->frames[k], st->poses[k] );
+    };
+
+    struct Case
+    {
+        const char* name;
+        bool dedupe;
+        bool parallel;
+    };
+    for ( Case c : { Case{ "integrate", true, false }, Case{ "integrate_pool", true, true }, Case{ "integrate_nodedupe", false, false } } )
+        bench::add( std::string( "occupancy/" ) + c.name, [st, c]( bench::Context& ctx ) {
+            OccupancyMapOptions options;
+            options.resolution = ctx.param( "resolution", options.resolution );
+            options.dedupe = c.dedupe;
+            OccupancyMap map( options );
+            ThreadPool* pool = c.parallel ? &bench_pool( ctx ) : nullptr;
+            OccupancyStats s, total;
+            for ( size_t k = 0; k < st->frames.size(); ++k )
+            {
+                map.integrate( st->frames[k], st->poses[k], &s, pool );
+                total.rays += s.rays;
+                total.emitted += s.emitted;
+                total.updates += s.updates;
+            }
+
+            const PointCloud& last = st->frames.back();
+            const Isometry3& pose = st->poses.back();
+            double hits = 0.0, frees = 0.0, checked = 0.0;
+            for ( size_t i = 0; i < last.size(); i += 7 )
+            {
+                Vec3 p( last.x[i], last.y[i], last.z[i] );
+                if ( norm( p ) > options.max_range )
+                    continue;
+                checked += 1.0;
+                hits += map.state( pose * p ) == Occupancy::Occupied;
+                frees += map.state( pose * ( p * 0.5 ) ) == Occupancy::Free;
+            }
+            size_t occupied = 0, observed = 0;
+            map.for_each_voxel( [&]( const Vec3&, float l ) {
+                ++observed;
+                occupied += l > options.occupied;
+            } );
+            const double frames = double( st->frames.size() );
+            ctx.items( st->points );
+            ctx.counter( "points_per_frame", st->points / frames );
+            ctx.counter( "emitted_per_frame", total.emitted / frames );
+            ctx.counter( "updates_per_frame", total.updates / frames );
+            ctx.counter( "blocks", double( map.blocks() ) );
+            ctx.counter( "memory_mb", map.memory_bytes() / 1048576.0 );
+            ctx.counter( "observed", double( observed ) );
+            ctx.counter( "occupied", double( occupied ) );
+            ctx.counter( "hit_recall", checked ? hits / checked : 0.0 );
+            ctx.counter( "free_recall", checked ? frees / checked : 0.0 );
+            if ( pool )
+            {
+                // Each voxel takes one update per scan whatever the chunking,
+                // so the pooled map must equal the serial one exactly.
+                double mismatches = 0.0;
+                size_t serial_observed = 0;
+                st->serial->for_each_voxel( [&]( const Vec3& p, float l ) {
+                    ++serial_observed;
+                    mismatches += map.log_odds( p ) != l;
+                } );
+                mismatches += std::fabs( double( observed ) - double( serial_observed ) );
+                ctx.counter( "mismatches", mismatches );
+                ctx.counter( "threads", pool->size() );
+            }
+        }, setup );
+
+    // Point lookups spread over the mapped street, about half in observed
+    // space.
+    auto map = std::make_shared<OccupancyMap>();
+    bench::add( "occupancy/query", [map]( bench::Context& ctx ) {
+        std::mt19937 rng( 9 );
+        std::uniform_real_distribution<double> ux( -30.0, 40.0 ), uy( -30.0, 30.0 ), uz( -1.0, 10.0 );
+        const size_t lookups = 1000000;
+        double counts[3] = {};
+        for ( size_t i = 0; i < lookups; ++i )
+            counts[int( map->state( Vec3( ux( rng ), uy( rng ), uz( rng ) ) ) )] += 1.0;
+        ctx.items( double( lookups ) );
+        ctx.counter( "unknown", counts[0] / lookups );
+        ctx.counter( "free", counts[1] / lookups );
+        ctx.counter( "occupied", counts[2] / lookups );
+    }, [st, setup, map]( bench::Context& ctx ) {
+        setup( ctx );
+        if ( map->blocks() )
+            return;
+        for ( size_t k = 0; k < st->frames.size(); ++k )
+            map->integrate( st->frames[k], st->poses[k] );
+    } );
+}
+
+int main( int argc, char** argv )
+{
+    const bench::Options options = bench::parse_args( argc, argv );
+    register_baseline();
+    register_grid_planner();
+    register_dstar_lite();
+    register_costmap();
+    register_esdf();
+    register_sampling_planners();
+    register_parallel_rrt_star( options );
+    register_roadmap();
+    register_collision();
+    register_kinematics();
+    register_inverse_kinematics();
+    register_dynamics();
+    register_topp_ra();
+    register_trajectory_optimizer();
+    register_mpc();
+    register_ilqr();
+    register_kalman();
+    register_amcl();
+    register_scan_matching();
+    register_pose_graph();
+    register_place_recognition();
+    register_cloud_pipeline();
+    register_spatial_index();
+    register_occupancy_map();
+
+    int status = bench::run_all( options );
+    remove_bench_data();
+    return status;
+}
@@ -0,0 +1,622 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "dense_cholesky.hpp"
+
+namespace wra
+{
+
+struct QpOptions
+{
+    int max_iterations = 30;
+    // Converged once the mean complementarity and the last input step are
+    // both below this.
+    double tolerance = 1e-6;
+    // Barrier parameter for a cold start; warm starts pass their own.
+    double initial_mu = 1e-1;
+    // Centering: each step targets sigma times the current mean gap.
+    double sigma = 0.1;
+    // Fraction-to-boundary rule for slacks and multipliers.
+    double tau = 0.995;
+};
+
+struct QpResult
+{
+    bool converged = false;
+    int iterations = 0;
+    double gap = 0.0;
+};
+
+// Stage-wise QP
+//
+//   min  sum_k 1/2 [x; u]' [Q S'; S R] [x; u] + q' x + r' u  +  1/2 x_N' Q_N x_N + q_N' x_N
+//   s.t. x_k+1 = A_k x_k + B_k u_k + c_k,  x_0 given,  lb_k <= u_k <= ub_k
+//
+// by a primal-dual interior point method on the input bounds. Each Newton
+// step is one backward Riccati sweep and one forward rollout, so an
+// iteration costs O(N (NX^3 + NU^3)) rather than a dense KKT solve, and
+// the state trajectory stays dynamically feasible throughout. All storage
+// is sized by the horizon at construction; solve() does not allocate.
+template <size_t NX, size_t NU>
+class RiccatiQp
+{
+public:
+    static constexpr size_t nx = NX;
+    static constexpr size_t nu = NU;
+
+    struct Stage
+    {
+        double A[NX][NX];
+        double B[NX][NU];
+        double c[NX];
+        double Q[NX][NX];
+        double S[NU][NX];
+        double R[NU][NU];
+        double q[NX];
+        double r[NU];
+        double lb[NU];
+        double ub[NU];
+    };
+
+    explicit RiccatiQp( size_t horizon ) : stages_( horizon ), work_( horizon ), x_( ( horizon + 1 ) * NX ), u_( horizon * NU )
+    {
+        for ( Stage& s : stages_ )
+            clear( s );
+        zero( QN_ );
+        zero( qN_ );
+    }
+
+    size_t horizon() const { return stages_.size(); }
+    Stage& stage( size_t k ) { return stages_[k]; }
+    const Stage& stage( size_t k ) const { return stages_[k]; }
+    double ( &terminal_Q() )[NX][NX] { return QN_; }
+    double ( &terminal_q() )[NX] { return qN_; }
+
+    // Starts from u (horizon * NU, nudged strictly inside the bounds) or
+    // from the bound midpoints when null. Warm starts pass the previous
+    // solution with a small mu.
+    QpResult solve( const double* x0, const double* u_init, double mu, const QpOptions& options = QpOptions() )
+    {
+        const size_t N = stages_.size();
+        for ( size_t k = 0; k < N; ++k )
+        {
+            const Stage& s = stages_[k];
+            Work& w = work_[k];
+            for ( size_t i = 0; i < NU; ++i )
+            {
+                double width = s.ub[i] - s.lb[i];
+                double margin = std::min( 1e-3 * width + 1e-9, 0.5 * width );
+                double u = u_init ? u_init[k * NU + i] : 0.5 * ( s.lb[i] + s.ub[i] );
+                u = std::min( std::max( u, s.lb[i] + margin ), s.ub[i] - margin );
+                u_[k * NU + i] = u;
+                w.lam_u[i] = mu / ( s.ub[i] - u );
+                w.lam_l[i] = mu / ( u - s.lb[i] );
+            }
+        }
+        std::copy( x0, x0 + NX, x_.begin() );
+        rollout();
+
+        QpResult result;
+        for ( int it = 0; it < options.max_iterations; ++it )
+        {
+            double gap = mean_gap();
+            result.gap = gap;
+            double target = options.sigma * gap;
+            if ( !backward( target ) )
+                break;
+            forward_step();
+
+            // Longest steps keeping slacks and multipliers positive.
+            double ap = 1.0, ad = 1.0;
+            for ( size_t k = 0; k < N; ++k )
+            {
+                const Stage& s = stages_[k];
+                Work& w = work_[k];
+                for ( size_t i = 0; i < NU; ++i )
+                {
+                    double du = w.du[i];
+                    double su = s.ub[i] - u_[k * NU + i], sl = u_[k * NU + i] - s.lb[i];
+                    w.dlam_u[i] = ( target - w.lam_u[i] * su + w.lam_u[i] * du ) / su;
+                    w.dlam_l[i] = ( target - w.lam_l[i] * sl - w.lam_l[i] * du ) / sl;
+                    if ( du > 0.0 )
+                        ap = std::min( ap, options.tau * su / du );
+                    if ( du < 0.0 )
+                        ap = std::min( ap, -options.tau * sl / du );
+                    if ( w.dlam_u[i] < 0.0 )
+                        ad = std::min( ad, -options.tau * w.lam_u[i] / w.dlam_u[i] );
+                    if ( w.dlam_l[i] < 0.0 )
+                        ad = std::min( ad, -options.tau * w.lam_l[i] / w.dlam_l[i] );
+                }
+            }
+
+            double largest = 0.0;
+            for ( size_t k = 0; k < N; ++k )
+            {
+                Work& w = work_[k];
+                for ( size_t i = 0; i < NU; ++i )
+                {
+                    u_[k * NU + i] += ap * w.du[i];
+                    w.lam_u[i] += ad * w.dlam_u[i];
+                    w.lam_l[i] += ad * w.dlam_l[i];
+                    largest = std::max( largest, std::fabs( ap * w.du[i] ) );
+                }
+            }
+            for ( size_t i = 0; i < ( N + 1 ) * NX; ++i )
+                x_[i] += ap * dx_at( i );
+
+            result.iterations = it + 1;
+            result.gap = mean_gap();
+            if ( result.gap < options.tolerance && largest < options.tolerance )
+            {
+                result.converged = true;
+                break;
+            }
+        }
+        return result;
+    }
+
+    const double* x( size_t k ) const { return &x_[k * NX]; }
+    const double* u( size_t k ) const { return &u_[k * NU]; }
+    const std::vector<double>& inputs() const { return u_; }
+    const std::vector<double>& states() const { return x_; }
+
+private:
+    struct Work
+    {
+        double K[NU][NX];
+        double kff[NU];
+        double du[NU];
+        double dx[NX];
+        double lam_u[NU];
+        double lam_l[NU];
+        double dlam_u[NU];
+        double dlam_l[NU];
+    };
+
+    template <typename T, size_t M>
+    static void zero( T ( &a )[M] )
+    {
+        std::fill( &a[0], &a[0] + M, T() );
+    }
+    template <typename T, size_t M, size_t L>
+    static void zero( T ( &a )[M][L] )
+    {
+        std::fill( &a[0][0], &a[0][0] + M * L, T() );
+    }
+
+    static void clear( Stage& s )
+    {
+        zero( s.A );
+        zero( s.B );
+        zero( s.c );
+        zero( s.Q );
+        zero( s.S );
+        zero( s.R );
+        zero( s.q );
+        zero( s.r );
+        std::fill( s.lb, s.lb + NU, -1e6 );
+        std::fill( s.ub, s.ub + NU, 1e6 );
+    }
+
+    void rollout()
+    {
+        for ( size_t k = 0; k < stages_.size(); ++k )
+        {
+            const Stage& s = stages_[k];
+            const double* x = &x_[k * NX];
+            const double* u = &u_[k * NU];
+            double* next = &x_[( k + 1 ) * NX];
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                double v = s.c[i];
+                for ( size_t j = 0; j < NX; ++j )
+                    v += s.A[i][j] * x[j];
+                for ( size_t j = 0; j < NU; ++j )
+                    v += s.B[i][j] * u[j];
+                next[i] = v;
+            }
+        }
+    }
+
+    double mean_gap() const
+    {
+        double sum = 0.0;
+        for ( size_t k = 0; k < stages_.size(); ++k )
+            for ( size_t i = 0; i < NU; ++i )
+            {
+                double u = u_[k * NU + i];
+                sum += work_[k].lam_u[i] * ( stages_[k].ub[i] - u ) + work_[k].lam_l[i] * ( u - stages_[k].lb[i] );
+            }
+        return stages_.empty() ? 0.0 : sum / double( 2 * NU * stages_.size() );
+    }
+
+    // Riccati recursion for the Newton step in (dx, du) with dx_0 = 0. The
+    // bounds enter as the primal-dual diagonal lam/s on R and the barrier
+    // gradient mu (1/s_u - 1/s_l) on r. Fails if some H_uu is not positive
+    // definite, i.e. the stage cost is not convex in u.
+    bool backward( double mu )
+    {
+        const size_t N = stages_.size();
+        double P[NX][NX], p[NX];
+        const double* xN = &x_[N * NX];
+        for ( size_t i = 0; i < NX; ++i )
+        {
+            p[i] = qN_[i];
+            for ( size_t j = 0; j < NX; ++j )
+            {
+                P[i][j] = QN_[i][j];
+                p[i] += QN_[i][j] * xN[j];
+            }
+        }
+
+        for ( size_t k = N; k-- > 0; )
+        {
+            const Stage& s = stages_[k];
+            Work& w = work_[k];
+            const double* x = &x_[k * NX];
+            const double* u = &u_[k * NU];
+
+            // Gradients of the stage cost at the current iterate.
+            double gx[NX], gu[NU];
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                gx[i] = s.q[i];
+                for ( size_t j = 0; j < NX; ++j )
+                    gx[i] += s.Q[i][j] * x[j];
+                for ( size_t j = 0; j < NU; ++j )
+                    gx[i] += s.S[j][i] * u[j];
+            }
+            for ( size_t i = 0; i < NU; ++i )
+            {
+                double su = s.ub[i] - u[i], sl = u[i] - s.lb[i];
+                gu[i] = s.r[i] + mu / su - mu / sl;
+                for ( size_t j = 0; j < NU; ++j )
+                    gu[i] += s.R[i][j] * u[j];
+                for ( size_t j = 0; j < NX; ++j )
+                    gu[i] += s.S[i][j] * x[j];
+            }
+
+            // PA = P A, PB = P B.
+            double PA[NX][NX], PB[NX][NU];
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                for ( size_t j = 0; j < NX; ++j )
+                {
+                    double v = 0.0;
+                    for ( size_t m = 0; m < NX; ++m )
+                        v += P[i][m] * s.A[m][j];
+                    PA[i][j] = v;
+                }
+                for ( size_t j = 0; j < NU; ++j )
+                {
+                    double v = 0.0;
+                    for ( size_t m = 0; m < NX; ++m )
+                        v += P[i][m] * s.B[m][j];
+                    PB[i][j] = v;
+                }
+            }
+
+            // Huu = R + Sigma + B' P B, Hux = S + B' P A, hu = gu + B' p.
+            double Huu[NU][NU], Hux[NU][NX], hu[NU];
+            for ( size_t i = 0; i < NU; ++i )
+            {
+                double su = s.ub[i] - u[i], sl = u[i] - s.lb[i];
+                for ( size_t j = 0; j < NU; ++j )
+                {
+                    double v = s.R[i][j];
+                    for ( size_t m = 0; m < NX; ++m )
+                        v += s.B[m][i] * PB[m][j];
+                    Huu[i][j] = v;
+                }
+                Huu[i][i] += w.lam_u[i] / su + w.lam_l[i] / sl;
+                for ( size_t j = 0; j < NX; ++j )
+                {
+                    double v = s.S[i][j];
+                    for ( size_t m = 0; m < NX; ++m )
+                        v += s.B[m][i] * PA[m][j];
+                    Hux[i][j] = v;
+                }
+                hu[i] = gu[i];
+                for ( size_t m = 0; m < NX; ++m )
+                    hu[i] += s.B[m][i] * p[m];
+            }
+
+            // K = -Huu^-1 Hux, k = -Huu^-1 hu via Cholesky.
+            double L[NU][NU];
+            if ( !cholesky_factor( Huu, L ) )
+                return false;
+            for ( size_t j = 0; j < NX; ++j )
+            {
+                double col[NU];
+                for ( size_t i = 0; i < NU; ++i )
+                    col[i] = Hux[i][j];
+                cholesky_solve( L, col );
+                for ( size_t i = 0; i < NU; ++i )
+                    w.K[i][j] = -col[i];
+            }
+            double rhs[NU];
+            for ( size_t i = 0; i < NU; ++i )
+                rhs[i] = hu[i];
+            cholesky_solve( L, rhs );
+            for ( size_t i = 0; i < NU; ++i )
+                w.kff[i] = -rhs[i];
+
+            // P <- Q + A' P A + Hux' K, p <- gx + A' p + Hux' k.
+            double Pn[NX][NX], pn[NX];
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                for ( size_t j = 0; j < NX; ++j )
+                {
+                    double v = s.Q[i][j];
+                    for ( size_t m = 0; m < NX; ++m )
+                        v += s.A[m][i] * PA[m][j];
+                    for ( size_t m = 0; m < NU; ++m )
+                        v += Hux[m][i] * w.K[m][j];
+                    Pn[i][j] = v;
+                }
+                double v = gx[i];
+                for ( size_t m = 0; m < NX; ++m )
+                    v += s.A[m][i] * p[m];
+                for ( size_t m = 0; m < NU; ++m )
+                    v += Hux[m][i] * w.kff[m];
+                pn[i] = v;
+            }
+            // Symmetrise against round-off drift over long horizons.
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                p[i] = pn[i];
+                for ( size_t j = 0; j < NX; ++j )
+                    P[i][j] = 0.5 * ( Pn[i][j] + Pn[j][i] );
+            }
+        }
+        return true;
+    }
+
+    void forward_step()
+    {
+        double dx[NX] = {};
+        for ( size_t k = 0; k < stages_.size(); ++k )
+        {
+            const Stage& s = stages_[k];
+            Work& w = work_[k];
+            std::copy( dx, dx + NX, w.dx );
+            for ( size_t i = 0; i < NU; ++i )
+            {
+                double v = w.kff[i];
+                for ( size_t j = 0; j < NX; ++j )
+                    v += w.K[i][j] * dx[j];
+                w.du[i] = v;
+            }
+            double next[NX];
+            for ( size_t i = 0; i < NX; ++i )
+            {
+                double v = 0.0;
+                for ( size_t j = 0; j < NX; ++j )
+                    v += s.A[i][j] * dx[j];
+                for ( size_t j = 0; j < NU; ++j )
+                    v += s.B[i][j] * w.du[j];
+                next[i] = v;
+            }
+            std::copy( next, next + NX, dx );
+        }
+        std::copy( dx, dx + NX, dxN_ );
+    }
+
+    double dx_at( size_t i ) const
+    {
+        size_t k = i / NX;
+        return k < stages_.size() ? work_[k].dx[i % NX] : dxN_[i % NX];
+    }
+
+    std::vector<Stage> stages_;
+    std::vector<Work> work_;
+    double QN_[NX][NX];
+    double qN_[NX];
+    double dxN_[NX] = {};
+    std::vector<double> x_;
+    std::vector<double> u_;
+};
+
+// Differential-drive base: state (x, y, heading), input (forward speed,
+// yaw rate). Discretised with the midpoint heading, which is exact for a
+// constant-curvature arc to second order.
+struct Unicycle
+{
+    static constexpr size_t nx = 3;
+    static constexpr size_t nu = 2;
+
+    static void step( const double* x, const double* u, double dt, double* next, double ( *A )[nx] = nullptr,
+                      double ( *B )[nu] = nullptr )
+    {
+        double th = x[2] + 0.5 * u[1] * dt;
+        double c = std::cos( th ), s = std::sin( th );
+        next[0] = x[0] + u[0] * c * dt;
+        next[1] = x[1] + u[0] * s * dt;
+        next[2] = x[2] + u[1] * dt;
+        if ( A )
+        {
+            double a[3][3] = { { 1, 0, -u[0] * s * dt }, { 0, 1, u[0] * c * dt }, { 0, 0, 1 } };
+            std::copy( &a[0][0], &a[0][0] + 9, &A[0][0] );
+        }
+        if ( B )
+        {
+            double b[3][2] = { { c * dt, -0.5 * u[0] * s * dt * dt }, { s * dt, 0.5 * u[0] * c * dt * dt }, { 0, dt } };
+            std::copy( &b[0][0], &b[0][0] + 6, &B[0][0] );
+        }
+    }
+
+    // x - ref with the heading difference wrapped to [-pi, pi].
+    static void error( const double* x, const double* ref, double* e )
+    {
+        const double two_pi = 6.28318530717958647692;
+        e[0] = x[0] - ref[0];
+        e[1] = x[1] - ref[1];
+        e[2] = x[2] - ref[2];
+        e[2] -= two_pi * std::round( e[2] / two_pi );
+    }
+};
+
+template <size_t NX, size_t NU>
+struct MpcOptions
+{
+    double dt = 0.05;
+    // Diagonal weights on the tracking error, terminal error and input
+    // deviation from the reference input.
+    double state_weight[NX];
+    double terminal_weight[NX];
+    double input_weight[NU];
+    double u_min[NU];
+    double u_max[NU];
+    // SQP iterations per control step; 1 is the real-time iteration
+    // scheme (one QP on the shifted linearisation).
+    int sqp_iterations = 1;
+    // Barrier parameter the QP restarts from when warm.
+    double warm_mu = 1e-3;
+    QpOptions qp;
+
+    MpcOptions()
+    {
+        std::fill( state_weight, state_weight + NX, 1.0 );
+        std::fill( terminal_weight, terminal_weight + NX, 10.0 );
+        std::fill( input_weight, input_weight + NU, 0.1 );
+        std::fill( u_min, u_min + NU, -1.0 );
+        std::fill( u_max, u_max + NU, 1.0 );
+    }
+};
+
+struct MpcResult
+{
+    bool converged = false;
+    bool warm = false;
+    int qp_iterations = 0;
+};
+
+// Nonlinear MPC by sequential quadratic programming. Each control step
+// shifts the previous input sequence by one stage, rolls Model out from
+// the measured state, linearises along the rollout and solves the
+// resulting stage-wise QP for the input correction; the shifted sequence
+// is the QP's warm start (zero correction, small barrier parameter).
+// A linear Model works unchanged. Model provides nx, nu,
+// step(x, u, dt, next, A, B) and error(x, ref, e).
+//
+// Memory is fixed at construction by the horizon.
+template <typename Model>
+class NonlinearMpc
+{
+public:
+    static constexpr size_t nx = Model::nx;
+    static constexpr size_t nu = Model::nu;
+    typedef MpcOptions<nx, nu> Options;
+
+    NonlinearMpc( size_t horizon, const Options& options = Options() )
+        : options_( options ), qp_( horizon ), u_( horizon * nu, 0.0 ), x_( ( horizon + 1 ) * nx, 0.0 ),
+          zero_( horizon * nu, 0.0 )
+    {
+    }
+
+    size_t horizon() const { return qp_.horizon(); }
+    const Options& options() const { return options_; }
+    void set_options( const Options& options ) { options_ = options; }
+
+    // Forgets the previous solution; the next solve starts cold from the
+    // reference inputs.
+    void reset() { warm_ = false; }
+
+    // x_ref holds horizon + 1 states and u_ref horizon inputs, one per
+    // stage from now. Writes the first input to apply.
+    MpcResult solve( const double* x0, const double* x_ref, const double* u_ref, double* u_out )
+    {
+        const size_t N = qp_.horizon();
+        MpcResult result;
+        result.warm = warm_;
+        if ( warm_ )
+        {
+            std::copy( u_.begin() + nu, u_.end(), u_.begin() );
+            std::copy( u_ref + ( N - 1 ) * nu, u_ref + N * nu, u_.end() - nu );
+        }
+        else
+            std::copy( u_ref, u_ref + N * nu, u_.begin() );
+        for ( size_t i = 0; i < N * nu; ++i )
+            u_[i] = std::min( std::max( u_[i], options_.u_min[i % nu] ), options_.u_max[i % nu] );
+
+        for ( int it = 0; it < options_.sqp_iterations; ++it )
+        {
+            linearise( x0, x_ref, u_ref );
+            double x_zero[nx] = {};
+            QpResult qr = qp_.solve( x_zero, zero_.data(), warm_ || it > 0 ? options_.warm_mu : options_.qp.initial_mu,
+                                     options_.qp );
+            result.qp_iterations += qr.iterations;
+            result.converged = qr.converged;
+            for ( size_t i = 0; i < N * nu; ++i )
+                u_[i] += qp_.inputs()[i];
+        }
+        rollout( x0 );
+        std::copy( u_.begin(), u_.begin() + nu, u_out );
+        warm_ = true;
+        return result;
+    }
+
+    // Planned inputs and the predicted states under them.
+    const std::vector<double>& inputs() const { return u_; }
+    const std::vector<double>& states() const { return x_; }
+
+private:
+    void rollout( const double* x0 )
+    {
+        std::copy( x0, x0 + nx, x_.begin() );
+        for ( size_t k = 0; k < qp_.horizon(); ++k )
+            Model::step( &x_[k * nx], &u_[k * nu], options_.dt, &x_[( k + 1 ) * nx] );
+    }
+
+    // QP in the corrections (dx, du) about the rollout: dx_0 = 0, zero
+    // defects, cost gradients from the tracking errors, bounds shifted by
+    // the nominal input.
+    void linearise( const double* x0, const double* x_ref, const double* u_ref )
+    {
+        const size_t N = qp_.horizon();
+        std::copy( x0, x0 + nx, x_.begin() );
+        for ( size_t k = 0; k < N; ++k )
+        {
+            auto& s = qp_.stage( k );
+            const double* x = &x_[k * nx];
+            const double* u = &u_[k * nu];
+            Model::step( x, u, options_.dt, &x_[( k + 1 ) * nx], s.A, s.B );
+            double e[nx];
+            Model::error( x, &x_ref[k * nx], e );
+            for ( size_t i = 0; i < nx; ++i )
+            {
+                s.c[i] = 0.0;
+                s.Q[i][i] = options_.state_weight[i];
+                s.q[i] = options_.state_weight[i] * e[i];
+            }
+            for ( size_t i = 0; i < nu; ++i )
+            {
+                s.R[i][i] = options_.input_weight[i];
+                s.r[i] = options_.input_weight[i] * ( u[i] - u_ref[k * nu + i] );
+                s.lb[i] = options_.u_min[i] - u[i];
+                s.ub[i] = options_.u_max[i] - u[i];
+            }
+        }
+        double e[nx];
+        Model::error( &x_[N * nx], &x_ref[N * nx], e );
+        for ( size_t i = 0; i < nx; ++i )
+        {
+            qp_.terminal_Q()[i][i] = options_.terminal_weight[i];
+            qp_.terminal_q()[i] = options_.terminal_weight[i] * e[i];
+        }
+    }
+
+    Options options_;
+    RiccatiQp<nx, nu> qp_;
+    std::vector<double> u_;
+    std::vector<double> x_;
+    std::vector<double> zero_;
+    bool warm_ = false;
+};
+
+} // namespace wra
@@ -0,0 +1,1016 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace wra
+{
+
+// Fixed-capacity structure-of-arrays point arena: coordinate d of point i
+// lives at column(d)[i]. Capacity is rounded up to 8 so vector kernels may
+// read whole blocks; clear() keeps the memory for the next query.
+class SoaStore
+{
+public:
+    void reset( int dim, size_t capacity )
+    {
+        capacity = ( capacity + 7 ) & ~size_t( 7 );
+        if ( dim != dim_ || capacity > capacity_ )
+        {
+            dim_ = dim;
+            capacity_ = capacity;
+            data_.assign( static_cast<size_t>( dim ) * capacity, 0.0f );
+        }
+        size_ = 0;
+    }
+
+    void clear() { size_ = 0; }
+    int dim() const { return dim_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool full() const { return size_ == capacity_; }
+
+    uint32_t push( const float* q )
+    {
+        for ( int d = 0; d < dim_; ++d )
+            data_[d * capacity_ + size_] = q[d];
+        return static_cast<uint32_t>( size_++ );
+    }
+
+    float coord( uint32_t i, int d ) const { return data_[d * capacity_ + i]; }
+    const float* column( int d ) const { return data_.data() + d * capacity_; }
+
+    void get( uint32_t i, float* out ) const
+    {
+        for ( int d = 0; d < dim_; ++d )
+            out[d] = data_[d * capacity_ + i];
+    }
+
+    float distance2( uint32_t i, const float* q ) const
+    {
+        float s = 0.0f;
+        for ( int d = 0; d < dim_; ++d )
+        {
+            float t = data_[d * capacity_ + i] - q[d];
+            s += t * t;
+        }
+        return s;
+    }
+
+    float distance2( uint32_t i, uint32_t j ) const
+    {
+        float s = 0.0f;
+        for ( int d = 0; d < dim_; ++d )
+        {
+            float t = data_[d * capacity_ + i] - data_[d * capacity_ + j];
+            s += t * t;
+        }
+        return s;
+    }
+
+private:
+    int dim_ = 0;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    std::vector<float> data_;
+};
+
+namespace detail
+{
+
+// Squared distances from q to points [begin, end); begin must be a
+// multiple of 8.
+inline void soa_distances_scalar( const SoaStore& s, const float* q, size_t begin, size_t end, float* out )
+{
+    for ( size_t i = begin; i < end; ++i )
+        out[i - begin] = 0.0f;
+    for ( int d = 0; d < s.dim(); ++d )
+    {
+        const float* c = s.column( d );
+        for ( size_t i = begin; i < end; ++i )
+        {
+            float t = c[i] - q[d];
+            out[i - begin] += t * t;
+        }
+    }
+}
+
+#if defined( WRA_X86_SIMD )
+
+inline void soa_distances_sse2( const SoaStore& s, const float* q, size_t begin, size_t end, float* out )
+{
+    for ( size_t i = begin; i < end; i += 4 )
+    {
+        __m128 acc = _mm_setzero_ps();
+        for ( int d = 0; d < s.dim(); ++d )
+        {
+            __m128 t = _mm_sub_ps( _mm_loadu_ps( s.column( d ) + i ), _mm_set1_ps( q[d] ) );
+            acc = _mm_add_ps( acc, _mm_mul_ps( t, t ) );
+        }
+        _mm_storeu_ps( out + ( i - begin ), acc );
+    }
+}
+
+__attribute__( ( target( "avx2,fma" ) ) ) inline void soa_distances_avx2( const SoaStore& s, const float* q, size_t begin,
+                                                                          size_t end, float* out )
+{
+    for ( size_t i = begin; i < end; i += 8 )
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for ( int d = 0; d < s.dim(); ++d )
+        {
+            __m256 t = _mm256_sub_ps( _mm256_loadu_ps( s.column( d ) + i ), _mm256_set1_ps( q[d] ) );
+            acc = _mm256_fmadd_ps( t, t, acc );
+        }
+        _mm256_storeu_ps( out + ( i - begin ), acc );
+    }
+}
+
+#endif
+
+// Bounded max-heap keeping the k smallest (distance, id) pairs seen.
+class KnnHeap
+{
+public:
+    void reset( size_t k )
+    {
+        k_ = k;
+        heap_.clear();
+    }
+
+    bool full() const { return heap_.size() >= k_; }
+
+    // Distance a new point must beat to enter.
+    float bound() const { return full() && k_ ? heap_.front().first : std::numeric_limits<float>::max(); }
+
+    void push( float d, uint32_t id )
+    {
+        if ( !k_ )
+            return;
+        if ( full() )
+        {
+            if ( d >= heap_.front().first )
+                return;
+            std::pop_heap( heap_.begin(), heap_.end() );
+            heap_.pop_back();
+        }
+        heap_.emplace_back( d, id );
+        std::push_heap( heap_.begin(), heap_.end() );
+    }
+
+    // Ids nearest first; leaves the heap empty.
+    void take( std::vector<uint32_t>& out )
+    {
+        std::sort_heap( heap_.begin(), heap_.end() );
+        out.clear();
+        for ( const auto& e : heap_ )
+            out.push_back( e.second );
+        heap_.clear();
+    }
+
+private:
+    size_t k_ = 0;
+    std::vector<std::pair<float, uint32_t>> heap_;
+};
+
+} // namespace detail
+
+// Index over the points of a SoaStore, which must outlive it. Points are
+// added by id in insertion order.
+class NearestNeighbors
+{
+public:
+    explicit NearestNeighbors( const SoaStore& store ) : store_( store ) {}
+    virtual ~NearestNeighbors() = default;
+
+    virtual const char* name() const = 0;
+    virtual void clear() = 0;
+    virtual void add( uint32_t id ) = 0;
+    // Closest point to q; the index must not be empty.
+    virtual uint32_t nearest( const float* q ) const = 0;
+    // Appends every point within radius of q to out.
+    virtual void within( const float* q, float radius, std::vector<uint32_t>& out ) const = 0;
+    // The k closest points to q, nearest first, replacing out's contents.
+    virtual void nearest_k( const float* q, size_t k, std::vector<uint32_t>& out ) const = 0;
+
+protected:
+    const SoaStore& store_;
+};
+
+// Linear scan over the SoA columns in SIMD blocks. Hard to beat for small
+// trees and high dimensions, and the reference for the other indexes.
+class BruteForceIndex : public NearestNeighbors
+{
+public:
+    explicit BruteForceIndex( const SoaStore& store, SimdLevel level = detect_simd() )
+        : NearestNeighbors( store ), level_( level )
+    {
+    }
+
+    const char* name() const override { return "brute"; }
+    void clear() override { count_ = 0; }
+    void add( uint32_t id ) override { count_ = std::max<size_t>( count_, id + 1 ); }
+
+    uint32_t nearest( const float* q ) const override
+    {
+        float best = std::numeric_limits<float>::max();
+        uint32_t arg = 0;
+        float d[kBlock];
+        for ( size_t begin = 0; begin < count_; begin += kBlock )
+        {
+            size_t end = std::min( count_, begin + kBlock );
+            distances( q, begin, end, d );
+            for ( size_t i = 0; i < end - begin; ++i )
+                if ( d[i] < best )
+                {
+                    best = d[i];
+                    arg = static_cast<uint32_t>( begin + i );
+                }
+        }
+        return arg;
+    }
+
+    void within( const float* q, float radius, std::vector<uint32_t>& out ) const override
+    {
+        const float r2 = radius * radius;
+        float d[kBlock];
+        for ( size_t begin = 0; begin < count_; begin += kBlock )
+        {
+            size_t end = std::min( count_, begin + kBlock );
+            distances( q, begin, end, d );
+            for ( size_t i = 0; i < end - begin; ++i )
+                if ( d[i] <= r2 )
+                    out.push_back( static_cast<uint32_t>( begin + i ) );
+        }
+    }
+
+    void nearest_k( const float* q, size_t k, std::vector<uint32_t>& out ) const override
+    {
+        heap_.reset( k );
+        float d[kBlock];
+        for ( size_t begin = 0; begin < count_; begin += kBlock )
+        {
+            size_t end = std::min( count_, begin + kBlock );
+            distances( q, begin, end, d );
+            for ( size_t i = 0; i < end - begin; ++i )
+                if ( d[i] < heap_.bound() )
+                    heap_.push( d[i], static_cast<uint32_t>( begin + i ) );
+        }
+        heap_.take( out );
+    }
+
+private:
+    static constexpr size_t kBlock = 256;
+
+    // Kernels run to the next multiple of 8, inside the store's padding.
+    void distances( const float* q, size_t begin, size_t end, float* d ) const
+    {
+        size_t padded = std::min( ( end + 7 ) & ~size_t( 7 ), store_.capacity() );
+        switch ( level_ )
+        {
+#if defined( WRA_X86_SIMD )
+        case SimdLevel::Avx2:
+            detail::soa_distances_avx2( store_, q, begin, padded, d );
+            break;
+        case SimdLevel::Sse2:
+            detail::soa_distances_sse2( store_, q, begin, padded, d );
+            break;
+#endif
+        default:
+            detail::soa_distances_scalar( store_, q, begin, end, d );
+        }
+    }
+
+    SimdLevel level_;
+    size_t count_ = 0;
+    mutable detail::KnnHeap heap_;
+};
+
+// Incremental k-d tree: each inserted point becomes a node splitting on
+// depth % dim. Nodes live in flat arrays indexed by insertion order.
+class KdTreeIndex : public NearestNeighbors
+{
+public:
+    explicit KdTreeIndex( const SoaStore& store ) : NearestNeighbors( store ) {}
+
+    const char* name() const override { return "kdtree"; }
+
+    void clear() override
+    {
+        point_.clear();
+        left_.clear();
+        right_.clear();
+        axis_.clear();
+    }
+
+    void add( uint32_t id ) override
+    {
+        int32_t node = static_cast<int32_t>( point_.size() );
+        point_.push_back( id );
+        left_.push_back( -1 );
+        right_.push_back( -1 );
+        if ( node == 0 )
+        {
+            axis_.push_back( 0 );
+            return;
+        }
+        int32_t cur = 0;
+        for ( ;; )
+        {
+            int a = axis_[cur];
+            int32_t& child = store_.coord( id, a ) < store_.coord( point_[cur], a ) ? left_[cur] : right_[cur];
+            if ( child < 0 )
+            {
+                child = node;
+                axis_.push_back( static_cast<uint8_t>( ( a + 1 ) % store_.dim() ) );
+                return;
+            }
+            cur = child;
+        }
+    }
+
+    uint32_t nearest( const float* q ) const override
+    {
+        uint32_t best = point_[0];
+        float best_d2 = std::numeric_limits<float>::max();
+        nearest( 0, q, best, best_d2 );
+        return best;
+    }
+
+    void within( const float* q, float radius, std::vector<uint32_t>& out ) const override
+    {
+        if ( !point_.empty() )
+            within( 0, q, radius, radius * radius, out );
+    }
+
+    void nearest_k( const float* q, size_t k, std::vector<uint32_t>& out ) const override
+    {
+        heap_.reset( k );
+        if ( !point_.empty() )
+            nearest_k( 0, q, heap_ );
+        heap_.take( out );
+    }
+
+private:
+    void nearest( int32_t node, const float* q, uint32_t& best, float& best_d2 ) const
+    {
+        while ( node >= 0 )
+        {
+            uint32_t p = point_[node];
+            float d2 = store_.distance2( p, q );
+            if ( d2 < best_d2 )
+            {
+                best_d2 = d2;
+                best = p;
+            }
+            int a = axis_[node];
+            float diff = q[a] - store_.coord( p, a );
+            int32_t near = diff < 0 ? left_[node] : right_[node];
+            int32_t far = diff < 0 ? right_[node] : left_[node];
+            if ( far >= 0 && diff * diff < best_d2 )
+            {
+                // Descend the near side first so the far check sees a tight bound.
+                nearest( near, q, best, best_d2 );
+                if ( diff * diff < best_d2 )
+                    nearest( far, q, best, best_d2 );
+                return;
+            }
+            node = near;
+        }
+    }
+
+    void nearest_k( int32_t node, const float* q, detail::KnnHeap& heap ) const
+    {
+        while ( node >= 0 )
+        {
+            uint32_t p = point_[node];
+            heap.push( store_.distance2( p, q ), p );
+            int a = axis_[node];
+            float diff = q[a] - store_.coord( p, a );
+            int32_t near = diff < 0 ? left_[node] : right_[node];
+            int32_t far = diff < 0 ? right_[node] : left_[node];
+            if ( far >= 0 && diff * diff < heap.bound() )
+            {
+                nearest_k( near, q, heap );
+                if ( diff * diff < heap.bound() )
+                    nearest_k( far, q, heap );
+                return;
+            }
+            node = near;
+        }
+    }
+
+    void within( int32_t node, const float* q, float r, float r2, std::vector<uint32_t>& out ) const
+    {
+        if ( node < 0 )
+            return;
+        uint32_t p = point_[node];
+        if ( store_.distance2( p, q ) <= r2 )
+            out.push_back( p );
+        int a = axis_[node];
+        float diff = q[a] - store_.coord( p, a );
+        if ( diff < r )
+            within( left_[node], q, r, r2, out );
+        if ( diff >= -r )
+            within( right_[node], q, r, r2, out );
+    }
+
+    std::vector<uint32_t> point_;
+    std::vector<int32_t> left_;
+    std::vector<int32_t> right_;
+    std::vector<uint8_t> axis_;
+    mutable detail::KnnHeap heap_;
+};
+
+// Geometric Near-neighbour Access Tree (Brin). Internal nodes partition
+// their points among up to `degree` pivots and keep, for every sibling
+// pivot, the range of distances to each child's points, which prunes
+// children by the triangle inequality. Works for any metric; here it is
+// Euclidean over the store.
+class GnatIndex : public NearestNeighbors
+{
+public:
+    GnatIndex( const SoaStore& store, int degree = 8, size_t leaf_size = 48 )
+        : NearestNeighbors( store ), degree_( std::max( degree, 2 ) ), leaf_size_( std::max<size_t>( leaf_size, degree_ ) )
+    {
+    }
+
+    const char* name() const override { return "gnat"; }
+
+    void clear() override { nodes_.clear(); }
+
+    void add( uint32_t id ) override
+    {
+        if ( nodes_.empty() )
+        {
+            nodes_.emplace_back();
+            nodes_[0].pivot = id;
+            return;
+        }
+        uint32_t n = 0;
+        while ( !nodes_[n].children.empty() )
+        {
+            Node& node = nodes_[n];
+            size_t k = node.children.size();
+            scratch_.resize( k );
+            size_t best = 0;
+            for ( size_t i = 0; i < k; ++i )
+            {
+                scratch_[i] = distance( id, nodes_[node.children[i]].pivot );
+                if ( scratch_[i] < scratch_[best] )
+                    best = i;
+            }
+            Node& child = nodes_[node.children[best]];
+            for ( size_t i = 0; i < k; ++i )
+                child.include( i, scratch_[i] );
+            n = node.children[best];
+        }
+        nodes_[n].bucket.push_back( id );
+        if ( nodes_[n].bucket.size() > leaf_size_ )
+            split( n );
+    }
+
+    uint32_t nearest( const float* q ) const override
+    {
+        float r = std::numeric_limits<float>::max();
+        uint32_t best = nodes_[0].pivot;
+        search( q, r, &best, nullptr, nullptr );
+        return best;
+    }
+
+    void within( const float* q, float radius, std::vector<uint32_t>& out ) const override
+    {
+        if ( nodes_.empty() )
+            return;
+        float r = radius;
+        search( q, r, nullptr, &out, nullptr );
+    }
+
+    void nearest_k( const float* q, size_t k, std::vector<uint32_t>& out ) const override
+    {
+        heap_.reset( k );
+        if ( !nodes_.empty() && k )
+        {
+            float r = std::numeric_limits<float>::max();
+            search( q, r, nullptr, nullptr, &heap_ );
+        }
+        heap_.take( out );
+    }
+
+private:
+    struct Node
+    {
+        uint32_t pivot = 0;
+        std::vector<uint32_t> bucket;
+        std::vector<uint32_t> children;
+        // Distance range from sibling pivot i to this subtree's points.
+        std::vector<float> min_range;
+        std::vector<float> max_range;
+
+        void include( size_t sibling, float d )
+        {
+            if ( min_range.size() <= sibling )
+            {
+                min_range.resize( sibling + 1, std::numeric_limits<float>::max() );
+                max_range.resize( sibling + 1, 0.0f );
+            }
+            min_range[sibling] = std::min( min_range[sibling], d );
+            max_range[sibling] = std::max( max_range[sibling], d );
+        }
+    };
+
+    float distance( uint32_t a, uint32_t b ) const { return std::sqrt( store_.distance2( a, b ) ); }
+
+    // Turns a full leaf into an internal node: farthest-first pivots, then
+    // every bucket point goes to its closest pivot.
+    void split( uint32_t n )
+    {
+        std::vector<uint32_t> points;
+        points.swap( nodes_[n].bucket );
+        const uint32_t parent_pivot = nodes_[n].pivot;
+
+        std::vector<uint32_t> pivots;
+        std::vector<float> gap( points.size(), std::numeric_limits<float>::max() );
+        uint32_t from = parent_pivot;
+        std::vector<uint8_t> taken( points.size(), 0 );
+        for ( int p = 0; p < degree_ && pivots.size() < points.size(); ++p )
+        {
+            size_t far = 0;
+            float far_d = -1.0f;
+            for ( size_t i = 0; i < points.size(); ++i )
+            {
+                if ( taken[i] )
+                    continue;
+                gap[i] = std::min( gap[i], distance( points[i], from ) );
+                if ( gap[i] > far_d )
+                {
+                    far_d = gap[i];
+                    far = i;
+                }
+            }
+            taken[far] = 1;
+            pivots.push_back( points[far] );
+            from = points[far];
+        }
+
+        std::vector<uint32_t> child_ids;
+        for ( uint32_t p : pivots )
+        {
+            child_ids.push_back( static_cast<uint32_t>( nodes_.size() ) );
+            nodes_.emplace_back();
+            nodes_.back().pivot = p;
+        }
+        std::vector<float> d( pivots.size() );
+        for ( size_t i = 0; i < points.size(); ++i )
+        {
+            size_t best = 0;
+            for ( size_t j = 0; j < pivots.size(); ++j )
+            {
+                d[j] = distance( points[i], pivots[j] );
+                if ( d[j] < d[best] )
+                    best = j;
+            }
+            Node& child = nodes_[child_ids[best]];
+            for ( size_t j = 0; j < pivots.size(); ++j )
+                child.include( j, d[j] );
+            if ( !taken[i] )
+                child.bucket.push_back( points[i] );
+        }
+        nodes_[n].children = child_ids;
+        for ( uint32_t c : child_ids )
+            if ( nodes_[c].bucket.size() > leaf_size_ )
+                split( c );
+    }
+
+    // Best-first traversal. With best set it shrinks r to the nearest
+    // distance; with heap set, to the k-th nearest; with out set it
+    // collects everything within the fixed r.
+    void search( const float* q, float& r, uint32_t* best, std::vector<uint32_t>* out, detail::KnnHeap* heap ) const
+    {
+        auto visit = [&]( uint32_t id ) {
+            float d = std::sqrt( store_.distance2( id, q ) );
+            if ( d > r )
+                return d;
+            if ( best )
+            {
+                r = d;
+                *best = id;
+            }
+            else if ( heap )
+            {
+                heap->push( d, id );
+                r = heap->bound();
+            }
+            else
+                out->push_back( id );
+            return d;
+        };
+
+        using Entry = std::pair<float, uint32_t>;
+        auto later = std::greater<Entry>();
+        queue_.clear();
+        visit( nodes_[0].pivot );
+        queue_.emplace_back( 0.0f, 0 );
+        std::vector<float>& d = dist_;
+        std::vector<uint8_t>& alive = alive_;
+        while ( !queue_.empty() )
+        {
+            std::pop_heap( queue_.begin(), queue_.end(), later );
+            Entry e = queue_.back();
+            queue_.pop_back();
+            if ( e.first > r )
+                break;
+            const Node& node = nodes_[e.second];
+            for ( uint32_t id : node.bucket )
+                visit( id );
+            size_t k = node.children.size();
+            if ( k == 0 )
+                continue;
+            d.resize( k );
+            alive.assign( k, 1 );
+            for ( size_t i = 0; i < k; ++i )
+                d[i] = visit( nodes_[node.children[i]].pivot );
+            for ( size_t i = 0; i < k; ++i )
+                for ( size_t j = 0; j < k; ++j )
+                {
+                    if ( !alive[j] )
+                        continue;
+                    const Node& c = nodes_[node.children[j]];
+                    if ( i < c.min_range.size() && ( d[i] - r > c.max_range[i] || d[i] + r < c.min_range[i] ) )
+                        alive[j] = 0;
+                }
+            for ( size_t j = 0; j < k; ++j )
+            {
+                if ( !alive[j] )
+                    continue;
+                const Node& c = nodes_[node.children[j]];
+                // Lower bound on the distance to anything in child j.
+                float bound = j < c.max_range.size() ? std::max( 0.0f, d[j] - c.max_range[j] ) : 0.0f;
+                queue_.emplace_back( bound, node.children[j] );
+                std::push_heap( queue_.begin(), queue_.end(), later );
+            }
+        }
+    }
+
+    int degree_;
+    size_t leaf_size_;
+    std::vector<Node> nodes_;
+    std::vector<float> scratch_;
+    // Query scratch.
+    mutable std::vector<std::pair<float, uint32_t>> queue_;
+    mutable std::vector<float> dist_;
+    mutable std::vector<uint8_t> alive_;
+    mutable detail::KnnHeap heap_;
+};
+
+// Hierarchical navigable small world graph (Malkov & Yashunin). Each point
+// draws a geometric level and is linked into every layer up to it; links
+// are pruned by the relative-neighbourhood heuristic, which keeps long
+// edges between clusters. Queries descend greedily from the top and finish
+// with a beam search of width ef on layer 0. Approximate: recall and query
+// time both grow with ef_search. Graph walks touch points at random, so the
+// index keeps a row-major copy instead of striding the store's columns.
+class HnswIndex : public NearestNeighbors
+{
+public:
+    HnswIndex( const SoaStore& store, int m = 12, int ef_construction = 100, int ef_search = 48, uint32_t seed = 1 )
+        : NearestNeighbors( store ), m_( std::max( m, 2 ) ), ef_construction_( std::max( ef_construction, m_ ) ),
+          ef_search_( std::max( ef_search, 1 ) ), seed_( seed ), level_scale_( 1.0 / std::log( double( m_ ) ) ), rng_( seed )
+    {
+    }
+
+    const char* name() const override { return "hnsw"; }
+
+    int ef_search() const { return ef_search_; }
+    void set_ef_search( int ef ) { ef_search_ = std::max( ef, 1 ); }
+
+    void clear() override
+    {
+        point_.clear();
+        rows_.clear();
+        links0_.clear();
+        upper_.clear();
+        top_ = -1;
+        rng_.seed( seed_ );
+    }
+
+    void add( uint32_t id ) override
+    {
+        const int dim = store_.dim();
+        const uint32_t node = static_cast<uint32_t>( point_.size() );
+        point_.push_back( id );
+        rows_.resize( rows_.size() + dim );
+        store_.get( id, &rows_[size_t( node ) * dim] );
+        std::uniform_real_distribution<double> u( 0.0, 1.0 );
+        int level = static_cast<int>( -std::log( 1.0 - u( rng_ ) ) * level_scale_ );
+        links0_.resize( links0_.size() + 2 * m_ + 1, 0 );
+        upper_.emplace_back( size_t( level ) * ( m_ + 1 ), 0 );
+        if ( top_ < 0 )
+        {
+            entry_ = node;
+            top_ = level;
+            return;
+        }
+
+        const float* q = row( node );
+        uint32_t ep = entry_;
+        for ( int l = top_; l > level; --l )
+            ep = greedy( q, ep, l );
+        for ( int l = std::min( level, top_ ); l >= 0; --l )
+        {
+            search_layer( q, ep, ef_construction_, l, found_ );
+            ep = found_[0].second;
+            select( found_, m_, picked_ );
+            uint32_t* links = this->links( node, l );
+            links[0] = static_cast<uint32_t>( picked_.size() );
+            for ( size_t i = 0; i < picked_.size(); ++i )
+                links[i + 1] = picked_[i].second;
+            for ( const auto& p : picked_ )
+                connect( p.second, node, l );
+        }
+        if ( level > top_ )
+        {
+            top_ = level;
+            entry_ = node;
+        }
+    }
+
+    uint32_t nearest( const float* q ) const override
+    {
+        nearest_k( q, 1, one_ );
+        return one_.empty() ? 0 : one_[0];
+    }
+
+    // Seeds from the beam search, then floods layer 0 through neighbours
+    // inside the radius, so it misses only regions the graph does not
+    // connect within it.
+    void within( const float* q, float radius, std::vector<uint32_t>& out ) const override
+    {
+        if ( top_ < 0 )
+            return;
+        const float r2 = radius * radius;
+        search_layer( q, descend( q ), ef_search_, 0, found_ );
+        next_stamp();
+        flood_.clear();
+        for ( const auto& f : found_ )
+            if ( f.first <= r2 )
+            {
+                seen_[f.second] = stamp_;
+                flood_.push_back( f.second );
+            }
+        for ( size_t i = 0; i < flood_.size(); ++i )
+        {
+            out.push_back( point_[flood_[i]] );
+            const uint32_t* links = this->links( flood_[i], 0 );
+            for ( uint32_t j = 1; j <= links[0]; ++j )
+            {
+                uint32_t n = links[j];
+                if ( seen_[n] == stamp_ )
+                    continue;
+                seen_[n] = stamp_;
+                if ( distance2( row( n ), q ) <= r2 )
+                    flood_.push_back( n );
+            }
+        }
+    }
+
+    void nearest_k( const float* q, size_t k, std::vector<uint32_t>& out ) const override
+    {
+        out.clear();
+        if ( top_ < 0 || !k )
+            return;
+        search_layer( q, descend( q ), std::max<int>( ef_search_, static_cast<int>( k ) ), 0, found_ );
+        for ( size_t i = 0; i < found_.size() && i < k; ++i )
+            out.push_back( point_[found_[i].second] );
+    }
+
+private:
+    using Entry = std::pair<float, uint32_t>;
+
+    const float* row( uint32_t node ) const { return &rows_[size_t( node ) * store_.dim()]; }
+
+    // Independent partial sums so the loop vectorises.
+    float distance2( const float* a, const float* b ) const
+    {
+        const int dim = store_.dim();
+        float acc[4] = {};
+        int d = 0;
+        for ( ; d + 4 <= dim; d += 4 )
+            for ( int l = 0; l < 4; ++l )
+            {
+                float t = a[d + l] - b[d + l];
+                acc[l] += t * t;
+            }
+        for ( ; d < dim; ++d )
+        {
+            float t = a[d] - b[d];
+            acc[0] += t * t;
+        }
+        return ( acc[0] + acc[1] ) + ( acc[2] + acc[3] );
+    }
+
+    // Layer 0 holds up to 2m links, the others m; slot 0 is the count.
+    uint32_t* links( uint32_t node, int layer )
+    {
+        return layer ? &upper_[node][size_t( layer - 1 ) * ( m_ + 1 )] : &links0_[size_t( node ) * ( 2 * m_ + 1 )];
+    }
+    const uint32_t* links( uint32_t node, int layer ) const { return const_cast<HnswIndex*>( this )->links( node, layer ); }
+
+    void next_stamp() const
+    {
+        seen_.resize( point_.size(), 0 );
+        if ( ++stamp_ == 0 )
+        {
+            std::fill( seen_.begin(), seen_.end(), 0 );
+            stamp_ = 1;
+        }
+    }
+
+    uint32_t greedy( const float* q, uint32_t ep, int layer ) const
+    {
+        float best = distance2( row( ep ), q );
+        for ( bool moved = true; moved; )
+        {
+            moved = false;
+            const uint32_t* links = this->links( ep, layer );
+            for ( uint32_t j = 1; j <= links[0]; ++j )
+            {
+                float d = distance2( row( links[j] ), q );
+                if ( d < best )
+                {
+                    best = d;
+                    ep = links[j];
+                    moved = true;
+                }
+            }
+        }
+        return ep;
+    }
+
+    uint32_t descend( const float* q ) const
+    {
+        uint32_t ep = entry_;
+        for ( int l = top_; l > 0; --l )
+            ep = greedy( q, ep, l );
+        return ep;
+    }
+
+    // Beam search of width ef from ep; out gets the beam nearest first.
+    void search_layer( const float* q, uint32_t ep, int ef, int layer, std::vector<Entry>& out ) const
+    {
+        auto later = std::greater<Entry>();
+        next_stamp();
+        seen_[ep] = stamp_;
+        out.clear();
+        frontier_.clear();
+        float d0 = distance2( row( ep ), q );
+        out.emplace_back( d0, ep );
+        frontier_.emplace_back( d0, ep );
+        while ( !frontier_.empty() )
+        {
+            std::pop_heap( frontier_.begin(), frontier_.end(), later );
+            Entry c = frontier_.back();
+            frontier_.pop_back();
+            if ( c.first > out.front().first && out.size() >= size_t( ef ) )
+                break;
+            const uint32_t* links = this->links( c.second, layer );
+            for ( uint32_t j = 1; j <= links[0]; ++j )
+            {
+                uint32_t n = links[j];
+                if ( seen_[n] == stamp_ )
+                    continue;
+                seen_[n] = stamp_;
+                float d = distance2( row( n ), q );
+                if ( out.size() < size_t( ef ) || d < out.front().first )
+                {
+                    frontier_.emplace_back( d, n );
+                    std::push_heap( frontier_.begin(), frontier_.end(), later );
+                    out.emplace_back( d, n );
+                    std::push_heap( out.begin(), out.end() );
+                    if ( out.size() > size_t( ef ) )
+                    {
+                        std::pop_heap( out.begin(), out.end() );
+                        out.pop_back();
+                    }
+                }
+            }
+        }
+        std::sort_heap( out.begin(), out.end() );
+    }
+
+    // Walks sorted candidates nearest first and keeps one only if it is
+    // closer to the base point than to every neighbour already kept.
+    void select( const std::vector<Entry>& sorted, int m, std::vector<Entry>& out ) const
+    {
+        out.clear();
+        for ( const Entry& c : sorted )
+        {
+            if ( out.size() >= size_t( m ) )
+                break;
+            bool keep = true;
+            for ( const Entry& o : out )
+                if ( distance2( row( c.second ), row( o.second ) ) < c.first )
+                {
+                    keep = false;
+                    break;
+                }
+            if ( keep )
+                out.push_back( c );
+        }
+    }
+
+    // Back link from `from` to `to`, re-pruning when the list is full.
+    void connect( uint32_t from, uint32_t to, int layer )
+    {
+        uint32_t* links = this->links( from, layer );
+        const uint32_t cap = layer ? m_ : 2 * m_;
+        if ( links[0] < cap )
+        {
+            links[++links[0]] = to;
+            return;
+        }
+        prune_.clear();
+        const float* base = row( from );
+        for ( uint32_t j = 1; j <= links[0]; ++j )
+            prune_.emplace_back( distance2( row( links[j] ), base ), links[j] );
+        prune_.emplace_back( distance2( row( to ), base ), to );
+        std::sort( prune_.begin(), prune_.end() );
+        select( prune_, static_cast<int>( cap ), repruned_ );
+        links[0] = static_cast<uint32_t>( repruned_.size() );
+        for ( size_t i = 0; i < repruned_.size(); ++i )
+            links[i + 1] = repruned_[i].second;
+    }
+
+    int m_;
+    int ef_construction_;
+    int ef_search_;
+    uint32_t seed_;
+    double level_scale_;
+    std::mt19937 rng_;
+    std::vector<uint32_t> point_;
+    std::vector<float> rows_;
+    std::vector<uint32_t> links0_;
+    std::vector<std::vector<uint32_t>> upper_;
+    uint32_t entry_ = 0;
+    int top_ = -1;
+    std::vector<Entry> picked_;
+    std::vector<Entry> prune_;
+    std::vector<Entry> repruned_;
+    // Query scratch.
+    mutable std::vector<Entry> found_;
+    mutable std::vector<Entry> frontier_;
+    mutable std::vector<uint32_t> flood_;
+    mutable std::vector<uint32_t> one_;
+    mutable std::vector<uint32_t> seen_;
+    mutable uint32_t stamp_ = 0;
+};
+
+enum class NearestIndexKind
+{
+    Brute,
+    KdTree,
+    Gnat,
+    Hnsw
+};
+
+inline const char* to_string( NearestIndexKind kind )
+{
+    switch ( kind )
+    {
+    case NearestIndexKind::Brute:
+        return "brute";
+    case NearestIndexKind::KdTree:
+        return "kdtree";
+    case NearestIndexKind::Gnat:
+        return "gnat";
+    case NearestIndexKind::Hnsw:
+        return "hnsw";
+    }
+    return "?";
+}
+
+inline std::unique_ptr<NearestNeighbors> make_nearest_index( NearestIndexKind kind, const SoaStore& store )
+{
+    switch ( kind )
+    {
+    case NearestIndexKind::KdTree:
+        return std::unique_ptr<NearestNeighbors>( new KdTreeIndex( store ) );
+    case NearestIndexKind::Gnat:
+        return std::unique_ptr<NearestNeighbors>( new GnatIndex( store ) );
+    case NearestIndexKind::Hnsw:
+        return std::unique_ptr<NearestNeighbors>( new HnswIndex( store ) );
+    default:
+        return std::unique_ptr<NearestNeighbors>( new BruteForceIndex( store ) );
+    }
+}
+
+} // namespace wra
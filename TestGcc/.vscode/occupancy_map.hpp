@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "geometry.hpp"
+#include "point_cloud.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+enum class Occupancy
+{
+    Unknown,
+    Free,
+    Occupied
+};
+
+inline const char* to_string( Occupancy o )
+{
+    switch ( o )
+    {
+    case Occupancy::Unknown:
+        return "unknown";
+    case Occupancy::Free:
+        return "free";
+    case Occupancy::Occupied:
+        return "occupied";
+    }
+    return "?";
+}
+
+struct OccupancyMapOptions
+{
+    double resolution = 0.1; // m, voxel edge
+    double min_range = 0.5;  // m; nearer returns (the robot itself) are ignored
+    double max_range = 30.0; // m; longer returns only clear space up to here
+    float hit = 0.85f;       // log-odds added to an endpoint voxel, p = 0.7
+    float miss = -0.4f;      // log-odds added to a voxel a ray crosses, p = 0.4
+    float clamp_min = -2.0f; // log-odds bounds (p 0.12 .. 0.97) so the map can still change
+    float clamp_max = 3.5f;
+    float occupied = 0.0f;   // log-odds above which an observed voxel is occupied
+    bool dedupe = true;      // one update per voxel per scan; false updates once per ray crossing
+};
+
+struct OccupancyStats
+{
+    size_t rays = 0;    // returns inside the range limits
+    size_t hits = 0;    // of those, endpoints within max_range
+    size_t emitted = 0; // voxel keys handed from ray casting to the update
+    size_t updates = 0; // log-odds updates applied
+    size_t blocks = 0;  // blocks allocated by this scan
+};
+
+// Log-odds occupancy over a sparse grid of 8^3-voxel blocks, found through
+// open-addressing hash tables the way VDB or voxblox store them rather
+// than by walking a pointer octree. Blocks are spread over kShards tables
+// by hash, so a scan integrates in two parallel phases with no locking:
+// rays are cast in chunks with a 3D DDA, each chunk bucketing the keys it
+// visits by shard, then every shard applies its own keys. Endpoints are
+// applied before free space, and a per-voxel frame stamp makes each voxel
+// take exactly one update per scan, occupied winning over free as in
+// OctoMap. A voxel is unknown until some scan has updated it.
+class OccupancyMap
+{
+public:
+    static constexpr int kShards = 16;
+
+    explicit OccupancyMap( const OccupancyMapOptions& options = OccupancyMapOptions() )
+        : options_( options ), inv_res_( static_cast<float>( 1.0 / options.resolution ) )
+    {
+        clear();
+    }
+
+    const OccupancyMapOptions& options() const { return options_; }
+
+    size_t blocks() const
+    {
+        size_t n = 0;
+        for ( const Shard& s : shards_ )
+            n += s.keys.size();
+        return n;
+    }
+
+    size_t memory_bytes() const
+    {
+        size_t n = 0;
+        for ( const Shard& s : shards_ )
+            n += s.values.capacity() * sizeof( float ) + s.stamps.capacity() * sizeof( uint32_t ) +
+                 s.keys.capacity() * sizeof( uint64_t ) + s.table.capacity() * sizeof( int32_t );
+        return n;
+    }
+
+    void clear()
+    {
+        for ( Shard& s : shards_ )
+        {
+            s.table.assign( 256, -1 );
+            s.keys.clear();
+            s.values.clear();
+            s.stamps.clear();
+        }
+        frame_ = 0;
+    }
+
+    // Integrates a cloud given in the sensor frame at `pose`; rays start at
+    // pose.t.
+    void integrate( const PointCloud& cloud, const Isometry3& pose, OccupancyStats* stats = nullptr, ThreadPool* pool = nullptr )
+    {
+        ++frame_;
+        const size_t n = cloud.size();
+        const size_t chunks = pool ? std::min<size_t>( std::max<size_t>( 1, n / 1024 ), 4 * pool->size() ) : 1;
+        if ( chunks_.size() < chunks )
+            chunks_.resize( chunks );
+        for ( size_t c = 0; c < chunks; ++c )
+            chunks_[c].reset();
+
+        auto cast = [&]( size_t c ) { cast_rays( cloud, pose, n * c / chunks, n * ( c + 1 ) / chunks, chunks_[c] ); };
+        auto apply = [&]( size_t s ) { apply_shard( s, chunks ); };
+        if ( pool )
+        {
+            pool->run_chunks( chunks, cast );
+            pool->run_chunks( kShards, apply );
+        }
+        else
+        {
+            cast( 0 );
+            for ( size_t s = 0; s < kShards; ++s )
+                apply( s );
+        }
+
+        if ( stats )
+        {
+            *stats = OccupancyStats();
+            for ( size_t c = 0; c < chunks; ++c )
+            {
+                stats->rays += chunks_[c].rays;
+                stats->hits += chunks_[c].hit_count;
+                for ( int s = 0; s < kShards; ++s )
+                    stats->emitted += chunks_[c].hits[s].size() + chunks_[c].misses[s].size();
+            }
+            for ( const Shard& s : shards_ )
+            {
+                stats->updates += s.updates;
+                stats->blocks += s.new_blocks;
+            }
+        }
+    }
+
+    // Log-odds at p, 0 where unknown.
+    float log_odds( const Vec3& p ) const
+    {
+        const float* v = find_voxel( p, nullptr );
+        return v ? *v : 0.0f;
+    }
+
+    Occupancy state( const Vec3& p ) const
+    {
+        uint32_t stamp = 0;
+        const float* v = find_voxel( p, &stamp );
+        if ( !v || stamp == 0 )
+            return Occupancy::Unknown;
+        return *v > options_.occupied ? Occupancy::Occupied : Occupancy::Free;
+    }
+
+    // Calls f(centre, log_odds) for every observed voxel.
+    template <typename F>
+    void for_each_voxel( F&& f ) const
+    {
+        const double res = options_.resolution;
+        for ( const Shard& s : shards_ )
+            for ( size_t b = 0; b < s.keys.size(); ++b )
+            {
+                const uint64_t key = s.keys[b];
+                const int bx = int( ( key >> 36 ) & 0x3FFFF ), by = int( ( key >> 18 ) & 0x3FFFF ), bz = int( key & 0x3FFFF );
+                for ( int v = 0; v < kBlockVoxels; ++v )
+                {
+                    if ( s.stamps[b * kBlockVoxels + v] == 0 )
+                        continue;
+                    int ix = ( bx << 3 | ( v & 7 ) ) - ( 1 << 20 ), iy = ( by << 3 | ( v >> 3 & 7 ) ) - ( 1 << 20 ),
+                        iz = ( bz << 3 | ( v >> 6 ) ) - ( 1 << 20 );
+                    f( Vec3( ( ix + 0.5 ) * res, ( iy + 0.5 ) * res, ( iz + 0.5 ) * res ), s.values[b * kBlockVoxels + v] );
+                }
+            }
+    }
+
+private:
+    static constexpr int kBlockVoxels = 512;
+    static constexpr size_t kCache = size_t( 1 ) << 14;
+
+    // Blocks of one shard: keys[b] owns values and stamps [b * 512, + 512).
+    // A stamp is 2 * frame, + 1 when that frame's update was a hit, so 0
+    // is a voxel no scan has touched.
+    struct Shard
+    {
+        std::vector<int32_t> table;
+        std::vector<uint64_t> keys;
+        std::vector<float> values;
+        std::vector<uint32_t> stamps;
+        size_t updates = 0;
+        size_t new_blocks = 0;
+    };
+
+    // One ray-casting chunk's voxel keys, bucketed by shard. The cache is
+    // direct mapped and only filters repeats: neighbouring rays cross the
+    // same voxels near the sensor, so most duplicates never reach a bucket.
+    struct Chunk
+    {
+        std::vector<uint64_t> hits[kShards];
+        std::vector<uint64_t> misses[kShards];
+        std::vector<uint64_t> cache;
+        size_t rays = 0;
+        size_t hit_count = 0;
+
+        void reset()
+        {
+            for ( int s = 0; s < kShards; ++s )
+            {
+                hits[s].clear();
+                misses[s].clear();
+            }
+            cache.assign( kCache, ~uint64_t( 0 ) );
+            rays = hit_count = 0;
+        }
+    };
+
+    // Block of a voxel key: its three 21-bit fields shifted down by 3.
+    static uint64_t block_of( uint64_t key )
+    {
+        return ( ( key >> 45 ) & 0x3FFFF ) << 36 | ( ( key >> 24 ) & 0x3FFFF ) << 18 | ( ( key >> 3 ) & 0x3FFFF );
+    }
+
+    static int voxel_in_block( uint64_t key )
+    {
+        return int( ( key >> 42 ) & 7 ) | int( ( key >> 21 ) & 7 ) << 3 | int( key & 7 ) << 6;
+    }
+
+    static int shard_of( uint64_t block ) { return int( voxel_hash( block ) >> 60 ); }
+
+    void cast_rays( const PointCloud& cloud, const Isometry3& pose, size_t lo, size_t hi, Chunk& out ) const
+    {
+        const Mat3& R = pose.R;
+        const float ox = float( pose.t.x ) * inv_res_, oy = float( pose.t.y ) * inv_res_, oz = float( pose.t.z ) * inv_res_;
+        const float min2 = float( options_.min_range * options_.min_range );
+        const float max_range = float( options_.max_range );
+        const bool dedupe = options_.dedupe;
+        // Keys use 63 bits; the top bit of a cache entry marks a hit. A hit
+        // is dropped only after the same hit and a miss after either, so
+        // the filter never changes what the update applies and the map
+        // does not depend on how rays are chunked.
+        const uint64_t hit_bit = uint64_t( 1 ) << 63;
+        auto emit = [&]( bool is_hit, uint64_t key ) {
+            if ( dedupe )
+            {
+                uint64_t& slot = out.cache[( key * 0x9E3779B97F4A7C15ull ) >> 50];
+                if ( slot == ( key | hit_bit ) || ( !is_hit && slot == key ) )
+                    return;
+                slot = is_hit ? key | hit_bit : key;
+            }
+            ( is_hit ? out.hits : out.misses )[shard_of( block_of( key ) )].push_back( key );
+        };
+        for ( size_t i = lo; i < hi; ++i )
+        {
+            float x = cloud.x[i], y = cloud.y[i], z = cloud.z[i];
+            float r2 = x * x + y * y + z * z;
+            if ( r2 < min2 || !std::isfinite( r2 ) )
+                continue;
+            ++out.rays;
+            float scale = inv_res_;
+            bool hit = true;
+            if ( r2 > max_range * max_range )
+            {
+                scale *= max_range / std::sqrt( r2 );
+                hit = false;
+            }
+            // Ray in voxel units, from the origin to the endpoint.
+            const float dx = float( R.m[0][0] * x + R.m[0][1] * y + R.m[0][2] * z ) * scale;
+            const float dy = float( R.m[1][0] * x + R.m[1][1] * y + R.m[1][2] * z ) * scale;
+            const float dz = float( R.m[2][0] * x + R.m[2][1] * y + R.m[2][2] * z ) * scale;
+            const int v[3] = { int( std::floor( ox ) ), int( std::floor( oy ) ), int( std::floor( oz ) ) };
+            const int e[3] = { int( std::floor( ox + dx ) ), int( std::floor( oy + dy ) ), int( std::floor( oz + dz ) ) };
+            const float o[3] = { ox, oy, oz }, d[3] = { dx, dy, dz };
+            int step[3];
+            float next[3], delta[3];
+            for ( int a = 0; a < 3; ++a )
+            {
+                step[a] = d[a] > 0.0f ? 1 : -1;
+                delta[a] = d[a] != 0.0f ? std::fabs( 1.0f / d[a] ) : std::numeric_limits<float>::infinity();
+                next[a] = d[a] > 0.0f ? ( v[a] + 1 - o[a] ) * delta[a]
+                          : d[a] < 0.0f ? ( o[a] - v[a] ) * delta[a]
+                                        : std::numeric_limits<float>::infinity();
+            }
+            // Amanatides & Woo: the step count is fixed up front, so
+            // rounding can bend the path but never overrun the endpoint.
+            // Each packed field moves by one per step, so the key is
+            // stepped in place rather than packed per voxel.
+            const int steps = std::abs( e[0] - v[0] ) + std::abs( e[1] - v[1] ) + std::abs( e[2] - v[2] );
+            const uint64_t key_step[3] = { uint64_t( int64_t( step[0] ) * ( int64_t( 1 ) << 42 ) ),
+                                           uint64_t( int64_t( step[1] ) * ( int64_t( 1 ) << 21 ) ), uint64_t( int64_t( step[2] ) ) };
+            uint64_t key = voxel_key( v[0], v[1], v[2] );
+            for ( int s = 0; s < steps; ++s )
+            {
+                emit( false, key );
+                int a = next[0] < next[1] ? ( next[0] < next[2] ? 0 : 2 ) : ( next[1] < next[2] ? 1 : 2 );
+                key += key_step[a];
+                next[a] += delta[a];
+            }
+            if ( hit )
+            {
+                ++out.hit_count;
+                emit( true, key );
+            }
+            else
+                emit( false, key );
+        }
+    }
+
+    void apply_shard( size_t s, size_t chunks )
+    {
+        Shard& shard = shards_[s];
+        shard.updates = 0;
+        shard.new_blocks = 0;
+        const uint32_t hit_stamp = 2 * frame_ + 1, miss_stamp = 2 * frame_;
+        uint64_t last_block = ~uint64_t( 0 );
+        size_t base = 0;
+        auto update = [&]( uint64_t key, float delta, uint32_t stamp ) {
+            uint64_t block = block_of( key );
+            if ( block != last_block )
+            {
+                last_block = block;
+                base = size_t( find_or_add( shard, block ) ) * kBlockVoxels;
+            }
+            const size_t v = base + voxel_in_block( key );
+            if ( options_.dedupe && shard.stamps[v] >= miss_stamp )
+                return;
+            shard.stamps[v] = stamp;
+            shard.values[v] = std::min( std::max( shard.values[v] + delta, options_.clamp_min ), options_.clamp_max );
+            ++shard.updates;
+        };
+        for ( size_t c = 0; c < chunks; ++c )
+            for ( uint64_t key : chunks_[c].hits[s] )
+                update( key, options_.hit, hit_stamp );
+        for ( size_t c = 0; c < chunks; ++c )
+            for ( uint64_t key : chunks_[c].misses[s] )
+                update( key, options_.miss, miss_stamp );
+    }
+
+    int32_t find_or_add( Shard& shard, uint64_t block )
+    {
+        size_t mask = shard.table.size() - 1;
+        size_t slot = voxel_hash( block ) & mask;
+        for ( ; shard.table[slot] >= 0; slot = ( slot + 1 ) & mask )
+            if ( shard.keys[shard.table[slot]] == block )
+                return shard.table[slot];
+        const int32_t b = int32_t( shard.keys.size() );
+        shard.keys.push_back( block );
+        shard.values.resize( shard.values.size() + kBlockVoxels, 0.0f );
+        shard.stamps.resize( shard.stamps.size() + kBlockVoxels, 0 );
+        ++shard.new_blocks;
+        shard.table[slot] = b;
+        if ( 2 * shard.keys.size() > shard.table.size() )
+        {
+            shard.table.assign( 2 * shard.table.size(), -1 );
+            mask = shard.table.size() - 1;
+            for ( size_t i = 0; i < shard.keys.size(); ++i )
+            {
+                size_t t = voxel_hash( shard.keys[i] ) & mask;
+                while ( shard.table[t] >= 0 )
+                    t = ( t + 1 ) & mask;
+                shard.table[t] = int32_t( i );
+            }
+        }
+        return b;
+    }
+
+    const float* find_voxel( const Vec3& p, uint32_t* stamp ) const
+    {
+        const uint64_t key = voxel_key( float( p.x ), float( p.y ), float( p.z ), inv_res_ );
+        const uint64_t block = block_of( key );
+        const Shard& shard = shards_[shard_of( block )];
+        const size_t mask = shard.table.size() - 1;
+        for ( size_t slot = voxel_hash( block ) & mask; shard.table[slot] >= 0; slot = ( slot + 1 ) & mask )
+        {
+            const int32_t b = shard.table[slot];
+            if ( shard.keys[b] != block )
+                continue;
+            const size_t v = size_t( b ) * kBlockVoxels + voxel_in_block( key );
+            if ( stamp )
+                *stamp = shard.stamps[v];
+            return &shard.values[v];
+        }
+        return nullptr;
+    }
+
+    OccupancyMapOptions options_;
+    float inv_res_;
+    uint32_t frame_ = 0;
+    Shard shards_[kShards];
+    std::vector<Chunk> chunks_;
+};
+
+} // namespace wra
@@ -0,0 +1,499 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "sampling_planner.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+// RRT* tree shared by several workers without locks.
+//
+// A node's slot is claimed with one fetch_add and filled before the node is
+// published by a CAS into an incremental k-d tree, so readers that reach it
+// through the k-d links see complete coordinates. Parent and cost are packed
+// into one 64-bit word and only ever replaced by a CAS that lowers the cost.
+// Because costs only decrease and a child is always linked at a cost above
+// its parent's, parent links can never form a cycle.
+//
+// Children are kept in per-node lock-free lists that are never unlinked; an
+// entry whose node has since moved to another parent is skipped. Cost
+// propagation after a rewire is best effort under contention, so stored
+// costs are upper bounds of the true path costs.
+class ConcurrentTree
+{
+public:
+    static constexpr uint32_t kNoParent = 0xffffffffu;
+
+    void reset( int dim, size_t capacity )
+    {
+        if ( dim != dim_ || capacity != capacity_ )
+        {
+            dim_ = dim;
+            capacity_ = capacity;
+            coords_.assign( static_cast<size_t>( dim ) * capacity, 0.0f );
+            axis_.assign( capacity, 0 );
+            link_.reset( new std::atomic<uint64_t>[capacity] );
+            left_.reset( new std::atomic<int32_t>[capacity] );
+            right_.reset( new std::atomic<int32_t>[capacity] );
+            first_child_.reset( new std::atomic<int32_t>[capacity] );
+            // One entry per insertion plus headroom for rewires.
+            entry_capacity_ = capacity * 4;
+            entry_node_.assign( entry_capacity_, 0 );
+            entry_next_.assign( entry_capacity_, -1 );
+        }
+        count_.store( 0 );
+        entries_.store( 0 );
+    }
+
+    int dim() const { return dim_; }
+    size_t capacity() const { return capacity_; }
+    size_t size() const { return std::min( count_.load( std::memory_order_relaxed ), capacity_ ); }
+
+    const float* point( uint32_t id ) const { return &coords_[static_cast<size_t>( id ) * dim_]; }
+    uint32_t parent( uint32_t id ) const { return unpack_parent( link_[id].load( std::memory_order_acquire ) ); }
+    float cost( uint32_t id ) const { return unpack_cost( link_[id].load( std::memory_order_acquire ) ); }
+
+    float distance( const float* a, const float* b ) const { return state_distance( a, b, dim_ ); }
+
+    // Adds q under parent at the given cost; returns -1 once the tree is full.
+    int32_t insert( const float* q, uint32_t parent, float cost )
+    {
+        size_t slot = count_.fetch_add( 1, std::memory_order_relaxed );
+        if ( slot >= capacity_ )
+            return -1;
+        uint32_t id = static_cast<uint32_t>( slot );
+        std::memcpy( &coords_[slot * dim_], q, sizeof( float ) * dim_ );
+        link_[id].store( pack( parent, cost ), std::memory_order_relaxed );
+        left_[id].store( -1, std::memory_order_relaxed );
+        right_[id].store( -1, std::memory_order_relaxed );
+        first_child_[id].store( -1, std::memory_order_relaxed );
+        if ( id == 0 )
+        {
+            axis_[0] = 0;
+            return 0;
+        }
+        add_child( parent, id );
+
+        uint32_t cur = 0;
+        for ( ;; )
+        {
+            int a = axis_[cur];
+            std::atomic<int32_t>& child = q[a] < point( cur )[a] ? left_[cur] : right_[cur];
+            int32_t next = child.load( std::memory_order_acquire );
+            if ( next < 0 )
+            {
+                axis_[id] = static_cast<uint8_t>( ( a + 1 ) % dim_ );
+                if ( child.compare_exchange_strong( next, static_cast<int32_t>( id ), std::memory_order_release,
+                                                    std::memory_order_acquire ) )
+                    return static_cast<int32_t>( id );
+            }
+            cur = static_cast<uint32_t>( next );
+        }
+    }
+
+    uint32_t nearest( const float* q ) const
+    {
+        uint32_t best = 0;
+        float best_d2 = std::numeric_limits<float>::max();
+        nearest( 0, q, best, best_d2 );
+        return best;
+    }
+
+    void within( const float* q, float radius, std::vector<uint32_t>& out ) const
+    {
+        within( 0, q, radius, radius * radius, out );
+    }
+
+    // Moves v under p if that lowers its cost, then pushes the saving down
+    // v's subtree. stack is caller-owned scratch.
+    bool rewire( uint32_t v, uint32_t p, float cost, std::vector<uint32_t>& stack )
+    {
+        uint64_t cur = link_[v].load( std::memory_order_acquire );
+        do
+        {
+            if ( unpack_cost( cur ) <= cost )
+                return false;
+        } while ( !link_[v].compare_exchange_weak( cur, pack( p, cost ), std::memory_order_acq_rel,
+                                                   std::memory_order_acquire ) );
+        add_child( p, v );
+        propagate( v, stack );
+        return true;
+    }
+
+private:
+    static uint64_t pack( uint32_t parent, float cost )
+    {
+        uint32_t bits;
+        std::memcpy( &bits, &cost, sizeof( bits ) );
+        return static_cast<uint64_t>( parent ) << 32 | bits;
+    }
+    static uint32_t unpack_parent( uint64_t link ) { return static_cast<uint32_t>( link >> 32 ); }
+    static float unpack_cost( uint64_t link )
+    {
+        uint32_t bits = static_cast<uint32_t>( link );
+        float cost;
+        std::memcpy( &cost, &bits, sizeof( cost ) );
+        return cost;
+    }
+
+    void add_child( uint32_t parent, uint32_t child )
+    {
+        size_t e = entries_.fetch_add( 1, std::memory_order_relaxed );
+        // Out of entries: the child still links to its parent, it only
+        // misses future cost propagation.
+        if ( e >= entry_capacity_ )
+            return;
+        entry_node_[e] = child;
+        int32_t head = first_child_[parent].load( std::memory_order_relaxed );
+        do
+            entry_next_[e] = head;
+        while ( !first_child_[parent].compare_exchange_weak( head, static_cast<int32_t>( e ), std::memory_order_release,
+                                                             std::memory_order_relaxed ) );
+    }
+
+    void propagate( uint32_t root, std::vector<uint32_t>& stack )
+    {
+        stack.clear();
+        stack.push_back( root );
+        while ( !stack.empty() )
+        {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            float base = cost( n );
+            for ( int32_t e = first_child_[n].load( std::memory_order_acquire ); e >= 0; e = entry_next_[e] )
+            {
+                uint32_t c = entry_node_[e];
+                float through = base + distance( point( n ), point( c ) );
+                uint64_t link = link_[c].load( std::memory_order_acquire );
+                bool lowered = false;
+                while ( unpack_parent( link ) == n && through < unpack_cost( link ) )
+                {
+                    if ( link_[c].compare_exchange_weak( link, pack( n, through ), std::memory_order_acq_rel,
+                                                         std::memory_order_acquire ) )
+                    {
+                        lowered = true;
+                        break;
+                    }
+                }
+                if ( lowered )
+                    stack.push_back( c );
+            }
+        }
+    }
+
+    float distance2( uint32_t id, const float* q ) const
+    {
+        const float* p = point( id );
+        float s = 0.0f;
+        for ( int d = 0; d < dim_; ++d )
+            s += ( p[d] - q[d] ) * ( p[d] - q[d] );
+        return s;
+    }
+
+    void nearest( int32_t node, const float* q, uint32_t& best, float& best_d2 ) const
+    {
+        while ( node >= 0 )
+        {
+            float d2 = distance2( static_cast<uint32_t>( node ), q );
+            if ( d2 < best_d2 )
+            {
+                best_d2 = d2;
+                best = static_cast<uint32_t>( node );
+            }
+            int a = axis_[node];
+            float diff = q[a] - point( static_cast<uint32_t>( node ) )[a];
+            int32_t near = ( diff < 0 ? left_[node] : right_[node] ).load( std::memory_order_acquire );
+            int32_t far = ( diff < 0 ? right_[node] : left_[node] ).load( std::memory_order_acquire );
+            if ( far >= 0 && diff * diff < best_d2 )
+            {
+                nearest( near, q, best, best_d2 );
+                if ( diff * diff < best_d2 )
+                    nearest( far, q, best, best_d2 );
+                return;
+            }
+            node = near;
+        }
+    }
+
+    void within( int32_t node, const float* q, float r, float r2, std::vector<uint32_t>& out ) const
+    {
+        if ( node < 0 )
+            return;
+        if ( distance2( static_cast<uint32_t>( node ), q ) <= r2 )
+            out.push_back( static_cast<uint32_t>( node ) );
+        int a = axis_[node];
+        float diff = q[a] - point( static_cast<uint32_t>( node ) )[a];
+        if ( diff < r )
+            within( left_[node].load( std::memory_order_acquire ), q, r, r2, out );
+        if ( diff >= -r )
+            within( right_[node].load( std::memory_order_acquire ), q, r, r2, out );
+    }
+
+    int dim_ = 0;
+    size_t capacity_ = 0;
+    std::vector<float> coords_;
+    std::vector<uint8_t> axis_;
+    std::unique_ptr<std::atomic<uint64_t>[]> link_;
+    std::unique_ptr<std::atomic<int32_t>[]> left_;
+    std::unique_ptr<std::atomic<int32_t>[]> right_;
+    std::unique_ptr<std::atomic<int32_t>[]> first_child_;
+    std::atomic<size_t> count_{ 0 };
+
+    size_t entry_capacity_ = 0;
+    std::vector<uint32_t> entry_node_;
+    std::vector<int32_t> entry_next_;
+    std::atomic<size_t> entries_{ 0 };
+};
+
+struct ParallelRrtStarOptions
+{
+    size_t max_nodes = 50000;
+    // Samples across all workers; 0 means no limit.
+    size_t max_iterations = 0;
+    // Wall-clock budget; 0 means no limit.
+    double time_limit_ms = 0.0;
+    float step = 0.1f;
+    float goal_bias = 0.05f;
+    float rewire_factor = 1.1f;
+    uint32_t seed = 1;
+};
+
+struct ParallelRrtStarResult
+{
+    bool solved = false;
+    // Recomputed from the returned path, not read from the tree.
+    float cost = 0.0f;
+    double first_solution_ms = 0.0;
+    size_t iterations = 0;
+    size_t nodes = 0;
+    size_t state_checks = 0;
+    size_t rewires = 0;
+    std::vector<float> path;
+};
+
+// RRT* with workers sampling, extending and rewiring one ConcurrentTree.
+// problem.valid is called from every worker and must be thread-safe.
+class ParallelRrtStar
+{
+public:
+    ParallelRrtStar( const SamplingProblem& problem, const ParallelRrtStarOptions& options )
+        : problem_( problem ), options_( options ), dim_( problem.dim )
+    {
+    }
+
+    const ParallelRrtStarOptions& options() const { return options_; }
+    void set_options( const ParallelRrtStarOptions& options ) { options_ = options; }
+
+    // Runs `threads` workers on pool (clamped to its size); a null pool
+    // runs one worker inline.
+    bool solve( ParallelRrtStarResult& result, ThreadPool* pool = nullptr, unsigned threads = 1 )
+    {
+        using clock = std::chrono::steady_clock;
+
+        result = ParallelRrtStarResult();
+        threads = pool ? std::max( 1u, std::min( threads, pool->size() ) ) : 1;
+        if ( workers_.size() < threads )
+            workers_.resize( threads );
+        tree_.reset( dim_, options_.max_nodes );
+        goals_.assign( options_.max_nodes, 0 );
+        goal_count_.store( 0 );
+        iterations_.store( 0 );
+        stop_.store( false );
+        first_solution_ns_.store( -1 );
+        if ( !problem_.valid( problem_.start.data() ) || !problem_.valid( problem_.goal.data() ) )
+            return false;
+        tree_.insert( problem_.start.data(), ConcurrentTree::kNoParent, 0.0f );
+
+        gamma_ = optimal_radius_constant( problem_, options_.rewire_factor );
+
+        start_ = clock::now();
+        if ( pool && threads > 1 )
+            pool->run_chunks( threads, [this]( size_t w ) { work( static_cast<unsigned>( w ) ); } );
+        else
+            work( 0 );
+
+        for ( unsigned w = 0; w < threads; ++w )
+        {
+            result.state_checks += workers_[w].checks;
+            result.rewires += workers_[w].rewires;
+        }
+        result.iterations = std::min( iterations_.load(), options_.max_iterations ? options_.max_iterations : SIZE_MAX );
+        result.nodes = tree_.size();
+
+        // Stored costs may lag behind concurrent rewires, so rank goal
+        // nodes by their exact branch length.
+        size_t goals = std::min( goal_count_.load(), goals_.size() );
+        float best = std::numeric_limits<float>::infinity();
+        int64_t best_node = -1;
+        for ( size_t i = 0; i < goals; ++i )
+        {
+            float c = branch_length( goals_[i] );
+            if ( c < best )
+            {
+                best = c;
+                best_node = goals_[i];
+            }
+        }
+        if ( best_node < 0 )
+            return false;
+        result.solved = true;
+        result.cost = best;
+        result.first_solution_ms = first_solution_ns_.load() / 1e6;
+        for ( uint32_t n = static_cast<uint32_t>( best_node ); n != ConcurrentTree::kNoParent; n = tree_.parent( n ) )
+            result.path.insert( result.path.begin(), tree_.point( n ), tree_.point( n ) + dim_ );
+        return true;
+    }
+
+private:
+    struct Worker
+    {
+        std::mt19937 rng;
+        std::vector<float> q, from, x, other, step;
+        std::vector<uint32_t> near;
+        std::vector<std::pair<float, uint32_t>> candidates;
+        std::vector<uint32_t> stack;
+        size_t checks = 0;
+        size_t rewires = 0;
+    };
+
+    float branch_length( uint32_t n ) const
+    {
+        float c = 0.0f;
+        for ( uint32_t p = tree_.parent( n ); p != ConcurrentTree::kNoParent; n = p, p = tree_.parent( n ) )
+            c += tree_.distance( tree_.point( n ), tree_.point( p ) );
+        return c;
+    }
+
+    bool motion_valid( Worker& w, const float* a, const float* b )
+    {
+        return segment_valid( problem_, a, b, w.step.data(), w.checks );
+    }
+
+    void sample( Worker& w, float* q )
+    {
+        if ( std::uniform_real_distribution<float>( 0.0f, 1.0f )( w.rng ) < options_.goal_bias )
+        {
+            std::copy( problem_.goal.begin(), problem_.goal.end(), q );
+            return;
+        }
+        for ( int d = 0; d < dim_; ++d )
+            q[d] = std::uniform_real_distribution<float>( problem_.lower[d], problem_.upper[d] )( w.rng );
+    }
+
+    bool keep_going()
+    {
+        if ( stop_.load( std::memory_order_relaxed ) )
+            return false;
+        size_t i = iterations_.fetch_add( 1, std::memory_order_relaxed );
+        bool more = ( !options_.max_iterations || i < options_.max_iterations ) && tree_.size() < tree_.capacity();
+        if ( more && options_.time_limit_ms > 0 && i % 64 == 0 )
+            more = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start_ ).count() <
+                   options_.time_limit_ms;
+        if ( !more )
+            stop_.store( true, std::memory_order_relaxed );
+        return more;
+    }
+
+    void work( unsigned index )
+    {
+        Worker& w = workers_[index];
+        w.rng.seed( options_.seed + 7919u * index );
+        for ( auto* v : { &w.q, &w.from, &w.x, &w.other, &w.step } )
+            v->resize( dim_ );
+        w.checks = 0;
+        w.rewires = 0;
+        float* q = w.q.data();
+        float* x = w.x.data();
+
+        while ( keep_going() )
+        {
+            sample( w, q );
+            uint32_t n = tree_.nearest( q );
+            const float* from = tree_.point( n );
+            float len = tree_.distance( from, q );
+            float t = len > options_.step ? options_.step / len : 1.0f;
+            for ( int d = 0; d < dim_; ++d )
+                x[d] = from[d] + ( q[d] - from[d] ) * t;
+            if ( len <= 0.0f || !motion_valid( w, from, x ) )
+                continue;
+
+            double count = static_cast<double>( tree_.size() + 1 );
+            float radius = static_cast<float>(
+                std::min<double>( options_.step, gamma_ * std::pow( std::log( count ) / count, 1.0 / dim_ ) ) );
+            w.near.clear();
+            tree_.within( x, radius, w.near );
+
+            w.candidates.clear();
+            for ( uint32_t c : w.near )
+                w.candidates.emplace_back( tree_.cost( c ) + tree_.distance( tree_.point( c ), x ), c );
+            std::sort( w.candidates.begin(), w.candidates.end() );
+            uint32_t parent = n;
+            float cost = tree_.cost( n ) + tree_.distance( from, x );
+            for ( const auto& c : w.candidates )
+            {
+                if ( c.first >= cost )
+                    break;
+                if ( motion_valid( w, tree_.point( c.second ), x ) )
+                {
+                    parent = c.second;
+                    cost = c.first;
+                    break;
+                }
+            }
+            int32_t id = tree_.insert( x, parent, cost );
+            if ( id < 0 )
+                break;
+
+            for ( const auto& c : w.candidates )
+            {
+                uint32_t v = c.second;
+                if ( v == parent )
+                    continue;
+                float through = cost + tree_.distance( x, tree_.point( v ) );
+                if ( through >= tree_.cost( v ) )
+                    continue;
+                if ( motion_valid( w, x, tree_.point( v ) ) &&
+                     tree_.rewire( v, static_cast<uint32_t>( id ), through, w.stack ) )
+                    ++w.rewires;
+            }
+
+            if ( tree_.distance( x, problem_.goal.data() ) <= problem_.goal_tolerance )
+            {
+                size_t g = goal_count_.fetch_add( 1 );
+                if ( g < goals_.size() )
+                    goals_[g] = static_cast<uint32_t>( id );
+                int64_t expected = -1;
+                first_solution_ns_.compare_exchange_strong(
+                    expected, std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() -
+                                                                                     start_ )
+                                  .count() );
+            }
+        }
+    }
+
+    SamplingProblem problem_;
+    ParallelRrtStarOptions options_;
+    int dim_;
+    double gamma_ = 0.0;
+    ConcurrentTree tree_;
+    std::vector<Worker> workers_;
+    std::vector<uint32_t> goals_;
+    std::atomic<size_t> goal_count_{ 0 };
+    std::atomic<size_t> iterations_{ 0 };
+    std::atomic<bool> stop_{ false };
+    std::atomic<int64_t> first_solution_ns_{ -1 };
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace wra
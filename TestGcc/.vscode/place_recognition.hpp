@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "nearest_neighbors.hpp"
+#include "point_cloud.hpp"
+
+namespace wra
+{
+
+struct ScanContextOptions
+{
+    int rings = 20;                                  // radial bins out to max_range
+    int sectors = 60;                                // azimuth bins
+    double max_range = 80.0;                         // m; farther points are ignored
+    double sensor_height = 2.0;                      // m added to z so the floor reads positive
+    double shift_window = 0.1;                       // fraction of sectors searched around the sector-key alignment
+    int candidates = 10;                             // ring-key neighbours reranked per query
+    size_t exclude_recent = 50;                      // newest keyframes kept out of the index
+    // Largest descriptor distance proposed as a loop. Lower buys precision
+    // with recall, but only up to a point: where places look alike (the
+    // facility bench's aisles between near-identical racks) the wrong place
+    // often scores best, and its quick run goes from precision 0.33 and
+    // recall 0.74 at 0.3 through 0.39 / 0.60 at 0.2 to 0.56 / 0.20 at 0.1.
+    // No threshold makes a proposal a loop on its own.
+    double threshold = 0.2;
+    NearestIndexKind index = NearestIndexKind::Hnsw; // index over the ring keys
+    size_t capacity = 100000;                        // keyframes the database can hold
+};
+
+namespace detail
+{
+
+// Eight independent partial sums, so the reduction pipelines and
+// vectorises without reassociation flags.
+inline float dot( const float* a, const float* b, size_t n )
+{
+    float acc[8] = {};
+    size_t i = 0;
+    for ( ; i + 8 <= n; i += 8 )
+        for ( int l = 0; l < 8; ++l )
+            acc[l] += a[i + l] * b[i + l];
+    for ( ; i < n; ++i )
+        acc[0] += a[i] * b[i];
+    return ( ( acc[0] + acc[1] ) + ( acc[2] + acc[3] ) ) + ( ( acc[4] + acc[5] ) + ( acc[6] + acc[7] ) );
+}
+
+} // namespace detail
+
+// Scan Context (Kim & Kim, 2018): the highest point in each polar bin
+// around the sensor. Columns are sectors, so a yaw of the sensor is a
+// cyclic column shift; the ring key (mean per ring) does not change under
+// it and is what the database indexes.
+struct ScanContext
+{
+    std::vector<float> cells;      // sectors x rings, each sector contiguous
+    std::vector<float> unit;       // cells with every non-empty sector scaled to unit length
+    std::vector<uint8_t> occupied; // per sector: saw anything
+    std::vector<float> ring_key;   // mean height per ring
+    std::vector<float> sector_key; // mean height per sector
+};
+
+inline void make_scan_context( const PointCloud& cloud, const ScanContextOptions& options, ScanContext& out )
+{
+    const int R = options.rings, S = options.sectors;
+    out.cells.assign( size_t( R ) * S, 0.0f );
+    const float ring_scale = static_cast<float>( R / options.max_range );
+    const float sector_scale = static_cast<float>( S / ( 2.0 * kPi ) );
+    const float lift = static_cast<float>( options.sensor_height );
+    for ( size_t i = 0; i < cloud.size(); ++i )
+    {
+        float x = cloud.x[i], y = cloud.y[i];
+        int r = static_cast<int>( std::sqrt( x * x + y * y ) * ring_scale );
+        if ( r >= R )
+            continue;
+        int s = static_cast<int>( ( std::atan2( y, x ) + static_cast<float>( kPi ) ) * sector_scale );
+        float& cell = out.cells[size_t( std::min( s, S - 1 ) ) * R + r];
+        cell = std::max( cell, cloud.z[i] + lift );
+    }
+
+    out.unit.resize( out.cells.size() );
+    out.occupied.assign( S, 0 );
+    out.ring_key.assign( R, 0.0f );
+    out.sector_key.assign( S, 0.0f );
+    for ( int s = 0; s < S; ++s )
+    {
+        const float* column = &out.cells[size_t( s ) * R];
+        float sum = 0.0f, sq = 0.0f;
+        for ( int r = 0; r < R; ++r )
+        {
+            sum += column[r];
+            sq += column[r] * column[r];
+            out.ring_key[r] += column[r] / S;
+        }
+        out.occupied[s] = sq > 0.0f;
+        float inv = sq > 0.0f ? 1.0f / std::sqrt( sq ) : 0.0f;
+        for ( int r = 0; r < R; ++r )
+            out.unit[size_t( s ) * R + r] = column[r] * inv;
+        out.sector_key[s] = sum / R;
+    }
+}
+
+// Mean of 1 - cosine similarity over sector pairs that both saw something,
+// at the best cyclic shift of b. Only shifts within shift_window of the
+// sector-key alignment are scored. With shift set it receives the column
+// shift: sector j of a matches sector j + shift of b, i.e. a's heading is
+// shift * 2 pi / sectors to the left of b's.
+inline double scan_context_distance( const ScanContext& a, const ScanContext& b, const ScanContextOptions& options,
+                                     int* shift = nullptr )
+{
+    const int R = options.rings, S = options.sectors;
+    // Coarse yaw: the rotation of b's sector key that best matches a's,
+    // i.e. the largest cross-correlation since both norms are fixed.
+    int coarse = 0;
+    float coarse_score = -std::numeric_limits<float>::max();
+    for ( int k = 0; k < S; ++k )
+    {
+        float score = detail::dot( a.sector_key.data(), b.sector_key.data() + k, size_t( S - k ) ) +
+                      detail::dot( a.sector_key.data() + ( S - k ), b.sector_key.data(), size_t( k ) );
+        if ( score > coarse_score )
+        {
+            coarse_score = score;
+            coarse = k;
+        }
+    }
+
+    // Empty sectors are zero in unit, so the similarity at shift k is one
+    // dot product of a against b rotated by k sectors: two contiguous runs.
+    const int window = std::max( 1, static_cast<int>( std::lround( options.shift_window * S ) ) );
+    double best = 1.0;
+    int best_shift = coarse;
+    for ( int w = -window; w <= window; ++w )
+    {
+        const int k = ( ( coarse + w ) % S + S ) % S;
+        const size_t split = size_t( S - k ) * R;
+        float similarity = detail::dot( a.unit.data(), b.unit.data() + size_t( k ) * R, split ) +
+                           detail::dot( a.unit.data() + split, b.unit.data(), size_t( k ) * R );
+        int used = 0;
+        for ( int j = 0, jb = k; j < S; ++j, jb = jb + 1 == S ? 0 : jb + 1 )
+            used += a.occupied[j] & b.occupied[jb];
+        double d = used ? 1.0 - double( similarity ) / used : 1.0;
+        if ( d < best )
+        {
+            best = d;
+            best_shift = k;
+        }
+    }
+    if ( shift )
+        *shift = best_shift;
+    return best;
+}
+
+struct PlaceMatch
+{
+    bool proposed = false; // distance under the threshold; still to be verified
+    uint32_t id = 0;       // best keyframe, valid when candidates > 0
+    double distance = 1.0; // scan context distance to it
+    double yaw = 0.0;      // rad, query heading relative to the keyframe's
+    size_t candidates = 0; // ring-key neighbours reranked
+};
+
+// Keyframe descriptors with their ring keys in a nearest-neighbour index,
+// so loop candidates come from a sublinear lookup rather than a scan over
+// every past keyframe. Only the full descriptor distance of those few
+// candidates is computed. Keyframe ids count up from 0 in insertion order;
+// the newest exclude_recent are indexed only once later ones arrive, which
+// keeps the current trajectory from matching itself.
+class ScanContextDatabase
+{
+public:
+    explicit ScanContextDatabase( const ScanContextOptions& options = ScanContextOptions() ) : options_( options )
+    {
+        keys_.reset( options_.rings, options_.capacity );
+        index_ = make_nearest_index( options_.index, keys_ );
+    }
+
+    ScanContextDatabase( const ScanContextDatabase& ) = delete;
+    ScanContextDatabase& operator=( const ScanContextDatabase& ) = delete;
+
+    const ScanContextOptions& options() const { return options_; }
+    size_t size() const { return descriptors_.size(); }
+    // Keyframes currently searchable.
+    size_t indexed() const { return indexed_; }
+    const ScanContext& descriptor( uint32_t id ) const { return descriptors_[id]; }
+    const NearestNeighbors& index() const { return *index_; }
+
+    void clear()
+    {
+        descriptors_.clear();
+        keys_.clear();
+        index_->clear();
+        indexed_ = 0;
+    }
+
+    // Stores a keyframe as id size() - 1. False once capacity is reached.
+    bool add( const ScanContext& descriptor )
+    {
+        if ( keys_.full() )
+            return false;
+        descriptors_.push_back( descriptor );
+        keys_.push( descriptor.ring_key.data() );
+        for ( ; indexed_ + options_.exclude_recent < descriptors_.size(); ++indexed_ )
+            index_->add( static_cast<uint32_t>( indexed_ ) );
+        return true;
+    }
+
+    // Indexed keyframes with the closest ring keys, nearest first.
+    void candidates( const ScanContext& descriptor, std::vector<uint32_t>& out ) const
+    {
+        out.clear();
+        if ( indexed_ )
+            index_->nearest_k( descriptor.ring_key.data(), static_cast<size_t>( std::max( options_.candidates, 1 ) ), out );
+    }
+
+    // Reranks the candidates by full descriptor distance. Returns
+    // match.proposed. A proposal is a place that looks the same, not a
+    // loop: check it geometrically before closing one, e.g. align the two
+    // scans with ScanMatcher from match.yaw and gate on the correspondences
+    // and rmse.
+    bool query( const ScanContext& descriptor, PlaceMatch& match ) const
+    {
+        match = PlaceMatch();
+        candidates( descriptor, candidates_ );
+        match.candidates = candidates_.size();
+        int best_shift = 0;
+        for ( size_t i = 0; i < candidates_.size(); ++i )
+        {
+            int shift = 0;
+            double d = scan_context_distance( descriptor, descriptors_[candidates_[i]], options_, &shift );
+            if ( i == 0 || d < match.distance )
+            {
+                match.distance = d;
+                match.id = candidates_[i];
+                best_shift = shift;
+            }
+        }
+        if ( match.candidates )
+        {
+            double yaw = 2.0 * kPi * best_shift / options_.sectors;
+            match.yaw = yaw > kPi ? yaw - 2.0 * kPi : yaw;
+        }
+        match.proposed = match.candidates && match.distance < options_.threshold;
+        return match.proposed;
+    }
+
+private:
+    ScanContextOptions options_;
+    std::vector<ScanContext> descriptors_;
+    SoaStore keys_;
+    std::unique_ptr<NearestNeighbors> index_;
+    size_t indexed_ = 0;
+    mutable std::vector<uint32_t> candidates_;
+};
+
+} // namespace wra
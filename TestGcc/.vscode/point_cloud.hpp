@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+
+namespace wra
+{
+
+// Structure-of-arrays point cloud in float. intensity is carried along for
+// file round trips and ignored by the geometry code.
+struct PointCloud
+{
+    std::vector<float> x, y, z, intensity;
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        intensity.clear();
+    }
+
+    void reserve( size_t n )
+    {
+        x.reserve( n );
+        y.reserve( n );
+        z.reserve( n );
+        intensity.reserve( n );
+    }
+
+    void resize( size_t n )
+    {
+        x.resize( n );
+        y.resize( n );
+        z.resize( n );
+        intensity.resize( n );
+    }
+
+    void push_back( float px, float py, float pz, float pi = 0.0f )
+    {
+        x.push_back( px );
+        y.push_back( py );
+        z.push_back( pz );
+        intensity.push_back( pi );
+    }
+};
+
+// Reads a KITTI velodyne scan: packed float32 (x, y, z, intensity)
+// records. Returns false if the file cannot be read or is truncated.
+inline bool load_kitti_bin( const std::string& path, PointCloud& cloud )
+{
+    std::FILE* f = std::fopen( path.c_str(), "rb" );
+    if ( !f )
+        return false;
+    bool ok = std::fseek( f, 0, SEEK_END ) == 0;
+    long bytes = ok ? std::ftell( f ) : -1;
+    ok = ok && bytes >= 0 && bytes % 16 == 0 && std::fseek( f, 0, SEEK_SET ) == 0;
+    if ( ok )
+    {
+        size_t n = static_cast<size_t>( bytes ) / 16;
+        std::vector<float> raw( n * 4 );
+        ok = n == 0 || std::fread( raw.data(), 16, n, f ) == n;
+        cloud.resize( ok ? n : 0 );
+        for ( size_t i = 0; ok && i < n; ++i )
+        {
+            cloud.x[i] = raw[4 * i];
+            cloud.y[i] = raw[4 * i + 1];
+            cloud.z[i] = raw[4 * i + 2];
+            cloud.intensity[i] = raw[4 * i + 3];
+        }
+    }
+    std::fclose( f );
+    return ok;
+}
+
+inline bool save_kitti_bin( const std::string& path, const PointCloud& cloud )
+{
+    std::FILE* f = std::fopen( path.c_str(), "wb" );
+    if ( !f )
+        return false;
+    std::vector<float> raw( cloud.size() * 4 );
+    for ( size_t i = 0; i < cloud.size(); ++i )
+    {
+        raw[4 * i] = cloud.x[i];
+        raw[4 * i + 1] = cloud.y[i];
+        raw[4 * i + 2] = cloud.z[i];
+        raw[4 * i + 3] = cloud.intensity[i];
+    }
+    bool ok = raw.empty() || std::fwrite( raw.data(), 16, cloud.size(), f ) == cloud.size();
+    ok = std::fclose( f ) == 0 && ok;
+    return ok;
+}
+
+// Packs integer voxel coordinates (21 bits each, offset binary) into one
+// key; covers +-2^20 voxels per axis.
+inline uint64_t voxel_key( int ix, int iy, int iz )
+{
+    const uint64_t m = 0x1FFFFF;
+    return ( ( static_cast<uint64_t>( ix + ( 1 << 20 ) ) & m ) << 42 ) | ( ( static_cast<uint64_t>( iy + ( 1 << 20 ) ) & m ) << 21 ) |
+           ( static_cast<uint64_t>( iz + ( 1 << 20 ) ) & m );
+}
+
+inline uint64_t voxel_key( float x, float y, float z, float inv_size )
+{
+    return voxel_key( static_cast<int>( std::floor( x * inv_size ) ), static_cast<int>( std::floor( y * inv_size ) ),
+                      static_cast<int>( std::floor( z * inv_size ) ) );
+}
+
+// Mixes all three packed coordinates into the low bits that tables mask.
+inline size_t voxel_hash( uint64_t key )
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 29;
+    return static_cast<size_t>( key );
+}
+
+// Keeps the first point that falls in each voxel, as KISS-ICP does, so
+// output points are real measurements. The open-addressing table is
+// cleared by bumping a stamp, so repeated calls do not touch memory
+// proportional to its size.
+class VoxelDownsampler
+{
+public:
+    void apply( const PointCloud& in, double voxel, PointCloud& out )
+    {
+        size_t slots = 16;
+        while ( slots < 2 * in.size() )
+            slots <<= 1;
+        if ( slots > keys_.size() )
+        {
+            keys_.assign( slots, 0 );
+            stamps_.assign( slots, 0 );
+            stamp_ = 0;
+        }
+        ++stamp_;
+        const size_t mask = keys_.size() - 1;
+        const float inv = static_cast<float>( 1.0 / voxel );
+        out.clear();
+        for ( size_t i = 0; i < in.size(); ++i )
+        {
+            uint64_t key = voxel_key( in.x[i], in.y[i], in.z[i], inv );
+            for ( size_t s = voxel_hash( key ) & mask;; s = ( s + 1 ) & mask )
+            {
+                if ( stamps_[s] != stamp_ )
+                {
+                    stamps_[s] = stamp_;
+                    keys_[s] = key;
+                    out.push_back( in.x[i], in.y[i], in.z[i], in.intensity[i] );
+                    break;
+                }
+                if ( keys_[s] == key )
+                    break;
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> keys_;
+    std::vector<uint32_t> stamps_;
+    uint32_t stamp_ = 0;
+};
+
+// Applies a rigid transform to every point.
+inline void transform_cloud( const PointCloud& in, const Isometry3& T, PointCloud& out )
+{
+    out.resize( in.size() );
+    const Mat3& R = T.R;
+    for ( size_t i = 0; i < in.size(); ++i )
+    {
+        double x = in.x[i], y = in.y[i], z = in.z[i];
+        out.x[i] = static_cast<float>( R.m[0][0] * x + R.m[0][1] * y + R.m[0][2] * z + T.t.x );
+        out.y[i] = static_cast<float>( R.m[1][0] * x + R.m[1][1] * y + R.m[1][2] * z + T.t.y );
+        out.z[i] = static_cast<float>( R.m[2][0] * x + R.m[2][1] * y + R.m[2][2] * z + T.t.z );
+        out.intensity[i] = in.intensity[i];
+    }
+}
+
+} // namespace wra
@@ -0,0 +1,1403 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dense_cholesky.hpp"
+#include "geometry.hpp"
+
+namespace wra
+{
+
+// Lie group traits for the pose graph. A group provides the pose type, its
+// tangent dimension, retraction x (+) d and the relative-pose residual
+// e = z^-1 (+) (xi^-1 xj) with Jacobians w.r.t. the retraction of xi and
+// xj, plus g2o I/O.
+
+// SE(2) with the additive (x, y, theta) retraction.
+struct Se2
+{
+    static constexpr int dof = 3;
+    using Pose = Pose2D;
+
+    static double wrap( double a ) { return std::remainder( a, 2.0 * kPi ); }
+
+    static Pose retract( const Pose& x, const double* d )
+    {
+        Pose r;
+        r.x = x.x + d[0];
+        r.y = x.y + d[1];
+        r.theta = wrap( x.theta + d[2] );
+        return r;
+    }
+
+    static Pose compose( const Pose& a, const Pose& b )
+    {
+        double c = std::cos( a.theta ), s = std::sin( a.theta );
+        Pose r;
+        r.x = a.x + c * b.x - s * b.y;
+        r.y = a.y + s * b.x + c * b.y;
+        r.theta = wrap( a.theta + b.theta );
+        return r;
+    }
+
+    // a^-1 b
+    static Pose between( const Pose& a, const Pose& b )
+    {
+        double c = std::cos( a.theta ), s = std::sin( a.theta ), dx = b.x - a.x, dy = b.y - a.y;
+        Pose r;
+        r.x = c * dx + s * dy;
+        r.y = -s * dx + c * dy;
+        r.theta = wrap( b.theta - a.theta );
+        return r;
+    }
+
+    // Ji and Jj may be null.
+    static void error( const Pose& xi, const Pose& xj, const Pose& z, double* e, double ( *Ji )[dof], double ( *Jj )[dof] )
+    {
+        double ci = std::cos( xi.theta ), si = std::sin( xi.theta ), cz = std::cos( z.theta ), sz = std::sin( z.theta );
+        double dx = xj.x - xi.x, dy = xj.y - xi.y;
+        double ax = ci * dx + si * dy, ay = -si * dx + ci * dy;
+        e[0] = cz * ( ax - z.x ) + sz * ( ay - z.y );
+        e[1] = -sz * ( ax - z.x ) + cz * ( ay - z.y );
+        e[2] = wrap( xj.theta - xi.theta - z.theta );
+        if ( !Ji )
+            return;
+        // Rz^T Ri^T and Rz^T dRi^T/dtheta (xj - xi).
+        double m[2][2] = { { cz * ci - sz * si, cz * si + sz * ci }, { -sz * ci - cz * si, -sz * si + cz * ci } };
+        double dax = -si * dx + ci * dy, day = -ci * dx - si * dy;
+        double g[2] = { cz * dax + sz * day, -sz * dax + cz * day };
+        for ( int r = 0; r < 2; ++r )
+        {
+            Ji[r][0] = -m[r][0];
+            Ji[r][1] = -m[r][1];
+            Ji[r][2] = g[r];
+            Jj[r][0] = m[r][0];
+            Jj[r][1] = m[r][1];
+            Jj[r][2] = 0.0;
+        }
+        Ji[2][0] = Ji[2][1] = Jj[2][0] = Jj[2][1] = 0.0;
+        Ji[2][2] = -1.0;
+        Jj[2][2] = 1.0;
+    }
+
+    static const char* vertex_tag() { return "VERTEX_SE2"; }
+    static const char* edge_tag() { return "EDGE_SE2"; }
+    static constexpr int pose_fields = 3;
+    static constexpr int information_fields = 6;
+
+    static Pose pose_from_fields( const double* f )
+    {
+        Pose p;
+        p.x = f[0];
+        p.y = f[1];
+        p.theta = f[2];
+        return p;
+    }
+
+    static void fields_from_pose( const Pose& p, double* f )
+    {
+        f[0] = p.x;
+        f[1] = p.y;
+        f[2] = p.theta;
+    }
+
+    // g2o stores the upper triangle row-major in the residual order used
+    // here.
+    static void information_from_fields( const double* f, double ( &info )[dof][dof] )
+    {
+        for ( int r = 0, k = 0; r < dof; ++r )
+            for ( int c = r; c < dof; ++c, ++k )
+                info[r][c] = info[c][r] = f[k];
+    }
+
+    static void fields_from_information( const double ( &info )[dof][dof], double* f )
+    {
+        for ( int r = 0, k = 0; r < dof; ++r )
+            for ( int c = r; c < dof; ++c, ++k )
+                f[k] = info[r][c];
+    }
+};
+
+// SE(3) with tangent (v, w): translation added in the world frame,
+// rotation composed on the right, R <- R exp(w). The residual is
+// (Rz^T (Ri^T (tj - ti) - tz), log(Rz^T Ri^T Rj)).
+struct Se3
+{
+    static constexpr int dof = 6;
+    using Pose = Isometry3;
+
+    static Mat3 exp( const Vec3& w )
+    {
+        double angle = norm( w );
+        if ( angle < 1e-12 )
+            return Mat3::identity() + skew( w );
+        return axis_angle( w / angle, angle );
+    }
+
+    // Inverse of the right Jacobian of SO(3).
+    static Mat3 right_jacobian_inverse( const Vec3& phi )
+    {
+        double t = norm( phi );
+        Mat3 K = skew( phi );
+        double c = t < 1e-4 ? 1.0 / 12.0 + t * t / 720.0 : 1.0 / ( t * t ) - ( 1.0 + std::cos( t ) ) / ( 2.0 * t * std::sin( t ) );
+        return Mat3::identity() + K * 0.5 + K * K * c;
+    }
+
+    static Pose retract( const Pose& x, const double* d )
+    {
+        return Pose( x.R * exp( Vec3( d[3], d[4], d[5] ) ), x.t + Vec3( d[0], d[1], d[2] ) );
+    }
+
+    static Pose compose( const Pose& a, const Pose& b ) { return a * b; }
+    static Pose between( const Pose& a, const Pose& b ) { return a.inverse() * b; }
+
+    static void error( const Pose& xi, const Pose& xj, const Pose& z, double* e, double ( *Ji )[dof], double ( *Jj )[dof] )
+    {
+        Mat3 RiT = xi.R.transposed(), RzT = z.R.transposed();
+        Vec3 a = RiT * ( xj.t - xi.t );
+        Vec3 et = RzT * ( a - z.t );
+        Mat3 E = RzT * RiT * xj.R;
+        Vec3 er = rotation_log( E );
+        for ( int k = 0; k < 3; ++k )
+        {
+            e[k] = et[k];
+            e[3 + k] = er[k];
+        }
+        if ( !Ji )
+            return;
+        Mat3 A = RzT * RiT;
+        Mat3 B = RzT * skew( a );
+        Mat3 Jr = right_jacobian_inverse( er );
+        Mat3 C = Jr * ( xj.R.transposed() * xi.R ) * -1.0;
+        for ( int r = 0; r < 3; ++r )
+            for ( int c = 0; c < 3; ++c )
+            {
+                Ji[r][c] = -A( r, c );
+                Ji[r][3 + c] = B( r, c );
+                Ji[3 + r][c] = 0.0;
+                Ji[3 + r][3 + c] = C( r, c );
+                Jj[r][c] = A( r, c );
+                Jj[r][3 + c] = 0.0;
+                Jj[3 + r][c] = 0.0;
+                Jj[3 + r][3 + c] = Jr( r, c );
+            }
+    }
+
+    static const char* vertex_tag() { return "VERTEX_SE3:QUAT"; }
+    static const char* edge_tag() { return "EDGE_SE3:QUAT"; }
+    static constexpr int pose_fields = 7;
+    static constexpr int information_fields = 21;
+
+    // x y z qx qy qz qw
+    static Pose pose_from_fields( const double* f )
+    {
+        double qx = f[3], qy = f[4], qz = f[5], qw = f[6];
+        double n = std::sqrt( qx * qx + qy * qy + qz * qz + qw * qw );
+        qx /= n, qy /= n, qz /= n, qw /= n;
+        Mat3 R;
+        R.m[0][0] = 1 - 2 * ( qy * qy + qz * qz );
+        R.m[0][1] = 2 * ( qx * qy - qz * qw );
+        R.m[0][2] = 2 * ( qx * qz + qy * qw );
+        R.m[1][0] = 2 * ( qx * qy + qz * qw );
+        R.m[1][1] = 1 - 2 * ( qx * qx + qz * qz );
+        R.m[1][2] = 2 * ( qy * qz - qx * qw );
+        R.m[2][0] = 2 * ( qx * qz - qy * qw );
+        R.m[2][1] = 2 * ( qy * qz + qx * qw );
+        R.m[2][2] = 1 - 2 * ( qx * qx + qy * qy );
+        return Pose( R, Vec3( f[0], f[1], f[2] ) );
+    }
+
+    static void fields_from_pose( const Pose& p, double* f )
+    {
+        const Mat3& R = p.R;
+        double tr = R( 0, 0 ) + R( 1, 1 ) + R( 2, 2 ), q[4];
+        if ( tr > 0.0 )
+        {
+            double s = 2.0 * std::sqrt( tr + 1.0 );
+            q[3] = 0.25 * s;
+            q[0] = ( R( 2, 1 ) - R( 1, 2 ) ) / s;
+            q[1] = ( R( 0, 2 ) - R( 2, 0 ) ) / s;
+            q[2] = ( R( 1, 0 ) - R( 0, 1 ) ) / s;
+        }
+        else
+        {
+            int i = R( 0, 0 ) >= R( 1, 1 ) && R( 0, 0 ) >= R( 2, 2 ) ? 0 : R( 1, 1 ) >= R( 2, 2 ) ? 1 : 2;
+            int j = ( i + 1 ) % 3, k = ( i + 2 ) % 3;
+            double s = 2.0 * std::sqrt( 1.0 + R( i, i ) - R( j, j ) - R( k, k ) );
+            q[i] = 0.25 * s;
+            q[3] = ( R( k, j ) - R( j, k ) ) / s;
+            q[j] = ( R( j, i ) + R( i, j ) ) / s;
+            q[k] = ( R( k, i ) + R( i, k ) ) / s;
+        }
+        f[0] = p.t.x;
+        f[1] = p.t.y;
+        f[2] = p.t.z;
+        for ( int a = 0; a < 4; ++a )
+            f[3 + a] = q[a];
+    }
+
+    // g2o's rotation residual is the quaternion vector part, half the
+    // rotation vector used here, so the rotation rows and columns of the
+    // information are scaled by 1/2 on the way in.
+    static void information_from_fields( const double* f, double ( &info )[dof][dof] )
+    {
+        for ( int r = 0, k = 0; r < dof; ++r )
+            for ( int c = r; c < dof; ++c, ++k )
+            {
+                double s = ( r < 3 ? 1.0 : 0.5 ) * ( c < 3 ? 1.0 : 0.5 );
+                info[r][c] = info[c][r] = f[k] * s;
+            }
+    }
+
+    static void fields_from_information( const double ( &info )[dof][dof], double* f )
+    {
+        for ( int r = 0, k = 0; r < dof; ++r )
+            for ( int c = r; c < dof; ++c, ++k )
+                f[k] = info[r][c] * ( r < 3 ? 1.0 : 2.0 ) * ( c < 3 ? 1.0 : 2.0 );
+    }
+};
+
+template <typename Group>
+class PoseGraph
+{
+public:
+    static constexpr int D = Group::dof;
+    using Pose = typename Group::Pose;
+
+    struct Edge
+    {
+        uint32_t i = 0;
+        uint32_t j = 0;
+        Pose z;
+        double info[D][D] = {};
+    };
+
+    uint32_t add_vertex( const Pose& p )
+    {
+        poses_.push_back( p );
+        return static_cast<uint32_t>( poses_.size() - 1 );
+    }
+
+    void add_edge( const Edge& e ) { edges_.push_back( e ); }
+
+    void add_edge( uint32_t i, uint32_t j, const Pose& z, const double ( &info )[D][D] )
+    {
+        Edge e;
+        e.i = i;
+        e.j = j;
+        e.z = z;
+        std::memcpy( e.info, info, sizeof( info ) );
+        edges_.push_back( e );
+    }
+
+    void clear()
+    {
+        poses_.clear();
+        edges_.clear();
+    }
+
+    size_t vertices() const { return poses_.size(); }
+    const Pose& pose( size_t i ) const { return poses_[i]; }
+    Pose& pose( size_t i ) { return poses_[i]; }
+    const std::vector<Edge>& edges() const { return edges_; }
+
+    // Sum of e^T Omega e over all edges.
+    double chi2() const
+    {
+        return chi2( [this]( uint32_t v ) { return poses_[v]; } );
+    }
+
+    template <typename Poses>
+    double chi2( const Poses& poses ) const
+    {
+        double total = 0.0;
+        for ( const Edge& e : edges_ )
+        {
+            double r[D];
+            Group::error( poses( e.i ), poses( e.j ), e.z, r, nullptr, nullptr );
+            for ( int a = 0; a < D; ++a )
+                for ( int b = 0; b < D; ++b )
+                    total += r[a] * e.info[a][b] * r[b];
+        }
+        return total;
+    }
+
+private:
+    std::vector<Pose> poses_;
+    std::vector<Edge> edges_;
+};
+
+namespace detail
+{
+
+inline bool read_fields( const char*& s, double* out, int n )
+{
+    for ( int k = 0; k < n; ++k )
+    {
+        char* end = nullptr;
+        out[k] = std::strtod( s, &end );
+        if ( end == s )
+            return false;
+        s = end;
+    }
+    return true;
+}
+
+inline bool read_id( const char*& s, long& id )
+{
+    char* end = nullptr;
+    id = std::strtol( s, &end, 10 );
+    if ( end == s )
+        return false;
+    s = end;
+    return true;
+}
+
+} // namespace detail
+
+// Reads the vertices and edges of Group from a g2o file; other lines are
+// skipped. Vertex ids are mapped to indices in order of appearance, and
+// edges must come after both of their vertices. Returns false on I/O or
+// parse errors.
+template <typename Group>
+bool load_g2o( const std::string& path, PoseGraph<Group>& graph )
+{
+    std::FILE* f = std::fopen( path.c_str(), "r" );
+    if ( !f )
+        return false;
+    graph.clear();
+    std::unordered_map<long, uint32_t> index;
+    const std::string vertex = Group::vertex_tag(), edge = Group::edge_tag();
+    char line[1024];
+    bool ok = true;
+    while ( ok && std::fgets( line, sizeof( line ), f ) )
+    {
+        const char* s = line;
+        while ( *s == ' ' || *s == '\t' )
+            ++s;
+        size_t len = std::strcspn( s, " \t\r\n" );
+        std::string tag( s, len );
+        s += len;
+        double fields[Group::pose_fields + Group::information_fields];
+        long a = 0, b = 0;
+        if ( tag == vertex )
+        {
+            ok = detail::read_id( s, a ) && detail::read_fields( s, fields, Group::pose_fields );
+            if ( ok && !index.count( a ) )
+                index[a] = graph.add_vertex( Group::pose_from_fields( fields ) );
+        }
+        else if ( tag == edge )
+        {
+            ok = detail::read_id( s, a ) && detail::read_id( s, b ) &&
+                 detail::read_fields( s, fields, Group::pose_fields + Group::information_fields ) && index.count( a ) && index.count( b );
+            if ( ok )
+            {
+                typename PoseGraph<Group>::Edge e;
+                e.i = index[a];
+                e.j = index[b];
+                e.z = Group::pose_from_fields( fields );
+                Group::information_from_fields( fields + Group::pose_fields, e.info );
+                graph.add_edge( e );
+            }
+        }
+    }
+    std::fclose( f );
+    return ok;
+}
+
+template <typename Group>
+bool save_g2o( const std::string& path, const PoseGraph<Group>& graph )
+{
+    std::FILE* f = std::fopen( path.c_str(), "w" );
+    if ( !f )
+        return false;
+    double fields[Group::pose_fields + Group::information_fields];
+    auto put = [&]( int n ) {
+        for ( int k = 0; k < n; ++k )
+            std::fprintf( f, " %.17g", fields[k] );
+        std::fputc( '\n', f );
+    };
+    for ( size_t v = 0; v < graph.vertices(); ++v )
+    {
+        std::fprintf( f, "%s %zu", Group::vertex_tag(), v );
+        Group::fields_from_pose( graph.pose( v ), fields );
+        put( Group::pose_fields );
+    }
+    for ( const auto& e : graph.edges() )
+    {
+        std::fprintf( f, "%s %u %u", Group::edge_tag(), e.i, e.j );
+        Group::fields_from_pose( e.z, fields );
+        Group::fields_from_information( e.info, fields + Group::pose_fields );
+        put( Group::pose_fields + Group::information_fields );
+    }
+    return std::fclose( f ) == 0;
+}
+
+// Minimum degree elimination order of an undirected graph given as
+// adjacency lists. The elimination graph is kept explicitly, which is
+// exact rather than AMD's approximate degrees but cheap at pose-graph
+// sparsity; ties go to the lower index so the order is deterministic.
+// Nodes flagged in last are held back until every other node is gone.
+inline std::vector<uint32_t> minimum_degree_ordering( std::vector<std::vector<uint32_t>> adj, const std::vector<uint8_t>* last = nullptr )
+{
+    const size_t n = adj.size();
+    for ( auto& a : adj )
+    {
+        std::sort( a.begin(), a.end() );
+        a.erase( std::unique( a.begin(), a.end() ), a.end() );
+    }
+    auto key = [&]( uint32_t v ) { return adj[v].size() + ( last && ( *last )[v] ? n : 0 ); };
+    using Entry = std::pair<size_t, uint32_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    for ( uint32_t v = 0; v < n; ++v )
+        heap.push( { key( v ), v } );
+    std::vector<uint8_t> done( n, 0 );
+    std::vector<uint32_t> order, merged;
+    order.reserve( n );
+    while ( !heap.empty() )
+    {
+        Entry top = heap.top();
+        heap.pop();
+        uint32_t v = top.second;
+        if ( done[v] || top.first != key( v ) )
+            continue;
+        done[v] = 1;
+        order.push_back( v );
+        const std::vector<uint32_t>& nv = adj[v];
+        // The remaining neighbours of v become a clique.
+        for ( uint32_t u : nv )
+        {
+            merged.clear();
+            std::set_union( adj[u].begin(), adj[u].end(), nv.begin(), nv.end(), std::back_inserter( merged ) );
+            merged.erase( std::remove_if( merged.begin(), merged.end(), [&]( uint32_t w ) { return w == u || w == v; } ), merged.end() );
+            adj[u].swap( merged );
+            heap.push( { key( u ), u } );
+        }
+        std::vector<uint32_t>().swap( adj[v] );
+    }
+    return order;
+}
+
+// Sparse Cholesky L L^T = A of a symmetric matrix of D x D blocks, kept up
+// to date as A changes, in the manner of iSAM2 but on plain factor columns
+// rather than a Bayes tree. A and the right-hand side are accumulated in
+// place and each touched column is marked. update() then re-eliminates the
+// affected part of the factor: the touched columns and all their
+// elimination-tree ancestors. That set is closed upwards, so it can be
+// moved to the end of the order and reordered by minimum degree, touched
+// columns last, without invalidating any other column; the columns below
+// only need the affected rows of their pattern re-sorted. What a subtree
+// below contributes to the affected rows is summed once at its root (an
+// orphan, in Bayes tree terms) and cached there until that root is
+// re-eliminated, so repeated loop closures in one area do not re-read the
+// whole factor. Back substitution starts from the re-eliminated columns and
+// spreads to columns further down only while the solution moves by more
+// than a threshold (wildfire). A first call with every column touched is a
+// batch factorisation.
+template <int D>
+class SparseBlockCholesky
+{
+public:
+    static constexpr int kBlock = D * D;
+
+    size_t columns() const { return rows_.size(); }
+    size_t refactored() const { return refactored_; }
+    size_t back_substituted() const { return back_substituted_; }
+    // Blocks held in subtree contribution caches.
+    size_t cached_blocks() const { return cached_blocks_; }
+
+    // Block count of L, diagonal included.
+    size_t factor_blocks() const
+    {
+        size_t n = 0;
+        for ( const auto& r : rows_ )
+            n += r.size() + 1;
+        return n;
+    }
+
+    void clear()
+    {
+        a_rows_.clear();
+        a_vals_.clear();
+        rhs_.clear();
+        pos_.clear();
+        rows_.clear();
+        vals_.clear();
+        rowlist_.clear();
+        children_.clear();
+        cache_.clear();
+        cache_rhs_.clear();
+        cache_valid_.clear();
+        row_orphans_.clear();
+        row_affected_.clear();
+        orphan_of_.clear();
+        y_.clear();
+        x_.clear();
+        touched_.clear();
+        touched_flag_.clear();
+        affected_mark_.clear();
+        seen_mark_.clear();
+        seen_tick_.clear();
+        slot_.clear();
+        next_pos_ = 0;
+        stamp_ = 0;
+        tick_ = 0;
+        cached_blocks_ = 0;
+    }
+
+    // Adds a column at the end of the order.
+    uint32_t append_column()
+    {
+        uint32_t c = static_cast<uint32_t>( rows_.size() );
+        a_rows_.emplace_back();
+        a_vals_.emplace_back( kBlock, 0.0 );
+        rhs_.insert( rhs_.end(), D, 0.0 );
+        pos_.push_back( next_pos_++ );
+        rows_.emplace_back();
+        vals_.emplace_back( kBlock, 0.0 );
+        rowlist_.emplace_back();
+        children_.emplace_back();
+        cache_.emplace_back();
+        cache_rhs_.emplace_back();
+        cache_valid_.push_back( 0 );
+        row_orphans_.emplace_back();
+        row_affected_.emplace_back();
+        orphan_of_.push_back( { 0, 0 } );
+        y_.insert( y_.end(), D, 0.0 );
+        x_.insert( x_.end(), D, 0.0 );
+        touched_flag_.push_back( 0 );
+        affected_mark_.push_back( 0 );
+        seen_mark_.push_back( 0 );
+        seen_tick_.push_back( 0 );
+        slot_.push_back( 0 );
+        touch( c );
+        return c;
+    }
+
+    // A(r, c) += scale * blk, with blk row-major; A(c, r) follows by
+    // symmetry.
+    void add_hessian( uint32_t r, uint32_t c, const double* blk, double scale = 1.0 )
+    {
+        if ( r == c )
+        {
+            double* dst = a_vals_[c].data();
+            for ( int k = 0; k < kBlock; ++k )
+                dst[k] += scale * blk[k];
+        }
+        else
+        {
+            double* rc = a_block( r, c );
+            double* cr = a_block( c, r );
+            for ( int i = 0; i < D; ++i )
+                for ( int j = 0; j < D; ++j )
+                {
+                    rc[i * D + j] += scale * blk[i * D + j];
+                    cr[j * D + i] += scale * blk[i * D + j];
+                }
+            touch( r );
+        }
+        touch( c );
+    }
+
+    void add_rhs( uint32_t c, const double* g, double scale = 1.0 )
+    {
+        for ( int k = 0; k < D; ++k )
+            rhs_[c * D + k] += scale * g[k];
+        touch( c );
+    }
+
+    void touch( uint32_t c )
+    {
+        if ( !touched_flag_[c] )
+        {
+            touched_flag_[c] = 1;
+            touched_.push_back( c );
+        }
+    }
+
+    // Solution block of column c.
+    const double* solution( uint32_t c ) const { return x_.data() + c * D; }
+
+    // Re-eliminates and re-solves as described above; reorder = false keeps
+    // the affected columns in index order. Columns whose solution changed
+    // are appended to changed. Returns false if A is not positive definite
+    // on the re-eliminated part; the factor is then unusable until the
+    // offending entries are fixed and touched again.
+    bool update( double wildfire, std::vector<uint32_t>* changed = nullptr, bool reorder = true )
+    {
+        refactored_ = back_substituted_ = 0;
+        if ( touched_.empty() )
+            return true;
+        collect_affected();
+        order_affected( reorder );
+        cache_orphans();
+        bool ok = true;
+        for ( uint32_t j : affected_ )
+        {
+            symbolic( j );
+            ok = numeric( j ) && ok;
+            forward_solve( j );
+            back_.push( { pos_[j], j } );
+        }
+        refactored_ = affected_.size();
+        for ( uint32_t c : touched_ )
+            touched_flag_[c] = 0;
+        touched_.clear();
+
+        // affected_mark_ doubles as the back substitution queue flag.
+        while ( !back_.empty() )
+        {
+            uint32_t j = back_.top().second;
+            back_.pop();
+            affected_mark_[j] = 0;
+            ++back_substituted_;
+            double moved = back_solve( j );
+            if ( moved > 0.0 && changed )
+                changed->push_back( j );
+            if ( moved > wildfire )
+                for ( uint32_t k : rowlist_[j] )
+                    if ( affected_mark_[k] != stamp_ )
+                    {
+                        affected_mark_[k] = stamp_;
+                        back_.push( { pos_[k], k } );
+                    }
+        }
+        return ok;
+    }
+
+private:
+    // Block A(r, c) in column c, created on first use.
+    double* a_block( uint32_t r, uint32_t c )
+    {
+        std::vector<uint32_t>& ar = a_rows_[c];
+        size_t k = std::find( ar.begin(), ar.end(), r ) - ar.begin();
+        if ( k == ar.size() )
+        {
+            ar.push_back( r );
+            a_vals_[c].resize( ( k + 2 ) * kBlock, 0.0 );
+        }
+        return a_vals_[c].data() + ( k + 1 ) * kBlock;
+    }
+
+    bool before( uint32_t a, uint32_t b ) const { return pos_[a] < pos_[b]; }
+
+    size_t find_row( uint32_t k, uint32_t r ) const
+    {
+        const std::vector<uint32_t>& R = rows_[k];
+        return std::lower_bound( R.begin(), R.end(), r, [this]( uint32_t a, uint32_t b ) { return before( a, b ); } ) - R.begin();
+    }
+
+    // Packed lower triangle index of block (a, b), a >= b.
+    static size_t tri( size_t a, size_t b ) { return a * ( a + 1 ) / 2 + b; }
+
+    void drop_cache( uint32_t k )
+    {
+        if ( !cache_valid_[k] )
+            return;
+        cached_blocks_ -= cache_[k].size() / kBlock;
+        std::vector<double>().swap( cache_[k] );
+        std::vector<double>().swap( cache_rhs_[k] );
+        cache_valid_[k] = 0;
+    }
+
+    // The touched columns and their ancestors, detached from the factor,
+    // plus the boundary: untouched columns with blocks in affected rows.
+    void collect_affected()
+    {
+        ++stamp_;
+        affected_.clear();
+        for ( uint32_t v : touched_ )
+            for ( uint32_t u = v; affected_mark_[u] != stamp_; u = rows_[u][0] )
+            {
+                affected_mark_[u] = stamp_;
+                affected_.push_back( u );
+                if ( rows_[u].empty() )
+                    break;
+            }
+        // Rows of an affected column are its ancestors, so they are affected
+        // too and every reference to it sits in an affected row list.
+        boundary_.clear();
+        for ( uint32_t s : affected_ )
+        {
+            std::vector<uint32_t>& rl = rowlist_[s];
+            rl.erase( std::remove_if( rl.begin(), rl.end(), [this]( uint32_t k ) { return affected_mark_[k] == stamp_; } ), rl.end() );
+            for ( uint32_t k : rl )
+                if ( seen_mark_[k] != stamp_ )
+                {
+                    seen_mark_[k] = stamp_;
+                    boundary_.push_back( k );
+                }
+            children_[s].clear();
+            row_orphans_[s].clear();
+            row_affected_[s].clear();
+            drop_cache( s );
+        }
+        orphans_.clear();
+        for ( uint32_t k : boundary_ )
+            if ( affected_mark_[rows_[k][0]] == stamp_ )
+                orphans_.push_back( k );
+    }
+
+    // Assigns new positions after every existing one and sorts affected_
+    // into elimination order, then restores the row order of the boundary.
+    void order_affected( bool reorder )
+    {
+        const size_t m = affected_.size();
+        std::vector<uint32_t> order;
+        if ( reorder )
+        {
+            for ( size_t i = 0; i < m; ++i )
+                slot_[affected_[i]] = static_cast<uint32_t>( i );
+            // Minimum degree on the affected part of A plus the clique each
+            // orphan's pattern leaves behind.
+            std::vector<std::vector<uint32_t>> adj( m );
+            std::vector<uint8_t> last( m );
+            for ( size_t i = 0; i < m; ++i )
+            {
+                uint32_t s = affected_[i];
+                last[i] = touched_flag_[s];
+                for ( uint32_t r : a_rows_[s] )
+                    if ( affected_mark_[r] == stamp_ )
+                        adj[i].push_back( slot_[r] );
+            }
+            for ( uint32_t k : orphans_ )
+            {
+                const std::vector<uint32_t>& R = rows_[k];
+                for ( uint32_t a : R )
+                    for ( uint32_t b : R )
+                        if ( a != b )
+                            adj[slot_[a]].push_back( slot_[b] );
+            }
+            order = minimum_degree_ordering( std::move( adj ), &last );
+        }
+        else
+        {
+            std::sort( affected_.begin(), affected_.end() );
+            for ( uint32_t i = 0; i < m; ++i )
+                order.push_back( i );
+        }
+        sorted_.resize( m );
+        for ( size_t i = 0; i < m; ++i )
+        {
+            sorted_[i] = affected_[order[i]];
+            pos_[sorted_[i]] = next_pos_++;
+        }
+        affected_.swap( sorted_ );
+        for ( uint32_t s : affected_ )
+            rows_[s].clear();
+
+        // Affected rows are a suffix of each boundary pattern and only their
+        // relative order changed.
+        for ( uint32_t k : boundary_ )
+        {
+            std::vector<uint32_t>& R = rows_[k];
+            size_t f = 0;
+            while ( affected_mark_[R[f]] != stamp_ )
+                ++f;
+            perm_.clear();
+            for ( size_t t = f; t < R.size(); ++t )
+                perm_.push_back( static_cast<uint32_t>( t ) );
+            std::sort( perm_.begin(), perm_.end(), [&]( uint32_t a, uint32_t b ) { return before( R[a], R[b] ); } );
+            scratch_rows_.assign( R.begin() + f, R.end() );
+            scratch_vals_.assign( vals_[k].begin() + ( f + 1 ) * kBlock, vals_[k].end() );
+            for ( size_t t = 0; t < perm_.size(); ++t )
+            {
+                R[f + t] = scratch_rows_[perm_[t] - f];
+                std::copy_n( scratch_vals_.begin() + ( perm_[t] - f ) * kBlock, kBlock, vals_[k].begin() + ( f + 1 + t ) * kBlock );
+            }
+            if ( cache_valid_[k] )
+                permute_cache( k, f );
+            if ( f == 0 )
+                children_[R[0]].push_back( k );
+        }
+        for ( uint32_t o : orphans_ )
+            for ( uint32_t r : rows_[o] )
+                row_orphans_[r].push_back( o );
+    }
+
+    // Applies the suffix permutation in perm_ (old indices from f on) to
+    // column k's cache.
+    void permute_cache( uint32_t k, size_t f )
+    {
+        const size_t n = rows_[k].size();
+        std::vector<uint32_t> p( n );
+        for ( size_t t = 0; t < n; ++t )
+            p[t] = static_cast<uint32_t>( t < f ? t : perm_[t - f] );
+        scratch_vals_.assign( cache_[k].begin(), cache_[k].end() );
+        for ( size_t a = 0; a < n; ++a )
+            for ( size_t b = 0; b <= a; ++b )
+            {
+                double* dst = cache_[k].data() + tri( a, b ) * kBlock;
+                if ( p[a] >= p[b] )
+                    std::copy_n( scratch_vals_.begin() + tri( p[a], p[b] ) * kBlock, kBlock, dst );
+                else
+                {
+                    const double* src = scratch_vals_.data() + tri( p[b], p[a] ) * kBlock;
+                    for ( int i = 0; i < D; ++i )
+                        for ( int j = 0; j < D; ++j )
+                            dst[i * D + j] = src[j * D + i];
+                }
+            }
+        scratch_vals_.assign( cache_rhs_[k].begin(), cache_rhs_[k].end() );
+        for ( size_t a = 0; a < n; ++a )
+            std::copy_n( scratch_vals_.begin() + p[a] * D, D, cache_rhs_[k].begin() + a * D );
+    }
+
+    // Orphan whose subtree holds boundary column k.
+    uint32_t orphan_of( uint32_t k )
+    {
+        path_.clear();
+        uint32_t u = k;
+        while ( orphan_of_[u].first != stamp_ && affected_mark_[rows_[u][0]] != stamp_ )
+        {
+            path_.push_back( u );
+            u = rows_[u][0];
+        }
+        uint32_t o = orphan_of_[u].first == stamp_ ? orphan_of_[u].second : u;
+        orphan_of_[u] = { stamp_, o };
+        for ( uint32_t v : path_ )
+            orphan_of_[v] = { stamp_, o };
+        return o;
+    }
+
+    // Fills the cache of every orphan that lacks one with
+    // sum_k L_ak L_bk^T and sum_k L_ak y_k over the columns k of its subtree,
+    // for a, b in the orphan's pattern.
+    void cache_orphans()
+    {
+        pairs_.clear();
+        for ( uint32_t k : boundary_ )
+        {
+            uint32_t o = orphan_of( k );
+            if ( !cache_valid_[o] )
+                pairs_.push_back( { o, k } );
+        }
+        std::sort( pairs_.begin(), pairs_.end() );
+        for ( size_t g = 0; g < pairs_.size(); )
+        {
+            const uint32_t o = pairs_[g].first;
+            const std::vector<uint32_t>& Ro = rows_[o];
+            for ( size_t t = 0; t < Ro.size(); ++t )
+                slot_[Ro[t]] = static_cast<uint32_t>( t );
+            cache_[o].assign( tri( Ro.size(), 0 ) * kBlock, 0.0 );
+            cache_rhs_[o].assign( Ro.size() * D, 0.0 );
+            cache_valid_[o] = 1;
+            cached_blocks_ += tri( Ro.size(), 0 );
+            for ( ; g < pairs_.size() && pairs_[g].first == o; ++g )
+            {
+                const uint32_t k = pairs_[g].second;
+                const std::vector<uint32_t>& R = rows_[k];
+                size_t f = 0;
+                while ( affected_mark_[R[f]] != stamp_ )
+                    ++f;
+                for ( size_t a = f; a < R.size(); ++a )
+                {
+                    const double* La = vals_[k].data() + ( a + 1 ) * kBlock;
+                    size_t ia = slot_[R[a]];
+                    double* z = cache_rhs_[o].data() + ia * D;
+                    for ( int r = 0; r < D; ++r )
+                        for ( int c = 0; c < D; ++c )
+                            z[r] += La[r * D + c] * y_[k * D + c];
+                    for ( size_t b = f; b <= a; ++b )
+                        subtract_outer( cache_[o].data() + tri( ia, slot_[R[b]] ) * kBlock, La, vals_[k].data() + ( b + 1 ) * kBlock, -1.0 );
+                }
+            }
+        }
+    }
+
+    // Pattern of column j: its later A neighbours and its children's
+    // patterns. Every such neighbour is affected, since any other column is
+    // now earlier.
+    void symbolic( uint32_t j )
+    {
+        std::vector<uint32_t>& R = rows_[j];
+        ++tick_;
+        auto add = [&]( uint32_t r ) {
+            if ( seen_tick_[r] != tick_ )
+            {
+                seen_tick_[r] = tick_;
+                R.push_back( r );
+            }
+        };
+        for ( uint32_t r : a_rows_[j] )
+            if ( affected_mark_[r] == stamp_ && before( j, r ) )
+                add( r );
+        for ( uint32_t c : children_[j] )
+            for ( uint32_t r : rows_[c] )
+                if ( r != j )
+                    add( r );
+        std::sort( R.begin(), R.end(), [this]( uint32_t a, uint32_t b ) { return before( a, b ); } );
+        for ( uint32_t r : R )
+        {
+            rowlist_[r].push_back( j );
+            row_affected_[r].push_back( j );
+        }
+        if ( !R.empty() )
+            children_[R[0]].push_back( j );
+    }
+
+    bool numeric( uint32_t j )
+    {
+        const std::vector<uint32_t>& R = rows_[j];
+        std::vector<double>& W = vals_[j];
+        W.assign( ( R.size() + 1 ) * kBlock, 0.0 );
+        for ( size_t t = 0; t < R.size(); ++t )
+            slot_[R[t]] = static_cast<uint32_t>( t + 1 );
+        std::copy_n( a_vals_[j].begin(), kBlock, W.begin() );
+        for ( size_t t = 0; t < a_rows_[j].size(); ++t )
+        {
+            uint32_t r = a_rows_[j][t];
+            if ( !before( j, r ) )
+                continue;
+            double* dst = W.data() + slot_[r] * kBlock;
+            const double* src = a_vals_[j].data() + ( t + 1 ) * kBlock;
+            for ( int k = 0; k < kBlock; ++k )
+                dst[k] += src[k];
+        }
+        // Left-looking over the affected columns, cached sums for the rest.
+        for ( uint32_t k : row_affected_[j] )
+        {
+            const std::vector<uint32_t>& Rk = rows_[k];
+            size_t t = find_row( k, j );
+            const double* Ljk = vals_[k].data() + ( t + 1 ) * kBlock;
+            subtract_outer( W.data(), Ljk, Ljk );
+            for ( size_t s = t + 1; s < Rk.size(); ++s )
+                subtract_outer( W.data() + slot_[Rk[s]] * kBlock, vals_[k].data() + ( s + 1 ) * kBlock, Ljk );
+        }
+        for ( uint32_t o : row_orphans_[j] )
+        {
+            const std::vector<uint32_t>& Ro = rows_[o];
+            size_t t = find_row( o, j );
+            const double* C = cache_[o].data();
+            for ( size_t s = t; s < Ro.size(); ++s )
+            {
+                double* dst = W.data() + ( s == t ? 0 : slot_[Ro[s]] * kBlock );
+                const double* src = C + tri( s, t ) * kBlock;
+                for ( int k = 0; k < kBlock; ++k )
+                    dst[k] -= src[k];
+            }
+        }
+
+        // Dense Cholesky of the diagonal block, then L_rj = W_rj L_jj^-T.
+        double* L = W.data();
+        double( &Ljj )[D][D] = *reinterpret_cast<double( * )[D][D]>( L );
+        if ( !cholesky_factor( Ljj, Ljj ) )
+            return false;
+        for ( int r = 0; r < D; ++r )
+            for ( int c = r + 1; c < D; ++c )
+                Ljj[r][c] = 0.0;
+        for ( size_t t = 0; t < R.size(); ++t )
+        {
+            double* X = W.data() + ( t + 1 ) * kBlock;
+            for ( int r = 0; r < D; ++r )
+                for ( int c = 0; c < D; ++c )
+                {
+                    double s = X[r * D + c];
+                    for ( int k = 0; k < c; ++k )
+                        s -= X[r * D + k] * L[c * D + k];
+                    X[r * D + c] = s / L[c * D + c];
+                }
+        }
+        return true;
+    }
+
+    // W -= scale A B^T for D x D blocks.
+    static void subtract_outer( double* W, const double* A, const double* B, double scale = 1.0 )
+    {
+        for ( int r = 0; r < D; ++r )
+            for ( int c = 0; c < D; ++c )
+            {
+                double s = 0.0;
+                for ( int k = 0; k < D; ++k )
+                    s += A[r * D + k] * B[c * D + k];
+                W[r * D + c] -= scale * s;
+            }
+    }
+
+    // y_j = L_jj^-1 (b_j - sum_k L_jk y_k)
+    void forward_solve( uint32_t j )
+    {
+        double v[D];
+        for ( int k = 0; k < D; ++k )
+            v[k] = rhs_[j * D + k];
+        for ( uint32_t k : row_affected_[j] )
+        {
+            const double* Ljk = vals_[k].data() + ( find_row( k, j ) + 1 ) * kBlock;
+            for ( int r = 0; r < D; ++r )
+                for ( int c = 0; c < D; ++c )
+                    v[r] -= Ljk[r * D + c] * y_[k * D + c];
+        }
+        for ( uint32_t o : row_orphans_[j] )
+        {
+            const double* z = cache_rhs_[o].data() + find_row( o, j ) * D;
+            for ( int r = 0; r < D; ++r )
+                v[r] -= z[r];
+        }
+        const double* L = vals_[j].data();
+        for ( int r = 0; r < D; ++r )
+        {
+            for ( int c = 0; c < r; ++c )
+                v[r] -= L[r * D + c] * v[c];
+            v[r] /= L[r * D + r];
+            y_[j * D + r] = v[r];
+        }
+    }
+
+    // x_j = L_jj^-T (y_j - sum_r L_rj^T x_r); returns the largest change.
+    double back_solve( uint32_t j )
+    {
+        double v[D];
+        for ( int k = 0; k < D; ++k )
+            v[k] = y_[j * D + k];
+        const std::vector<uint32_t>& R = rows_[j];
+        for ( size_t t = 0; t < R.size(); ++t )
+        {
+            const double* Lrj = vals_[j].data() + ( t + 1 ) * kBlock;
+            const double* xr = x_.data() + R[t] * D;
+            for ( int c = 0; c < D; ++c )
+                for ( int r = 0; r < D; ++r )
+                    v[c] -= Lrj[r * D + c] * xr[r];
+        }
+        const double* L = vals_[j].data();
+        for ( int r = D - 1; r >= 0; --r )
+        {
+            for ( int c = r + 1; c < D; ++c )
+                v[r] -= L[c * D + r] * v[c];
+            v[r] /= L[r * D + r];
+        }
+        double moved = 0.0;
+        for ( int r = 0; r < D; ++r )
+        {
+            moved = std::max( moved, std::fabs( v[r] - x_[j * D + r] ) );
+            x_[j * D + r] = v[r];
+        }
+        return moved;
+    }
+
+    // A per column: diagonal block first, then the blocks A(r, c) of the
+    // rows a_rows_[c], unordered.
+    std::vector<std::vector<uint32_t>> a_rows_;
+    std::vector<std::vector<double>> a_vals_;
+    std::vector<double> rhs_;
+    // Elimination position of each column; positions only grow.
+    std::vector<uint64_t> pos_;
+    // L in the same layout with rows sorted by position, plus for each row
+    // the columns that have a block in it and for each column its children
+    // in the elimination tree (kept for affected columns only).
+    std::vector<std::vector<uint32_t>> rows_;
+    std::vector<std::vector<double>> vals_;
+    std::vector<std::vector<uint32_t>> rowlist_;
+    std::vector<std::vector<uint32_t>> children_;
+    // Per column, valid while it is not re-eliminated: the packed lower
+    // triangle of sum L_ak L_bk^T and the vector sum L_ak y_k over its
+    // subtree, for a, b in its pattern.
+    std::vector<std::vector<double>> cache_;
+    std::vector<std::vector<double>> cache_rhs_;
+    std::vector<uint8_t> cache_valid_;
+    // For each affected row, the orphans and the affected columns whose
+    // pattern holds it.
+    std::vector<std::vector<uint32_t>> row_orphans_;
+    std::vector<std::vector<uint32_t>> row_affected_;
+    std::vector<std::pair<uint32_t, uint32_t>> orphan_of_;
+    std::vector<double> y_;
+    std::vector<double> x_;
+
+    std::vector<uint32_t> touched_;
+    std::vector<uint8_t> touched_flag_;
+    std::vector<uint32_t> affected_mark_;
+    std::vector<uint32_t> seen_mark_;
+    std::vector<uint64_t> seen_tick_;
+    std::vector<uint32_t> slot_;
+    std::vector<uint32_t> affected_;
+    std::vector<uint32_t> boundary_;
+    std::vector<uint32_t> orphans_;
+    std::vector<uint32_t> path_;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs_;
+    std::vector<uint32_t> sorted_;
+    std::vector<uint32_t> perm_;
+    std::vector<uint32_t> scratch_rows_;
+    std::vector<double> scratch_vals_;
+    std::priority_queue<std::pair<uint64_t, uint32_t>> back_;
+    uint64_t next_pos_ = 0;
+    uint32_t stamp_ = 0;
+    uint64_t tick_ = 0;
+    size_t refactored_ = 0;
+    size_t back_substituted_ = 0;
+    size_t cached_blocks_ = 0;
+};
+
+struct PoseGraphOptions
+{
+    size_t max_iterations = 20;
+    double tolerance = 1e-6;     // stop once no tangent component moves more
+    double prior_weight = 1e8;   // anchors vertex 0 (removes the gauge freedom)
+    bool reorder = true;         // minimum degree ordering, else vertex order
+};
+
+struct PoseGraphResult
+{
+    size_t iterations = 0;
+    double initial_chi2 = 0.0;
+    double final_chi2 = 0.0;
+    size_t factor_blocks = 0; // blocks of L, a measure of fill
+    bool converged = false;
+};
+
+namespace detail
+{
+
+// Adds sign * (J^T Omega J, -J^T Omega e) of one edge to the system, whose
+// columns are the vertex indices.
+template <typename Group>
+void linearize_edge( const typename PoseGraph<Group>::Edge& e, const typename Group::Pose& xi, const typename Group::Pose& xj, double sign,
+                     SparseBlockCholesky<Group::dof>& solver )
+{
+    constexpr int D = Group::dof;
+    double r[D], Ji[D][D], Jj[D][D];
+    Group::error( xi, xj, e.z, r, Ji, Jj );
+    double OJi[D][D], OJj[D][D], Or[D];
+    for ( int a = 0; a < D; ++a )
+    {
+        Or[a] = 0.0;
+        for ( int b = 0; b < D; ++b )
+        {
+            Or[a] += e.info[a][b] * r[b];
+            OJi[a][b] = OJj[a][b] = 0.0;
+            for ( int k = 0; k < D; ++k )
+            {
+                OJi[a][b] += e.info[a][k] * Ji[k][b];
+                OJj[a][b] += e.info[a][k] * Jj[k][b];
+            }
+        }
+    }
+    double Hii[D * D], Hij[D * D], Hjj[D * D], gi[D], gj[D];
+    for ( int a = 0; a < D; ++a )
+    {
+        gi[a] = gj[a] = 0.0;
+        for ( int k = 0; k < D; ++k )
+        {
+            gi[a] -= Ji[k][a] * Or[k];
+            gj[a] -= Jj[k][a] * Or[k];
+        }
+        for ( int b = 0; b < D; ++b )
+        {
+            double ii = 0.0, ij = 0.0, jj = 0.0;
+            for ( int k = 0; k < D; ++k )
+            {
+                ii += Ji[k][a] * OJi[k][b];
+                ij += Ji[k][a] * OJj[k][b];
+                jj += Jj[k][a] * OJj[k][b];
+            }
+            Hii[a * D + b] = ii;
+            Hij[a * D + b] = ij;
+            Hjj[a * D + b] = jj;
+        }
+    }
+    solver.add_hessian( e.i, e.i, Hii, sign );
+    solver.add_hessian( e.j, e.j, Hjj, sign );
+    solver.add_hessian( e.i, e.j, Hij, sign );
+    solver.add_rhs( e.i, gi, sign );
+    solver.add_rhs( e.j, gj, sign );
+}
+
+template <int D>
+void add_prior( SparseBlockCholesky<D>& solver, uint32_t c, double weight )
+{
+    double P[D * D] = {};
+    for ( int k = 0; k < D; ++k )
+        P[k * D + k] = weight;
+    solver.add_hessian( c, c, P );
+}
+
+} // namespace detail
+
+// Batch Gauss-Newton on a pose graph, relinearising every edge and
+// factoring from scratch each iteration.
+template <typename Group>
+class BatchPoseGraphOptimizer
+{
+public:
+    static constexpr int D = Group::dof;
+
+    bool optimize( PoseGraph<Group>& graph, const PoseGraphOptions& options, PoseGraphResult& result )
+    {
+        result = PoseGraphResult();
+        result.initial_chi2 = result.final_chi2 = graph.chi2();
+        const size_t n = graph.vertices();
+        if ( n == 0 )
+            return true;
+        for ( size_t it = 0; it < options.max_iterations; ++it )
+        {
+            solver_.clear();
+            for ( size_t k = 0; k < n; ++k )
+                solver_.append_column();
+            for ( const auto& e : graph.edges() )
+                detail::linearize_edge<Group>( e, graph.pose( e.i ), graph.pose( e.j ), 1.0, solver_ );
+            detail::add_prior( solver_, 0, options.prior_weight );
+            if ( !solver_.update( 0.0, nullptr, options.reorder ) )
+                return false;
+            double step = 0.0;
+            for ( uint32_t v = 0; v < n; ++v )
+            {
+                const double* d = solver_.solution( v );
+                for ( int k = 0; k < D; ++k )
+                    step = std::max( step, std::fabs( d[k] ) );
+                graph.pose( v ) = Group::retract( graph.pose( v ), d );
+            }
+            result.iterations = it + 1;
+            result.factor_blocks = solver_.factor_blocks();
+            result.final_chi2 = graph.chi2();
+            if ( step < options.tolerance )
+            {
+                result.converged = true;
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    SparseBlockCholesky<D> solver_;
+};
+
+struct IncrementalPoseGraphOptions
+{
+    double relinearize_threshold = 0.1; // relinearise a vertex once its tangent offset exceeds this
+    size_t relinearize_skip = 10;       // updates between relinearisation checks
+    double wildfire = 1e-3;             // back substitution stops below this change
+    double prior_weight = 1e8;
+};
+
+struct IncrementalPoseGraphStats
+{
+    size_t refactored = 0;       // columns re-eliminated
+    size_t back_substituted = 0; // columns re-solved
+    size_t relinearized = 0;     // vertices moved to a new linearisation point
+};
+
+// Incremental smoothing in the spirit of iSAM2 on top of
+// SparseBlockCholesky: odometry re-eliminates a few columns at the top of
+// the factor, a loop closure the path from the older vertex up, reordered
+// so the newest vertices stay near the top. Edges stay linearised at
+// per-vertex linearisation points; vertices whose offset from theirs
+// exceeds relinearize_threshold are moved there at the next update, their
+// edges' old contributions subtracted and the new ones added (fluid
+// relinearisation).
+template <typename Group>
+class IncrementalPoseGraphOptimizer
+{
+public:
+    static constexpr int D = Group::dof;
+    using Pose = typename Group::Pose;
+    using Edge = typename PoseGraph<Group>::Edge;
+
+    explicit IncrementalPoseGraphOptimizer( const IncrementalPoseGraphOptions& options = IncrementalPoseGraphOptions() )
+        : options_( options )
+    {
+    }
+
+    size_t vertices() const { return graph_.vertices(); }
+    size_t factor_blocks() const { return solver_.factor_blocks(); }
+    size_t cached_blocks() const { return solver_.cached_blocks(); }
+    // Linearisation points and edges.
+    const PoseGraph<Group>& graph() const { return graph_; }
+
+    uint32_t add_vertex( const Pose& initial )
+    {
+        uint32_t v = graph_.add_vertex( initial );
+        solver_.append_column();
+        vertex_edges_.emplace_back();
+        if ( v == 0 )
+            detail::add_prior( solver_, 0, options_.prior_weight );
+        return v;
+    }
+
+    void add_edge( uint32_t i, uint32_t j, const Pose& z, const double ( &info )[D][D] )
+    {
+        graph_.add_edge( i, j, z, info );
+        uint32_t id = static_cast<uint32_t>( graph_.edges().size() - 1 );
+        vertex_edges_[i].push_back( id );
+        vertex_edges_[j].push_back( id );
+        detail::linearize_edge<Group>( graph_.edges()[id], graph_.pose( i ), graph_.pose( j ), 1.0, solver_ );
+    }
+
+    Pose estimate( uint32_t v ) const { return Group::retract( graph_.pose( v ), solver_.solution( v ) ); }
+
+    double chi2() const
+    {
+        return graph_.chi2( [this]( uint32_t v ) { return estimate( v ); } );
+    }
+
+    bool update( IncrementalPoseGraphStats* stats = nullptr )
+    {
+        IncrementalPoseGraphStats s;
+        if ( ++updates_ % std::max<size_t>( options_.relinearize_skip, 1 ) == 0 )
+            s.relinearized = relinearize();
+        changed_.clear();
+        bool ok = solver_.update( options_.wildfire, &changed_ );
+        s.refactored = solver_.refactored();
+        s.back_substituted = solver_.back_substituted();
+        for ( uint32_t v : changed_ )
+        {
+            const double* d = solver_.solution( v );
+            for ( int k = 0; k < D; ++k )
+                if ( std::fabs( d[k] ) > options_.relinearize_threshold )
+                {
+                    pending_.push_back( v );
+                    break;
+                }
+        }
+        if ( stats )
+            *stats = s;
+        return ok;
+    }
+
+private:
+    size_t relinearize()
+    {
+        if ( pending_.empty() )
+            return 0;
+        std::sort( pending_.begin(), pending_.end() );
+        pending_.erase( std::unique( pending_.begin(), pending_.end() ), pending_.end() );
+        edge_list_.clear();
+        for ( uint32_t v : pending_ )
+            edge_list_.insert( edge_list_.end(), vertex_edges_[v].begin(), vertex_edges_[v].end() );
+        std::sort( edge_list_.begin(), edge_list_.end() );
+        edge_list_.erase( std::unique( edge_list_.begin(), edge_list_.end() ), edge_list_.end() );
+        const auto& edges = graph_.edges();
+        for ( uint32_t id : edge_list_ )
+            detail::linearize_edge<Group>( edges[id], graph_.pose( edges[id].i ), graph_.pose( edges[id].j ), -1.0, solver_ );
+        for ( uint32_t v : pending_ )
+            graph_.pose( v ) = estimate( v );
+        // The moved vertices' solution blocks are now offsets from the old
+        // points; they are recomputed because their columns are touched.
+        for ( uint32_t id : edge_list_ )
+            detail::linearize_edge<Group>( edges[id], graph_.pose( edges[id].i ), graph_.pose( edges[id].j ), 1.0, solver_ );
+        size_t n = pending_.size();
+        pending_.clear();
+        return n;
+    }
+
+    IncrementalPoseGraphOptions options_;
+    PoseGraph<Group> graph_;
+    SparseBlockCholesky<D> solver_;
+    std::vector<std::vector<uint32_t>> vertex_edges_;
+    std::vector<uint32_t> pending_;
+    std::vector<uint32_t> edge_list_;
+    std::vector<uint32_t> changed_;
+    size_t updates_ = 0;
+};
+
+} // namespace wra
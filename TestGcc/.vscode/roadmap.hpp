@@ -0,0 +1,667 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nearest_neighbors.hpp"
+#include "sampling_planner.hpp"
+
+#if defined( _WIN32 )
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+// minwindef.h defines near and far as empty macros, which would break every
+// header included after this one that uses them as names.
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace wra
+{
+
+// Collision status of a roadmap edge. A lazy roadmap starts all Unknown and
+// edges are settled the first time a query path uses them.
+enum class EdgeState : uint8_t
+{
+    Unknown = 0,
+    Valid = 1,
+    Invalid = 2
+};
+
+// Non-owning view of a roadmap in CSR form. Each undirected edge is stored
+// once per direction; reverse[e] is the index of the opposite direction so
+// both halves can be settled together. Points to vectors of a Roadmap or
+// straight into a mapped file.
+struct RoadmapView
+{
+    int dim = 0;
+    uint32_t vertices = 0;
+    uint32_t edges = 0;
+    const float* coords = nullptr; // vertices x dim, row-major
+    const uint32_t* offsets = nullptr; // vertices + 1
+    const uint32_t* targets = nullptr;
+    const uint32_t* reverse = nullptr;
+    const float* lengths = nullptr;
+    EdgeState* states = nullptr;
+
+    const float* point( uint32_t v ) const { return coords + static_cast<size_t>( v ) * dim; }
+};
+
+// Roadmap held in memory, as produced by RoadmapBuilder.
+struct Roadmap
+{
+    int dim = 0;
+    std::vector<float> coords;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> reverse;
+    std::vector<float> lengths;
+    std::vector<EdgeState> states;
+
+    RoadmapView view()
+    {
+        RoadmapView v;
+        v.dim = dim;
+        v.vertices = offsets.empty() ? 0 : static_cast<uint32_t>( offsets.size() - 1 );
+        v.edges = static_cast<uint32_t>( targets.size() );
+        v.coords = coords.data();
+        v.offsets = offsets.data();
+        v.targets = targets.data();
+        v.reverse = reverse.data();
+        v.lengths = lengths.data();
+        v.states = states.data();
+        return v;
+    }
+};
+
+struct RoadmapOptions
+{
+    uint32_t vertices = 5000;
+    // Connection radius; 0 picks the PRM* radius for the vertex count.
+    float radius = 0.0f;
+    float radius_factor = 1.1f;
+    // Leave edges Unknown instead of checking them all up front.
+    bool lazy = false;
+    NearestIndexKind index = NearestIndexKind::KdTree;
+    uint32_t seed = 1;
+};
+
+// Samples valid vertices and connects every pair within the radius.
+class RoadmapBuilder
+{
+public:
+    size_t state_checks() const { return checks_; }
+
+    void build( const SamplingProblem& problem, const RoadmapOptions& options, Roadmap& out )
+    {
+        int dim = problem.dim;
+        std::mt19937 rng( options.seed );
+        std::vector<float> q( dim );
+        checks_ = 0;
+
+        store_.reset( dim, options.vertices );
+        auto index = make_nearest_index( options.index, store_ );
+        while ( store_.size() < options.vertices )
+        {
+            for ( int d = 0; d < dim; ++d )
+                q[d] = std::uniform_real_distribution<float>( problem.lower[d], problem.upper[d] )( rng );
+            ++checks_;
+            if ( problem.valid( q.data() ) )
+                index->add( store_.push( q.data() ) );
+        }
+        uint32_t n = static_cast<uint32_t>( store_.size() );
+
+        float radius = options.radius;
+        if ( radius <= 0.0f )
+            radius = static_cast<float>( optimal_radius_constant( problem, options.radius_factor ) *
+                                         std::pow( std::log( double( n ) ) / n, 1.0 / dim ) );
+
+        out.dim = dim;
+        out.coords.resize( static_cast<size_t>( n ) * dim );
+        for ( uint32_t v = 0; v < n; ++v )
+            store_.get( v, &out.coords[static_cast<size_t>( v ) * dim] );
+
+        // Undirected pairs (u < v) that survive checking, then CSR.
+        pairs_.clear();
+        std::vector<float> scratch( dim );
+        for ( uint32_t u = 0; u < n; ++u )
+        {
+            near_.clear();
+            index->within( &out.coords[static_cast<size_t>( u ) * dim], radius, near_ );
+            for ( uint32_t v : near_ )
+            {
+                if ( v <= u )
+                    continue;
+                if ( !options.lazy &&
+                     !segment_valid( problem, &out.coords[static_cast<size_t>( u ) * dim],
+                                     &out.coords[static_cast<size_t>( v ) * dim], scratch.data(), checks_ ) )
+                    continue;
+                pairs_.emplace_back( u, v );
+            }
+        }
+
+        out.offsets.assign( n + 1, 0 );
+        for ( const auto& p : pairs_ )
+        {
+            ++out.offsets[p.first + 1];
+            ++out.offsets[p.second + 1];
+        }
+        for ( uint32_t v = 0; v < n; ++v )
+            out.offsets[v + 1] += out.offsets[v];
+        size_t m = pairs_.size() * 2;
+        out.targets.resize( m );
+        out.reverse.resize( m );
+        out.lengths.resize( m );
+        out.states.assign( m, options.lazy ? EdgeState::Unknown : EdgeState::Valid );
+        std::vector<uint32_t> fill( out.offsets.begin(), out.offsets.end() - 1 );
+        for ( const auto& p : pairs_ )
+        {
+            uint32_t eu = fill[p.first]++;
+            uint32_t ev = fill[p.second]++;
+            float len = state_distance( &out.coords[static_cast<size_t>( p.first ) * dim],
+                                        &out.coords[static_cast<size_t>( p.second ) * dim], dim );
+            out.targets[eu] = p.second;
+            out.targets[ev] = p.first;
+            out.reverse[eu] = ev;
+            out.reverse[ev] = eu;
+            out.lengths[eu] = len;
+            out.lengths[ev] = len;
+        }
+    }
+
+private:
+    SoaStore store_;
+    std::vector<uint32_t> near_;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs_;
+    size_t checks_ = 0;
+};
+
+// On-disk layout: this header, then each array at a 64-byte aligned offset
+// so a mapping can be used in place. Native byte order; the magic number
+// rejects files from a machine of the other endianness.
+struct RoadmapFileHeader
+{
+    static constexpr uint64_t kMagic = 0x31304d5250415257ull; // "WRAPRM01"
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t vertices;
+    uint32_t edges;
+    uint64_t coords;
+    uint64_t offsets;
+    uint64_t targets;
+    uint64_t reverse;
+    uint64_t lengths;
+    uint64_t states;
+    uint64_t file_size;
+};
+
+namespace detail
+{
+
+inline uint64_t align64( uint64_t x )
+{
+    return ( x + 63 ) & ~uint64_t( 63 );
+}
+
+inline RoadmapFileHeader roadmap_layout( int dim, uint32_t vertices, uint32_t edges )
+{
+    RoadmapFileHeader h;
+    std::memset( &h, 0, sizeof( h ) );
+    h.magic = RoadmapFileHeader::kMagic;
+    h.version = RoadmapFileHeader::kVersion;
+    h.dim = static_cast<uint32_t>( dim );
+    h.vertices = vertices;
+    h.edges = edges;
+    h.coords = align64( sizeof( RoadmapFileHeader ) );
+    h.offsets = align64( h.coords + uint64_t( vertices ) * dim * sizeof( float ) );
+    h.targets = align64( h.offsets + ( uint64_t( vertices ) + 1 ) * sizeof( uint32_t ) );
+    h.reverse = align64( h.targets + uint64_t( edges ) * sizeof( uint32_t ) );
+    h.lengths = align64( h.reverse + uint64_t( edges ) * sizeof( uint32_t ) );
+    h.states = align64( h.lengths + uint64_t( edges ) * sizeof( float ) );
+    h.file_size = h.states + edges;
+    return h;
+}
+
+// Full scan of the CSR arrays: offsets rise from 0 to edges, targets name
+// vertices, reverse names the opposite half of each edge (so it leads back
+// to the edge's source) and every state is a known EdgeState.
+inline bool roadmap_consistent( const RoadmapView& map )
+{
+    if ( map.offsets[0] != 0 || map.offsets[map.vertices] != map.edges )
+        return false;
+    for ( uint32_t v = 0; v < map.vertices; ++v )
+        if ( map.offsets[v] > map.offsets[v + 1] )
+            return false;
+    for ( uint32_t v = 0; v < map.vertices; ++v )
+        for ( uint32_t e = map.offsets[v]; e < map.offsets[v + 1]; ++e )
+        {
+            uint32_t r = map.reverse[e];
+            if ( map.targets[e] >= map.vertices || r >= map.edges || map.reverse[r] != e || map.targets[r] != v ||
+                 static_cast<uint8_t>( map.states[e] ) > static_cast<uint8_t>( EdgeState::Invalid ) )
+                return false;
+        }
+    return true;
+}
+
+} // namespace detail
+
+// Writes the roadmap in the layout above; returns false on I/O failure.
+inline bool save_roadmap( const std::string& path, const RoadmapView& map )
+{
+    RoadmapFileHeader h = detail::roadmap_layout( map.dim, map.vertices, map.edges );
+    std::FILE* f = std::fopen( path.c_str(), "wb" );
+    if ( !f )
+        return false;
+    bool ok = true;
+    auto put = [&]( uint64_t offset, const void* data, size_t bytes ) {
+        // Zero-fill the alignment gap up to this section.
+        static const char zeros[64] = {};
+        long pos = std::ftell( f );
+        if ( pos < 0 || static_cast<uint64_t>( pos ) > offset )
+        {
+            ok = false;
+            return;
+        }
+        ok = ok && std::fwrite( zeros, 1, offset - pos, f ) == offset - pos;
+        ok = ok && ( bytes == 0 || std::fwrite( data, 1, bytes, f ) == bytes );
+    };
+    put( 0, &h, sizeof( h ) );
+    put( h.coords, map.coords, size_t( map.vertices ) * map.dim * sizeof( float ) );
+    put( h.offsets, map.offsets, ( size_t( map.vertices ) + 1 ) * sizeof( uint32_t ) );
+    put( h.targets, map.targets, size_t( map.edges ) * sizeof( uint32_t ) );
+    put( h.reverse, map.reverse, size_t( map.edges ) * sizeof( uint32_t ) );
+    put( h.lengths, map.lengths, size_t( map.edges ) * sizeof( float ) );
+    put( h.states, map.states, size_t( map.edges ) );
+    ok = std::fclose( f ) == 0 && ok;
+    return ok;
+}
+
+// Read-only file mapped copy-on-write: pages are loaded on first touch and
+// writes (lazy edge states) stay private to the process.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    bool open( const std::string& path )
+    {
+        close();
+#if defined( _WIN32 )
+        HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr );
+        if ( file == INVALID_HANDLE_VALUE )
+            return false;
+        LARGE_INTEGER size;
+        if ( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 )
+        {
+            CloseHandle( file );
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA( file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr );
+        CloseHandle( file );
+        if ( !mapping )
+            return false;
+        data_ = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+        CloseHandle( mapping );
+        if ( !data_ )
+            return false;
+        size_ = static_cast<size_t>( size.QuadPart );
+#else
+        int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            return false;
+        struct stat st;
+        if ( fstat( fd, &st ) != 0 || st.st_size == 0 )
+        {
+            ::close( fd );
+            return false;
+        }
+        void* p = mmap( nullptr, static_cast<size_t>( st.st_size ), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+        ::close( fd );
+        if ( p == MAP_FAILED )
+            return false;
+        data_ = p;
+        size_ = static_cast<size_t>( st.st_size );
+#endif
+        return true;
+    }
+
+    void close()
+    {
+        if ( !data_ )
+            return;
+#if defined( _WIN32 )
+        UnmapViewOfFile( data_ );
+#else
+        munmap( data_, size_ );
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    uint8_t* data() const { return static_cast<uint8_t*>( data_ ); }
+    size_t size() const { return size_; }
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A roadmap file mapped for use in place. Opening checks the header, the
+// section bounds and the first and last offsets; the arrays themselves are
+// paged in as queries touch them. validate() checks the rest.
+class RoadmapFile
+{
+public:
+    bool open( const std::string& path )
+    {
+        view_ = RoadmapView();
+        if ( !file_.open( path ) )
+            return false;
+        if ( file_.size() < sizeof( RoadmapFileHeader ) )
+            return fail();
+        RoadmapFileHeader h;
+        std::memcpy( &h, file_.data(), sizeof( h ) );
+        if ( h.magic != RoadmapFileHeader::kMagic || h.version != RoadmapFileHeader::kVersion || h.dim == 0 )
+            return fail();
+        RoadmapFileHeader expect = detail::roadmap_layout( static_cast<int>( h.dim ), h.vertices, h.edges );
+        if ( std::memcmp( &h, &expect, sizeof( h ) ) != 0 || h.file_size > file_.size() )
+            return fail();
+
+        uint8_t* base = file_.data();
+        view_.dim = static_cast<int>( h.dim );
+        view_.vertices = h.vertices;
+        view_.edges = h.edges;
+        view_.coords = reinterpret_cast<const float*>( base + h.coords );
+        view_.offsets = reinterpret_cast<const uint32_t*>( base + h.offsets );
+        view_.targets = reinterpret_cast<const uint32_t*>( base + h.targets );
+        view_.reverse = reinterpret_cast<const uint32_t*>( base + h.reverse );
+        view_.lengths = reinterpret_cast<const float*>( base + h.lengths );
+        view_.states = reinterpret_cast<EdgeState*>( base + h.states );
+        if ( view_.offsets[0] != 0 || view_.offsets[view_.vertices] != view_.edges )
+            return fail();
+        return true;
+    }
+
+    // Walks every array to check the CSR structure and edge states. Costs a
+    // read of the whole file, so it is left to callers that do not trust
+    // the file's origin; queries on a corrupt file may index out of bounds.
+    bool validate() const { return is_open() && detail::roadmap_consistent( view_ ); }
+
+    void close()
+    {
+        file_.close();
+        view_ = RoadmapView();
+    }
+
+    bool is_open() const { return view_.coords != nullptr; }
+    const RoadmapView& view() const { return view_; }
+
+private:
+    bool fail()
+    {
+        close();
+        return false;
+    }
+
+    MappedFile file_;
+    RoadmapView view_;
+};
+
+struct PrmResult
+{
+    bool solved = false;
+    float cost = 0.0f;
+    size_t edges_checked = 0;
+    size_t edges_invalidated = 0;
+    size_t state_checks = 0;
+    // States from start to goal, dim floats each.
+    std::vector<float> path;
+};
+
+// Answers start/goal queries on a fixed roadmap. Start and goal are joined
+// to their `connect` nearest vertices, then A* runs over the graph with
+// edge checks deferred: an Unknown edge is checked only when A* pops the
+// vertex it leads to, i.e. when the current best candidate path commits to
+// it (Lazy Weighted A*, Cohen et al.). One search answers the query, unlike
+// LazyPRM's search-check-repeat loop, which on dense roadmaps re-runs A*
+// once per edge found blocked. Settled states are written back into the
+// roadmap, so later queries reuse them; on an eagerly built roadmap only the
+// start and goal links are ever checked.
+class PrmPlanner
+{
+public:
+    PrmPlanner( const RoadmapView& roadmap, const SamplingProblem& problem, int connect = 10 )
+        : map_( roadmap ), problem_( problem ), connect_( std::max( connect, 1 ) )
+    {
+        size_t n = size_t( map_.vertices ) + 2;
+        g_.resize( n );
+        parent_.resize( n );
+        stamp_.assign( n, 0 );
+        closed_.assign( n, 0 );
+        goal_link_.assign( map_.vertices, -1 );
+        scratch_.resize( problem_.dim );
+    }
+
+    bool query( const float* start, const float* goal, PrmResult& result )
+    {
+        result = PrmResult();
+        start_ = start;
+        goal_ = goal;
+        result.state_checks += 2;
+        if ( !problem_.valid( start ) || !problem_.valid( goal ) )
+            return false;
+        link( start, start_links_ );
+        link( goal, goal_links_ );
+        for ( uint32_t i = 0; i < goal_links_.size(); ++i )
+            goal_link_[goal_links_[i].vertex] = static_cast<int32_t>( i );
+
+        bool solved = search( result );
+
+        for ( const Link& l : goal_links_ )
+            goal_link_[l.vertex] = -1;
+        if ( !solved )
+            return false;
+
+        result.solved = true;
+        result.cost = g_[goal_id()];
+        for ( uint32_t v = goal_id(); v != start_id(); v = parent_[v] )
+            push_front( result.path, point( v ) );
+        push_front( result.path, start );
+        return true;
+    }
+
+private:
+    struct Link
+    {
+        uint32_t vertex;
+        float length;
+        EdgeState state;
+    };
+
+    struct Entry
+    {
+        float f;
+        float g;
+        uint32_t vertex;
+        uint32_t parent;
+        uint32_t via;
+
+        // Max-heap order on -f: the smallest f pops first.
+        bool operator<( const Entry& o ) const { return f > o.f; }
+    };
+
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+    // Entry::via tags for links from the virtual start and to the goal.
+    static constexpr uint32_t kStartLink = 0x80000000u;
+    static constexpr uint32_t kGoalLink = 0x40000000u;
+
+    uint32_t start_id() const { return map_.vertices; }
+    uint32_t goal_id() const { return map_.vertices + 1; }
+
+    const float* point( uint32_t v ) const
+    {
+        return v == start_id() ? start_ : v == goal_id() ? goal_ : map_.point( v );
+    }
+
+    void push_front( std::vector<float>& path, const float* q ) const
+    {
+        path.insert( path.begin(), q, q + problem_.dim );
+    }
+
+    // k nearest roadmap vertices to q by a linear scan; two per query, so
+    // the mapped file needs no spatial index.
+    void link( const float* q, std::vector<Link>& out )
+    {
+        best_.clear();
+        for ( uint32_t v = 0; v < map_.vertices; ++v )
+        {
+            float d = state_distance( q, map_.point( v ), map_.dim );
+            if ( best_.size() < size_t( connect_ ) )
+            {
+                best_.emplace_back( d, v );
+                std::push_heap( best_.begin(), best_.end() );
+            }
+            else if ( d < best_.front().first )
+            {
+                std::pop_heap( best_.begin(), best_.end() );
+                best_.back() = { d, v };
+                std::push_heap( best_.begin(), best_.end() );
+            }
+        }
+        out.clear();
+        for ( const auto& b : best_ )
+            out.push_back( { b.second, b.first, EdgeState::Unknown } );
+    }
+
+    EdgeState& state_of( uint32_t via )
+    {
+        if ( via & kStartLink )
+            return start_links_[via & ~kStartLink].state;
+        if ( via & kGoalLink )
+            return goal_links_[via & ~kGoalLink].state;
+        return map_.states[via];
+    }
+
+    void push( const Entry& from, uint32_t to, float length, uint32_t via, EdgeState state )
+    {
+        if ( stamp_[to] != search_ )
+        {
+            stamp_[to] = search_;
+            closed_[to] = 0;
+            g_[to] = std::numeric_limits<float>::infinity();
+        }
+        if ( closed_[to] )
+            return;
+        float g = from.g + length;
+        // g_ only tracks costs through settled edges: an Unknown edge may
+        // still fail, so its entry must not shadow costlier alternatives.
+        if ( g >= g_[to] )
+            return;
+        if ( state == EdgeState::Valid )
+            g_[to] = g;
+        open_.push_back( { g + state_distance( point( to ), goal_, map_.dim ), g, to, from.vertex, via } );
+        std::push_heap( open_.begin(), open_.end() );
+    }
+
+    bool search( PrmResult& result )
+    {
+        if ( ++search_ == 0 )
+        {
+            std::fill( stamp_.begin(), stamp_.end(), 0 );
+            search_ = 1;
+        }
+        open_.clear();
+        open_.push_back( { 0.0f, 0.0f, start_id(), kNone, kNone } );
+        stamp_[start_id()] = search_;
+        closed_[start_id()] = 0;
+        while ( !open_.empty() )
+        {
+            std::pop_heap( open_.begin(), open_.end() );
+            Entry e = open_.back();
+            open_.pop_back();
+            if ( closed_[e.vertex] )
+                continue;
+            if ( e.via != kNone )
+            {
+                EdgeState& state = state_of( e.via );
+                if ( state == EdgeState::Unknown )
+                {
+                    ++result.edges_checked;
+                    bool valid = segment_valid( problem_, point( e.parent ), point( e.vertex ), scratch_.data(),
+                                                result.state_checks );
+                    state = valid ? EdgeState::Valid : EdgeState::Invalid;
+                    if ( !( e.via & ( kStartLink | kGoalLink ) ) )
+                        map_.states[map_.reverse[e.via]] = state;
+                    result.edges_invalidated += !valid;
+                }
+                if ( state == EdgeState::Invalid )
+                    continue;
+            }
+            // The edge length is exact, so a settled entry is still the
+            // cheapest in the queue and the vertex can be closed.
+            uint32_t u = e.vertex;
+            closed_[u] = 1;
+            g_[u] = e.g;
+            parent_[u] = e.parent;
+            if ( u == goal_id() )
+                return true;
+            if ( u == start_id() )
+            {
+                for ( uint32_t i = 0; i < start_links_.size(); ++i )
+                    if ( start_links_[i].state != EdgeState::Invalid )
+                        push( e, start_links_[i].vertex, start_links_[i].length, kStartLink | i, start_links_[i].state );
+                continue;
+            }
+            for ( uint32_t k = map_.offsets[u]; k < map_.offsets[u + 1]; ++k )
+                if ( map_.states[k] != EdgeState::Invalid )
+                    push( e, map_.targets[k], map_.lengths[k], k, map_.states[k] );
+            int32_t gl = goal_link_[u];
+            if ( gl >= 0 && goal_links_[gl].state != EdgeState::Invalid )
+                push( e, goal_id(), goal_links_[gl].length, kGoalLink | static_cast<uint32_t>( gl ), goal_links_[gl].state );
+        }
+        return false;
+    }
+
+    RoadmapView map_;
+    SamplingProblem problem_;
+    int connect_;
+    const float* start_ = nullptr;
+    const float* goal_ = nullptr;
+    std::vector<Link> start_links_;
+    std::vector<Link> goal_links_;
+    std::vector<int32_t> goal_link_;
+    std::vector<std::pair<float, uint32_t>> best_;
+    std::vector<Entry> open_;
+    std::vector<float> g_;
+    std::vector<uint32_t> parent_;
+    std::vector<uint32_t> stamp_;
+    std::vector<uint8_t> closed_;
+    uint32_t search_ = 0;
+    std::vector<float> scratch_;
+};
+
+} // namespace wra
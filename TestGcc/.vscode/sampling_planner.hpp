@@ -0,0 +1,522 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "nearest_neighbors.hpp"
+
+namespace wra
+{
+
+// Planning query in a box-bounded Euclidean configuration space.
+struct SamplingProblem
+{
+    int dim = 0;
+    std::vector<float> lower;
+    std::vector<float> upper;
+    std::vector<float> start;
+    std::vector<float> goal;
+    float goal_tolerance = 0.05f;
+    // Longest step between state checks along an edge.
+    float resolution = 0.01f;
+    std::function<bool( const float* )> valid;
+};
+
+inline float state_distance( const float* a, const float* b, int dim )
+{
+    float s = 0.0f;
+    for ( int d = 0; d < dim; ++d )
+        s += ( a[d] - b[d] ) * ( a[d] - b[d] );
+    return std::sqrt( s );
+}
+
+// Checks states along a -> b every problem.resolution, the end state
+// included and the start state not. q is dim floats of scratch; every state
+// checked is counted into checks.
+inline bool segment_valid( const SamplingProblem& problem, const float* a, const float* b, float* q, size_t& checks )
+{
+    float len = state_distance( a, b, problem.dim );
+    int steps = std::max( 1, static_cast<int>( std::ceil( len / problem.resolution ) ) );
+    for ( int s = 1; s <= steps; ++s )
+    {
+        float t = static_cast<float>( s ) / steps;
+        for ( int d = 0; d < problem.dim; ++d )
+            q[d] = a[d] + ( b[d] - a[d] ) * t;
+        ++checks;
+        if ( !problem.valid( q ) )
+            return false;
+    }
+    return true;
+}
+
+// Connection radius constant of Karaman & Frazzoli for RRT* and PRM*, with
+// the bounding box standing in for the free-space volume. The radius for n
+// states is gamma * (log n / n)^(1/dim).
+inline double optimal_radius_constant( const SamplingProblem& problem, double factor )
+{
+    int dim = problem.dim;
+    double volume = 1.0;
+    for ( int d = 0; d < dim; ++d )
+        volume *= problem.upper[d] - problem.lower[d];
+    double unit_ball = std::pow( 3.14159265358979323846, dim / 2.0 ) / std::tgamma( dim / 2.0 + 1.0 );
+    return factor * 2.0 * std::pow( 1.0 + 1.0 / dim, 1.0 / dim ) * std::pow( volume / unit_ball, 1.0 / dim );
+}
+
+enum class SamplingAlgorithm
+{
+    Rrt,
+    RrtConnect,
+    RrtStar,
+    InformedRrtStar
+};
+
+inline const char* to_string( SamplingAlgorithm a )
+{
+    switch ( a )
+    {
+    case SamplingAlgorithm::Rrt:
+        return "rrt";
+    case SamplingAlgorithm::RrtConnect:
+        return "rrt_connect";
+    case SamplingAlgorithm::RrtStar:
+        return "rrt_star";
+    case SamplingAlgorithm::InformedRrtStar:
+        return "informed_rrt_star";
+    }
+    return "?";
+}
+
+struct SamplingOptions
+{
+    SamplingAlgorithm algorithm = SamplingAlgorithm::Rrt;
+    NearestIndexKind index = NearestIndexKind::Brute;
+    size_t max_nodes = 20000;
+    // RRT and RRT-Connect stop at the first solution; the RRT* variants
+    // keep improving until this many samples.
+    size_t max_iterations = 20000;
+    float step = 0.1f;
+    float goal_bias = 0.05f;
+    float rewire_factor = 1.1f;
+    uint32_t seed = 1;
+};
+
+struct SamplingResult
+{
+    bool solved = false;
+    float cost = 0.0f;
+    size_t iterations = 0;
+    size_t nodes = 0;
+    size_t state_checks = 0;
+    // States from start to goal, dim floats each.
+    std::vector<float> path;
+};
+
+// Search tree in structure-of-arrays form. Coordinates, parents, costs and
+// child links live in arrays sized once to max_nodes, so planning never
+// allocates per node; reset() reuses them for the next query.
+class SamplingTree
+{
+public:
+    void reset( int dim, size_t capacity, NearestIndexKind kind )
+    {
+        points.reset( dim, capacity );
+        parent.resize( points.capacity() );
+        cost.resize( points.capacity() );
+        first_child.resize( points.capacity() );
+        next_sibling.resize( points.capacity() );
+        if ( !index || kind != kind_ )
+            index = make_nearest_index( kind, points );
+        index->clear();
+        kind_ = kind;
+    }
+
+    size_t size() const { return points.size(); }
+    bool full() const { return points.full(); }
+
+    uint32_t add( const float* q, int32_t p, float c )
+    {
+        uint32_t id = points.push( q );
+        parent[id] = p;
+        cost[id] = c;
+        first_child[id] = -1;
+        next_sibling[id] = -1;
+        if ( p >= 0 )
+            link( id, p );
+        index->add( id );
+        return id;
+    }
+
+    // Moves node x under p at new cost c and shifts its descendants' costs.
+    void reparent( uint32_t x, uint32_t p, float c )
+    {
+        int32_t old = parent[x];
+        int32_t* slot = &first_child[old];
+        while ( *slot != static_cast<int32_t>( x ) )
+            slot = &next_sibling[*slot];
+        *slot = next_sibling[x];
+        parent[x] = static_cast<int32_t>( p );
+        link( x, p );
+        propagate( x, c - cost[x] );
+    }
+
+    SoaStore points;
+    std::vector<int32_t> parent;
+    std::vector<float> cost;
+    std::vector<int32_t> first_child;
+    std::vector<int32_t> next_sibling;
+    std::unique_ptr<NearestNeighbors> index;
+
+private:
+    void link( uint32_t x, uint32_t p )
+    {
+        next_sibling[x] = first_child[p];
+        first_child[p] = static_cast<int32_t>( x );
+    }
+
+    void propagate( uint32_t x, float delta )
+    {
+        stack_.clear();
+        stack_.push_back( static_cast<int32_t>( x ) );
+        while ( !stack_.empty() )
+        {
+            int32_t n = stack_.back();
+            stack_.pop_back();
+            cost[n] += delta;
+            for ( int32_t c = first_child[n]; c >= 0; c = next_sibling[c] )
+                stack_.push_back( c );
+        }
+    }
+
+    NearestIndexKind kind_ = NearestIndexKind::Brute;
+    std::vector<int32_t> stack_;
+};
+
+// RRT, RRT-Connect, RRT* and Informed RRT* over one SamplingProblem.
+class SamplingPlanner
+{
+public:
+    SamplingPlanner( const SamplingProblem& problem, const SamplingOptions& options )
+        : problem_( problem ), options_( options ), dim_( problem.dim )
+    {
+        for ( auto& s : scratch_ )
+            s.resize( dim_ );
+    }
+
+    const SamplingOptions& options() const { return options_; }
+    void set_options( const SamplingOptions& options ) { options_ = options; }
+
+    bool solve( SamplingResult& result )
+    {
+        result = SamplingResult();
+        rng_.seed( options_.seed );
+        checks_ = 0;
+        for ( auto& t : trees_ )
+            t.reset( dim_, options_.max_nodes, options_.index );
+        if ( !check( problem_.start.data() ) || !check( problem_.goal.data() ) )
+            return false;
+
+        switch ( options_.algorithm )
+        {
+        case SamplingAlgorithm::Rrt:
+            rrt( result );
+            break;
+        case SamplingAlgorithm::RrtConnect:
+            connect( result );
+            break;
+        default:
+            rrt_star( result, options_.algorithm == SamplingAlgorithm::InformedRrtStar );
+        }
+        result.nodes = trees_[0].size() + trees_[1].size();
+        result.state_checks = checks_;
+        return result.solved;
+    }
+
+private:
+    enum class Extend
+    {
+        Trapped,
+        Advanced,
+        Reached
+    };
+
+    bool check( const float* q )
+    {
+        ++checks_;
+        return problem_.valid( q );
+    }
+
+    float distance( const float* a, const float* b ) const { return state_distance( a, b, dim_ ); }
+
+    bool motion_valid( const float* a, const float* b )
+    {
+        return segment_valid( problem_, a, b, scratch_[3].data(), checks_ );
+    }
+
+    void sample_uniform( float* q )
+    {
+        for ( int d = 0; d < dim_; ++d )
+            q[d] = std::uniform_real_distribution<float>( problem_.lower[d], problem_.upper[d] )( rng_ );
+    }
+
+    void sample( float* q )
+    {
+        if ( std::uniform_real_distribution<float>( 0.0f, 1.0f )( rng_ ) < options_.goal_bias )
+            std::copy( problem_.goal.begin(), problem_.goal.end(), q );
+        else
+            sample_uniform( q );
+    }
+
+    // Uniform sample from the prolate hyperspheroid of states that could
+    // improve a solution of cost c_best (Gammell et al.). The transverse
+    // axes are all equal, so a Householder reflection taking e1 onto the
+    // start-goal direction is enough to orient it.
+    void sample_informed( float* q, float c_best )
+    {
+        const float* s = problem_.start.data();
+        const float* g = problem_.goal.data();
+        float c_min = distance( s, g );
+        float* ball = scratch_[4].data();
+        for ( int attempt = 0; attempt < 100; ++attempt )
+        {
+            std::normal_distribution<float> normal;
+            float norm = 0.0f;
+            for ( int d = 0; d < dim_; ++d )
+            {
+                ball[d] = normal( rng_ );
+                norm += ball[d] * ball[d];
+            }
+            float radius = std::pow( std::uniform_real_distribution<float>( 0.0f, 1.0f )( rng_ ), 1.0f / dim_ );
+            float scale = radius / std::sqrt( std::max( norm, 1e-12f ) );
+            float r1 = c_best / 2;
+            float rt = std::sqrt( std::max( c_best * c_best - c_min * c_min, 0.0f ) ) / 2;
+            for ( int d = 0; d < dim_; ++d )
+                ball[d] *= scale * ( d == 0 ? r1 : rt );
+
+            // v = e1 - a1; H = I - 2 v v^T / |v|^2 maps e1 to a1.
+            float vv = 0.0f;
+            float vb = 0.0f;
+            for ( int d = 0; d < dim_; ++d )
+            {
+                float a = c_min > 0 ? ( g[d] - s[d] ) / c_min : ( d == 0 );
+                float v = ( d == 0 ) - a;
+                scratch_[5][d] = v;
+                vv += v * v;
+                vb += v * ball[d];
+            }
+            bool inside = true;
+            for ( int d = 0; d < dim_; ++d )
+            {
+                float x = ball[d] - ( vv > 1e-12f ? 2 * vb / vv * scratch_[5][d] : 0.0f );
+                q[d] = x + ( s[d] + g[d] ) / 2;
+                inside &= q[d] >= problem_.lower[d] && q[d] <= problem_.upper[d];
+            }
+            if ( inside )
+                return;
+        }
+        sample_uniform( q );
+    }
+
+    // Point at most `step` from `from` towards `to`.
+    void steer( const float* from, const float* to, float* out ) const
+    {
+        float len = distance( from, to );
+        float t = len > options_.step ? options_.step / len : 1.0f;
+        for ( int d = 0; d < dim_; ++d )
+            out[d] = from[d] + ( to[d] - from[d] ) * t;
+    }
+
+    Extend extend( SamplingTree& tree, const float* target, uint32_t& added )
+    {
+        if ( tree.full() )
+            return Extend::Trapped;
+        float* from = scratch_[1].data();
+        float* q = scratch_[2].data();
+        uint32_t n = tree.index->nearest( target );
+        tree.points.get( n, from );
+        steer( from, target, q );
+        if ( !motion_valid( from, q ) )
+            return Extend::Trapped;
+        added = tree.add( q, static_cast<int32_t>( n ), tree.cost[n] + distance( from, q ) );
+        return distance( q, target ) < 1e-6f ? Extend::Reached : Extend::Advanced;
+    }
+
+    bool at_goal( const float* q ) const { return distance( q, problem_.goal.data() ) <= problem_.goal_tolerance; }
+
+    // States of tree branch root..node, appended in root-to-node order.
+    void append_branch( const SamplingTree& tree, uint32_t node, std::vector<float>& out, bool reverse ) const
+    {
+        size_t first = out.size();
+        for ( int32_t n = static_cast<int32_t>( node ); n >= 0; n = tree.parent[n] )
+            for ( int d = dim_ - 1; d >= 0; --d )
+                out.push_back( tree.points.coord( n, d ) );
+        if ( !reverse )
+            std::reverse( out.begin() + first, out.end() );
+        else
+            for ( size_t i = first; i < out.size(); i += dim_ )
+                std::reverse( out.begin() + i, out.begin() + i + dim_ );
+    }
+
+    void rrt( SamplingResult& result )
+    {
+        SamplingTree& tree = trees_[0];
+        tree.add( problem_.start.data(), -1, 0.0f );
+        float* q = scratch_[0].data();
+        for ( result.iterations = 0; result.iterations < options_.max_iterations && !tree.full(); ++result.iterations )
+        {
+            sample( q );
+            uint32_t added;
+            if ( extend( tree, q, added ) == Extend::Trapped )
+                continue;
+            float* p = scratch_[2].data();
+            if ( at_goal( p ) )
+            {
+                result.solved = true;
+                result.cost = tree.cost[added];
+                append_branch( tree, added, result.path, false );
+                return;
+            }
+        }
+    }
+
+    void connect( SamplingResult& result )
+    {
+        trees_[0].add( problem_.start.data(), -1, 0.0f );
+        trees_[1].add( problem_.goal.data(), -1, 0.0f );
+        float* q = scratch_[0].data();
+        float* reached = scratch_[6].data();
+        int a = 0;
+        for ( result.iterations = 0; result.iterations < options_.max_iterations; ++result.iterations, a ^= 1 )
+        {
+            SamplingTree& ta = trees_[a];
+            SamplingTree& tb = trees_[a ^ 1];
+            sample_uniform( q );
+            uint32_t na;
+            if ( extend( ta, q, na ) == Extend::Trapped )
+                continue;
+            ta.points.get( na, reached );
+            uint32_t nb = 0;
+            Extend e = Extend::Advanced;
+            while ( e == Extend::Advanced )
+                e = extend( tb, reached, nb );
+            if ( e != Extend::Reached )
+                continue;
+
+            const SamplingTree& from_start = a == 0 ? ta : tb;
+            const SamplingTree& from_goal = a == 0 ? tb : ta;
+            uint32_t ns = a == 0 ? na : nb;
+            uint32_t ng = a == 0 ? nb : na;
+            append_branch( from_start, ns, result.path, false );
+            // The meeting state appears in both branches; keep one copy.
+            result.path.resize( result.path.size() - dim_ );
+            append_branch( from_goal, ng, result.path, true );
+            result.solved = true;
+            result.cost = from_start.cost[ns] + from_goal.cost[ng];
+            return;
+        }
+    }
+
+    void rrt_star( SamplingResult& result, bool informed )
+    {
+        SamplingTree& tree = trees_[0];
+        tree.add( problem_.start.data(), -1, 0.0f );
+        float* q = scratch_[0].data();
+        float* from = scratch_[1].data();
+        float* x = scratch_[2].data();
+        float* other = scratch_[6].data();
+
+        double gamma = optimal_radius_constant( problem_, options_.rewire_factor );
+
+        goal_nodes_.clear();
+        float best = std::numeric_limits<float>::infinity();
+        int32_t best_node = -1;
+        for ( result.iterations = 0; result.iterations < options_.max_iterations && !tree.full(); ++result.iterations )
+        {
+            if ( informed && best_node >= 0 )
+                sample_informed( q, best );
+            else
+                sample( q );
+
+            uint32_t n = tree.index->nearest( q );
+            tree.points.get( n, from );
+            steer( from, q, x );
+            if ( !motion_valid( from, x ) )
+                continue;
+
+            double count = static_cast<double>( tree.size() + 1 );
+            float radius = static_cast<float>(
+                std::min<double>( options_.step, gamma * std::pow( std::log( count ) / count, 1.0 / dim_ ) ) );
+            near_.clear();
+            tree.index->within( x, radius, near_ );
+
+            // Cheapest collision-free parent among the neighbours, trying
+            // candidates in cost order so the first valid one wins.
+            candidates_.clear();
+            for ( uint32_t c : near_ )
+                candidates_.emplace_back( tree.cost[c] + std::sqrt( tree.points.distance2( c, x ) ), c );
+            std::sort( candidates_.begin(), candidates_.end() );
+            uint32_t parent = n;
+            float cost = tree.cost[n] + distance( from, x );
+            for ( const auto& c : candidates_ )
+            {
+                if ( c.first >= cost )
+                    break;
+                tree.points.get( c.second, other );
+                if ( motion_valid( other, x ) )
+                {
+                    parent = c.second;
+                    cost = c.first;
+                    break;
+                }
+            }
+            uint32_t id = tree.add( x, static_cast<int32_t>( parent ), cost );
+
+            for ( const auto& c : candidates_ )
+            {
+                uint32_t v = c.second;
+                if ( v == parent )
+                    continue;
+                // Earlier rewires may have lowered cost[v], so c.first is stale.
+                float through = cost + std::sqrt( tree.points.distance2( v, x ) );
+                if ( through >= tree.cost[v] )
+                    continue;
+                tree.points.get( v, other );
+                if ( motion_valid( x, other ) )
+                    tree.reparent( v, id, through );
+            }
+
+            if ( at_goal( x ) )
+                goal_nodes_.push_back( id );
+            for ( uint32_t g : goal_nodes_ )
+                if ( tree.cost[g] < best )
+                {
+                    best = tree.cost[g];
+                    best_node = static_cast<int32_t>( g );
+                }
+        }
+
+        if ( best_node < 0 )
+            return;
+        result.solved = true;
+        result.cost = tree.cost[best_node];
+        append_branch( tree, static_cast<uint32_t>( best_node ), result.path, false );
+    }
+
+    SamplingProblem problem_;
+    SamplingOptions options_;
+    int dim_;
+    std::mt19937 rng_;
+    size_t checks_ = 0;
+    SamplingTree trees_[2];
+    std::vector<float> scratch_[7];
+    std::vector<uint32_t> near_;
+    std::vector<std::pair<float, uint32_t>> candidates_;
+    std::vector<uint32_t> goal_nodes_;
+};
+
+} // namespace wra
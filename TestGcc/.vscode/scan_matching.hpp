@@ -0,0 +1,559 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dense_cholesky.hpp"
+#include "geometry.hpp"
+#include "point_cloud.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+namespace detail
+{
+
+// Cyclic Jacobi eigen-decomposition of a symmetric 3x3 matrix. Eigenvalues
+// come back ascending in w, eigenvectors in the columns of V.
+inline void symmetric_eigen3( const double ( &A )[3][3], double ( &w )[3], double ( &V )[3][3] )
+{
+    double a[3][3];
+    for ( int i = 0; i < 3; ++i )
+        for ( int j = 0; j < 3; ++j )
+        {
+            a[i][j] = A[i][j];
+            V[i][j] = i == j ? 1.0 : 0.0;
+        }
+    for ( int sweep = 0; sweep < 16; ++sweep )
+    {
+        double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if ( off < 1e-30 )
+            break;
+        for ( int p = 0; p < 2; ++p )
+            for ( int q = p + 1; q < 3; ++q )
+            {
+                if ( a[p][q] == 0.0 )
+                    continue;
+                double theta = ( a[q][q] - a[p][p] ) / ( 2.0 * a[p][q] );
+                double t = ( theta >= 0 ? 1.0 : -1.0 ) / ( std::fabs( theta ) + std::sqrt( theta * theta + 1.0 ) );
+                double c = 1.0 / std::sqrt( t * t + 1.0 ), s = t * c;
+                for ( int k = 0; k < 3; ++k )
+                {
+                    double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for ( int k = 0; k < 3; ++k )
+                {
+                    double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for ( int k = 0; k < 3; ++k )
+                {
+                    double vkp = V[k][p], vkq = V[k][q];
+                    V[k][p] = c * vkp - s * vkq;
+                    V[k][q] = s * vkp + c * vkq;
+                }
+            }
+    }
+    int order[3] = { 0, 1, 2 };
+    std::sort( order, order + 3, [&]( int i, int j ) { return a[i][i] < a[j][j]; } );
+    double U[3][3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        w[k] = a[order[k]][order[k]];
+        for ( int i = 0; i < 3; ++i )
+            U[i][k] = V[i][order[k]];
+    }
+    for ( int i = 0; i < 3; ++i )
+        for ( int k = 0; k < 3; ++k )
+            V[i][k] = U[i][k];
+}
+
+} // namespace detail
+
+// Sparse voxel map of registered points for scan matching: each voxel keeps
+// up to max_points_per_voxel points in one contiguous block, located
+// through an open-addressing hash on the packed voxel key. Correspondence
+// search visits the 27 voxels around a query, so adding a scan costs one
+// hash insert per point instead of a tree rebuild. Voxels also carry the
+// statistics point-to-plane ICP and NDT need, refreshed for touched voxels
+// only.
+class VoxelHashMap
+{
+public:
+    struct Voxel
+    {
+        uint64_t key = 0;
+        uint32_t count = 0;
+        bool dirty = false;
+        bool planar = false;   // normal is valid
+        bool gaussian = false; // mean and icov are valid
+        float mean[3] = {};
+        float normal[3] = {};
+        float icov[6] = {}; // xx, xy, xz, yy, yz, zz of the inverse covariance
+    };
+
+    explicit VoxelHashMap( double voxel_size = 1.0, size_t max_points_per_voxel = 20 )
+        : voxel_size_( voxel_size ), inv_size_( static_cast<float>( 1.0 / voxel_size ) ), max_points_( max_points_per_voxel )
+    {
+        table_.assign( 1024, -1 );
+    }
+
+    double voxel_size() const { return voxel_size_; }
+    size_t max_points_per_voxel() const { return max_points_; }
+    size_t voxels() const { return voxels_.size(); }
+    size_t points() const { return points_; }
+    const Voxel& voxel( size_t i ) const { return voxels_[i]; }
+    // xyz triples of the points stored in voxel i.
+    const float* voxel_points( size_t i ) const { return data_.data() + i * max_points_ * 3; }
+
+    void clear()
+    {
+        voxels_.clear();
+        data_.clear();
+        std::fill( table_.begin(), table_.end(), -1 );
+        points_ = 0;
+    }
+
+    // Adds a cloud given in the sensor frame at `pose`. Points landing in a
+    // full voxel are dropped.
+    void insert( const PointCloud& cloud, const Isometry3& pose )
+    {
+        const Mat3& R = pose.R;
+        for ( size_t i = 0; i < cloud.size(); ++i )
+        {
+            double x = cloud.x[i], y = cloud.y[i], z = cloud.z[i];
+            float p[3] = { static_cast<float>( R.m[0][0] * x + R.m[0][1] * y + R.m[0][2] * z + pose.t.x ),
+                           static_cast<float>( R.m[1][0] * x + R.m[1][1] * y + R.m[1][2] * z + pose.t.y ),
+                           static_cast<float>( R.m[2][0] * x + R.m[2][1] * y + R.m[2][2] * z + pose.t.z ) };
+            uint64_t key = voxel_key( p[0], p[1], p[2], inv_size_ );
+            int v = find( key );
+            if ( v < 0 )
+                v = add_voxel( key );
+            Voxel& vox = voxels_[v];
+            if ( vox.count == max_points_ )
+                continue;
+            float* dst = data_.data() + ( static_cast<size_t>( v ) * max_points_ + vox.count ) * 3;
+            dst[0] = p[0];
+            dst[1] = p[1];
+            dst[2] = p[2];
+            ++vox.count;
+            vox.dirty = true;
+            ++points_;
+        }
+    }
+
+    // Drops voxels whose centre lies farther than max_distance from origin.
+    void remove_far( const Vec3& origin, double max_distance )
+    {
+        const double limit = max_distance * max_distance;
+        size_t kept = 0;
+        points_ = 0;
+        for ( size_t i = 0; i < voxels_.size(); ++i )
+        {
+            const Voxel& v = voxels_[i];
+            int c[3] = { static_cast<int>( ( v.key >> 42 ) & 0x1FFFFF ) - ( 1 << 20 ), static_cast<int>( ( v.key >> 21 ) & 0x1FFFFF ) - ( 1 << 20 ),
+                         static_cast<int>( v.key & 0x1FFFFF ) - ( 1 << 20 ) };
+            Vec3 centre( ( c[0] + 0.5 ) * voxel_size_, ( c[1] + 0.5 ) * voxel_size_, ( c[2] + 0.5 ) * voxel_size_ );
+            if ( squared_norm( centre - origin ) > limit )
+                continue;
+            if ( kept != i )
+            {
+                voxels_[kept] = v;
+                std::copy( voxel_points( i ), voxel_points( i ) + v.count * 3, data_.begin() + kept * max_points_ * 3 );
+            }
+            points_ += v.count;
+            ++kept;
+        }
+        voxels_.resize( kept );
+        data_.resize( kept * max_points_ * 3 );
+        rehash( table_.size() );
+    }
+
+    // Refreshes mean, normal and inverse covariance of voxels changed since
+    // the last call. A voxel is gaussian from 5 points on, with eigenvalues
+    // floored at 1% of the largest so thin structures stay invertible, and
+    // planar when its smallest eigenvalue is under a tenth of the middle one.
+    void update_statistics( ThreadPool* pool = nullptr )
+    {
+        auto body = [&]( size_t lo, size_t hi ) {
+            for ( size_t i = lo; i < hi; ++i )
+                if ( voxels_[i].dirty )
+                    refresh( i );
+        };
+        if ( pool )
+            pool->parallel_for( 0, voxels_.size(), 256, body );
+        else
+            body( 0, voxels_.size() );
+    }
+
+    int find( uint64_t key ) const
+    {
+        const size_t mask = table_.size() - 1;
+        for ( size_t s = voxel_hash( key ) & mask;; s = ( s + 1 ) & mask )
+        {
+            int v = table_[s];
+            if ( v < 0 || voxels_[v].key == key )
+                return v;
+        }
+    }
+
+    int find( float x, float y, float z ) const { return find( voxel_key( x, y, z, inv_size_ ) ); }
+
+    // Nearest stored point to p among the 27 voxels around it, within
+    // sqrt(max_dist2). Writes the point to out and returns its voxel, or -1.
+    int nearest( const float* p, float max_dist2, float* out ) const
+    {
+        const int cx = static_cast<int>( std::floor( p[0] * inv_size_ ) );
+        const int cy = static_cast<int>( std::floor( p[1] * inv_size_ ) );
+        const int cz = static_cast<int>( std::floor( p[2] * inv_size_ ) );
+        int best_voxel = -1;
+        const float* best = nullptr;
+        float best_d2 = max_dist2;
+        for ( int dz = -1; dz <= 1; ++dz )
+            for ( int dy = -1; dy <= 1; ++dy )
+                for ( int dx = -1; dx <= 1; ++dx )
+                {
+                    int v = find( voxel_key( cx + dx, cy + dy, cz + dz ) );
+                    if ( v < 0 )
+                        continue;
+                    const float* q = voxel_points( v );
+                    for ( uint32_t k = 0; k < voxels_[v].count; ++k, q += 3 )
+                    {
+                        float ex = q[0] - p[0], ey = q[1] - p[1], ez = q[2] - p[2];
+                        float d2 = ex * ex + ey * ey + ez * ez;
+                        if ( d2 < best_d2 )
+                        {
+                            best_d2 = d2;
+                            best = q;
+                            best_voxel = v;
+                        }
+                    }
+                }
+        if ( best )
+        {
+            out[0] = best[0];
+            out[1] = best[1];
+            out[2] = best[2];
+        }
+        return best_voxel;
+    }
+
+private:
+    int add_voxel( uint64_t key )
+    {
+        if ( 2 * ( voxels_.size() + 1 ) > table_.size() )
+            rehash( table_.size() * 2 );
+        Voxel v;
+        v.key = key;
+        voxels_.push_back( v );
+        data_.resize( voxels_.size() * max_points_ * 3 );
+        int index = static_cast<int>( voxels_.size() - 1 );
+        place( key, index );
+        return index;
+    }
+
+    void place( uint64_t key, int index )
+    {
+        const size_t mask = table_.size() - 1;
+        size_t s = voxel_hash( key ) & mask;
+        while ( table_[s] >= 0 )
+            s = ( s + 1 ) & mask;
+        table_[s] = index;
+    }
+
+    void rehash( size_t slots )
+    {
+        while ( slots < 2 * voxels_.size() )
+            slots *= 2;
+        table_.assign( slots, -1 );
+        for ( size_t i = 0; i < voxels_.size(); ++i )
+            place( voxels_[i].key, static_cast<int>( i ) );
+    }
+
+    void refresh( size_t i )
+    {
+        Voxel& v = voxels_[i];
+        v.dirty = false;
+        v.planar = v.gaussian = false;
+        if ( v.count < 5 )
+            return;
+        const float* q = voxel_points( i );
+        double mean[3] = { 0, 0, 0 };
+        for ( uint32_t k = 0; k < v.count; ++k )
+            for ( int a = 0; a < 3; ++a )
+                mean[a] += q[3 * k + a];
+        for ( double& m : mean )
+            m /= v.count;
+        double C[3][3] = {};
+        for ( uint32_t k = 0; k < v.count; ++k )
+        {
+            double d[3] = { q[3 * k] - mean[0], q[3 * k + 1] - mean[1], q[3 * k + 2] - mean[2] };
+            for ( int a = 0; a < 3; ++a )
+                for ( int b = 0; b < 3; ++b )
+                    C[a][b] += d[a] * d[b];
+        }
+        for ( auto& row : C )
+            for ( double& c : row )
+                c /= v.count - 1;
+        double w[3], V[3][3];
+        detail::symmetric_eigen3( C, w, V );
+        for ( int a = 0; a < 3; ++a )
+        {
+            v.mean[a] = static_cast<float>( mean[a] );
+            v.normal[a] = static_cast<float>( V[a][0] );
+        }
+        v.planar = w[0] < 0.1 * w[1];
+        double floor = std::max( 0.01 * w[2], 1e-6 );
+        double inv[3] = { 1.0 / std::max( w[0], floor ), 1.0 / std::max( w[1], floor ), 1.0 / std::max( w[2], floor ) };
+        int n = 0;
+        for ( int a = 0; a < 3; ++a )
+            for ( int b = a; b < 3; ++b )
+                v.icov[n++] = static_cast<float>( V[a][0] * inv[0] * V[b][0] + V[a][1] * inv[1] * V[b][1] + V[a][2] * inv[2] * V[b][2] );
+        v.gaussian = true;
+    }
+
+    double voxel_size_;
+    float inv_size_;
+    size_t max_points_;
+    std::vector<Voxel> voxels_;
+    std::vector<float> data_;
+    std::vector<int> table_;
+    size_t points_ = 0;
+};
+
+enum class ScanMatchMethod
+{
+    PointToPoint,
+    PointToPlane,
+    Ndt
+};
+
+struct ScanMatchOptions
+{
+    ScanMatchMethod method = ScanMatchMethod::PointToPlane;
+    size_t max_iterations = 30;
+    double max_correspondence = 1.0; // nearest-neighbour gate for ICP, m
+    double robust_scale = 0.2;       // Cauchy kernel width on ICP residuals, m
+    double ndt_scale = 3.0;          // Cauchy kernel width on NDT Mahalanobis distance
+    double tolerance = 1e-4;         // stop once the update (rad and m) is this small
+};
+
+struct ScanMatchResult
+{
+    Isometry3 pose;
+    size_t iterations = 0;
+    size_t correspondences = 0; // in the last iteration
+    double rmse = 0.0;          // of the last iteration's residuals; Mahalanobis for NDT
+    bool converged = false;
+};
+
+// Gauss-Newton registration of a scan against a VoxelHashMap with a left
+// perturbation (rotation vector, translation) of the pose. Correspondence
+// search and normal-equation accumulation run in a fixed number of chunks,
+// each with its own cache-line-aligned accumulator, so the reduction order
+// and the result do not depend on the thread count.
+class ScanMatcher
+{
+public:
+    static constexpr size_t kChunks = 64;
+
+    explicit ScanMatcher( const ScanMatchOptions& options = ScanMatchOptions(), ThreadPool* pool = nullptr )
+        : options_( options ), pool_( pool ), partial_( kChunks )
+    {
+    }
+
+    const ScanMatchOptions& options() const { return options_; }
+    void set_options( const ScanMatchOptions& options ) { options_ = options; }
+
+    // Aligns source (sensor frame) to the map starting from guess. Returns
+    // false if the normal equations became singular; result.pose then holds
+    // the last good estimate.
+    bool align( const VoxelHashMap& map, const PointCloud& source, const Isometry3& guess, ScanMatchResult& result )
+    {
+        result = ScanMatchResult();
+        result.pose = guess;
+        for ( size_t it = 0; it < options_.max_iterations; ++it )
+        {
+            accumulate( map, source, result.pose );
+            Accumulator total;
+            for ( const Accumulator& a : partial_ )
+                total.add( a );
+            result.iterations = it + 1;
+            result.correspondences = total.count;
+            result.rmse = total.count ? std::sqrt( total.cost / total.count ) : 0.0;
+            if ( total.count < 6 )
+                return false;
+
+            double A[6][6], d[6];
+            for ( int i = 0; i < 6; ++i )
+            {
+                d[i] = -total.g[i];
+                for ( int j = 0; j < 6; ++j )
+                    A[i][j] = i <= j ? total.H[i][j] : total.H[j][i];
+            }
+            if ( !cholesky_factor( A, A ) )
+                return false;
+            cholesky_solve( A, d );
+            Vec3 w( d[0], d[1], d[2] ), v( d[3], d[4], d[5] );
+            double angle = norm( w );
+            Mat3 R = angle > 0.0 ? axis_angle( w / angle, angle ) : Mat3::identity();
+            result.pose = Isometry3( R, v ) * result.pose;
+            if ( angle + norm( v ) < options_.tolerance )
+            {
+                result.converged = true;
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    // Upper triangle of J^T W J, J^T W r, the squared residual sum and the
+    // correspondence count for one chunk.
+    struct alignas( 64 ) Accumulator
+    {
+        double H[6][6] = {};
+        double g[6] = {};
+        double cost = 0.0;
+        size_t count = 0;
+
+        void add( const Accumulator& o )
+        {
+            for ( int i = 0; i < 6; ++i )
+            {
+                g[i] += o.g[i];
+                for ( int j = i; j < 6; ++j )
+                    H[i][j] += o.H[i][j];
+            }
+            cost += o.cost;
+            count += o.count;
+        }
+
+        // Adds rows J (rows x 6) with residuals r, weighted by the symmetric
+        // rows x rows matrix W.
+        template <int rows>
+        void add( const double ( &J )[rows][6], const double* r, const double ( &W )[rows][rows] )
+        {
+            double WJ[rows][6], Wr[rows];
+            for ( int a = 0; a < rows; ++a )
+            {
+                Wr[a] = 0.0;
+                for ( int b = 0; b < rows; ++b )
+                    Wr[a] += W[a][b] * r[b];
+                for ( int j = 0; j < 6; ++j )
+                {
+                    WJ[a][j] = 0.0;
+                    for ( int b = 0; b < rows; ++b )
+                        WJ[a][j] += W[a][b] * J[b][j];
+                }
+            }
+            for ( int i = 0; i < 6; ++i )
+            {
+                for ( int a = 0; a < rows; ++a )
+                    g[i] += J[a][i] * Wr[a];
+                for ( int j = i; j < 6; ++j )
+                    for ( int a = 0; a < rows; ++a )
+                        H[i][j] += J[a][i] * WJ[a][j];
+            }
+        }
+    };
+
+    void accumulate( const VoxelHashMap& map, const PointCloud& source, const Isometry3& T )
+    {
+        const size_t n = source.size();
+        auto chunk = [&]( size_t c ) {
+            Accumulator& acc = partial_[c];
+            acc = Accumulator();
+            const size_t lo = n * c / kChunks, hi = n * ( c + 1 ) / kChunks;
+            const float gate2 = static_cast<float>( options_.max_correspondence * options_.max_correspondence );
+            const double k2 = options_.robust_scale * options_.robust_scale;
+            const double ndt2 = options_.ndt_scale * options_.ndt_scale;
+            for ( size_t i = lo; i < hi; ++i )
+            {
+                Vec3 q = T * Vec3( source.x[i], source.y[i], source.z[i] );
+                float p[3] = { static_cast<float>( q.x ), static_cast<float>( q.y ), static_cast<float>( q.z ) };
+                // d(T p) / d(w, v) = [-skew(q) | I].
+                double J[3][6] = { { 0, q.z, -q.y, 1, 0, 0 }, { -q.z, 0, q.x, 0, 1, 0 }, { q.y, -q.x, 0, 0, 0, 1 } };
+
+                if ( options_.method == ScanMatchMethod::Ndt )
+                {
+                    // The containing cell and its six face neighbours
+                    // (DIRECT7) each add a Mahalanobis term; the neighbours
+                    // widen the basin of convergence past one cell.
+                    const float inv = static_cast<float>( 1.0 / map.voxel_size() );
+                    const int cx = static_cast<int>( std::floor( p[0] * inv ) ), cy = static_cast<int>( std::floor( p[1] * inv ) ),
+                              cz = static_cast<int>( std::floor( p[2] * inv ) );
+                    static const int offsets[7][3] = { { 0, 0, 0 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+                    for ( const auto& o : offsets )
+                    {
+                        int v = map.find( voxel_key( cx + o[0], cy + o[1], cz + o[2] ) );
+                        if ( v < 0 || !map.voxel( v ).gaussian )
+                            continue;
+                        const VoxelHashMap::Voxel& vox = map.voxel( v );
+                        double r[3] = { q.x - vox.mean[0], q.y - vox.mean[1], q.z - vox.mean[2] };
+                        const float* s = vox.icov;
+                        double W[3][3] = { { s[0], s[1], s[2] }, { s[1], s[3], s[4] }, { s[2], s[4], s[5] } };
+                        double d2 = 0.0;
+                        for ( int a = 0; a < 3; ++a )
+                            for ( int b = 0; b < 3; ++b )
+                                d2 += r[a] * W[a][b] * r[b];
+                        double w = 1.0 / ( 1.0 + d2 / ndt2 );
+                        for ( auto& row : W )
+                            for ( double& x : row )
+                                x *= w;
+                        acc.add( J, r, W );
+                        acc.cost += d2;
+                        ++acc.count;
+                    }
+                    continue;
+                }
+
+                float m[3];
+                int v = map.nearest( p, gate2, m );
+                if ( v < 0 )
+                    continue;
+                double r[3] = { q.x - m[0], q.y - m[1], q.z - m[2] };
+                if ( options_.method == ScanMatchMethod::PointToPlane )
+                {
+                    const VoxelHashMap::Voxel& vox = map.voxel( v );
+                    if ( !vox.planar )
+                        continue;
+                    Vec3 nrm( vox.normal[0], vox.normal[1], vox.normal[2] );
+                    double e[1] = { r[0] * nrm.x + r[1] * nrm.y + r[2] * nrm.z };
+                    Vec3 jw = cross( q, nrm );
+                    double Jp[1][6] = { { jw.x, jw.y, jw.z, nrm.x, nrm.y, nrm.z } };
+                    double W[1][1] = { { 1.0 / ( 1.0 + e[0] * e[0] / k2 ) } };
+                    acc.add( Jp, e, W );
+                    acc.cost += e[0] * e[0];
+                }
+                else
+                {
+                    double e2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+                    double w = 1.0 / ( 1.0 + e2 / k2 );
+                    double W[3][3] = { { w, 0, 0 }, { 0, w, 0 }, { 0, 0, w } };
+                    acc.add( J, r, W );
+                    acc.cost += e2;
+                }
+                ++acc.count;
+            }
+        };
+        if ( pool_ )
+            pool_->run_chunks( kChunks, chunk );
+        else
+            for ( size_t c = 0; c < kChunks; ++c )
+                chunk( c );
+    }
+
+    ScanMatchOptions options_;
+    ThreadPool* pool_;
+    std::vector<Accumulator> partial_;
+};
+
+} // namespace wra
@@ -0,0 +1,38 @@
+#pragma once
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define WRA_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace wra
+{
+
+// Instruction sets the kernels dispatch on. Kernels for a level are
+// compiled with GCC target attributes, so the build needs no -m flags and
+// the choice is made at runtime.
+enum class SimdLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+inline SimdLevel detect_simd()
+{
+#if defined( WRA_X86_SIMD )
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+        return SimdLevel::Avx2;
+    if ( __builtin_cpu_supports( "sse2" ) )
+        return SimdLevel::Sse2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+inline const char* to_string( SimdLevel level )
+{
+    return level == SimdLevel::Avx2 ? "avx2" : level == SimdLevel::Sse2 ? "sse2" : "scalar";
+}
+
+} // namespace wra
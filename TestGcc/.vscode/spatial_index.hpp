@@ -0,0 +1,865 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "point_cloud.hpp"
+#include "thread_pool.hpp"
+
+namespace wra
+{
+
+constexpr uint32_t kNoPoint = std::numeric_limits<uint32_t>::max();
+
+// k nearest per query, nearest first: row q is [q * k, q * k + k). Rows of
+// queries with fewer than k points in the index end in kNoPoint / inf.
+struct KnnBatch
+{
+    int k = 0;
+    std::vector<uint32_t> ids;
+    std::vector<float> dist2;
+};
+
+// Points within the radius of query q: ids[offsets[q], offsets[q + 1]).
+struct RadiusBatch
+{
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ids;
+};
+
+// Interleaves the low 21 bits of x, y and z.
+inline uint64_t morton_code( uint32_t x, uint32_t y, uint32_t z )
+{
+    auto spread = []( uint64_t v ) {
+        v &= 0x1FFFFF;
+        v = ( v | v << 32 ) & 0x1F00000000FFFFull;
+        v = ( v | v << 16 ) & 0x1F0000FF0000FFull;
+        v = ( v | v << 8 ) & 0x100F00F00F00F00Full;
+        v = ( v | v << 4 ) & 0x10C30C30C30C30C3ull;
+        v = ( v | v << 2 ) & 0x1249249249249249ull;
+        return v;
+    };
+    return spread( x ) << 2 | spread( y ) << 1 | spread( z );
+}
+
+namespace detail
+{
+
+// Sorts (key, value) pairs by key with 8-bit LSD passes, skipping digits
+// every key shares.
+inline void radix_sort( std::vector<std::pair<uint64_t, uint32_t>>& items, std::vector<std::pair<uint64_t, uint32_t>>& scratch )
+{
+    scratch.resize( items.size() );
+    for ( int shift = 0; shift < 64; shift += 8 )
+    {
+        size_t count[257] = {};
+        for ( const auto& it : items )
+            ++count[( ( it.first >> shift ) & 0xFF ) + 1];
+        if ( std::any_of( count + 1, count + 257, [&]( size_t c ) { return c == items.size(); } ) )
+            continue;
+        for ( int b = 0; b < 256; ++b )
+            count[b + 1] += count[b];
+        for ( const auto& it : items )
+            scratch[count[( it.first >> shift ) & 0xFF]++] = it;
+        items.swap( scratch );
+    }
+}
+
+// Morton order of the points, quantised over their bounding box.
+inline void morton_order( const float* x, const float* y, const float* z, size_t n, std::vector<uint32_t>& order )
+{
+    float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float hi[3] = { -lo[0], -lo[0], -lo[0] };
+    for ( size_t i = 0; i < n; ++i )
+    {
+        lo[0] = std::min( lo[0], x[i] ), hi[0] = std::max( hi[0], x[i] );
+        lo[1] = std::min( lo[1], y[i] ), hi[1] = std::max( hi[1], y[i] );
+        lo[2] = std::min( lo[2], z[i] ), hi[2] = std::max( hi[2], z[i] );
+    }
+    float extent = std::max( { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-6f } );
+    float scale = float( ( 1 << 21 ) - 1 ) / extent;
+    std::vector<std::pair<uint64_t, uint32_t>> items( n ), scratch;
+    for ( size_t i = 0; i < n; ++i )
+        items[i] = { morton_code( uint32_t( ( x[i] - lo[0] ) * scale ), uint32_t( ( y[i] - lo[1] ) * scale ),
+                                  uint32_t( ( z[i] - lo[2] ) * scale ) ),
+                     uint32_t( i ) };
+    radix_sort( items, scratch );
+    order.resize( n );
+    for ( size_t i = 0; i < n; ++i )
+        order[i] = items[i].second;
+}
+
+inline float box_distance2( const float* box, float x, float y, float z )
+{
+    float dx = std::max( { box[0] - x, 0.0f, x - box[3] } );
+    float dy = std::max( { box[1] - y, 0.0f, y - box[4] } );
+    float dz = std::max( { box[2] - z, 0.0f, z - box[5] } );
+    return dx * dx + dy * dy + dz * dz;
+}
+
+constexpr int kQueryGroup = 8;
+
+// Walks a tree for up to kQueryGroup nearby queries at once. A bitmask
+// carries the queries still interested in a subtree, so the nodes they
+// share are fetched and tested once, and every leaf reached is scanned for
+// all of them while it is in cache. Tree provides root(), empty(),
+// box(n) -> {lo xyz, hi xyz}, children(n, out) -> count (0 for a leaf) and
+// spans(n, f) calling f(x, y, z, id, count) over the leaf's points.
+// Without radius2 it keeps the k nearest of each query; with it, Emit gets
+// (query slot, id) for every point within the radius.
+template <typename Tree>
+class GroupSearch
+{
+public:
+    explicit GroupSearch( const Tree& tree ) : tree_( tree ) {}
+
+    void knn( const float* qx, const float* qy, const float* qz, int count, int k, uint32_t** ids, float** dist2 )
+    {
+        best_d_.assign( size_t( kQueryGroup ) * k, std::numeric_limits<float>::infinity() );
+        best_i_.assign( size_t( kQueryGroup ) * k, kNoPoint );
+        for ( int q = 0; q < count; ++q )
+        {
+            found_[q] = 0;
+            bound_[q] = std::numeric_limits<float>::infinity();
+        }
+        walk( qx, qy, qz, count, [&]( int q, const float* d2, const uint32_t* id, size_t n ) {
+            float* bd = &best_d_[size_t( q ) * k];
+            uint32_t* bi = &best_i_[size_t( q ) * k];
+            for ( size_t j = 0; j < n; ++j )
+            {
+                if ( d2[j] >= bound_[q] )
+                    continue;
+                int p = found_[q] < k ? found_[q]++ : k - 1;
+                while ( p > 0 && bd[p - 1] > d2[j] )
+                {
+                    bd[p] = bd[p - 1];
+                    bi[p] = bi[p - 1];
+                    --p;
+                }
+                bd[p] = d2[j];
+                bi[p] = id[j];
+                if ( found_[q] == k )
+                    bound_[q] = bd[k - 1];
+            }
+        } );
+        for ( int q = 0; q < count; ++q )
+        {
+            std::copy( &best_i_[size_t( q ) * k], &best_i_[size_t( q ) * k] + k, ids[q] );
+            std::copy( &best_d_[size_t( q ) * k], &best_d_[size_t( q ) * k] + k, dist2[q] );
+        }
+    }
+
+    template <typename Emit>
+    void radius( const float* qx, const float* qy, const float* qz, int count, float radius2, Emit&& emit )
+    {
+        for ( int q = 0; q < count; ++q )
+            bound_[q] = radius2;
+        walk( qx, qy, qz, count, [&]( int q, const float* d2, const uint32_t* id, size_t n ) {
+            for ( size_t j = 0; j < n; ++j )
+                if ( d2[j] <= radius2 )
+                    emit( q, id[j] );
+        } );
+    }
+
+private:
+    // bound_[q] is the squared distance a point must beat (kNN) or reach
+    // (radius) for query q; subtrees farther than it are skipped.
+    template <typename Visit>
+    void walk( const float* qx, const float* qy, const float* qz, int count, Visit&& visit )
+    {
+        if ( tree_.empty() || count == 0 )
+            return;
+        float cx = 0.0f, cy = 0.0f, cz = 0.0f;
+        for ( int q = 0; q < count; ++q )
+            cx += qx[q], cy += qy[q], cz += qz[q];
+        cx /= count, cy /= count, cz /= count;
+
+        stack_.clear();
+        stack_.emplace_back( tree_.root(), ( 1u << count ) - 1 );
+        uint32_t kids[8];
+        std::pair<float, uint32_t> order[8];
+        while ( !stack_.empty() )
+        {
+            const uint32_t node = stack_.back().first;
+            uint32_t mask = stack_.back().second;
+            stack_.pop_back();
+            const float* box = tree_.box( node );
+            for ( uint32_t m = mask; m; m &= m - 1 )
+            {
+                int q = __builtin_ctz( m );
+                if ( box_distance2( box, qx[q], qy[q], qz[q] ) > bound_[q] )
+                    mask &= ~( 1u << q );
+            }
+            if ( !mask )
+                continue;
+            int n = tree_.children( node, kids );
+            if ( n == 0 )
+            {
+                tree_.spans( node, [&]( const float* x, const float* y, const float* z, const uint32_t* id, size_t len ) {
+                    if ( d2_.size() < len )
+                        d2_.resize( len );
+                    for ( uint32_t m = mask; m; m &= m - 1 )
+                    {
+                        int q = __builtin_ctz( m );
+                        const float px = qx[q], py = qy[q], pz = qz[q];
+                        for ( size_t j = 0; j < len; ++j )
+                        {
+                            float dx = x[j] - px, dy = y[j] - py, dz = z[j] - pz;
+                            d2_[j] = dx * dx + dy * dy + dz * dz;
+                        }
+                        visit( q, d2_.data(), id, len );
+                    }
+                } );
+                continue;
+            }
+            // Nearest child to the group is searched first, so bounds
+            // tighten before the others are tested.
+            for ( int c = 0; c < n; ++c )
+                order[c] = { box_distance2( tree_.box( kids[c] ), cx, cy, cz ), kids[c] };
+            std::sort( order, order + n );
+            for ( int c = n - 1; c >= 0; --c )
+                stack_.emplace_back( order[c].second, mask );
+        }
+    }
+
+    const Tree& tree_;
+    int found_[kQueryGroup];
+    float bound_[kQueryGroup];
+    std::vector<float> best_d_;
+    std::vector<uint32_t> best_i_;
+    std::vector<float> d2_;
+    std::vector<std::pair<uint32_t, uint32_t>> stack_;
+};
+
+// Batched kNN: queries are Morton ordered so each group of kQueryGroup is
+// spatially tight, and groups are spread over the pool.
+template <typename Tree>
+void batch_knn( const Tree& tree, const PointCloud& queries, int k, KnnBatch& out, ThreadPool* pool )
+{
+    const size_t n = queries.size();
+    k = std::max( k, 1 );
+    out.k = k;
+    out.ids.assign( n * k, kNoPoint );
+    out.dist2.assign( n * k, std::numeric_limits<float>::infinity() );
+    std::vector<uint32_t> order;
+    morton_order( queries.x.data(), queries.y.data(), queries.z.data(), n, order );
+    const size_t groups = ( n + kQueryGroup - 1 ) / kQueryGroup;
+    auto body = [&]( size_t lo, size_t hi ) {
+        GroupSearch<Tree> search( tree );
+        float qx[kQueryGroup], qy[kQueryGroup], qz[kQueryGroup];
+        uint32_t* ids[kQueryGroup];
+        float* dist2[kQueryGroup];
+        for ( size_t g = lo; g < hi; ++g )
+        {
+            int count = static_cast<int>( std::min<size_t>( kQueryGroup, n - g * kQueryGroup ) );
+            for ( int q = 0; q < count; ++q )
+            {
+                uint32_t i = order[g * kQueryGroup + q];
+                qx[q] = queries.x[i], qy[q] = queries.y[i], qz[q] = queries.z[i];
+                ids[q] = &out.ids[size_t( i ) * k];
+                dist2[q] = &out.dist2[size_t( i ) * k];
+            }
+            search.knn( qx, qy, qz, count, k, ids, dist2 );
+        }
+    };
+    if ( pool )
+        pool->parallel_for( 0, groups, 16, body );
+    else
+        body( 0, groups );
+}
+
+// Batched radius search. Groups run in fixed chunks; each query's hits are
+// gathered per group and appended to its chunk's buffer as one run, and a
+// final pass copies the runs into CSR, so the output order does not
+// depend on the thread count.
+template <typename Tree>
+void batch_radius( const Tree& tree, const PointCloud& queries, float radius, RadiusBatch& out, ThreadPool* pool )
+{
+    const size_t n = queries.size();
+    std::vector<uint32_t> order;
+    morton_order( queries.x.data(), queries.y.data(), queries.z.data(), n, order );
+    const size_t groups = ( n + kQueryGroup - 1 ) / kQueryGroup;
+    const size_t chunks = std::max<size_t>( 1, std::min<size_t>( groups, 64 ) );
+    std::vector<std::vector<uint32_t>> found( chunks );
+    std::vector<uint32_t> start( n ), chunk_of( n );
+    out.offsets.assign( n + 1, 0 );
+    auto chunk = [&]( size_t c ) {
+        GroupSearch<Tree> search( tree );
+        float qx[kQueryGroup], qy[kQueryGroup], qz[kQueryGroup];
+        uint32_t slot[kQueryGroup];
+        std::vector<uint32_t> hits[kQueryGroup];
+        for ( size_t g = groups * c / chunks; g < groups * ( c + 1 ) / chunks; ++g )
+        {
+            int count = static_cast<int>( std::min<size_t>( kQueryGroup, n - g * kQueryGroup ) );
+            for ( int q = 0; q < count; ++q )
+            {
+                slot[q] = order[g * kQueryGroup + q];
+                qx[q] = queries.x[slot[q]], qy[q] = queries.y[slot[q]], qz[q] = queries.z[slot[q]];
+                hits[q].clear();
+            }
+            search.radius( qx, qy, qz, count, radius * radius, [&]( int q, uint32_t id ) { hits[q].push_back( id ); } );
+            for ( int q = 0; q < count; ++q )
+            {
+                start[slot[q]] = static_cast<uint32_t>( found[c].size() );
+                chunk_of[slot[q]] = static_cast<uint32_t>( c );
+                out.offsets[slot[q] + 1] = static_cast<uint32_t>( hits[q].size() );
+                found[c].insert( found[c].end(), hits[q].begin(), hits[q].end() );
+            }
+        }
+    };
+    if ( pool )
+        pool->run_chunks( chunks, chunk );
+    else
+        for ( size_t c = 0; c < chunks; ++c )
+            chunk( c );
+
+    for ( size_t q = 0; q < n; ++q )
+        out.offsets[q + 1] += out.offsets[q];
+    out.ids.resize( out.offsets[n] );
+    auto copy = [&]( size_t lo, size_t hi ) {
+        for ( size_t q = lo; q < hi; ++q )
+        {
+            const uint32_t* from = found[chunk_of[q]].data() + start[q];
+            std::copy( from, from + ( out.offsets[q + 1] - out.offsets[q] ), out.ids.begin() + out.offsets[q] );
+        }
+    };
+    if ( pool )
+        pool->parallel_for( 0, n, 1024, copy );
+    else
+        copy( 0, n );
+}
+
+// Single-query kNN as a group of one.
+template <typename Tree>
+void single_knn( const Tree& tree, float x, float y, float z, int k, std::vector<uint32_t>& ids, std::vector<float>* dist2 )
+{
+    k = std::max( k, 1 );
+    ids.assign( k, kNoPoint );
+    std::vector<float> d( k );
+    uint32_t* pi = ids.data();
+    float* pd = d.data();
+    GroupSearch<Tree> search( tree );
+    search.knn( &x, &y, &z, 1, k, &pi, &pd );
+    size_t found = std::find( ids.begin(), ids.end(), kNoPoint ) - ids.begin();
+    ids.resize( found );
+    if ( dist2 )
+        dist2->assign( d.begin(), d.begin() + found );
+}
+
+} // namespace detail
+
+// Static k-d tree in implicit layout: node i has children 2i + 1 and
+// 2i + 2, every split is at the median index, and points are reordered so
+// each leaf is one contiguous SoA run. Nodes keep the tight bounding box
+// of their points for pruning and nothing else. The top levels are split
+// serially; the subtrees below are built on the pool.
+class ImplicitKdTree
+{
+public:
+    explicit ImplicitKdTree( size_t leaf_size = 16 ) : leaf_size_( std::max<size_t>( leaf_size, 1 ) ) {}
+
+    size_t size() const { return x_.size(); }
+    bool empty() const { return x_.empty(); }
+
+    // Point ids are indices into cloud.
+    void build( const PointCloud& cloud, ThreadPool* pool = nullptr )
+    {
+        const size_t n = cloud.size();
+        perm_.resize( n );
+        for ( size_t i = 0; i < n; ++i )
+            perm_[i] = static_cast<uint32_t>( i );
+        size_t leaves = 1, depth = 0;
+        while ( leaves * leaf_size_ < n )
+            leaves *= 2, ++depth;
+        nodes_.assign( ( size_t( 2 ) << depth ) - 1, Node() );
+        cloud_ = &cloud;
+
+        // Serial split down to enough independent subtrees for the pool.
+        const size_t want = pool ? 4 * pool->size() : 1;
+        std::vector<std::pair<uint32_t, uint32_t>> frontier{ { 0u, 0u } }, next;
+        std::vector<uint32_t> ends{ uint32_t( n ) }, next_ends;
+        while ( frontier.size() < want )
+        {
+            next.clear();
+            next_ends.clear();
+            bool split_any = false;
+            for ( size_t f = 0; f < frontier.size(); ++f )
+            {
+                uint32_t node = frontier[f].first, lo = frontier[f].second, hi = ends[f];
+                if ( !split( node, lo, hi ) )
+                {
+                    next.emplace_back( node, lo ), next_ends.push_back( hi );
+                    continue;
+                }
+                split_any = true;
+                uint32_t mid = lo + ( hi - lo ) / 2;
+                next.emplace_back( 2 * node + 1, lo ), next_ends.push_back( mid );
+                next.emplace_back( 2 * node + 2, mid ), next_ends.push_back( hi );
+            }
+            if ( !split_any )
+                break;
+            std::swap( frontier, next );
+            std::swap( ends, next_ends );
+        }
+        auto subtree = [&]( size_t f ) { build_subtree( frontier[f].first, frontier[f].second, ends[f] ); };
+        if ( pool && frontier.size() > 1 )
+            pool->run_chunks( frontier.size(), subtree );
+        else
+            for ( size_t f = 0; f < frontier.size(); ++f )
+                subtree( f );
+
+        x_.resize( n ), y_.resize( n ), z_.resize( n ), id_.resize( n );
+        auto gather = [&]( size_t lo, size_t hi ) {
+            for ( size_t i = lo; i < hi; ++i )
+            {
+                uint32_t p = perm_[i];
+                x_[i] = cloud.x[p], y_[i] = cloud.y[p], z_[i] = cloud.z[p], id_[i] = p;
+            }
+        };
+        if ( pool )
+            pool->parallel_for( 0, n, 4096, gather );
+        else
+            gather( 0, n );
+        cloud_ = nullptr;
+    }
+
+    // k nearest of (x, y, z), nearest first, at most k.
+    void knn( float x, float y, float z, int k, std::vector<uint32_t>& ids, std::vector<float>* dist2 = nullptr ) const
+    {
+        detail::single_knn( *this, x, y, z, k, ids, dist2 );
+    }
+
+    void radius( float x, float y, float z, float r, std::vector<uint32_t>& ids ) const
+    {
+        ids.clear();
+        detail::GroupSearch<ImplicitKdTree> search( *this );
+        search.radius( &x, &y, &z, 1, r * r, [&]( int, uint32_t id ) { ids.push_back( id ); } );
+    }
+
+    void knn( const PointCloud& queries, int k, KnnBatch& out, ThreadPool* pool = nullptr ) const
+    {
+        detail::batch_knn( *this, queries, k, out, pool );
+    }
+
+    void radius( const PointCloud& queries, float r, RadiusBatch& out, ThreadPool* pool = nullptr ) const
+    {
+        detail::batch_radius( *this, queries, r, out, pool );
+    }
+
+    // Tree interface for detail::GroupSearch.
+    uint32_t root() const { return 0; }
+    const float* box( uint32_t n ) const { return nodes_[n].box; }
+    int children( uint32_t n, uint32_t* out ) const
+    {
+        if ( nodes_[n].end - nodes_[n].begin <= leaf_size_ )
+            return 0;
+        out[0] = 2 * n + 1;
+        out[1] = 2 * n + 2;
+        return 2;
+    }
+    template <typename F>
+    void spans( uint32_t n, F&& f ) const
+    {
+        const Node& node = nodes_[n];
+        f( &x_[node.begin], &y_[node.begin], &z_[node.begin], &id_[node.begin], size_t( node.end - node.begin ) );
+    }
+
+private:
+    struct Node
+    {
+        float box[6] = { 0, 0, 0, 0, 0, 0 };
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    // Fits node's box to perm_[lo, hi) and, unless it is a leaf, moves the
+    // median along the widest axis to the middle. False for a leaf.
+    bool split( uint32_t node, uint32_t lo, uint32_t hi )
+    {
+        const PointCloud& c = *cloud_;
+        Node& nd = nodes_[node];
+        nd.begin = lo;
+        nd.end = hi;
+        float* b = nd.box;
+        b[0] = b[1] = b[2] = std::numeric_limits<float>::max();
+        b[3] = b[4] = b[5] = -std::numeric_limits<float>::max();
+        for ( uint32_t i = lo; i < hi; ++i )
+        {
+            uint32_t p = perm_[i];
+            b[0] = std::min( b[0], c.x[p] ), b[3] = std::max( b[3], c.x[p] );
+            b[1] = std::min( b[1], c.y[p] ), b[4] = std::max( b[4], c.y[p] );
+            b[2] = std::min( b[2], c.z[p] ), b[5] = std::max( b[5], c.z[p] );
+        }
+        if ( hi - lo <= leaf_size_ )
+            return false;
+        int axis = 0;
+        for ( int a = 1; a < 3; ++a )
+            if ( b[a + 3] - b[a] > b[axis + 3] - b[axis] )
+                axis = a;
+        const float* v = axis == 0 ? c.x.data() : axis == 1 ? c.y.data() : c.z.data();
+        uint32_t mid = lo + ( hi - lo ) / 2;
+        std::nth_element( perm_.begin() + lo, perm_.begin() + mid, perm_.begin() + hi,
+                          [v]( uint32_t i, uint32_t j ) { return v[i] < v[j]; } );
+        return true;
+    }
+
+    void build_subtree( uint32_t node, uint32_t lo, uint32_t hi )
+    {
+        if ( !split( node, lo, hi ) )
+            return;
+        uint32_t mid = lo + ( hi - lo ) / 2;
+        build_subtree( 2 * node + 1, lo, mid );
+        build_subtree( 2 * node + 2, mid, hi );
+    }
+
+    size_t leaf_size_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> perm_;
+    std::vector<float> x_, y_, z_;
+    std::vector<uint32_t> id_;
+    const PointCloud* cloud_ = nullptr;
+};
+
+// Octree over a fixed root cube whose leaves hold up to leaf_size points
+// in fixed-size slots. Bulk build sorts the points by Morton code, so each
+// subtree is a contiguous code range and the leaves' slots are laid out in
+// Morton order. Insertion descends by position, appends to the leaf and
+// splits it once full; freed slots are reused. Nodes keep the tight box of
+// the points below them, which prunes far better than the cube on sparse
+// lidar data.
+class MortonOctree
+{
+public:
+    explicit MortonOctree( size_t leaf_size = 32, int max_depth = 16 )
+        : leaf_size_( std::max<size_t>( leaf_size, 1 ) ), max_depth_( std::min( std::max( max_depth, 1 ), 21 ) )
+    {
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t nodes() const { return nodes_.size(); }
+    size_t slots() const { return slot_count_.size() - free_.size(); }
+
+    // Empty tree over the cube center +- half.
+    void reset( const Vec3& center, double half )
+    {
+        center_[0] = float( center.x ), center_[1] = float( center.y ), center_[2] = float( center.z );
+        half_ = float( half );
+        nodes_.assign( 1, Node() );
+        x_.clear(), y_.clear(), z_.clear(), id_.clear();
+        slot_count_.clear(), slot_next_.clear(), free_.clear();
+        size_ = 0;
+    }
+
+    // Rebuilds over the bounding cube of cloud, padded by `margin` for
+    // later inserts; ids are indices into cloud.
+    void build( const PointCloud& cloud, double margin = 1.0, ThreadPool* pool = nullptr )
+    {
+        const size_t n = cloud.size();
+        float lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+        if ( n )
+        {
+            lo[0] = *std::min_element( cloud.x.begin(), cloud.x.end() ), hi[0] = *std::max_element( cloud.x.begin(), cloud.x.end() );
+            lo[1] = *std::min_element( cloud.y.begin(), cloud.y.end() ), hi[1] = *std::max_element( cloud.y.begin(), cloud.y.end() );
+            lo[2] = *std::min_element( cloud.z.begin(), cloud.z.end() ), hi[2] = *std::max_element( cloud.z.begin(), cloud.z.end() );
+        }
+        double half = 0.5 * std::max( { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] } ) + margin;
+        reset( Vec3( 0.5 * ( lo[0] + hi[0] ), 0.5 * ( lo[1] + hi[1] ), 0.5 * ( lo[2] + hi[2] ) ), std::max( half, 1e-3 ) );
+        if ( !n )
+            return;
+
+        codes_.resize( n );
+        auto encode = [&]( size_t a, size_t b ) {
+            for ( size_t i = a; i < b; ++i )
+                codes_[i] = { code( cloud.x[i], cloud.y[i], cloud.z[i] ), uint32_t( i ) };
+        };
+        if ( pool )
+            pool->parallel_for( 0, n, 4096, encode );
+        else
+            encode( 0, n );
+        detail::radix_sort( codes_, scratch_ );
+
+        // Topology first, serially: it is one node per leaf_size points.
+        leaf_ranges_.clear();
+        build_node( 0, 0, uint32_t( n ), 0 );
+        const size_t slots = slot_count_.size();
+        x_.resize( slots * leaf_size_ ), y_.resize( slots * leaf_size_ ), z_.resize( slots * leaf_size_ );
+        id_.resize( slots * leaf_size_ );
+
+        // Then every leaf copies its run of sorted points into its slots.
+        auto fill = [&]( size_t a, size_t b ) {
+            for ( size_t l = a; l < b; ++l )
+            {
+                const LeafRange& r = leaf_ranges_[l];
+                for ( uint32_t i = r.begin; i < r.end; ++i )
+                {
+                    size_t at = size_t( r.slot + ( i - r.begin ) / leaf_size_ ) * leaf_size_ + ( i - r.begin ) % leaf_size_;
+                    uint32_t p = codes_[i].second;
+                    x_[at] = cloud.x[p], y_[at] = cloud.y[p], z_[at] = cloud.z[p], id_[at] = p;
+                }
+            }
+        };
+        if ( pool )
+            pool->parallel_for( 0, leaf_ranges_.size(), 64, fill );
+        else
+            fill( 0, leaf_ranges_.size() );
+        size_ = n;
+        fit_boxes( 0 );
+    }
+
+    // Adds a point; false when it lies outside the root cube.
+    bool insert( float x, float y, float z, uint32_t id )
+    {
+        float c[3] = { center_[0], center_[1], center_[2] }, h = half_;
+        const float p[3] = { x, y, z };
+        for ( int a = 0; a < 3; ++a )
+            if ( !( std::fabs( p[a] - c[a] ) <= h ) )
+                return false;
+        uint32_t n = 0;
+        int depth = 0;
+        for ( ;; )
+        {
+            grow( nodes_[n].box, x, y, z );
+            ++nodes_[n].count;
+            if ( nodes_[n].first_child < 0 )
+            {
+                if ( nodes_[n].count <= leaf_size_ || depth == max_depth_ )
+                {
+                    append( n, x, y, z, id );
+                    ++size_;
+                    return true;
+                }
+                --nodes_[n].count;
+                split_leaf( n, c );
+                ++nodes_[n].count;
+            }
+            int child = ( x >= c[0] ) << 2 | ( y >= c[1] ) << 1 | ( z >= c[2] );
+            h *= 0.5f;
+            c[0] += ( child & 4 ) ? h : -h;
+            c[1] += ( child & 2 ) ? h : -h;
+            c[2] += ( child & 1 ) ? h : -h;
+            n = uint32_t( nodes_[n].first_child + child );
+            ++depth;
+        }
+    }
+
+    void knn( float x, float y, float z, int k, std::vector<uint32_t>& ids, std::vector<float>* dist2 = nullptr ) const
+    {
+        detail::single_knn( *this, x, y, z, k, ids, dist2 );
+    }
+
+    void radius( float x, float y, float z, float r, std::vector<uint32_t>& ids ) const
+    {
+        ids.clear();
+        detail::GroupSearch<MortonOctree> search( *this );
+        search.radius( &x, &y, &z, 1, r * r, [&]( int, uint32_t id ) { ids.push_back( id ); } );
+    }
+
+    void knn( const PointCloud& queries, int k, KnnBatch& out, ThreadPool* pool = nullptr ) const
+    {
+        detail::batch_knn( *this, queries, k, out, pool );
+    }
+
+    void radius( const PointCloud& queries, float r, RadiusBatch& out, ThreadPool* pool = nullptr ) const
+    {
+        detail::batch_radius( *this, queries, r, out, pool );
+    }
+
+    // Tree interface for detail::GroupSearch.
+    uint32_t root() const { return 0; }
+    const float* box( uint32_t n ) const { return nodes_[n].box; }
+    int children( uint32_t n, uint32_t* out ) const
+    {
+        const Node& node = nodes_[n];
+        if ( node.first_child < 0 )
+            return 0;
+        int k = 0;
+        for ( int c = 0; c < 8; ++c )
+            if ( nodes_[node.first_child + c].count )
+                out[k++] = uint32_t( node.first_child + c );
+        return k;
+    }
+    template <typename F>
+    void spans( uint32_t n, F&& f ) const
+    {
+        for ( int32_t s = nodes_[n].slot; s >= 0; s = slot_next_[s] )
+        {
+            size_t at = size_t( s ) * leaf_size_;
+            f( &x_[at], &y_[at], &z_[at], &id_[at], size_t( slot_count_[s] ) );
+        }
+    }
+
+private:
+    struct Node
+    {
+        float box[6] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                         -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max() };
+        int32_t first_child = -1; // eight consecutive nodes, or -1 for a leaf
+        int32_t slot = -1;        // first slot of a leaf's chain
+        uint32_t count = 0;       // points in the subtree
+    };
+
+    struct LeafRange
+    {
+        uint32_t begin, end, slot;
+    };
+
+    static void grow( float* b, float x, float y, float z )
+    {
+        b[0] = std::min( b[0], x ), b[3] = std::max( b[3], x );
+        b[1] = std::min( b[1], y ), b[4] = std::max( b[4], y );
+        b[2] = std::min( b[2], z ), b[5] = std::max( b[5], z );
+    }
+
+    // Morton code on the 2^21 grid over the root cube; the digit of depth
+    // d is bits 3 * (20 - d) .. + 2, matching the insert descent.
+    uint64_t code( float x, float y, float z ) const
+    {
+        const float scale = float( 1 << 21 ) / ( 2.0f * half_ );
+        auto q = [&]( float v, int a ) {
+            float t = ( v - ( center_[a] - half_ ) ) * scale;
+            return uint32_t( std::min( std::max( t, 0.0f ), float( ( 1 << 21 ) - 1 ) ) );
+        };
+        return morton_code( q( x, 0 ), q( y, 1 ), q( z, 2 ) );
+    }
+
+    uint32_t new_slot()
+    {
+        if ( !free_.empty() )
+        {
+            uint32_t s = free_.back();
+            free_.pop_back();
+            slot_count_[s] = 0;
+            slot_next_[s] = -1;
+            return s;
+        }
+        slot_count_.push_back( 0 );
+        slot_next_.push_back( -1 );
+        x_.resize( x_.size() + leaf_size_ ), y_.resize( y_.size() + leaf_size_ ), z_.resize( z_.size() + leaf_size_ );
+        id_.resize( id_.size() + leaf_size_ );
+        return uint32_t( slot_count_.size() - 1 );
+    }
+
+    // Appends to the leaf's last slot, chaining a new one when it is full.
+    void append( uint32_t n, float x, float y, float z, uint32_t id )
+    {
+        int32_t s = nodes_[n].slot;
+        if ( s < 0 )
+            s = nodes_[n].slot = int32_t( new_slot() );
+        while ( slot_next_[s] >= 0 )
+            s = slot_next_[s];
+        if ( slot_count_[s] == leaf_size_ )
+        {
+            int32_t t = int32_t( new_slot() );
+            slot_next_[s] = t;
+            s = t;
+        }
+        size_t at = size_t( s ) * leaf_size_ + slot_count_[s]++;
+        x_[at] = x, y_[at] = y, z_[at] = z, id_[at] = id;
+    }
+
+    void split_leaf( uint32_t n, const float* c )
+    {
+        int32_t first = int32_t( nodes_.size() );
+        nodes_.resize( nodes_.size() + 8 );
+        int32_t s = nodes_[n].slot;
+        nodes_[n].first_child = first;
+        nodes_[n].slot = -1;
+        for ( ; s >= 0; s = slot_next_[s] )
+        {
+            for ( uint32_t j = 0; j < slot_count_[s]; ++j )
+            {
+                size_t at = size_t( s ) * leaf_size_ + j;
+                float x = x_[at], y = y_[at], z = z_[at];
+                int child = ( x >= c[0] ) << 2 | ( y >= c[1] ) << 1 | ( z >= c[2] );
+                uint32_t m = uint32_t( first + child );
+                grow( nodes_[m].box, x, y, z );
+                ++nodes_[m].count;
+                append( m, x, y, z, id_[at] );
+            }
+            free_.push_back( uint32_t( s ) );
+        }
+    }
+
+    // Sorted codes_[lo, hi) below node n at depth. Leaves reserve their
+    // slots in visiting order, which is Morton order.
+    void build_node( uint32_t n, uint32_t lo, uint32_t hi, int depth )
+    {
+        nodes_[n].count = hi - lo;
+        if ( hi - lo <= leaf_size_ || depth == max_depth_ )
+        {
+            if ( hi == lo )
+                return;
+            uint32_t first = uint32_t( slot_count_.size() );
+            for ( uint32_t i = lo, prev = kNoPoint; i < hi; i += uint32_t( leaf_size_ ) )
+            {
+                slot_count_.push_back( uint32_t( std::min<size_t>( leaf_size_, hi - i ) ) );
+                slot_next_.push_back( -1 );
+                if ( prev != kNoPoint )
+                    slot_next_[prev] = int32_t( slot_count_.size() - 1 );
+                prev = uint32_t( slot_count_.size() - 1 );
+            }
+            nodes_[n].slot = int32_t( first );
+            leaf_ranges_.push_back( { lo, hi, first } );
+            return;
+        }
+        int32_t first = int32_t( nodes_.size() );
+        nodes_.resize( nodes_.size() + 8 );
+        nodes_[n].first_child = first;
+        const int shift = 3 * ( 20 - depth );
+        uint32_t begin = lo;
+        for ( int c = 0; c < 8; ++c )
+        {
+            uint32_t end = begin;
+            while ( end < hi && int( ( codes_[end].first >> shift ) & 7 ) == c )
+                ++end;
+            build_node( uint32_t( first + c ), begin, end, depth + 1 );
+            begin = end;
+        }
+    }
+
+    void fit_boxes( uint32_t n )
+    {
+        Node& node = nodes_[n];
+        if ( node.first_child < 0 )
+        {
+            spans( n, [&]( const float* x, const float* y, const float* z, const uint32_t*, size_t len ) {
+                for ( size_t j = 0; j < len; ++j )
+                    grow( nodes_[n].box, x[j], y[j], z[j] );
+            } );
+            return;
+        }
+        for ( int c = 0; c < 8; ++c )
+        {
+            uint32_t m = uint32_t( nodes_[n].first_child + c );
+            fit_boxes( m );
+            const float* b = nodes_[m].box;
+            if ( nodes_[m].count )
+            {
+                grow( nodes_[n].box, b[0], b[1], b[2] );
+                grow( nodes_[n].box, b[3], b[4], b[5] );
+            }
+        }
+    }
+
+    size_t leaf_size_;
+    int max_depth_;
+    float center_[3] = { 0, 0, 0 };
+    float half_ = 1.0f;
+    std::vector<Node> nodes_{ 1 };
+    std::vector<float> x_, y_, z_;
+    std::vector<uint32_t> id_;
+    std::vector<uint32_t> slot_count_;
+    std::vector<int32_t> slot_next_;
+    std::vector<uint32_t> free_;
+    size_t size_ = 0;
+    // Bulk build scratch.
+    std::vector<std::pair<uint64_t, uint32_t>> codes_, scratch_;
+    std::vector<LeafRange> leaf_ranges_;
+};
+
+} // namespace wra
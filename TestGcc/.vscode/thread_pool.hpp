@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wra
+{
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// joins in, so a pool of size 1 runs everything inline. One parallel_for
+// may be in flight at a time.
+class ThreadPool
+{
+public:
+    explicit ThreadPool( unsigned threads = std::max( 1u, std::thread::hardware_concurrency() ) )
+    {
+        threads = std::max( 1u, threads );
+        for ( unsigned i = 1; i < threads; ++i )
+            workers_.emplace_back( [this] { worker(); } );
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for ( auto& t : workers_ )
+            t.join();
+    }
+
+    ThreadPool( const ThreadPool& ) = delete;
+    ThreadPool& operator=( const ThreadPool& ) = delete;
+
+    unsigned size() const { return static_cast<unsigned>( workers_.size() + 1 ); }
+
+    // Calls f(chunk) for every chunk in [0, chunks), spread over the pool.
+    void run_chunks( size_t chunks, const std::function<void( size_t )>& f )
+    {
+        if ( chunks == 0 )
+            return;
+        if ( workers_.empty() || chunks == 1 )
+        {
+            for ( size_t c = 0; c < chunks; ++c )
+                f( c );
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            job_ = &f;
+            chunks_ = chunks;
+            next_.store( 0 );
+            busy_ = workers_.size();
+            ++generation_;
+        }
+        wake_.notify_all();
+        drain( f, chunks );
+        std::unique_lock<std::mutex> lock( mutex_ );
+        done_.wait( lock, [this] { return busy_ == 0; } );
+        job_ = nullptr;
+    }
+
+    // Calls f(lo, hi) over subranges of [begin, end) of at least grain items.
+    template <typename F>
+    void parallel_for( size_t begin, size_t end, size_t grain, F&& f )
+    {
+        if ( end <= begin )
+            return;
+        size_t n = end - begin;
+        grain = std::max<size_t>( 1, grain );
+        size_t chunks = std::min( ( n + grain - 1 ) / grain, static_cast<size_t>( size() ) * 4 );
+        size_t step = ( n + chunks - 1 ) / chunks;
+        run_chunks( chunks, [&]( size_t c ) {
+            size_t lo = begin + c * step;
+            size_t hi = std::min( end, lo + step );
+            if ( lo < hi )
+                f( lo, hi );
+        } );
+    }
+
+private:
+    void drain( const std::function<void( size_t )>& f, size_t chunks )
+    {
+        for ( size_t c = next_.fetch_add( 1 ); c < chunks; c = next_.fetch_add( 1 ) )
+            f( c );
+    }
+
+    void worker()
+    {
+        uint64_t seen = 0;
+        for ( ;; )
+        {
+            const std::function<void( size_t )>* job;
+            size_t chunks;
+            {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                wake_.wait( lock, [&] { return stop_ || generation_ != seen; } );
+                if ( stop_ )
+                    return;
+                seen = generation_;
+                job = job_;
+                chunks = chunks_;
+            }
+            drain( *job, chunks );
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                if ( --busy_ == 0 )
+                    done_.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void( size_t )>* job_ = nullptr;
+    size_t chunks_ = 0;
+    std::atomic<size_t> next_{ 0 };
+    size_t busy_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+} // namespace wra
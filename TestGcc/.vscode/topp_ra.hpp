@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "dynamics.hpp"
+
+namespace wra
+{
+
+struct ToppRaResult
+{
+    bool feasible = false;
+    // First stage whose controllable set came out empty, when infeasible.
+    size_t failed_stage = 0;
+    double duration = 0.0;
+    // Per grid point: time stamp, path speed sdot and path parameter s.
+    std::vector<double> time;
+    std::vector<double> sd;
+    std::vector<double> s;
+    // Per grid point, dof values each.
+    std::vector<double> velocity;
+    std::vector<double> acceleration;
+};
+
+// Time-optimal path parameterisation by reachability analysis (Pham and
+// Pham, 2018). The waypoints are joined by a natural cubic spline over
+// chord length s; each knot is a grid stage with path acceleration
+// u = sddot and squared speed x = sdot^2 as the two unknowns, related by
+// x' = x + 2 ds u. Joint velocity, acceleration and (optionally) torque
+// limits are all linear in (u, x), so the backward pass computing the
+// controllable sets and the greedy forward pass are tiny 2D / 1D LPs,
+// solved here directly (see extreme_x) instead of by an LP library.
+//
+// All per-stage buffers are members and are only grown, so repeated
+// calls on similar paths do not allocate.
+class ToppRa
+{
+public:
+    // Torque as a(s) u + b(s) x + c(s): given q, q' and q'' at a stage,
+    // write the three dof-vectors.
+    typedef std::function<void( const double* q, const double* dq, const double* ddq, double* a, double* b, double* c )>
+        TorqueModel;
+
+    explicit ToppRa( size_t dof ) : dof_( dof ), vmax_( dof, 0.0 ), amax_( dof, 0.0 ), tmax_( dof, 0.0 ) {}
+
+    size_t dof() const { return dof_; }
+
+    // Symmetric per-joint limits; zero disables that joint's limit.
+    void set_velocity_limits( const double* v ) { vmax_.assign( v, v + dof_ ); }
+    void set_acceleration_limits( const double* a ) { amax_.assign( a, a + dof_ ); }
+    void set_torque_limits( const double* t, TorqueModel model )
+    {
+        tmax_.assign( t, t + dof_ );
+        torque_ = std::move( model );
+    }
+
+    // count waypoints of dof joints each. Starts and ends at rest.
+    bool solve( const double* waypoints, size_t count, ToppRaResult& result )
+    {
+        result.feasible = false;
+        result.failed_stage = 0;
+        if ( !build_path( waypoints, count ) )
+            return false;
+        build_constraints();
+        if ( !backward_pass( result.failed_stage ) )
+            return false;
+        forward_pass( result );
+        return result.feasible;
+    }
+
+    // Path after solve(): grid positions and derivatives in s, dof per stage.
+    size_t stages() const { return s_.size(); }
+    const std::vector<double>& path_s() const { return s_; }
+    const std::vector<double>& path_q() const { return q_; }
+    const std::vector<double>& path_dq() const { return dq_; }
+    const std::vector<double>& path_ddq() const { return ddq_; }
+
+private:
+    // a u + b x <= c.
+    struct Line
+    {
+        double a, b, c;
+    };
+
+    // Chord-length natural cubic spline through the waypoints; repeated
+    // waypoints are dropped since they add no length.
+    bool build_path( const double* w, size_t count )
+    {
+        q_.clear();
+        s_.clear();
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const double* p = w + i * dof_;
+            double step = 0.0;
+            if ( !s_.empty() )
+            {
+                const double* prev = &q_[q_.size() - dof_];
+                for ( size_t j = 0; j < dof_; ++j )
+                    step += ( p[j] - prev[j] ) * ( p[j] - prev[j] );
+                step = std::sqrt( step );
+                if ( step < 1e-12 )
+                    continue;
+            }
+            s_.push_back( s_.empty() ? 0.0 : s_.back() + step );
+            q_.insert( q_.end(), p, p + dof_ );
+        }
+        const size_t n = s_.size();
+        if ( n < 2 )
+            return false;
+
+        // Second derivatives from the tridiagonal system (Thomas algorithm),
+        // one right-hand side per joint.
+        ddq_.assign( n * dof_, 0.0 );
+        dq_.assign( n * dof_, 0.0 );
+        diag_.assign( n, 1.0 );
+        rhs_.assign( n * dof_, 0.0 );
+        for ( size_t i = 1; i + 1 < n; ++i )
+        {
+            double h0 = s_[i] - s_[i - 1], h1 = s_[i + 1] - s_[i];
+            double d = 2.0 * ( h0 + h1 ) - h0 * h0 / diag_[i - 1] * ( i > 1 ? 1.0 : 0.0 );
+            diag_[i] = d;
+            for ( size_t j = 0; j < dof_; ++j )
+            {
+                double r = 6.0 * ( ( q_[( i + 1 ) * dof_ + j] - q_[i * dof_ + j] ) / h1 -
+                                   ( q_[i * dof_ + j] - q_[( i - 1 ) * dof_ + j] ) / h0 );
+                if ( i > 1 )
+                    r -= h0 / diag_[i - 1] * rhs_[( i - 1 ) * dof_ + j];
+                rhs_[i * dof_ + j] = r;
+            }
+        }
+        for ( size_t i = n - 1; i-- > 1; )
+        {
+            double h1 = s_[i + 1] - s_[i];
+            for ( size_t j = 0; j < dof_; ++j )
+                ddq_[i * dof_ + j] = ( rhs_[i * dof_ + j] - h1 * ddq_[( i + 1 ) * dof_ + j] ) / diag_[i];
+        }
+        for ( size_t i = 0; i < n; ++i )
+        {
+            bool last = i + 1 == n;
+            size_t a = last ? i - 1 : i, b = a + 1;
+            double h = s_[b] - s_[a];
+            for ( size_t j = 0; j < dof_; ++j )
+            {
+                double slope = ( q_[b * dof_ + j] - q_[a * dof_ + j] ) / h;
+                double Ma = ddq_[a * dof_ + j], Mb = ddq_[b * dof_ + j];
+                dq_[i * dof_ + j] = last ? slope + h * ( Ma + 2.0 * Mb ) / 6.0 : slope - h * ( 2.0 * Ma + Mb ) / 6.0;
+            }
+        }
+        return true;
+    }
+
+    // Per-stage constraint lines plus the x interval from velocity limits.
+    void build_constraints()
+    {
+        const size_t n = s_.size();
+        bool torque = torque_ && std::any_of( tmax_.begin(), tmax_.end(), []( double t ) { return t > 0; } );
+        per_stage_ = 0;
+        for ( size_t j = 0; j < dof_; ++j )
+            per_stage_ += ( amax_[j] > 0 ? 2 : 0 ) + ( torque && tmax_[j] > 0 ? 2 : 0 );
+        lines_.resize( n * per_stage_ );
+        xmax_.resize( n );
+        ta_.resize( dof_ );
+        tb_.resize( dof_ );
+        tc_.resize( dof_ );
+        for ( size_t i = 0; i < n; ++i )
+        {
+            const double* dq = &dq_[i * dof_];
+            const double* ddq = &ddq_[i * dof_];
+            double xm = std::numeric_limits<double>::infinity();
+            for ( size_t j = 0; j < dof_; ++j )
+                if ( vmax_[j] > 0 && dq[j] * dq[j] > 0 )
+                    xm = std::min( xm, vmax_[j] * vmax_[j] / ( dq[j] * dq[j] ) );
+            xmax_[i] = xm;
+
+            Line* out = &lines_[i * per_stage_];
+            for ( size_t j = 0; j < dof_; ++j )
+                if ( amax_[j] > 0 )
+                {
+                    *out++ = { dq[j], ddq[j], amax_[j] };
+                    *out++ = { -dq[j], -ddq[j], amax_[j] };
+                }
+            if ( torque )
+            {
+                torque_( &q_[i * dof_], dq, ddq, ta_.data(), tb_.data(), tc_.data() );
+                for ( size_t j = 0; j < dof_; ++j )
+                    if ( tmax_[j] > 0 )
+                    {
+                        *out++ = { ta_[j], tb_[j], tmax_[j] - tc_[j] };
+                        *out++ = { -ta_[j], -tb_[j], tmax_[j] + tc_[j] };
+                    }
+            }
+        }
+    }
+
+    // Largest (sign = 1) or smallest (sign = -1) x in [xlo, xhi] for which
+    // some u satisfies every line. For fixed x the feasible u lie between
+    // the max of the lower bounds and the min of the upper bounds; their
+    // gap g(x) is concave and piecewise linear, so starting from the end
+    // of the interval and stepping to the root of the active pieces' line
+    // never overshoots and ends after a few pieces.
+    static bool extreme_x( const Line* lines, size_t n, double xlo, double xhi, int sign, double& x_out )
+    {
+        if ( xlo > xhi )
+            return false;
+        double x = sign > 0 ? xhi : xlo;
+        for ( size_t iter = 0; iter < n + 4; ++iter )
+        {
+            double up = std::numeric_limits<double>::infinity(), lo = -up, up_slope = 0.0, lo_slope = 0.0;
+            for ( size_t k = 0; k < n; ++k )
+            {
+                const Line& l = lines[k];
+                if ( l.a == 0.0 )
+                    continue;
+                double v = ( l.c - l.b * x ) / l.a, slope = -l.b / l.a;
+                double tol = 1e-12 * ( 1.0 + std::fabs( v ) );
+                // On ties keep the piece that binds on the side we move to.
+                if ( l.a > 0 )
+                {
+                    if ( v < up - tol || ( v < up + tol && slope * sign > up_slope * sign ) )
+                    {
+                        up = v;
+                        up_slope = slope;
+                    }
+                }
+                else if ( v > lo + tol || ( v > lo - tol && slope * sign < lo_slope * sign ) )
+                {
+                    lo = v;
+                    lo_slope = slope;
+                }
+            }
+            double gap = up - lo;
+            if ( gap >= -1e-9 * ( 1.0 + std::fabs( up ) + std::fabs( lo ) ) )
+            {
+                x_out = x;
+                return true;
+            }
+            double slope = up_slope - lo_slope;
+            if ( slope * sign >= 0 )
+                return false;
+            x -= gap / slope;
+            if ( x < xlo - 1e-12 || x > xhi + 1e-12 )
+                return false;
+            x = std::min( std::max( x, xlo ), xhi );
+        }
+        return false;
+    }
+
+    // Lines of stage i with its x-only rows (a == 0) folded into [xlo, xhi],
+    // plus the pair keeping x + 2 ds u inside [klo, khi]. The last point has
+    // no stage of its own and is reached at rest with the final stage's u,
+    // so that stage also carries the last point's lines at x = 0.
+    size_t stage_lines( size_t i, double ds, double klo, double khi, double& xlo, double& xhi )
+    {
+        scratch_.clear();
+        xlo = 0.0;
+        xhi = xmax_[i];
+        auto add = [&]( Line l ) {
+            if ( std::fabs( l.a ) > 1e-12 )
+                scratch_.push_back( l );
+            else if ( l.b > 0 )
+                xhi = std::min( xhi, l.c / l.b );
+            else if ( l.b < 0 )
+                xlo = std::max( xlo, l.c / l.b );
+            else if ( l.c < 0 )
+                xhi = -1.0;
+        };
+        for ( size_t k = 0; k < per_stage_; ++k )
+            add( lines_[i * per_stage_ + k] );
+        if ( i + 2 == s_.size() )
+            for ( size_t k = 0; k < per_stage_; ++k )
+            {
+                Line l = lines_[( i + 1 ) * per_stage_ + k];
+                l.b = 0.0;
+                add( l );
+            }
+        if ( ds > 0 )
+        {
+            scratch_.push_back( { 2.0 * ds, 1.0, khi } );
+            scratch_.push_back( { -2.0 * ds, -1.0, -klo } );
+        }
+        return scratch_.size();
+    }
+
+    // Controllable sets K_i = [klo_i, khi_i], from the rest state at the end.
+    bool backward_pass( size_t& failed )
+    {
+        const size_t n = s_.size();
+        klo_.assign( n, 0.0 );
+        khi_.assign( n, 0.0 );
+        for ( size_t i = n - 1; i-- > 0; )
+        {
+            double ds = s_[i + 1] - s_[i], xlo, xhi;
+            size_t m = stage_lines( i, ds, klo_[i + 1], khi_[i + 1], xlo, xhi );
+            if ( !extreme_x( scratch_.data(), m, xlo, xhi, 1, khi_[i] ) ||
+                 !extreme_x( scratch_.data(), m, xlo, xhi, -1, klo_[i] ) )
+            {
+                failed = i;
+                return false;
+            }
+        }
+        if ( klo_[0] > 0.0 )
+        {
+            failed = 0;
+            return false;
+        }
+        return true;
+    }
+
+    // Greedy: the largest u at each stage that stays controllable.
+    void forward_pass( ToppRaResult& result )
+    {
+        const size_t n = s_.size();
+        x_.assign( n, 0.0 );
+        u_.assign( n, 0.0 );
+        for ( size_t i = 0; i + 1 < n; ++i )
+        {
+            double ds = s_[i + 1] - s_[i], xlo, xhi;
+            size_t m = stage_lines( i, ds, klo_[i + 1], khi_[i + 1], xlo, xhi );
+            double up = std::numeric_limits<double>::infinity(), lo = -up;
+            for ( size_t k = 0; k < m; ++k )
+            {
+                const Line& l = scratch_[k];
+                double v = ( l.c - l.b * x_[i] ) / l.a;
+                if ( l.a > 0 )
+                    up = std::min( up, v );
+                else
+                    lo = std::max( lo, v );
+            }
+            u_[i] = std::max( up, lo );
+            x_[i + 1] = std::min( std::max( x_[i] + 2.0 * ds * u_[i], klo_[i + 1] ), khi_[i + 1] );
+            u_[i] = ( x_[i + 1] - x_[i] ) / ( 2.0 * ds );
+        }
+
+        result.time.resize( n );
+        result.sd.resize( n );
+        result.s.assign( s_.begin(), s_.end() );
+        result.velocity.resize( n * dof_ );
+        result.acceleration.resize( n * dof_ );
+        double t = 0.0;
+        for ( size_t i = 0; i < n; ++i )
+        {
+            double sd = std::sqrt( std::max( 0.0, x_[i] ) );
+            if ( i > 0 )
+                t += 2.0 * ( s_[i] - s_[i - 1] ) / ( result.sd[i - 1] + sd );
+            result.time[i] = t;
+            result.sd[i] = sd;
+            // Path accelerations hold over a stage; the last point has no
+            // stage of its own and takes the final one's u at its own
+            // derivatives, as its constraints were written.
+            const double u = i + 1 < n ? u_[i] : u_[i - 1];
+            for ( size_t j = 0; j < dof_; ++j )
+            {
+                result.velocity[i * dof_ + j] = dq_[i * dof_ + j] * sd;
+                result.acceleration[i * dof_ + j] = dq_[i * dof_ + j] * u + ddq_[i * dof_ + j] * x_[i];
+            }
+        }
+        result.duration = t;
+        result.feasible = std::isfinite( t );
+    }
+
+    size_t dof_;
+    std::vector<double> vmax_;
+    std::vector<double> amax_;
+    std::vector<double> tmax_;
+    TorqueModel torque_;
+
+    // Reused between calls.
+    std::vector<double> s_, q_, dq_, ddq_;
+    std::vector<double> diag_, rhs_;
+    std::vector<Line> lines_;
+    size_t per_stage_ = 0;
+    std::vector<double> xmax_;
+    std::vector<double> ta_, tb_, tc_;
+    std::vector<Line> scratch_;
+    std::vector<double> klo_, khi_;
+    std::vector<double> x_, u_;
+};
+
+// Torque rows from rigid-body dynamics: with qdot = q' sdot and
+// qddot = q' u + q'' x, tau = M q' u + (M q'' + C(q, q') q') x + g(q),
+// so a and b are gravity-free RNEA calls and c is the gravity torque.
+template <typename Model>
+ToppRa::TorqueModel rnea_torque_model()
+{
+    auto dyn = std::make_shared<RigidBodyDynamics<Model>>();
+    auto no_gravity = std::make_shared<RigidBodyDynamics<Model>>();
+    no_gravity->set_gravity( Vec3() );
+    return [dyn, no_gravity]( const double* q, const double* dq, const double* ddq, double* a, double* b, double* c ) {
+        double zero[Model::dof] = {};
+        no_gravity->inverse_dynamics( q, zero, dq, a );
+        no_gravity->inverse_dynamics( q, dq, ddq, b );
+        dyn->gravity_torques( q, c );
+    };
+}
+
+} // namespace wra
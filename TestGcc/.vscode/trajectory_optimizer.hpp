@@ -0,0 +1,466 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "esdf.hpp"
+
+namespace wra
+{
+
+// Cholesky factor L L^T of a symmetric positive definite band matrix with
+// `bandwidth` sub-diagonals. Only the lower band is stored, row by row, so
+// factorisation is O(n p^2) and a solve O(n p) for bandwidth p.
+class BandedCholesky
+{
+public:
+    void resize( size_t n, size_t bandwidth )
+    {
+        n_ = n;
+        p_ = bandwidth;
+        band_.assign( n * ( p_ + 1 ), 0.0 );
+    }
+
+    size_t size() const { return n_; }
+    size_t bandwidth() const { return p_; }
+
+    // Entry (i, j) of the matrix, i >= j and i - j <= bandwidth. Before
+    // factor() this is the matrix itself; after it, the factor L.
+    double& at( size_t i, size_t j ) { return band_[i * ( p_ + 1 ) + ( i - j )]; }
+    double at( size_t i, size_t j ) const { return band_[i * ( p_ + 1 ) + ( i - j )]; }
+
+    // In place; false if the matrix is not positive definite.
+    bool factor()
+    {
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            size_t first = i > p_ ? i - p_ : 0;
+            for ( size_t j = first; j <= i; ++j )
+            {
+                double s = at( i, j );
+                for ( size_t m = first; m < j; ++m )
+                    s -= at( i, m ) * at( j, m );
+                if ( j < i )
+                    at( i, j ) = s / at( j, j );
+                else if ( s > 0.0 )
+                    at( i, i ) = std::sqrt( s );
+                else
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Solves A x = b in place for `columns` right-hand sides stored
+    // interleaved (b[i * columns + c]).
+    void solve( double* b, size_t columns ) const
+    {
+        for ( size_t i = 0; i < n_; ++i )
+        {
+            size_t first = i > p_ ? i - p_ : 0;
+            double inv = 1.0 / at( i, i );
+            for ( size_t c = 0; c < columns; ++c )
+            {
+                double s = b[i * columns + c];
+                for ( size_t m = first; m < i; ++m )
+                    s -= at( i, m ) * b[m * columns + c];
+                b[i * columns + c] = s * inv;
+            }
+        }
+        for ( size_t i = n_; i-- > 0; )
+        {
+            size_t last = std::min( n_ - 1, i + p_ );
+            double inv = 1.0 / at( i, i );
+            for ( size_t c = 0; c < columns; ++c )
+            {
+                double s = b[i * columns + c];
+                for ( size_t m = i + 1; m <= last; ++m )
+                    s -= at( m, i ) * b[m * columns + c];
+                b[i * columns + c] = s * inv;
+            }
+        }
+    }
+
+private:
+    size_t n_ = 0;
+    size_t p_ = 0;
+    std::vector<double> band_;
+};
+
+struct TrajectoryOptimizerOptions
+{
+    // Interior waypoints; the endpoints are held fixed.
+    size_t waypoints = 100;
+    // Smoothness = integral of w_v |x'|^2 + w_a |x''|^2 over unit time.
+    double velocity_weight = 1.0;
+    double acceleration_weight = 0.01;
+    double obstacle_weight = 20.0;
+    // Clearance below which the obstacle cost starts, and the robot radius
+    // subtracted from the field.
+    double epsilon = 0.4;
+    double radius = 0.0;
+    // Fraction of the covariant step taken per iteration, and a cap on any
+    // waypoint's displacement (0 = field resolution). The cap is a trust
+    // region: the obstacle term is stiff inside obstacles, and without it
+    // an update can also jump across a thin wall.
+    double step = 0.1;
+    double max_step = 0.0;
+    int max_iterations = 200;
+    // Stops once collision free and the relative cost change drops below.
+    double tolerance = 1e-4;
+};
+
+struct TrajectoryOptimizerResult
+{
+    bool collision_free = false;
+    int iterations = 0;
+    double smoothness_cost = 0.0;
+    double obstacle_cost = 0.0;
+    // Smallest field distance minus radius along the trajectory, checked at
+    // waypoints and segment midpoints.
+    double min_clearance = 0.0;
+    double length = 0.0;
+};
+
+// CHOMP-style trajectory optimisation (Ratliff et al., 2009) of a point
+// robot in a 2D or 3D DistanceField. The input polyline (an RRT path, say)
+// is resampled to evenly spaced waypoints, then moved by covariant gradient
+// steps x -= step A^-1 g, where A is the finite-difference smoothness
+// metric. A is banded (tridiagonal for velocity, pentadiagonal with
+// acceleration), so it is factored once per waypoint count and every step
+// is an O(n) banded solve instead of a dense one. The obstacle term is the
+// arc-length weighted CHOMP cost with its curvature correction, read from
+// the field by trilinear interpolation.
+//
+// Buffers are members and are reused across calls.
+class TrajectoryOptimizer
+{
+public:
+    explicit TrajectoryOptimizer( const DistanceField& field, const TrajectoryOptimizerOptions& options = {} )
+        : field_( &field ), options_( options ), dim_( field.is3d() ? 3 : 2 )
+    {
+    }
+
+    const TrajectoryOptimizerOptions& options() const { return options_; }
+    void set_options( const TrajectoryOptimizerOptions& options )
+    {
+        options_ = options;
+        factored_ = 0;
+    }
+
+    int dim() const { return dim_; }
+
+    // path holds count >= 2 points of dim() doubles, in metres.
+    bool optimize( const double* path, size_t count, TrajectoryOptimizerResult& result )
+    {
+        result = TrajectoryOptimizerResult();
+        size_t n = options_.waypoints;
+        if ( count < 2 || n == 0 )
+            return false;
+        if ( factored_ != n && !factor_metric( n ) )
+            return false;
+        resample( path, count, n + 2 );
+
+        const size_t d = dim_;
+        int extent[3] = { field_->nx(), field_->ny(), field_->nz() };
+        for ( size_t k = 0; k < d; ++k )
+            upper_[k] = ( extent[k] - 1 ) * field_->resolution();
+        double max_step = options_.max_step > 0.0 ? options_.max_step : field_->resolution();
+        // Smoothness grows with the square of the path length and the
+        // obstacle term linearly, so the obstacle weight is scaled by the
+        // initial length to keep the balance independent of path scale.
+        double weight = options_.obstacle_weight * length();
+        double previous = std::numeric_limits<double>::infinity();
+        for ( int it = 0; it < options_.max_iterations; ++it )
+        {
+            double smooth = smoothness( &grad_ );
+            double obstacle = obstacle_gradient( &grad_, weight );
+            double cost = smooth + weight * obstacle;
+            if ( result.min_clearance > 0.0 && std::fabs( previous - cost ) <= options_.tolerance * cost )
+                break;
+            result.iterations = it + 1;
+            previous = cost;
+
+            metric_.solve( grad_.data(), d );
+            double largest = 0.0;
+            for ( size_t i = 0; i < n; ++i )
+            {
+                double s = 0.0;
+                for ( size_t k = 0; k < d; ++k )
+                    s += grad_[i * d + k] * grad_[i * d + k];
+                largest = std::max( largest, s );
+            }
+            double scale = options_.step;
+            largest = std::sqrt( largest ) * scale;
+            if ( largest > max_step )
+                scale *= max_step / largest;
+            // The field clamps lookups at its border but keeps the border
+            // gradient, so waypoints are held inside it.
+            for ( size_t i = 0; i < n * d; ++i )
+                xi_[d + i] = std::min( std::max( xi_[d + i] - scale * grad_[i], 0.0 ), upper_[i % d] );
+            result.min_clearance = clearance();
+        }
+
+        result.smoothness_cost = smoothness( nullptr );
+        result.obstacle_cost = obstacle_gradient( nullptr, 0.0 );
+        result.min_clearance = clearance();
+        result.collision_free = result.min_clearance > 0.0;
+        result.length = length();
+        return true;
+    }
+
+    // Waypoints including both endpoints, dim() doubles each.
+    const std::vector<double>& trajectory() const { return xi_; }
+
+    // 1/2 integral of w_v |x'|^2 + w_a |x''|^2 of a polyline taken as
+    // uniformly timed over [0, 1]; handy for comparing inputs and outputs.
+    static double smoothness_cost( const double* points, size_t count, int dim, double velocity_weight,
+                                   double acceleration_weight )
+    {
+        if ( count < 2 )
+            return 0.0;
+        double dt = 1.0 / double( count - 1 );
+        double v = 0.0, a = 0.0;
+        for ( size_t i = 0; i + 1 < count; ++i )
+            for ( int k = 0; k < dim; ++k )
+            {
+                double e = points[( i + 1 ) * dim + k] - points[i * dim + k];
+                v += e * e;
+            }
+        for ( size_t i = 0; i + 2 < count; ++i )
+            for ( int k = 0; k < dim; ++k )
+            {
+                double e = points[( i + 2 ) * dim + k] - 2.0 * points[( i + 1 ) * dim + k] + points[i * dim + k];
+                a += e * e;
+            }
+        return 0.5 * ( velocity_weight * v / dt + acceleration_weight * a / ( dt * dt * dt ) );
+    }
+
+private:
+    double distance( const double* a, const double* b ) const
+    {
+        double s = 0.0;
+        for ( int k = 0; k < dim_; ++k )
+            s += ( a[k] - b[k] ) * ( a[k] - b[k] );
+        return std::sqrt( s );
+    }
+
+    double length() const
+    {
+        double total = 0.0;
+        for ( size_t i = dim_; i < xi_.size(); i += dim_ )
+            total += distance( &xi_[i - dim_], &xi_[i] );
+        return total;
+    }
+
+    // A = dt^-1 w_v D1^T D1 + dt^-3 w_a D2^T D2 over the interior rows and
+    // columns, dt = 1 / (n + 1).
+    bool factor_metric( size_t n )
+    {
+        static const double d1[2] = { -1.0, 1.0 };
+        static const double d2[3] = { 1.0, -2.0, 1.0 };
+        double dt = 1.0 / double( n + 1 );
+        bool acceleration = options_.acceleration_weight > 0.0;
+        metric_.resize( n, acceleration ? 2 : 1 );
+        add_stencil( d1, 2, options_.velocity_weight / dt, n );
+        if ( acceleration )
+            add_stencil( d2, 3, options_.acceleration_weight / ( dt * dt * dt ), n );
+        factored_ = metric_.factor() ? n : 0;
+        return factored_ != 0;
+    }
+
+    void add_stencil( const double* c, size_t width, double w, size_t n )
+    {
+        // Row r of the difference operator touches full indices r .. r +
+        // width - 1; interior index = full index - 1.
+        for ( size_t r = 0; r + width <= n + 2; ++r )
+            for ( size_t a = 0; a < width; ++a )
+                for ( size_t b = 0; b <= a; ++b )
+                {
+                    size_t ia = r + a, ib = r + b;
+                    if ( ib == 0 || ia == n + 1 )
+                        continue;
+                    metric_.at( ia - 1, ib - 1 ) += w * c[a] * c[b];
+                }
+    }
+
+    // Evenly spaced by arc length, endpoints kept exactly.
+    void resample( const double* path, size_t count, size_t m )
+    {
+        const size_t d = dim_;
+        xi_.resize( m * d );
+        grad_.resize( ( m - 2 ) * d );
+        arc_.resize( count );
+        arc_[0] = 0.0;
+        for ( size_t i = 1; i < count; ++i )
+            arc_[i] = arc_[i - 1] + distance( &path[( i - 1 ) * d], &path[i * d] );
+        double total = arc_.back();
+        size_t seg = 0;
+        for ( size_t j = 0; j < m; ++j )
+        {
+            double s = total * double( j ) / double( m - 1 );
+            while ( seg + 2 < count && arc_[seg + 1] < s )
+                ++seg;
+            double len = arc_[seg + 1] - arc_[seg];
+            double t = len > 0.0 ? std::min( 1.0, std::max( 0.0, ( s - arc_[seg] ) / len ) ) : 0.0;
+            for ( size_t k = 0; k < d; ++k )
+                xi_[j * d + k] = path[seg * d + k] + t * ( path[( seg + 1 ) * d + k] - path[seg * d + k] );
+        }
+        for ( size_t k = 0; k < d; ++k )
+        {
+            xi_[k] = path[k];
+            xi_[( m - 1 ) * d + k] = path[( count - 1 ) * d + k];
+        }
+    }
+
+    // Smoothness cost; if grad is given, overwrites it with the gradient
+    // over the interior waypoints (A x + boundary terms).
+    double smoothness( std::vector<double>* grad )
+    {
+        const size_t d = dim_;
+        const size_t m = xi_.size() / d;
+        double dt = 1.0 / double( m - 1 );
+        double wv = options_.velocity_weight / dt;
+        double wa = options_.acceleration_weight / ( dt * dt * dt );
+        if ( grad )
+            std::fill( grad->begin(), grad->end(), 0.0 );
+        double cost = 0.0;
+        for ( size_t i = 0; i + 1 < m; ++i )
+            for ( size_t k = 0; k < d; ++k )
+            {
+                double e = xi_[( i + 1 ) * d + k] - xi_[i * d + k];
+                cost += 0.5 * wv * e * e;
+                if ( !grad )
+                    continue;
+                if ( i > 0 )
+                    ( *grad )[( i - 1 ) * d + k] -= wv * e;
+                if ( i + 1 < m - 1 )
+                    ( *grad )[i * d + k] += wv * e;
+            }
+        if ( wa <= 0.0 )
+            return cost;
+        for ( size_t i = 0; i + 2 < m; ++i )
+            for ( size_t k = 0; k < d; ++k )
+            {
+                double e = xi_[( i + 2 ) * d + k] - 2.0 * xi_[( i + 1 ) * d + k] + xi_[i * d + k];
+                cost += 0.5 * wa * e * e;
+                if ( !grad )
+                    continue;
+                if ( i > 0 )
+                    ( *grad )[( i - 1 ) * d + k] += wa * e;
+                ( *grad )[i * d + k] -= 2.0 * wa * e;
+                if ( i + 2 < m - 1 )
+                    ( *grad )[( i + 1 ) * d + k] += wa * e;
+            }
+        return cost;
+    }
+
+    // Field distance minus radius and its gradient at a waypoint.
+    double lookup( const double* x, double* g ) const
+    {
+        double p[3] = { x[0], x[1], dim_ > 2 ? x[2] : 0.0 };
+        return field_->interpolate( p[0], p[1], p[2], g ) - options_.radius;
+    }
+
+    // Discretised CHOMP obstacle functional sum c(x_i) s_i over interior
+    // waypoints, with arc-length weight s_i = |x_i+1 - x_i-1| / 2. If grad
+    // is given, adds weight times its exact gradient: c'(x_i) grad d s_i
+    // plus the pull through the neighbours' arc-length weights. In the
+    // limit of fine sampling this is CHOMP's curvature-corrected gradient,
+    // but unlike that form it stays bounded at the corners of raw planner
+    // paths.
+    double obstacle_gradient( std::vector<double>* grad, double weight )
+    {
+        const size_t d = dim_;
+        const size_t m = xi_.size() / d;
+        const double eps = options_.epsilon;
+        cost_.assign( m, 0.0 );
+        tangent_.assign( m * d, 0.0 );
+        double total = 0.0;
+        for ( size_t i = 1; i + 1 < m; ++i )
+        {
+            const double* x = &xi_[i * d];
+            double g[3] = { 0.0, 0.0, 0.0 };
+            double dist = lookup( x, g );
+            double c, dc;
+            if ( dist < 0.0 )
+            {
+                c = 0.5 * eps - dist;
+                dc = -1.0;
+            }
+            else if ( dist < eps )
+            {
+                c = 0.5 * ( dist - eps ) * ( dist - eps ) / eps;
+                dc = ( dist - eps ) / eps;
+            }
+            else
+                continue;
+
+            double e[3], len = 0.0;
+            for ( size_t k = 0; k < d; ++k )
+            {
+                e[k] = xi_[( i + 1 ) * d + k] - xi_[( i - 1 ) * d + k];
+                len += e[k] * e[k];
+            }
+            len = std::sqrt( len );
+            total += 0.5 * c * len;
+            if ( !grad )
+                continue;
+            cost_[i] = c;
+            for ( size_t k = 0; k < d; ++k )
+            {
+                ( *grad )[( i - 1 ) * d + k] += weight * 0.5 * len * dc * g[k];
+                tangent_[i * d + k] = len > 0.0 ? e[k] / len : 0.0;
+            }
+        }
+        if ( !grad )
+            return total;
+        // s_i depends on x_i-1 and x_i+1 through the unit chord t_i.
+        for ( size_t i = 1; i + 1 < m; ++i )
+            for ( size_t k = 0; k < d; ++k )
+            {
+                double pull = 0.0;
+                if ( i >= 2 )
+                    pull += cost_[i - 1] * tangent_[( i - 1 ) * d + k];
+                if ( i + 2 < m )
+                    pull -= cost_[i + 1] * tangent_[( i + 1 ) * d + k];
+                ( *grad )[( i - 1 ) * d + k] += weight * 0.5 * pull;
+            }
+        return total;
+    }
+
+    double clearance() const
+    {
+        const size_t d = dim_;
+        const size_t m = xi_.size() / d;
+        double lowest = std::numeric_limits<double>::infinity();
+        double mid[3];
+        for ( size_t i = 0; i < m; ++i )
+        {
+            lowest = std::min( lowest, lookup( &xi_[i * d], nullptr ) );
+            if ( i + 1 == m )
+                break;
+            for ( size_t k = 0; k < d; ++k )
+                mid[k] = 0.5 * ( xi_[i * d + k] + xi_[( i + 1 ) * d + k] );
+            lowest = std::min( lowest, lookup( mid, nullptr ) );
+        }
+        return lowest;
+    }
+
+    const DistanceField* field_;
+    TrajectoryOptimizerOptions options_;
+    int dim_;
+    double upper_[3] = { 0.0, 0.0, 0.0 };
+    size_t factored_ = 0;
+    BandedCholesky metric_;
+    std::vector<double> xi_;
+    std::vector<double> grad_;
+    std::vector<double> arc_;
+    std::vector<double> cost_;
+    std::vector<double> tangent_;
+};
+
+} // namespace wra